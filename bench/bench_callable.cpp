@@ -0,0 +1,225 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.hpp"
+
+/**
+ * Compares the cost of registering and dispatching event handlers through the
+ * raw C API, a lambda stored inline by `udaemon::Daemon`, and a heap-allocated
+ * `std::function` called through a C trampoline (the usual way to bind a C
+ * callback API to C++ without the inline storage).
+ *
+ * Each handler polls an eventfd that is always readable, so every iteration of
+ * the mainloop dispatches all handlers.
+ */
+namespace {
+
+// The number of handlers, all of which are dispatched in every iteration...
+constexpr int HANDLERS = 256;
+// The number of dispatches per run...
+constexpr uint64_t DISPATCHES = 4000000;
+// The number of times all handlers are added and removed again...
+constexpr int REGISTRATIONS = 2000;
+// The number of direct calls of a handler, without the mainloop...
+constexpr uint64_t CALLS = 50000000;
+
+using Clock = std::chrono::steady_clock;
+using Function = std::function<ud_result_t(struct pollfd &)>;
+
+struct Counter {
+    uint64_t count;
+    const ud_state_t *state;
+};
+
+double elapsed_ns(Clock::time_point start, uint64_t ops) {
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count()) /
+           static_cast<double>(ops);
+}
+
+ud_result_t c_handler(const ud_state_t *, struct pollfd *, void *context) {
+    auto *counter = static_cast<Counter *>(context);
+    if (++counter->count == DISPATCHES) {
+        ud_terminate(counter->state);
+    }
+    return RES_OK;
+}
+
+ud_result_t function_trampoline(const ud_state_t *, struct pollfd *pollfd, void *context) {
+    return (*static_cast<Function *>(context))(*pollfd);
+}
+
+ud_config_t make_config() {
+    ud_config_t config{};
+    config.foreground = true;
+    config.max_handlers = HANDLERS + 1;
+    return config;
+}
+
+/**
+ * Calls a handler the way the mainloop does, through a function pointer the
+ * compiler cannot see through, and returns the time per call.
+ */
+double run_calls(ud_event_handler_t handler, void *context, Counter &counter) {
+    ud_event_handler_t volatile callback = handler;
+    struct pollfd pollfd = { -1, POLLIN, POLLIN };
+    auto start = Clock::now();
+    for (uint64_t i = 0; i < CALLS; i++) {
+        callback(nullptr, &pollfd, context);
+    }
+    double result = elapsed_ns(start, CALLS);
+
+    counter.count = 0;
+    return result;
+}
+
+/**
+ * Runs the mainloop until the given number of dispatches is reached, and
+ * returns the time per dispatch.
+ */
+double run_dispatch(udaemon::Daemon &daemon, Counter &counter) {
+    counter.state = daemon.get();
+    auto start = Clock::now();
+    daemon.run();
+    return elapsed_ns(start, counter.count);
+}
+
+void bench(const std::vector<int> &fds) {
+    ud_config_t config = make_config();
+    std::vector<eh_id_t> ids(fds.size());
+
+    // raw C API...
+    double c_add, c_dispatch, c_call;
+    {
+        udaemon::Daemon daemon(config);
+        Counter counter{};
+        c_call = run_calls(c_handler, &counter, counter);
+
+        auto start = Clock::now();
+        for (int r = 0; r < REGISTRATIONS; r++) {
+            for (size_t i = 0; i < fds.size(); i++) {
+                ud_add_event_handler(daemon.get(), fds[i], POLLIN, c_handler, &counter, &ids[i]);
+            }
+            for (size_t i = 0; i < fds.size(); i++) {
+                ud_remove_event_handler(daemon.get(), ids[i]);
+            }
+        }
+        c_add = elapsed_ns(start, REGISTRATIONS * fds.size());
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            ud_add_event_handler(daemon.get(), fds[i], POLLIN, c_handler, &counter, nullptr);
+        }
+        c_dispatch = run_dispatch(daemon, counter);
+    }
+
+    // lambda stored inline...
+    double inline_add, inline_dispatch, inline_call;
+    {
+        udaemon::Daemon daemon(config);
+        Counter counter{};
+        auto lambda = [&counter](struct pollfd &) {
+            if (++counter.count == DISPATCHES) {
+                ud_terminate(counter.state);
+            }
+            return RES_OK;
+        };
+        inline_call = run_calls(&udaemon::detail::handler_trampoline<decltype(lambda)>, &lambda, counter);
+
+        auto start = Clock::now();
+        for (int r = 0; r < REGISTRATIONS; r++) {
+            for (size_t i = 0; i < fds.size(); i++) {
+                daemon.add_handler(fds[i], POLLIN, lambda, &ids[i]);
+            }
+            for (size_t i = 0; i < fds.size(); i++) {
+                daemon.remove_handler(ids[i]);
+            }
+        }
+        inline_add = elapsed_ns(start, REGISTRATIONS * fds.size());
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            daemon.add_handler(fds[i], POLLIN, lambda);
+        }
+        inline_dispatch = run_dispatch(daemon, counter);
+    }
+
+    // std::function through a trampoline, which owns its callable on the heap...
+    double function_add, function_dispatch, function_call;
+    {
+        udaemon::Daemon daemon(config);
+        Counter counter{};
+        // a capture larger than the small buffer of std::function, as is common...
+        uint64_t limit = DISPATCHES;
+        const ud_state_t **state = &counter.state;
+        auto lambda = [&counter, limit, state](struct pollfd &) {
+            if (++counter.count == limit) {
+                ud_terminate(*state);
+            }
+            return RES_OK;
+        };
+        std::vector<std::unique_ptr<Function>> functions(fds.size());
+
+        Function function(lambda);
+        function_call = run_calls(function_trampoline, &function, counter);
+
+        auto start = Clock::now();
+        for (int r = 0; r < REGISTRATIONS; r++) {
+            for (size_t i = 0; i < fds.size(); i++) {
+                functions[i] = std::make_unique<Function>(lambda);
+                ud_add_event_handler(daemon.get(), fds[i], POLLIN, function_trampoline, functions[i].get(), &ids[i]);
+            }
+            for (size_t i = 0; i < fds.size(); i++) {
+                ud_remove_event_handler(daemon.get(), ids[i]);
+                functions[i].reset();
+            }
+        }
+        function_add = elapsed_ns(start, REGISTRATIONS * fds.size());
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            functions[i] = std::make_unique<Function>(lambda);
+            ud_add_event_handler(daemon.get(), fds[i], POLLIN, function_trampoline, functions[i].get(), nullptr);
+        }
+        function_dispatch = run_dispatch(daemon, counter);
+    }
+
+    std::printf("%-16s %10s %14s %14s\n", "VARIANT", "CALL(ns)", "ADD+REMOVE(ns)", "DISPATCH(ns)");
+    std::printf("%-16s %10.2f %14.1f %14.1f\n", "C API", c_call, c_add, c_dispatch);
+    std::printf("%-16s %10.2f %14.1f %14.1f\n", "inline lambda", inline_call, inline_add, inline_dispatch);
+    std::printf("%-16s %10.2f %14.1f %14.1f\n", "std::function", function_call, function_add, function_dispatch);
+}
+
+} // namespace
+
+int main() {
+    // only report warnings and errors of udaemon itself...
+    set_loglevel(WARNING);
+
+    std::vector<int> fds;
+    for (int i = 0; i < HANDLERS; i++) {
+        int fd = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            std::perror("eventfd");
+            return 1;
+        }
+        fds.push_back(fd);
+    }
+
+    bench(fds);
+
+    for (int fd : fds) {
+        close(fd);
+    }
+    return 0;
+}
@@ -0,0 +1,155 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+// The number of dispatches per run...
+#define DISPATCHES 4000000
+
+/**
+ * Measures the cost of dispatching ready event handlers, and the number of
+ * L1 data cache misses this takes, for increasing numbers of event handlers.
+ * Each handler polls an eventfd that is always readable, so every iteration of
+ * the mainloop dispatches all of them. Cache misses are counted in user space
+ * only (using perf_event_open), so the work of the kernel does not count.
+ */
+static const uint32_t SIZES[] = { 64, 1024, 8192 };
+
+static struct {
+    int fds[8192];
+    uint64_t count;
+} bench;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Opens a counter for the L1 data cache read misses of this thread.
+ *
+ * @return the file descriptor of the counter, or -1 if not permitted.
+ */
+static int open_l1d_counter(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static ud_result_t on_ready(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) pollfd;
+    (void) context;
+
+    if (++bench.count == DISPATCHES) {
+        ud_terminate(ud_state);
+    }
+    return RES_OK;
+}
+
+static int run(uint32_t handlers, ud_backend_t backend, int counter) {
+    ud_config_t config = {
+        .foreground = true,
+        .backend = backend,
+        .max_handlers = handlers + 1,
+    };
+
+    ud_state_t *ud_state = ud_init(&config);
+    if (!ud_state) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < handlers; i++) {
+        if (ud_add_event_handler(ud_state, bench.fds[i], POLLIN, on_ready, NULL, NULL)) {
+            ud_destroy(ud_state);
+            return -1;
+        }
+    }
+
+    bench.count = 0;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t start = now_ns();
+    ud_main_loop(ud_state);
+    uint64_t elapsed = now_ns() - start;
+
+    uint64_t misses = 0;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != (ssize_t) sizeof(misses)) {
+            misses = 0;
+        }
+    }
+    ud_destroy(ud_state);
+
+    char l1d[16] = "n/a";
+    if (counter >= 0) {
+        snprintf(l1d, sizeof(l1d), "%.2f", (double) misses / (double) bench.count);
+    }
+    printf("%-6s %8u %14.1f %14s\n", backend == UD_BACKEND_POLL ? "poll" : "epoll", handlers,
+           (double) elapsed / (double) bench.count, l1d);
+    return 0;
+}
+
+int main(void) {
+    // only report warnings and errors of udaemon itself...
+    set_loglevel(WARNING);
+
+    uint32_t max = SIZES[sizeof(SIZES) / sizeof(SIZES[0]) - 1];
+    for (uint32_t i = 0; i < max; i++) {
+        bench.fds[i] = eventfd(1, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (bench.fds[i] < 0) {
+            perror("eventfd");
+            return 1;
+        }
+    }
+
+    int counter = open_l1d_counter();
+    if (counter < 0) {
+        fprintf(stderr, "L1D misses not available: %s\n", strerror(errno));
+    }
+
+    printf("%-6s %8s %14s %14s\n", "MODE", "HANDLERS", "NS/DISPATCH", "L1D-MISS/DISP");
+
+    int retval = 0;
+    for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++) {
+        if (run(SIZES[s], UD_BACKEND_EPOLL, counter) || run(SIZES[s], UD_BACKEND_POLL, counter)) {
+            fprintf(stderr, "%u handlers: failed\n", SIZES[s]);
+            retval = 1;
+        }
+    }
+
+    if (counter >= 0) {
+        close(counter);
+    }
+    for (uint32_t i = 0; i < max; i++) {
+        close(bench.fds[i]);
+    }
+    return retval;
+}
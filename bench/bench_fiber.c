@@ -0,0 +1,130 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+
+#include "udaemon/ud_fiber.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+// The number of context switches per run...
+#define SWITCHES 2000000
+// The stack size of the swapcontext baseline...
+#define STACK_SIZE (64 * 1024)
+
+/**
+ * Compares the cost of switching between fibers to that of swapcontext(3),
+ * which the fibers avoid on x86_64 and aarch64, as it saves and restores the
+ * signal mask with a system call on every switch. The baseline ping-pongs
+ * between two contexts and does nothing else. The fibers yield through the
+ * mainloop, so each yield takes two switches plus the scheduling, and with few
+ * fibers the mainloop iteration itself as well.
+ */
+static const uint32_t FIBERS[] = { 1, 100, 1000 };
+
+static struct {
+    ucontext_t main_ctx;
+    ucontext_t ping_ctx;
+    uint64_t switches;
+    uint64_t limit;
+} bench;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void ping(void) {
+    for (;;) {
+        swapcontext(&bench.ping_ctx, &bench.main_ctx);
+    }
+}
+
+static double run_swapcontext(void) {
+    void *stack = malloc(STACK_SIZE);
+    if (!stack || getcontext(&bench.ping_ctx) < 0) {
+        free(stack);
+        return -1.0;
+    }
+    bench.ping_ctx.uc_stack.ss_sp = stack;
+    bench.ping_ctx.uc_stack.ss_size = STACK_SIZE;
+    bench.ping_ctx.uc_link = NULL;
+    makecontext(&bench.ping_ctx, ping, 0);
+
+    uint64_t start = now_ns();
+    for (int i = 0; i < SWITCHES / 2; i++) {
+        swapcontext(&bench.main_ctx, &bench.ping_ctx);
+    }
+    uint64_t elapsed = now_ns() - start;
+
+    free(stack);
+    return (double) elapsed / SWITCHES;
+}
+
+static void yielding(const ud_state_t *ud_state, void *context) {
+    (void) context;
+
+    // every yield switches out of and back into this fiber...
+    while (bench.switches < bench.limit) {
+        bench.switches += 2;
+        ud_fiber_yield(ud_state);
+    }
+    ud_terminate(ud_state);
+}
+
+static double run_fibers(uint32_t count) {
+    ud_config_t config = {
+        .foreground = true,
+    };
+
+    ud_state_t *ud_state = ud_init(&config);
+    if (!ud_state) {
+        return -1.0;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (ud_spawn_fiber(ud_state, yielding, NULL, 0)) {
+            ud_destroy(ud_state);
+            return -1.0;
+        }
+    }
+
+    bench.switches = 0;
+    bench.limit = SWITCHES;
+
+    uint64_t start = now_ns();
+    ud_main_loop(ud_state);
+    uint64_t elapsed = now_ns() - start;
+
+    ud_destroy(ud_state);
+    return (double) elapsed / (double) bench.switches;
+}
+
+int main(void) {
+    // only report warnings and errors of udaemon itself...
+    set_loglevel(WARNING);
+
+    printf("%-20s %12s\n", "MODE", "NS/SWITCH");
+    printf("%-20s %12.1f\n", "swapcontext", run_swapcontext());
+
+    for (size_t i = 0; i < sizeof(FIBERS) / sizeof(FIBERS[0]); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "fiber yield (%u)", FIBERS[i]);
+
+        double ns = run_fibers(FIBERS[i]);
+        if (ns < 0) {
+            fprintf(stderr, "%s: failed\n", name);
+            return 1;
+        }
+        printf("%-20s %12.1f\n", name, ns);
+    }
+    return 0;
+}
@@ -0,0 +1,238 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+// The size of a single ping message...
+#define MSG_SIZE 64
+// The number of round trips that are not measured...
+#define WARMUP 2000
+// The number of measured round trips...
+#define ROUNDS 20000
+
+/**
+ * Measures the round-trip latency of an echo handler on a loopback TCP
+ * connection, with the mainloop blocking in the backend, busy polling, and
+ * pinned to a CPU with real-time priority. The client runs in a thread of its
+ * own, which is pinned to another CPU if more than one is available.
+ */
+typedef struct mode {
+    const char *name;
+    uint32_t busy_poll;
+    bool pin;
+    uint8_t rt_priority;
+} bench_mode_t;
+
+static const bench_mode_t MODES[] = {
+    { "blocking", 0, false, 0 },
+    { "busy-poll", 1000, false, 0 },
+    { "blocking+pin+fifo", 0, true, 50 },
+    { "busy-poll+pin+fifo", 1000, true, 50 },
+};
+
+static struct {
+    int listen_fd;
+    int server_fd;
+    struct sockaddr_in addr;
+    size_t echoed;
+    int client_cpu;
+    uint64_t rtt[ROUNDS];
+} bench;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static ud_result_t on_echo(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    char buf[4096];
+
+    (void) context;
+
+    ssize_t n = read(pollfd->fd, buf, sizeof(buf));
+    if (n <= 0) {
+        return (n < 0 && errno == EAGAIN) ? RES_OK : RES_ERROR;
+    }
+    if (write(pollfd->fd, buf, (size_t) n) != n) {
+        return RES_ERROR;
+    }
+
+    bench.echoed += (size_t) n;
+    if (bench.echoed >= (size_t) (WARMUP + ROUNDS) * MSG_SIZE) {
+        ud_terminate(ud_state);
+    }
+    return RES_OK;
+}
+
+static void *client(void *arg) {
+    (void) arg;
+
+    if (bench.client_cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((size_t) bench.client_cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (struct sockaddr *) &bench.addr, sizeof(bench.addr))) {
+        perror("connect");
+        close(fd);
+        return NULL;
+    }
+
+    char msg[MSG_SIZE];
+    memset(msg, 'x', sizeof(msg));
+
+    for (int i = 0; i < WARMUP + ROUNDS; i++) {
+        uint64_t start = now_ns();
+        if (write(fd, msg, sizeof(msg)) != (ssize_t) sizeof(msg)) {
+            break;
+        }
+        size_t got = 0;
+        while (got < sizeof(msg)) {
+            ssize_t n = read(fd, msg + got, sizeof(msg) - got);
+            if (n <= 0) {
+                close(fd);
+                return NULL;
+            }
+            got += (size_t) n;
+        }
+        if (i >= WARMUP) {
+            bench.rtt[i - WARMUP] = now_ns() - start;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+static int init(const ud_state_t *ud_state) {
+    bench.server_fd = accept4(bench.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (bench.server_fd < 0) {
+        perror("accept");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(bench.server_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    return ud_add_event_handler(ud_state, bench.server_fd, POLLIN, on_echo, NULL, NULL);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(double p) {
+    size_t idx = (size_t) (p * (ROUNDS - 1));
+    return (double) bench.rtt[idx] / 1000.0;
+}
+
+static int run(const bench_mode_t *mode, int cpus) {
+    memset(bench.rtt, 0, sizeof(bench.rtt));
+    bench.echoed = 0;
+    bench.client_cpu = (mode->pin && cpus > 1) ? cpus - 1 : -1;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, client, NULL)) {
+        return -1;
+    }
+
+    ud_config_t config = {
+        .foreground = true,
+        .busy_poll = mode->busy_poll,
+        .cpu_affinity = mode->pin ? 1 : 0,
+        .rt_priority = mode->rt_priority,
+        .rt_policy = UD_RT_FIFO,
+        .initialize = init,
+    };
+
+    ud_state_t *ud_state = ud_init(&config);
+    int rc = ud_state ? ud_main_loop(ud_state) : -1;
+    ud_destroy(ud_state);
+    close(bench.server_fd);
+
+    // the real-time priority needs privileges, tell whether it was applied...
+    bool applied = !mode->rt_priority || sched_getscheduler(0) == SCHED_FIFO;
+    struct sched_param param = { .sched_priority = 0 };
+    sched_setscheduler(0, SCHED_OTHER, &param);
+
+    pthread_join(thread, NULL);
+    if (rc || bench.echoed < (size_t) (WARMUP + ROUNDS) * MSG_SIZE) {
+        fprintf(stderr, "%s: failed\n", mode->name);
+        return -1;
+    }
+
+    qsort(bench.rtt, ROUNDS, sizeof(uint64_t), cmp_u64);
+
+    double sum = 0;
+    for (int i = 0; i < ROUNDS; i++) {
+        sum += (double) bench.rtt[i];
+    }
+
+    printf("%-20s %9.1f %9.1f %9.1f %9.1f %9.1f%s\n", mode->name, sum / ROUNDS / 1000.0,
+           percentile(0.50), percentile(0.99), percentile(0.999), percentile(1.0),
+           applied ? "" : " (no real-time priority)");
+    return 0;
+}
+
+int main(void) {
+    int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    // only report warnings and errors of udaemon itself...
+    set_loglevel(WARNING);
+
+    bench.listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bench.addr.sin_family = AF_INET;
+    bench.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t len = sizeof(bench.addr);
+    if (bind(bench.listen_fd, (struct sockaddr *) &bench.addr, len) || listen(bench.listen_fd, 1) ||
+            getsockname(bench.listen_fd, (struct sockaddr *) &bench.addr, &len)) {
+        perror("listen");
+        return 1;
+    }
+
+    printf("%d CPU(s), %d round trips of %d bytes, times in microseconds\n", cpus, ROUNDS, MSG_SIZE);
+    printf("%-20s %9s %9s %9s %9s %9s\n", "MODE", "MEAN", "P50", "P99", "P99.9", "MAX");
+
+    int retval = 0;
+    for (size_t m = 0; m < sizeof(MODES) / sizeof(MODES[0]); m++) {
+        if (cpus < 2 && MODES[m].busy_poll && MODES[m].rt_priority) {
+            // a spinning real-time mainloop would starve the client...
+            printf("%-20s skipped, needs at least 2 CPUs\n", MODES[m].name);
+            continue;
+        }
+        if (run(&MODES[m], cpus)) {
+            retval = 1;
+        }
+    }
+
+    close(bench.listen_fd);
+    return retval;
+}
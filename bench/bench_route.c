@@ -0,0 +1,129 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "udaemon/ud_route.h"
+
+// The number of lookups per run...
+#define LOOKUPS 500000
+// The maximum length of a generated topic...
+#define TOPIC_MAX 48
+// The number of distinct topics looked up in the cached runs, fits in the cache...
+#define HOT_TOPICS 64
+
+/**
+ * Measures adding routes to, and matching topics against, routing tables of
+ * increasing size. Each route is of the form `site/<s>/device/<d>/<metric>`,
+ * and every site also has a `site/<s>/+/+/status` and `site/<s>/#` route, so
+ * each lookup walks both exact and wildcard branches of the trie.
+ */
+static const uint32_t SIZES[] = { 10000, 100000, 1000000 };
+
+static const char *const METRICS[] = { "temp", "humidity", "power", "status" };
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void make_topic(char *buf, size_t size, uint32_t i) {
+    // 100 devices per site...
+    snprintf(buf, size, "site/%u/device/%u/%s", i / 400, (i / 4) % 100, METRICS[i % 4]);
+}
+
+static uint32_t next_random(uint32_t *state) {
+    // xorshift32, good enough to pick topics...
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static double bench_lookups(ud_route_table_t *table, char *topics, uint32_t routes, uint32_t spread,
+                            uint64_t *matched) {
+    uint32_t state = 2463534242u;
+
+    // generate the topics up front, so only the matching itself is measured...
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+        make_topic(topics + i * TOPIC_MAX, TOPIC_MAX, next_random(&state) % spread % routes);
+    }
+
+    double start = now_s();
+    for (uint32_t i = 0; i < LOOKUPS; i++) {
+        void *const *targets;
+        int count = ud_route_match(table, topics + i * TOPIC_MAX, &targets);
+        if (count > 0) {
+            *matched += (uint64_t) count;
+        }
+    }
+    return (now_s() - start) * 1e9 / LOOKUPS;
+}
+
+static int bench(uint32_t routes, char *topics) {
+    ud_route_table_t *table = ud_route_create();
+    if (!table) {
+        return -1;
+    }
+
+    char filter[TOPIC_MAX];
+    double start = now_s();
+    for (uint32_t i = 0; i < routes; i++) {
+        make_topic(filter, sizeof(filter), i);
+        // the target is never dereferenced...
+        if (ud_route_add(table, filter, (void *) (uintptr_t) (i + 1))) {
+            fprintf(stderr, "Failed to add route %s\n", filter);
+            ud_route_destroy(table);
+            return -1;
+        }
+        if (i % 400 == 0) {
+            // use targets that differ from those of the exact routes...
+            uintptr_t site = routes + 2 * (i / 400);
+            snprintf(filter, sizeof(filter), "site/%u/+/+/status", i / 400);
+            ud_route_add(table, filter, (void *) (site + 1));
+            snprintf(filter, sizeof(filter), "site/%u/#", i / 400);
+            ud_route_add(table, filter, (void *) (site + 2));
+        }
+    }
+    double add_ns = (now_s() - start) * 1e9 / routes;
+
+    // a small set of topics that is matched over and over again, and random topics...
+    uint64_t matched = 0;
+    double hot_ns = bench_lookups(table, topics, routes, HOT_TOPICS, &matched);
+    double cold_ns = bench_lookups(table, topics, routes, UINT32_MAX, &matched);
+
+    printf("%8u %10.0f %12.0f %12.0f %12.2f\n", routes, add_ns, hot_ns, cold_ns,
+           (double) matched / (2.0 * LOOKUPS));
+
+    ud_route_destroy(table);
+    return 0;
+}
+
+int main(void) {
+    char *topics = malloc((size_t) LOOKUPS * TOPIC_MAX);
+    if (!topics) {
+        return 1;
+    }
+
+    printf("%8s %10s %12s %12s %12s\n", "ROUTES", "ADD(ns)", "CACHED(ns)", "RANDOM(ns)", "TARGETS");
+
+    int retval = 0;
+    for (size_t i = 0; i < sizeof(SIZES) / sizeof(SIZES[0]); i++) {
+        if (bench(SIZES[i], topics)) {
+            retval = 1;
+        }
+    }
+
+    free(topics);
+    return retval;
+}
@@ -0,0 +1,151 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/vfs.h>
+
+#include "udaemon/ud_spool.h"
+
+// The segment size used by all runs...
+#define SEGMENT_SIZE (4 * 1024 * 1024)
+
+typedef struct run {
+    size_t record_size;
+    uint16_t sync_batch;
+    int records;
+} run_t;
+
+static const run_t RUNS[] = {
+    { 64, 256, 500000 },
+    { 1024, 256, 200000 },
+    { 64, 1, 2000 },
+    { 1024, 1, 2000 },
+};
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static void remove_spool(const char *directory) {
+    DIR *dirp = opendir(directory);
+    if (!dirp) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dirp)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(dirp);
+    rmdir(directory);
+}
+
+static const char *fs_name(const char *directory) {
+    struct statfs st;
+    if (statfs(directory, &st)) {
+        return "?";
+    }
+    // only the ones we are interested in...
+    switch ((unsigned long) st.f_type) {
+    case 0x01021994UL:
+        return "tmpfs";
+    case 0xEF53UL:
+        return "ext4";
+    case 0x58465342UL:
+        return "xfs";
+    case 0x9123683EUL:
+        return "btrfs";
+    default:
+        return "other";
+    }
+}
+
+static int bench(const char *directory, const run_t *run) {
+    remove_spool(directory);
+
+    ud_spool_config_t config = {
+        .directory = directory,
+        .segment_size = SEGMENT_SIZE,
+        .sync_batch = run->sync_batch,
+    };
+    ud_spool_t *spool = ud_spool_open(&config);
+    if (!spool) {
+        fprintf(stderr, "Unable to open spool in %s: %s\n", directory, strerror(errno));
+        return -1;
+    }
+
+    char *record = malloc(run->record_size);
+    memset(record, 'x', run->record_size);
+
+    double start = now_s();
+    for (int i = 0; i < run->records; i++) {
+        int rc = ud_spool_append(spool, record, run->record_size);
+        if (rc) {
+            fprintf(stderr, "Failed to append: %s\n", strerror(-rc));
+            break;
+        }
+    }
+    ud_spool_sync(spool);
+    double appended = now_s() - start;
+
+    start = now_s();
+    int consumed = 0;
+    while (ud_spool_consume(spool) == 0) {
+        consumed++;
+    }
+    ud_spool_sync(spool);
+    double drained = now_s() - start;
+
+    double mb = (double) run->records * (double) run->record_size / (1024.0 * 1024.0);
+    printf("%-6s %7zu %6u %8d %12.0f %9.1f %12.0f %9.1f\n",
+           fs_name(directory), run->record_size, run->sync_batch, run->records,
+           run->records / appended, mb / appended, consumed / drained, mb / drained);
+
+    free(record);
+    ud_spool_close(spool);
+    remove_spool(directory);
+
+    return (consumed == run->records) ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *defaults[] = { "/dev/shm/udaemon-bench-spool", "/var/tmp/udaemon-bench-spool" };
+
+    int count = (argc > 1) ? argc - 1 : 2;
+    const char **directories = (argc > 1) ? (const char **) argv + 1 : defaults;
+
+    // only report warnings and errors of the spool itself...
+    set_loglevel(WARNING);
+
+    printf("%-6s %7s %6s %8s %12s %9s %12s %9s\n",
+           "FS", "SIZE", "BATCH", "RECORDS", "APPEND/s", "MB/s", "CONSUME/s", "MB/s");
+
+    int retval = 0;
+    for (int d = 0; d < count; d++) {
+        for (size_t r = 0; r < sizeof(RUNS) / sizeof(RUNS[0]); r++) {
+            if (bench(directories[d], &RUNS[r])) {
+                retval = 1;
+            }
+        }
+    }
+    return retval;
+}
@@ -25,6 +25,7 @@
 #include <arpa/inet.h>
 
 #include "udaemon/udaemon.h"
+#include "udaemon/ud_admin.h"
 #include "udaemon/ud_utils.h"
 
 #define PROGNAME "test"
@@ -36,7 +37,7 @@
 #define PORT 9000
 
 typedef struct {
-    int server_port;
+    uint16_t server_port;
     char *msg;
 } test_config_t;
 
@@ -45,14 +46,14 @@ typedef struct {
     int test_server_fd;
     struct sockaddr_in test_server;
     eh_id_t test_event_handler_id;
+    char *admin_socket;
+    ud_admin_t *admin;
 } run_state_t;
 
 static int reconnect_server(const ud_state_t *ud_state, const uint16_t interval, void *context);
 static int disconnect_server(const ud_state_t *ud_state, void *context);
 
 static ud_result_t test_file_callback(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
-    run_state_t *run_state = context;
-
     if (pollfd->revents & (POLLHUP | POLLERR | POLLNVAL)) {
         log_info("Socket closed by server...");
 
@@ -60,9 +61,9 @@ static ud_result_t test_file_callback(const ud_state_t *ud_state, struct pollfd
     }
     if ((pollfd->revents & POLLIN)) {
         static uint8_t buf[128] = { 0 };
-        int cnt = read(pollfd->fd, &buf, sizeof(buf));
+        ssize_t cnt = ud_read(ud_state, pollfd->fd, &buf, sizeof(buf));
         if (cnt > 0) {
-            log_info("Read %d bytes from server!", cnt);
+            log_info("Read %zd bytes from server!", cnt);
 
             return RES_OK;
         } else if (cnt == 0) {
@@ -77,6 +78,17 @@ static ud_result_t test_file_callback(const ud_state_t *ud_state, struct pollfd
     return RES_ERROR;
 }
 
+static void test_file_closed(const ud_state_t *ud_state, int fd, void *context) {
+    (void) ud_state;
+    run_state_t *run_state = context;
+
+    log_debug("Server connection (fd#%d) closed by udaemon...", fd);
+
+    // udaemon closes the socket and removes the event handler for us...
+    run_state->test_server_fd = 0;
+    run_state->test_event_handler_id = 0;
+}
+
 static int connect_server(const ud_state_t *ud_state, void *context) {
     const test_config_t *cfg = ud_get_app_config(ud_state);
     run_state_t *run_state = context;
@@ -105,6 +117,7 @@ static int connect_server(const ud_state_t *ud_state, void *context) {
         log_warning("Failed to register event handler!");
         return -1;
     }
+    ud_set_close_hook(ud_state, run_state->test_event_handler_id, test_file_closed);
 
     return 0;
 }
@@ -192,6 +205,15 @@ static int test_initialize(const ud_state_t *ud_state) {
     log_debug("Application configuration is %s", ud_get_app_config(ud_state) ? "present" : "NOT present");
     log_debug("Application state is %s", run_state ? "present" : "NOT present");
 
+    if (run_state->admin_socket) {
+        ud_admin_config_t admin_config = { .path = run_state->admin_socket };
+
+        run_state->admin = ud_admin_create(ud_state, &admin_config);
+        if (!run_state->admin) {
+            log_warning("Failed to create admin socket!");
+        }
+    }
+
     return ud_schedule_task(ud_state, 0, reconnect_server, run_state);
 }
 
@@ -202,10 +224,16 @@ static int test_cleanup(const ud_state_t *ud_state) {
 
     disconnect_server(ud_state, run_state);
 
+    ud_admin_destroy(run_state->admin);
+    run_state->admin = NULL;
+
     return 0;
 }
 
 static void *test_config_parser(const char *conf_file, const void *config) {
+    (void) conf_file;
+    (void) config;
+
     log_debug("Parsing test configuration...");
 
     test_config_t *cfg = malloc(sizeof(test_config_t));
@@ -227,8 +255,10 @@ int main(int argc, char *argv[]) {
     run_state_t run_state = {
         .connected = false,
         .test_server_fd = 0,
-        .test_server = 0,
+        .test_server = { 0 },
         .test_event_handler_id = 0,
+        .admin_socket = NULL,
+        .admin = NULL,
     };
 
     ud_config_t daemon_config = {
@@ -247,8 +277,11 @@ int main(int argc, char *argv[]) {
     bool debug = false;
     char *uid_gid = NULL;
 
-    while ((opt = getopt(argc, argv, "c:dfhp:u:v")) != -1) {
+    while ((opt = getopt(argc, argv, "a:c:dfhp:u:v")) != -1) {
         switch (opt) {
+        case 'a':
+            run_state.admin_socket = strdup(optarg);
+            break;
         case 'c':
             daemon_config.conf_file = strdup(optarg);
             break;
@@ -271,7 +304,7 @@ int main(int argc, char *argv[]) {
             if (opt == 'v') {
                 exit(0);
             }
-            fprintf(stderr, "Usage: %s [-d] [-f] [-c config file] [-p pid file] [-v]\n", PROGNAME);
+            fprintf(stderr, "Usage: %s [-d] [-f] [-a admin socket] [-c config file] [-p pid file] [-v]\n", PROGNAME);
             exit(1);
         }
     }
@@ -309,6 +342,7 @@ int main(int argc, char *argv[]) {
 
     free(daemon_config.conf_file);
     free(daemon_config.pid_file);
+    free(run_state.admin_socket);
 
     return retval;
 }
\ No newline at end of file
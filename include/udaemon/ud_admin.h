@@ -0,0 +1,96 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_ADMIN_H_
+#define UD_ADMIN_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Represents the configuration of an admin socket.
+ */
+typedef struct ud_admin_config {
+    /** the path of the UNIX socket to listen on, cannot be NULL. */
+    const char *path;
+    /** the permissions of the socket, defaults to 0600. */
+    mode_t mode;
+    /** the time (in ms) after which an idle connection is closed, defaults to 30000. */
+    uint32_t idle_timeout;
+    /**
+     * The (optional) callback to call for the "drain" command, which should
+     * stop accepting new work and terminate the mainloop once all current
+     * work is done. By default, the mainloop is terminated as if SIGTERM is
+     * received.
+     *
+     * @param ud_state the current state of udaemon, cannot be NULL;
+     * @param context the context of the admin socket.
+     */
+    void (*drain)(const ud_state_t *ud_state, void *context);
+    /** the context passed to the drain callback. */
+    void *context;
+} ud_admin_config_t;
+
+/**
+ * Represents an admin socket, which allows the daemon to be controlled at
+ * runtime, for example, using `socat - UNIX-CONNECT:<path>`.
+ *
+ * Unlike signals, commands can carry arguments and get replies, and never
+ * interrupt system calls. The protocol is line-based: each command is a
+ * single line, and each reply ends with a line that is either "OK" or
+ * "ERR <reason>". The following commands are supported:
+ *
+ * - `loglevel [module] <debug|info|warning|error>`: sets the loglevel, of
+ *   the daemon or a single module (see #set_module_loglevel);
+ * - `stats`: shows the resources used by all event handlers and tasks, see
+ *   #ud_format_top;
+ * - `tables`: shows the event handler and task tables, see #ud_format_tables;
+ * - `reload`: reloads the configuration, like SIGHUP;
+ * - `record start <path>` and `record stop`: starts or stops recording
+ *   events, see #ud_record_start;
+ * - `drain`: drains and terminates the daemon, see ud_admin_config_t.drain;
+ * - `help`: shows all commands;
+ * - `quit`: closes the connection.
+ *
+ * The admin socket is serviced by the mainloop and uses two event handlers:
+ * one to accept connections, and one for the connection being served, and a
+ * keepalive manager (see ud_keepalive.h) with a timer of its own. Other
+ * connections wait until the current one is closed, which happens once it is
+ * idle for longer than `ud_admin_config_t.idle_timeout`.
+ */
+typedef struct ud_admin ud_admin_t;
+
+/**
+ * Creates a new admin socket. A stale socket at the same path, on which nobody
+ * accepts connections anymore, is removed. The socket of another running
+ * instance, or any other kind of file at that path, is left alone and fails
+ * the creation.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param config the configuration of the admin socket, cannot be NULL.
+ * @return the admin socket, or NULL in case of errors, with errno set to
+ *         EADDRINUSE if another instance serves the path.
+ */
+ud_admin_t *ud_admin_create(const ud_state_t *ud_state, const ud_admin_config_t *config);
+
+/**
+ * Destroys an admin socket, closing its connection and removing the socket.
+ *
+ * @param admin the admin socket to destroy, may be NULL.
+ */
+void ud_admin_destroy(ud_admin_t *admin);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_ADMIN_H_ */
@@ -0,0 +1,107 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_BUFFER_H_
+#define UD_BUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The capacity of a single pooled buffer, in bytes.
+ */
+#define UD_BUF_SIZE 16384
+
+/**
+ * Represents a reference counted buffer, taken from a pool of buffers.
+ *
+ * NOTE: each thread has a pool of its own, and the references are not counted
+ * atomically, so a buffer should only be used by the thread that allocated it
+ * (typically, the thread running the mainloop). Copy its data to hand it over
+ * to another thread.
+ */
+typedef struct ud_buf {
+    /** the number of bytes used in the buffer. */
+    size_t len;
+    /** the capacity of the buffer, in bytes. */
+    size_t cap;
+    /** the number of references to this buffer. */
+    uint32_t refs;
+    /** the next buffer in the pool (private). */
+    struct ud_buf *next;
+    /** the buffer data. */
+    uint8_t data[];
+} ud_buf_t;
+
+/**
+ * Callback for the data read by #ud_drain_fd.
+ *
+ * The given buffer is only valid during the call, unless a reference is taken
+ * to it (see #ud_buf_ref).
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param buf the buffer with the read data, or NULL in case of EOF;
+ * @param context the user-defined context, can be NULL.
+ * @return RES_OK to continue draining, or any other value to stop draining
+ *         and return that value from #ud_drain_fd.
+ */
+typedef ud_result_t (*ud_drain_handler_t)(const ud_state_t *ud_state, ud_buf_t *buf, void *context);
+
+/**
+ * Allocates a buffer, reusing a pooled buffer if available.
+ *
+ * @return a buffer with a single reference, or NULL in case of out of memory.
+ */
+ud_buf_t *ud_buf_alloc(void);
+
+/**
+ * Takes an additional reference to a buffer. Not thread-safe, see #ud_buf_t.
+ *
+ * @param buf the buffer to reference, cannot be NULL.
+ * @return the given buffer.
+ */
+ud_buf_t *ud_buf_ref(ud_buf_t *buf);
+
+/**
+ * Releases a reference to a buffer, returning it to the pool of the calling
+ * thread once the last reference is released. Not thread-safe, see #ud_buf_t.
+ *
+ * @param buf the buffer to release, may be NULL.
+ */
+void ud_buf_release(ud_buf_t *buf);
+
+/**
+ * Reads all available data from a non-blocking file descriptor, until it
+ * returns EAGAIN, EOF is reached or the byte budget of the current event
+ * handler (see #ud_dispatch_budget) is exhausted.
+ *
+ * This is intended to be called (and returned) from an event handler, which
+ * makes it safe to use with edge-triggered event handlers: when the budget
+ * cuts the draining short, RES_MORE is returned and udaemon calls the event
+ * handler again in the next iteration of the main loop, even though no new
+ * edge will be reported for the data that is still pending.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param fd the (non-blocking) file descriptor to read from;
+ * @param handler the callback to pass the read data to, cannot be NULL;
+ * @param context the (optional) context to pass on to the callback.
+ * @return RES_OK if all data is read, RES_MORE if data is still pending, the
+ *         result of the callback if it stopped the draining, or RES_ERROR in
+ *         case of read errors.
+ */
+ud_result_t ud_drain_fd(const ud_state_t *ud_state, int fd, ud_drain_handler_t handler, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_BUFFER_H_ */
@@ -0,0 +1,187 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_BUS_H_
+#define UD_BUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Denotes the identifier of a topic on a bus.
+ *
+ * Topic identifiers are plain integers, either assigned by the application or
+ * derived from a topic name using #ud_topic_id. It is advised to compute the
+ * identifiers of named topics once, for example, while parsing the
+ * configuration.
+ */
+typedef uint32_t ud_topic_t;
+
+/**
+ * Represents a reference counted message that is published on a bus.
+ *
+ * Messages are delivered to all subscribers without copying their data. A
+ * subscriber that wants to retain a message beyond its callback must take a
+ * reference to it using #ud_msg_ref. Reference counting is thread-safe.
+ */
+typedef struct ud_msg {
+    /** the topic of this message. */
+    ud_topic_t topic;
+    /** the number of references to this message (private). */
+    uint32_t refs;
+    /** the next message in the queue of a bus (private). */
+    struct ud_msg *next;
+    /** used to hand the message over to the mainloop (private). */
+    ud_post_t post;
+    /** the bus the message is posted to (private). */
+    struct ud_bus *bus;
+    /** the length of the message data, in bytes. */
+    size_t len;
+    /** the message data. */
+    uint8_t data[];
+} ud_msg_t;
+
+/**
+ * Represents a publish/subscribe bus that delivers messages to the
+ * subscribers of their topic.
+ *
+ * Messages are delivered asynchronously on the mainloop of udaemon, in the
+ * order they were published. The messages published within a single iteration
+ * of the mainloop are handed to each subscriber in batches, rather than one
+ * by one.
+ */
+typedef struct ud_bus ud_bus_t;
+
+/**
+ * Callback used to deliver a batch of messages to a subscriber.
+ *
+ * The messages are only valid for the duration of the call, unless the
+ * subscriber takes a reference to them.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param msgs the messages of the subscribed topic, cannot be NULL;
+ * @param count the number of messages, > 0;
+ * @param context the context registered with the subscription, can be NULL.
+ */
+typedef void (*ud_bus_handler_t)(const ud_state_t *ud_state, ud_msg_t *const *msgs, size_t count, void *context);
+
+/**
+ * Derives a topic identifier from a topic name, using a 32-bit FNV-1a hash.
+ *
+ * @param name the topic name to derive the identifier for, cannot be NULL.
+ * @return the topic identifier.
+ */
+ud_topic_t ud_topic_id(const char *name);
+
+/**
+ * Allocates a new message with a single reference.
+ *
+ * This function can be called from any thread.
+ *
+ * @param topic the topic of the message;
+ * @param data the (optional) data to copy into the message, can be NULL in
+ *        which case the data is left uninitialized;
+ * @param len the length of the message data, in bytes.
+ * @return the message, or NULL if out of memory.
+ */
+ud_msg_t *ud_msg_alloc(ud_topic_t topic, const void *data, size_t len);
+
+/**
+ * Takes an additional reference to a message.
+ *
+ * @param msg the message to take a reference to, cannot be NULL.
+ * @return the given message.
+ */
+ud_msg_t *ud_msg_ref(ud_msg_t *msg);
+
+/**
+ * Releases a reference to a message, freeing it once it is no longer referenced.
+ *
+ * @param msg the message to release, may be NULL.
+ */
+void ud_msg_release(ud_msg_t *msg);
+
+/**
+ * Creates a new bus.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL.
+ * @return the bus, or NULL in case of errors.
+ */
+ud_bus_t *ud_bus_create(const ud_state_t *ud_state);
+
+/**
+ * Destroys a bus, dropping all messages that are not yet delivered.
+ *
+ * Messages that are posted by other threads, but have not reached the
+ * mainloop yet, are dropped on the mainloop, or once the state is destroyed
+ * (see #ud_destroy) if the mainloop has terminated, after which the bus is
+ * freed.
+ *
+ * NOTE: a bus cannot be destroyed from within one of its subscribers, nor
+ * while other threads are still posting to it.
+ *
+ * @param bus the bus to destroy, may be NULL.
+ */
+void ud_bus_destroy(ud_bus_t *bus);
+
+/**
+ * Subscribes to a topic.
+ *
+ * @param bus the bus to subscribe to, cannot be NULL;
+ * @param topic the topic to subscribe to;
+ * @param handler the callback to deliver messages to, cannot be NULL;
+ * @param context the (optional) context to pass on to the handler.
+ * @return the (non-negative) subscription identifier, or a negative errno
+ *         value in case of errors.
+ */
+int ud_bus_subscribe(ud_bus_t *bus, ud_topic_t topic, ud_bus_handler_t handler, void *context);
+
+/**
+ * Removes a subscription.
+ *
+ * @param bus the bus to unsubscribe from, cannot be NULL;
+ * @param subscription the subscription identifier to remove.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_bus_unsubscribe(ud_bus_t *bus, int subscription);
+
+/**
+ * Publishes a message on a bus.
+ *
+ * NOTE: this function must be called from the thread running the mainloop of
+ * udaemon. Use #ud_bus_post to publish from other threads.
+ *
+ * @param bus the bus to publish on, cannot be NULL;
+ * @param msg the message to publish, cannot be NULL. The reference of the
+ *        caller is handed over to the bus.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_bus_publish(ud_bus_t *bus, ud_msg_t *msg);
+
+/**
+ * Publishes a message on a bus from any thread.
+ *
+ * The message is handed over to the mainloop using #ud_post, where it is
+ * published as if by #ud_bus_publish.
+ *
+ * @param bus the bus to publish on, cannot be NULL;
+ * @param msg the message to publish, cannot be NULL. The reference of the
+ *        caller is handed over to the bus.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_bus_post(ud_bus_t *bus, ud_msg_t *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_BUS_H_ */
@@ -0,0 +1,103 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_FIBER_H_
+#define UD_FIBER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The default stack size of a fiber, in bytes.
+ */
+#define UD_FIBER_STACK_SIZE (64 * 1024)
+
+/**
+ * Represents the body of a fiber.
+ *
+ * Fibers are lightweight, cooperatively scheduled, threads of execution that
+ * run on the mainloop of udaemon. Each fiber has its own stack, allowing it to
+ * be written as sequential code, that waits for file descriptors, sleeps or
+ * yields without blocking the mainloop. The fiber terminates once its body
+ * returns.
+ *
+ * Stacks are pooled and protected by a guard page, so a stack overflow results
+ * in a segmentation fault rather than silent memory corruption.
+ *
+ * NOTE: fibers only run on the thread running the mainloop. Each state has a
+ * scheduler of its own. Fibers that are still waiting when the mainloop
+ * terminates continue once it runs again, or are released (without returning)
+ * once the state is destroyed.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param context the context the fiber was spawned with, can be NULL.
+ */
+typedef void (*ud_fiber_fn_t)(const ud_state_t *ud_state, void *context);
+
+/**
+ * Spawns a new fiber, which starts running in the next iteration of the
+ * mainloop.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param fn the body of the fiber, cannot be NULL;
+ * @param context the (optional) context to pass on to the fiber;
+ * @param stack_size the size of the stack of the fiber, in bytes, or 0 to
+ *        use #UD_FIBER_STACK_SIZE.
+ * @return zero in case of success, -ENOSPC if the fiber could not be
+ *         scheduled, or another negative errno value in case of errors.
+ */
+int ud_spawn_fiber(const ud_state_t *ud_state, ud_fiber_fn_t fn, void *context, size_t stack_size);
+
+/**
+ * Suspends the current fiber until a file descriptor is ready.
+ *
+ * NOTE: can only be called from within a fiber.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param fd the file descriptor to wait for;
+ * @param events the events to wait for, such as POLLIN or POLLOUT.
+ * @return the returned events (`revents`) of the file descriptor, or a
+ *         negative errno value in case of errors.
+ */
+int ud_fiber_wait_fd(const ud_state_t *ud_state, int fd, short events);
+
+/**
+ * Suspends the current fiber for a given amount of time.
+ *
+ * NOTE: can only be called from within a fiber.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param millis the time to sleep, in milliseconds.
+ * @return zero in case of success, -ENOSPC if no timer could be scheduled, in
+ *         which case the fiber returns right away, or another negative errno
+ *         value in case of errors.
+ */
+int ud_fiber_sleep(const ud_state_t *ud_state, uint32_t millis);
+
+/**
+ * Suspends the current fiber until the next iteration of the mainloop,
+ * allowing other fibers and event handlers to run.
+ *
+ * NOTE: can only be called from within a fiber.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL.
+ * @return zero in case of success, -ENOSPC if the fiber could not be
+ *         rescheduled, in which case it continues right away, or another
+ *         negative errno value in case of errors.
+ */
+int ud_fiber_yield(const ud_state_t *ud_state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_FIBER_H_ */
@@ -0,0 +1,191 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_FUTURE_H_
+#define UD_FUTURE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Represents the eventual result of an asynchronous operation.
+ *
+ * A future is owned by the mainloop of udaemon it is created for: it is
+ * settled exactly once, either resolved with a value or rejected with a
+ * (negative) errno value, and its continuations (see #ud_future_then) run on
+ * that mainloop. Futures are reference counted and taken from a pool, so
+ * creating and chaining them does usually not allocate.
+ *
+ * Each state has a pool of futures of its own. Once the state is destroyed
+ * (see #ud_destroy), futures that are still pending never time out, and can
+ * only be settled and released.
+ *
+ * NOTE: futures are not thread-safe, only #ud_future_post can be called from
+ * other threads, as long as the state is not destroyed.
+ */
+typedef struct ud_future ud_future_t;
+
+/**
+ * Represents a continuation of a future.
+ *
+ * The continuation is called once the future it is chained to is settled, and
+ * should settle the next future, either directly or at some later point in
+ * time, for example, once another asynchronous operation is finished.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param future the settled future, cannot be NULL;
+ * @param next the future returned by #ud_future_then, cannot be NULL;
+ * @param context the context the continuation was registered with.
+ */
+typedef void (*ud_future_fn_t)(const ud_state_t *ud_state, ud_future_t *future,
+                               ud_future_t *next, void *context);
+
+/**
+ * Creates a new, pending, future.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL.
+ * @return the future, with a single reference owned by the caller, or NULL
+ *         if out of memory.
+ */
+ud_future_t *ud_future_create(const ud_state_t *ud_state);
+
+/**
+ * Adds a reference to a future.
+ *
+ * @param future the future to reference, cannot be NULL.
+ * @return the given future.
+ */
+ud_future_t *ud_future_ref(ud_future_t *future);
+
+/**
+ * Releases a reference to a future, returning it to the pool once it is no
+ * longer referenced.
+ *
+ * NOTE: continuations of a future that is released before it is settled are
+ * never called.
+ *
+ * @param future the future to release, may be NULL.
+ */
+void ud_future_release(ud_future_t *future);
+
+/**
+ * Resolves a future with a value, and runs its continuations.
+ *
+ * @param future the future to resolve, cannot be NULL;
+ * @param value the value to resolve the future with, can be NULL.
+ * @return zero in case of success, -EALREADY if the future is already settled.
+ */
+int ud_future_resolve(ud_future_t *future, void *value);
+
+/**
+ * Rejects a future with an error, and runs its continuations.
+ *
+ * @param future the future to reject, cannot be NULL;
+ * @param error the negative errno value to reject the future with.
+ * @return zero in case of success, -EALREADY if the future is already settled.
+ */
+int ud_future_reject(ud_future_t *future, int error);
+
+/**
+ * Settles a future from any thread, for example, from a worker thread.
+ *
+ * The future is settled on its mainloop (see #ud_post), after which the
+ * reference held by the caller is released. A future can only be posted once.
+ * In case of errors, the future is not posted and the caller keeps its
+ * reference.
+ *
+ * @param future the future to settle, cannot be NULL;
+ * @param error zero to resolve the future, or a negative errno value to
+ *        reject it;
+ * @param value the value to resolve the future with, can be NULL.
+ * @return zero in case of success, -EALREADY if the future is already posted,
+ *         or another negative errno value in case of errors.
+ */
+int ud_future_post(ud_future_t *future, int error, void *value);
+
+/**
+ * @param future the future to check, cannot be NULL.
+ * @return true if the future is settled, false if it is still pending.
+ */
+bool ud_future_done(const ud_future_t *future);
+
+/**
+ * @param future the future to check, cannot be NULL.
+ * @return zero if the future is resolved, -EINPROGRESS if it is still
+ *         pending, or the negative errno value it was rejected with.
+ */
+int ud_future_error(const ud_future_t *future);
+
+/**
+ * @param future the future to get the value of, cannot be NULL.
+ * @return the value the future is resolved with, or NULL if it is not
+ *         resolved.
+ */
+void *ud_future_value(const ud_future_t *future);
+
+/**
+ * Chains a continuation to a future.
+ *
+ * Continuations are called in the order in which they are chained. If the
+ * future is already settled, the continuation is called right away.
+ *
+ * @param future the future to chain to, cannot be NULL;
+ * @param fn the continuation to call once the future is settled, cannot be NULL;
+ * @param context the (optional) context to pass on to the continuation.
+ * @return the next future, to be settled by the continuation, with a single
+ *         reference owned by the caller, or NULL in case of errors.
+ */
+ud_future_t *ud_future_then(ud_future_t *future, ud_future_fn_t fn, void *context);
+
+/**
+ * Combines futures into a future that is resolved once all of them are
+ * resolved, or rejected as soon as one of them is rejected.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param futures the futures to combine, cannot be NULL unless count is zero;
+ * @param count the number of futures to combine.
+ * @return the combined future, resolved with a NULL value or rejected with the
+ *         error of the first rejected future, with a single reference owned by
+ *         the caller, or NULL in case of errors.
+ */
+ud_future_t *ud_future_when_all(const ud_state_t *ud_state, ud_future_t *const *futures, size_t count);
+
+/**
+ * Combines futures into a future that is settled as soon as one of them is
+ * settled.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param futures the futures to combine, cannot be NULL;
+ * @param count the number of futures to combine, should be at least one.
+ * @return the combined future, settled like the first settled future, with a
+ *         single reference owned by the caller, or NULL in case of errors.
+ */
+ud_future_t *ud_future_when_any(const ud_state_t *ud_state, ud_future_t *const *futures, size_t count);
+
+/**
+ * Rejects a future with -ETIMEDOUT if it is not settled in time.
+ *
+ * @param future the future to time out, cannot be NULL;
+ * @param millis the time after which the future times out, in milliseconds.
+ * @return zero in case of success, -EALREADY if the future is already settled,
+ *         -ESRCH if its state is destroyed, -ENOSPC if no timer could be
+ *         scheduled, in which case the future does not time out at all, or
+ *         another negative errno value in case of errors.
+ */
+int ud_future_timeout(ud_future_t *future, uint32_t millis);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_FUTURE_H_ */
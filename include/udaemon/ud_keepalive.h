@@ -0,0 +1,130 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_KEEPALIVE_H_
+#define UD_KEEPALIVE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The default resolution (in milliseconds) of a keepalive manager.
+ */
+#define UD_KEEPALIVE_TICK 100
+
+/**
+ * Represents a keepalive manager, which detects idle connections.
+ *
+ * Connections are tracked by entries on a hashed timing wheel, which is
+ * driven by a single timer. Recording activity on a connection (see
+ * #ud_keepalive_touch) only updates a timestamp; entries are moved on the
+ * wheel lazily, once their original deadline passes. This makes it cheap to
+ * track thousands of connections, each with their own timeout.
+ */
+typedef struct ud_keepalive ud_keepalive_t;
+
+typedef struct ud_keepalive_entry ud_keepalive_entry_t;
+
+/**
+ * Called on the mainloop once a connection has been idle for its timeout.
+ *
+ * The entry is no longer tracked when this is called, so the callback should
+ * either close the connection, or send a heartbeat and re-add the entry (see
+ * #ud_keepalive_add), for example, with a shorter timeout for the reply.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param entry the entry of the idle connection, cannot be NULL;
+ * @param context the context of the entry.
+ */
+typedef void (*ud_keepalive_cb_t)(const ud_state_t *ud_state, ud_keepalive_entry_t *entry, void *context);
+
+/**
+ * Represents a tracked connection. Entries are intrusive: embed them in your
+ * own connection structure, so tracking does not need any allocations. Entries
+ * should be zero initialized before they are added for the first time, with
+ * their `eh_id` set explicitly, as 0 is a valid event handler identifier.
+ */
+struct ud_keepalive_entry {
+    /** the callback to call once the connection is idle, cannot be NULL. */
+    ud_keepalive_cb_t cb;
+    /** the (optional) context to pass on to the callback. */
+    void *context;
+    /**
+     * the (optional) event handler of the connection, whose dispatches count
+     * as activity (see #ud_last_activity), or #UD_INVALID_ID if there is none.
+     */
+    eh_id_t eh_id;
+
+    /** used internally to track the entry, should not be touched. */
+    uint32_t timeout;
+    uint64_t last_activity;
+    uint64_t deadline;
+    ud_keepalive_entry_t *prev;
+    ud_keepalive_entry_t *next;
+};
+
+/**
+ * Creates a new keepalive manager.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param tick the resolution of the timeouts in milliseconds, or 0 to use
+ *        #UD_KEEPALIVE_TICK.
+ * @return the keepalive manager, or NULL in case of errors.
+ */
+ud_keepalive_t *ud_keepalive_create(const ud_state_t *ud_state, uint16_t tick);
+
+/**
+ * Destroys a keepalive manager. The callbacks of entries that are still
+ * tracked are not called.
+ *
+ * @param keepalive the keepalive manager to destroy, may be NULL.
+ */
+void ud_keepalive_destroy(ud_keepalive_t *keepalive);
+
+/**
+ * Starts (or restarts) tracking a connection.
+ *
+ * @param keepalive the keepalive manager to use, cannot be NULL;
+ * @param entry the entry to track, cannot be NULL;
+ * @param timeout the time (in milliseconds) without activity after which the
+ *        connection is idle, should be greater than zero.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_keepalive_add(ud_keepalive_t *keepalive, ud_keepalive_entry_t *entry, uint32_t timeout);
+
+/**
+ * Stops tracking a connection, for example, when it is closed.
+ *
+ * @param keepalive the keepalive manager to use, cannot be NULL;
+ * @param entry the entry to remove, cannot be NULL.
+ */
+void ud_keepalive_remove(ud_keepalive_t *keepalive, ud_keepalive_entry_t *entry);
+
+/**
+ * Records activity on a tracked connection, in O(1).
+ *
+ * @param keepalive the keepalive manager to use, cannot be NULL;
+ * @param entry the entry of the connection, cannot be NULL.
+ */
+void ud_keepalive_touch(const ud_keepalive_t *keepalive, ud_keepalive_entry_t *entry);
+
+/**
+ * @param entry the entry to check, cannot be NULL.
+ * @return true if the entry is tracked, false otherwise.
+ */
+bool ud_keepalive_tracked(const ud_keepalive_entry_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_KEEPALIVE_H_ */
@@ -13,6 +13,10 @@
 #include <syslog.h>
 #include <time.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Represents the log levels we provide.
  */
@@ -39,6 +43,17 @@ void setup_logging(bool foreground);
  */
 void set_loglevel(loglevel_t loglevel);
 
+/**
+ * Sets the loglevel of a single module, overriding the loglevel set by
+ * #set_loglevel. A module is the name of the source file a message is logged
+ * from, without its directory and extension, for example, "ud_pool".
+ *
+ * @param module the name of the module, cannot be NULL;
+ * @param loglevel the minimum loglevel to log messages of the module at.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int set_module_loglevel(const char *module, loglevel_t loglevel);
+
 /**
  * Logs a message at the given level.
  *
@@ -47,32 +62,45 @@ void set_loglevel(loglevel_t loglevel);
  */
 void log_msg(const loglevel_t level, const char *msg, ...);
 
+/**
+ * Logs a message of a module at the given level, see #set_module_loglevel.
+ *
+ * @param level the level at which the message should be logged;
+ * @param file the source file the message is logged from;
+ * @param msg the message (printf-style) that should be logged.
+ */
+void log_msg_from(const loglevel_t level, const char *file, const char *msg, ...);
+
 /**
  * Logs a message on debug level.
  *
  * @param msg the log message; any message parameter can be added after the message.
  */
-#define log_debug(msg...) log_msg(DEBUG, msg)
+#define log_debug(msg...) log_msg_from(DEBUG, __FILE__, msg)
 
 /**
  * Logs a message on info level.
  *
  * @param msg the log message; any message parameter can be added after the message.
  */
-#define log_info(msg...) log_msg(INFO, msg)
+#define log_info(msg...) log_msg_from(INFO, __FILE__, msg)
 
 /**
  * Logs a message on warning level.
  *
  * @param msg the log message; any message parameter can be added after the message.
  */
-#define log_warning(msg...) log_msg(WARNING, msg)
+#define log_warning(msg...) log_msg_from(WARNING, __FILE__, msg)
 
 /**
  * Logs a message on error level.
  *
  * @param msg the log message; any message parameter can be added after the message.
  */
-#define log_error(msg...) log_msg(ERROR, msg)
+#define log_error(msg...) log_msg_from(ERROR, __FILE__, msg)
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif /* UD_LOGGING_H_ */
@@ -0,0 +1,177 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_POOL_H_
+#define UD_POOL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The interval (in milliseconds) at which a pool does its housekeeping, such
+ * as evicting idle connections and probing their health.
+ */
+#define UD_POOL_TICK 250
+
+/**
+ * Represents how a pool selects the endpoint to use.
+ */
+typedef enum ud_pool_select {
+    /** cycle through the endpoints. */
+    UD_POOL_ROUND_ROBIN = 0,
+    /** use the endpoint with the least connections in use. */
+    UD_POOL_LEAST_OUTSTANDING = 1,
+} ud_pool_select_t;
+
+/**
+ * Represents the configuration of a connection pool, all limits are per
+ * endpoint.
+ */
+typedef struct ud_pool_config {
+    /** the number of idle connections to keep open. */
+    uint8_t min_idle;
+    /** the maximum number of idle connections, defaults to max_conns. */
+    uint8_t max_idle;
+    /** the maximum number of connections, defaults to 4. */
+    uint8_t max_conns;
+    /** the time (in ms) after which idle connections above min_idle are closed, 0 to keep them. */
+    uint32_t idle_timeout;
+    /** the time (in ms) a connect may take, defaults to 5000. */
+    uint32_t connect_timeout;
+    /** the interval (in ms) at which idle connections are probed, 0 to disable probing. */
+    uint32_t probe_interval;
+    /** how to select the endpoint to use. */
+    ud_pool_select_t select;
+    /**
+     * The (optional) health probe for idle connections, returning zero if the
+     * connection is healthy. By default, a connection is considered healthy
+     * as long as the peer did not close it.
+     */
+    int (*probe)(int fd, void *context);
+    /** the context passed to the health probe. */
+    void *context;
+} ud_pool_config_t;
+
+/**
+ * Represents the statistics of a connection pool.
+ */
+typedef struct ud_pool_stats {
+    /** the number of acquisitions served by an idle connection right away. */
+    uint64_t hits;
+    /** the number of acquisitions that had to wait for a connection. */
+    uint64_t waits;
+    /** the number of successful and failed connects. */
+    uint64_t connects;
+    uint64_t connect_failures;
+    /** the total and maximum time (in µs) successful connects took. */
+    uint64_t connect_time_total;
+    uint64_t connect_time_max;
+    /** the number of idle connections closed because they timed out or failed their probe. */
+    uint64_t evictions;
+    uint64_t probe_failures;
+} ud_pool_stats_t;
+
+/**
+ * Represents a pool of connections towards one or more equivalent endpoints,
+ * such as replicas of an upstream service.
+ */
+typedef struct ud_pool ud_pool_t;
+
+/**
+ * Called on the mainloop once a connection is acquired.
+ *
+ * The callback is allowed to destroy the pool, in which case the remaining
+ * waiters are called with -ECANCELED before the pool is freed.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param fd the connected socket, or a negative errno value in case no
+ *        connection could be made. The socket should be returned to the pool
+ *        using #ud_pool_release;
+ * @param context the context passed to #ud_pool_acquire.
+ */
+typedef void (*ud_pool_cb_t)(const ud_state_t *ud_state, int fd, void *context);
+
+/**
+ * Creates a new connection pool.
+ *
+ * NOTE: connecting uses an event handler per connect in progress, so the
+ * number of concurrent connects is bounded by `ud_config_t.max_handlers`.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param config the configuration of the pool, cannot be NULL.
+ * @return the connection pool, or NULL in case of errors.
+ */
+ud_pool_t *ud_pool_create(const ud_state_t *ud_state, const ud_pool_config_t *config);
+
+/**
+ * Destroys a connection pool, closing all its idle connections and connects
+ * in progress.
+ *
+ * Acquisitions that are still waiting are called with -ECANCELED. Acquired
+ * connections are left open, and can no longer be released, so should be
+ * closed by the application instead.
+ *
+ * @param pool the pool to destroy, may be NULL.
+ */
+void ud_pool_destroy(ud_pool_t *pool);
+
+/**
+ * Adds an endpoint to a connection pool.
+ *
+ * @param pool the pool to add the endpoint to, cannot be NULL;
+ * @param addr the address of the endpoint, cannot be NULL;
+ * @param addrlen the length of the address.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_pool_add_endpoint(ud_pool_t *pool, const struct sockaddr *addr, socklen_t addrlen);
+
+/**
+ * Acquires a connection from a pool.
+ *
+ * If an idle connection is available, the callback is called right away.
+ * Otherwise, a new connection is made (if the limits allow it) or the request
+ * waits until a connection is released. The callback is called with an error
+ * if none of the endpoints can be connected to.
+ *
+ * @param pool the pool to acquire a connection from, cannot be NULL;
+ * @param cb the callback to call with the connection, cannot be NULL;
+ * @param context the (optional) context to pass on to the callback.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_pool_acquire(ud_pool_t *pool, ud_pool_cb_t cb, void *context);
+
+/**
+ * Returns an acquired connection to its pool.
+ *
+ * @param pool the pool to return the connection to, cannot be NULL;
+ * @param fd the connection to return;
+ * @param reuse true if the connection can be reused, false to close it, for
+ *        example, after an error.
+ * @return zero in case of success, -EINVAL if the connection is not acquired
+ *         from the given pool.
+ */
+int ud_pool_release(ud_pool_t *pool, int fd, bool reuse);
+
+/**
+ * Returns the statistics of a connection pool.
+ *
+ * @param pool the pool to get the statistics of, cannot be NULL;
+ * @param stats the statistics to fill, cannot be NULL.
+ */
+void ud_pool_get_stats(const ud_pool_t *pool, ud_pool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_POOL_H_ */
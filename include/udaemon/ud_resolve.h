@@ -0,0 +1,73 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_RESOLVE_H_
+#define UD_RESOLVE_H_
+
+#include <stdint.h>
+#include <netdb.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The time (in milliseconds) a successful resolution is cached.
+ */
+#define UD_RESOLVE_TTL 60000
+/**
+ * The time (in milliseconds) a failed resolution is cached.
+ */
+#define UD_RESOLVE_NEGATIVE_TTL 5000
+
+/**
+ * Called on the mainloop once a host name is resolved.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param error zero if the host name was resolved, or the `EAI_*` error code
+ *        returned by getaddrinfo(3) otherwise;
+ * @param result the resolved addresses, or NULL in case of errors. Only valid
+ *        during the call, so copy what is needed;
+ * @param context the context passed to #ud_resolve_async.
+ */
+typedef void (*ud_resolve_cb_t)(const ud_state_t *ud_state, int error, const struct addrinfo *result,
+                                void *context);
+
+/**
+ * Resolves a host name to stream socket addresses without blocking the
+ * mainloop.
+ *
+ * The actual resolution is done by getaddrinfo(3) on a helper thread, with the
+ * result being posted back to the mainloop (see #ud_post). Results are cached
+ * for #UD_RESOLVE_TTL milliseconds (or #UD_RESOLVE_NEGATIVE_TTL milliseconds
+ * for failures), as getaddrinfo does not expose the TTL of DNS records. Each
+ * state has a cache of its own, holding at most 64 results. Concurrent
+ * requests of a state for the same host and port share a single resolution.
+ *
+ * Callbacks are allowed to resolve other hosts: their result stays valid until
+ * they return, even if the cache is full.
+ *
+ * NOTE: if the result is cached, the callback is called right away. Callbacks
+ * of resolutions that are still in progress when the state is destroyed (see
+ * #ud_destroy) are never called.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param host the host name (or numeric address) to resolve, cannot be NULL;
+ * @param port the port to fill in the resolved addresses;
+ * @param cb the callback to call with the result, cannot be NULL;
+ * @param context the (optional) context to pass on to the callback.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_resolve_async(const ud_state_t *ud_state, const char *host, uint16_t port,
+                     ud_resolve_cb_t cb, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_RESOLVE_H_ */
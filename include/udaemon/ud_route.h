@@ -0,0 +1,88 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_ROUTE_H_
+#define UD_ROUTE_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Represents a routing table that maps hierarchical topics to sets of targets,
+ * such as sinks.
+ *
+ * Topics consist of levels separated by a slash, for example, `a/b/c`. Routes
+ * are added using topic filters, which are topics that can contain wildcards
+ * for entire levels:
+ *
+ * - `+` matches exactly one level, for example, `a/+/c` matches `a/b/c`, but
+ *   not `a/b/d/c`;
+ * - `#` matches any number of levels, including the parent level, and can only
+ *   be used as last level, for example, `a/#` matches `a`, `a/b` and `a/b/c`.
+ *
+ * Like in MQTT, topics starting with a `$` are not matched by filters that
+ * start with a wildcard.
+ *
+ * The routing table is intended to be built once, while parsing the
+ * configuration (see `ud_config_t.config_parser`), and is only read afterwards.
+ * The results of recent matches are cached, so matching the same topic over and
+ * over again is cheap. A routing table is not thread-safe.
+ */
+typedef struct ud_route_table ud_route_table_t;
+
+/**
+ * Creates a new, empty, routing table.
+ *
+ * @return the routing table, or NULL if out of memory.
+ */
+ud_route_table_t *ud_route_create(void);
+
+/**
+ * Destroys a routing table.
+ *
+ * NOTE: the targets of the routes are *not* destroyed.
+ *
+ * @param table the routing table to destroy, may be NULL.
+ */
+void ud_route_destroy(ud_route_table_t *table);
+
+/**
+ * Adds a route to a routing table.
+ *
+ * Adding the same route more than once has no effect. Adding a route
+ * invalidates the match cache of the routing table, in constant time.
+ *
+ * @param table the routing table to add the route to, cannot be NULL;
+ * @param filter the topic filter of the route, cannot be NULL;
+ * @param target the target to route matching topics to, cannot be NULL.
+ * @return zero in case of success, -EINVAL if the topic filter is invalid or
+ *         -ENOMEM if out of memory.
+ */
+int ud_route_add(ud_route_table_t *table, const char *filter, void *target);
+
+/**
+ * Determines the targets of all routes that match a given topic.
+ *
+ * Each target is returned only once, even if it is matched by multiple routes.
+ * The returned targets remain valid until the next call to #ud_route_match or
+ * #ud_route_add.
+ *
+ * @param table the routing table to match against, cannot be NULL;
+ * @param topic the topic to match, cannot be NULL and cannot contain wildcards;
+ * @param targets the pointer to the matching targets, cannot be NULL.
+ * @return the number of matching targets, or a negative errno value in case
+ *         of errors.
+ */
+int ud_route_match(ud_route_table_t *table, const char *topic, void *const **targets);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_ROUTE_H_ */
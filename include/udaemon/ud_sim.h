@@ -0,0 +1,78 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_SIM_H_
+#define UD_SIM_H_
+
+#include <stdint.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Represents a simulation, which runs the mainloop on a simulated clock and
+ * backend, for example, to test timer-heavy code.
+ *
+ * The simulated clock starts at zero and only advances when the mainloop has
+ * nothing else to do, in which case it skips right to the next task deadline.
+ * This way, a month of reconnect attempts runs in milliseconds, and always in
+ * the same order. No actual I/O is done: event handlers are only called for
+ * the events that are injected (see #ud_sim_inject), so they can be added for
+ * arbitrary file descriptors.
+ */
+typedef struct ud_sim ud_sim_t;
+
+/**
+ * Creates a new simulation, and installs its clock and backend in the given
+ * udaemon state. Should be called before the mainloop is started.
+ *
+ * NOTE: the mainloop never terminates by itself while simulated, use a task
+ * that calls #ud_terminate at the desired (simulated) time.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL.
+ * @return the simulation, or NULL in case of errors.
+ */
+ud_sim_t *ud_sim_create(const ud_state_t *ud_state);
+
+/**
+ * Destroys a simulation, and restores the clock and backend of its udaemon
+ * state. Should be called after the mainloop has terminated.
+ *
+ * @param sim the simulation to destroy, may be NULL.
+ */
+void ud_sim_destroy(ud_sim_t *sim);
+
+/**
+ * Advances the simulated clock, for example, to simulate an event handler that
+ * takes a while. Note that the time returned by #ud_now is only updated in
+ * the next iteration of the mainloop.
+ *
+ * @param sim the simulation to use, cannot be NULL;
+ * @param ms the number of milliseconds to advance the clock with.
+ */
+void ud_sim_advance(ud_sim_t *sim, uint64_t ms);
+
+/**
+ * Injects events for a file descriptor, which are delivered to its event
+ * handler in the next iteration of the mainloop, without advancing the clock.
+ * Events the event handler is not interested in are dropped, except for
+ * POLLERR, POLLHUP and POLLNVAL.
+ *
+ * @param sim the simulation to use, cannot be NULL;
+ * @param fd the file descriptor to inject the events for;
+ * @param revents the events to inject, such as POLLIN.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_sim_inject(ud_sim_t *sim, int fd, short revents);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_SIM_H_ */
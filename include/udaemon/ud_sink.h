@@ -0,0 +1,234 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_SINK_H_
+#define UD_SINK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "udaemon.h"
+#include "ud_spool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * The number of buckets in the histograms of a sink.
+ */
+#define UD_SINK_HIST_BUCKETS 16
+
+/**
+ * Represents a sink: a coalescing output stage towards a downstream server.
+ *
+ * Messages written to a sink are accumulated into batches. A batch is flushed
+ * with a single `writev`/`sendmsg` (stream sockets, pipes and files) or
+ * `sendmmsg` (datagram and sequenced-packet sockets, preserving the message
+ * boundaries) call whenever it reaches its maximum size, its maximum number of
+ * messages or its maximum delay, whichever comes first. When a flush would
+ * block, the remainder is written once the file descriptor becomes writable
+ * again. Batches that do not fit in a single call are written with MSG_MORE,
+ * so stream sockets only push out full frames until the last part.
+ *
+ * A sink that fails to write detaches itself. If the failure happens while
+ * flushing from the mainloop, it is reported to the error callback, or, if
+ * none is configured, returned by the next call to #ud_sink_write.
+ *
+ * Each sink has two output queues: control messages are written as soon as
+ * possible, while bulk messages are coalesced and can be rate limited using
+ * a token bucket. When both queues have pending messages, control messages
+ * take strict precedence, or are interleaved with bulk messages using a
+ * configurable weight. A throttled sink does not wait for POLLOUT, but
+ * schedules a timer for the moment enough tokens are available again.
+ *
+ * While the sink is not attached to a file descriptor (for example, because
+ * the downstream server is disconnected), bulk messages are written to the
+ * spool, if configured. Upon attaching, the spool is replayed before new bulk
+ * messages are sent again. Control messages are never spooled and are dropped
+ * when the sink is detached.
+ */
+typedef struct ud_sink ud_sink_t;
+
+/**
+ * Represents the priority of messages written to a sink.
+ */
+typedef enum ud_sink_prio {
+    /** control messages, such as heartbeats, that are written immediately. */
+    UD_SINK_PRIO_CONTROL = 0,
+    /** bulk messages that are coalesced and rate limited. */
+    UD_SINK_PRIO_BULK = 1,
+
+    UD_SINK_PRIO_MAX
+} ud_sink_prio_t;
+
+/**
+ * Called on the mainloop when a sink detaches itself due to a write error.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param sink the sink that failed, cannot be NULL;
+ * @param error the negative errno value of the failure;
+ * @param context the context from the sink configuration.
+ */
+typedef void (*ud_sink_error_cb_t)(const ud_state_t *ud_state, ud_sink_t *sink, int error, void *context);
+
+/**
+ * Represents the configuration of a sink.
+ */
+typedef struct ud_sink_config {
+    /** the number of buffered bytes after which a batch is flushed, > 0. */
+    size_t max_bytes;
+    /** the number of buffered messages after which a batch is flushed, > 0. */
+    uint16_t max_count;
+    /** the maximum time (in milliseconds) a message is buffered, 0 to flush on every write. */
+    uint16_t max_delay;
+    /** the (optional) spool to use while the sink is not attached, can be NULL. */
+    ud_spool_t *spool;
+    /** the maximum number of spooled messages to replay per second, > 0 if a spool is used. */
+    uint16_t replay_rate;
+    /** the sustained rate (in bytes per second) of bulk messages, 0 for no limit. */
+    uint32_t rate_limit;
+    /** the maximum burst (in bytes) of bulk messages, at least `max_bytes`. */
+    uint32_t rate_burst;
+    /** the number of control messages written for each bulk message, 0 for strict priority. */
+    uint16_t control_weight;
+    /** the (optional) callback for asynchronous write errors, can be NULL. */
+    ud_sink_error_cb_t on_error;
+    /** the (optional) context to pass on to the error callback. */
+    void *context;
+} ud_sink_config_t;
+
+/**
+ * Represents the statistics of a sink.
+ *
+ * The histograms use power-of-two buckets: bucket `i` counts the batches with
+ * a value in the range [2^i, 2^(i+1)), bucket 0 also counts the zero values
+ * and the last bucket counts all larger values.
+ */
+typedef struct ud_sink_stats {
+    /** the number of messages written. */
+    uint64_t messages;
+    /** the number of bytes written. */
+    uint64_t bytes;
+    /** the number of flushed batches. */
+    uint64_t batches;
+    /** the number of messages written to the spool. */
+    uint64_t spooled;
+    /** the number of messages dropped due to lack of buffer space or errors. */
+    uint64_t dropped;
+    /** the number of times the sink was throttled by its rate limit. */
+    uint64_t throttled;
+    /** the histogram of the number of messages per batch. */
+    uint64_t batch_size[UD_SINK_HIST_BUCKETS];
+    /** the histogram of the batch latency, in milliseconds, between queueing the first message and the flush. */
+    uint64_t batch_latency[UD_SINK_HIST_BUCKETS];
+} ud_sink_stats_t;
+
+/**
+ * Creates a new, unattached, sink.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param config the sink configuration, cannot be NULL.
+ * @return the sink, or NULL in case of errors.
+ */
+ud_sink_t *ud_sink_create(const ud_state_t *ud_state, const ud_sink_config_t *config);
+
+/**
+ * Destroys a sink, dropping any messages that are still buffered.
+ *
+ * NOTE: the file descriptor the sink is attached to is *not* closed, and the
+ * configured spool is *not* closed. A replay of the spool is only stopped if
+ * it replays to this sink, so a spool can be shared by multiple sinks.
+ *
+ * @param sink the sink to destroy, may be NULL.
+ */
+void ud_sink_destroy(ud_sink_t *sink);
+
+/**
+ * Attaches a sink to a (connected) file descriptor.
+ *
+ * The file descriptor is expected to be non-blocking. The type of socket is
+ * determined once and is used to select the way batches are written.
+ *
+ * @param sink the sink to attach, cannot be NULL;
+ * @param fd the file descriptor to write batches to.
+ * @return zero in case of success, a non-zero value in case of errors, in
+ *         which case the sink is left detached, for example, when the replay
+ *         of its spool cannot be scheduled.
+ */
+int ud_sink_attach(ud_sink_t *sink, int fd);
+
+/**
+ * Detaches a sink from its file descriptor.
+ *
+ * Messages that were not yet written are moved to the spool, if configured.
+ * NOTE: the file descriptor is *not* closed.
+ *
+ * @param sink the sink to detach, cannot be NULL.
+ */
+void ud_sink_detach(ud_sink_t *sink);
+
+/**
+ * Writes a bulk message to a sink.
+ *
+ * This is equivalent to calling #ud_sink_write_prio with `UD_SINK_PRIO_BULK`.
+ *
+ * The message is copied, so the caller retains ownership of the given data.
+ *
+ * @param sink the sink to write to, cannot be NULL;
+ * @param data the message data, cannot be NULL;
+ * @param len the length of the message, in bytes, <= `max_bytes`.
+ * @return zero in case of success, -ENOBUFS if the message could not be
+ *         buffered, -ENOSPC if it had to be spooled but the spool (or its
+ *         disk) is full, -EMSGSIZE if the message is too large or another
+ *         negative errno value in case of errors. The latter includes the
+ *         error of an earlier flush from the mainloop when no error callback
+ *         is configured, in which case this message is *not* written.
+ */
+int ud_sink_write(ud_sink_t *sink, const void *data, size_t len);
+
+/**
+ * Writes a message with a given priority to a sink.
+ *
+ * The message is copied, so the caller retains ownership of the given data.
+ *
+ * @param sink the sink to write to, cannot be NULL;
+ * @param prio the priority of the message;
+ * @param data the message data, cannot be NULL;
+ * @param len the length of the message, in bytes, <= `max_bytes`.
+ * @return zero in case of success, -ENOBUFS if the message could not be
+ *         buffered, -ENOSPC if it had to be spooled but the spool (or its
+ *         disk) is full, -EMSGSIZE if the message is too large or another
+ *         negative errno value in case of errors. The latter includes the
+ *         error of an earlier flush from the mainloop when no error callback
+ *         is configured, in which case this message is *not* written.
+ */
+int ud_sink_write_prio(ud_sink_t *sink, ud_sink_prio_t prio, const void *data, size_t len);
+
+/**
+ * Flushes all buffered messages of a sink.
+ *
+ * @param sink the sink to flush, cannot be NULL.
+ * @return zero in case of success (including the case where the remainder is
+ *         written later), a negative errno value in case of errors, including
+ *         the unreported error of an earlier flush from the mainloop.
+ */
+int ud_sink_flush(ud_sink_t *sink);
+
+/**
+ * Provides access to the statistics of a sink.
+ *
+ * @param sink the sink to get the statistics of, cannot be NULL.
+ * @return the statistics of the sink, cannot be NULL.
+ */
+const ud_sink_stats_t *ud_sink_get_stats(const ud_sink_t *sink);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_SINK_H_ */
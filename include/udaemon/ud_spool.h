@@ -0,0 +1,177 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_SPOOL_H_
+#define UD_SPOOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+
+#include "udaemon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Represents a persistent, disk-backed, store-and-forward spool.
+ *
+ * A spool is an append-only log that is split into fixed-size segments. Each
+ * segment is a memory-mapped file in the spool directory. Records are read
+ * back in the order they were appended, and the read position is checkpointed
+ * to disk, so the spool survives restarts of the daemon. Delivery is
+ * at-least-once: after a crash, records consumed since the last checkpoint
+ * will be replayed again.
+ *
+ * All blocks of a segment are allocated when it is created, so running out of
+ * disk space results in an error when appending, instead of a SIGBUS when the
+ * mapped segment is written to.
+ */
+typedef struct ud_spool ud_spool_t;
+
+/**
+ * Represents the configuration of a spool.
+ */
+typedef struct ud_spool_config {
+    /** the directory to store the spool segments in, cannot be NULL. */
+    const char *directory;
+    /** the size of a single segment in bytes, rounded up to the page size. */
+    size_t segment_size;
+    /** the maximum number of segments to keep on disk, 0 for no limit. */
+    uint16_t max_segments;
+    /** the number of appends or consumes after which data is synced to disk, 0 to sync on every call. */
+    uint16_t sync_batch;
+} ud_spool_config_t;
+
+/**
+ * Callback used to forward spooled records while replaying a spool.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param data the record data, cannot be NULL;
+ * @param len the length of the record data, in bytes;
+ * @param context the user-defined context, can be NULL.
+ * @return zero if the record was forwarded successfully, or a non-zero value
+ *         if the record could not be forwarded and should be retried later.
+ */
+typedef int (*ud_spool_writer_t)(const ud_state_t *ud_state, const void *data, size_t len, void *context);
+
+/**
+ * Opens a spool, recovering any records (and the read position) left behind
+ * in the spool directory.
+ *
+ * @param config the spool configuration, cannot be NULL.
+ * @return the spool, or NULL in case of errors (errno is set accordingly).
+ */
+ud_spool_t *ud_spool_open(const ud_spool_config_t *config);
+
+/**
+ * Closes a spool, stopping any active replay and synchronizing all
+ * outstanding data to disk.
+ *
+ * NOTE: after calling this method, the given `spool` must not be used anymore!
+ *
+ * @param spool the spool to close, may be NULL.
+ */
+void ud_spool_close(ud_spool_t *spool);
+
+/**
+ * Appends a record to the spool.
+ *
+ * @param spool the spool to append to, cannot be NULL;
+ * @param data the record data to append, cannot be NULL;
+ * @param len the length of the record, in bytes, > 0.
+ * @return zero in case of success, -ENOSPC if the spool is full (see
+ *         `max_segments`) or the disk is full, -EMSGSIZE if the record does
+ *         not fit in a single segment or another negative errno value in case
+ *         of errors.
+ */
+int ud_spool_append(ud_spool_t *spool, const void *data, size_t len);
+
+/**
+ * Returns the oldest record in the spool without consuming it.
+ *
+ * The returned pointer refers directly to the mapped segment and remains valid
+ * until the record is consumed or the spool is closed.
+ *
+ * @param spool the spool to read from, cannot be NULL;
+ * @param data the pointer to the record data, cannot be NULL.
+ * @return the length of the record, 0 if the spool is empty, or a negative
+ *         errno value in case of errors.
+ */
+ssize_t ud_spool_peek(ud_spool_t *spool, const void **data);
+
+/**
+ * Consumes the oldest record in the spool, advancing the read position.
+ *
+ * Segments that are completely consumed are recycled for new appends.
+ *
+ * @param spool the spool to consume from, cannot be NULL.
+ * @return zero in case of success, or a non-zero value in case of errors.
+ */
+int ud_spool_consume(ud_spool_t *spool);
+
+/**
+ * Synchronizes all appended data and the read checkpoint to disk.
+ *
+ * @param spool the spool to synchronize, cannot be NULL.
+ * @return zero in case of success, or a non-zero value in case of errors.
+ */
+int ud_spool_sync(ud_spool_t *spool);
+
+/**
+ * Tests whether the spool contains any unconsumed records.
+ *
+ * @param spool the spool to test, cannot be NULL.
+ * @return true if the spool is empty, false otherwise.
+ */
+bool ud_spool_empty(const ud_spool_t *spool);
+
+/**
+ * Schedules a task that drains the spool at a controlled rate.
+ *
+ * Every second, at most `rate` records are handed to the given writer. The
+ * task terminates itself once the spool is empty, or when the writer fails
+ * in which case it is retried at the next interval. Typically, this is called
+ * right after a downstream connection has been (re)established. Scheduling a
+ * replay while one is already active is a no-op.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param spool the spool to drain, cannot be NULL;
+ * @param rate the maximum number of records to forward per second, > 0;
+ * @param writer the callback to forward records with, cannot be NULL;
+ * @param context the (optional) context to pass on to the writer.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_spool_replay(const ud_state_t *ud_state, ud_spool_t *spool, uint16_t rate,
+                    ud_spool_writer_t writer, void *context);
+
+/**
+ * Stops an active replay of the spool, if any.
+ *
+ * @param spool the spool to stop replaying, cannot be NULL.
+ */
+void ud_spool_stop_replay(ud_spool_t *spool);
+
+/**
+ * Tests whether the spool is being replayed with the given writer and context,
+ * for example, to only stop a replay of a shared spool that is our own.
+ *
+ * @param spool the spool to test, cannot be NULL;
+ * @param writer the writer the replay was scheduled with;
+ * @param context the context the replay was scheduled with.
+ * @return true if the spool is being replayed with the given writer and
+ *         context, false otherwise.
+ */
+bool ud_spool_replaying(const ud_spool_t *spool, ud_spool_writer_t writer, const void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* UD_SPOOL_H_ */
@@ -7,8 +7,14 @@
 #ifndef UD_UTILS_H_
 #define UD_UTILS_H_
 
+#include <stddef.h>
+#include <stdint.h>
 #include <pwd.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef enum ud_daemon_result {
     err_none = 0,
 
@@ -70,4 +76,76 @@ int ud_parse_uid(const char *entry, uid_t *uid, gid_t *gid);
  */
 int daemonize(const char *pid_file, uid_t uid, gid_t gid);
 
+/**
+ * Enables busy polling on a given socket, if supported by the OS.
+ *
+ * This sets `SO_BUSY_POLL` and, when available, `SO_PREFER_BUSY_POLL`, which
+ * causes the kernel to poll the device queue of the socket for the given time
+ * instead of waiting for an interrupt. Note that increasing the busy poll time
+ * beyond the system default requires the `CAP_NET_ADMIN` capability.
+ *
+ * @param fd the socket to enable busy polling for;
+ * @param usec the time (in microseconds) to busy poll, 0 to disable.
+ * @return 0 if successful, or a negative errno value in case of failure
+ *         (-ENOTSUP if busy polling is not supported).
+ */
+int ud_set_busy_poll(int fd, uint32_t usec);
+
+/**
+ * Pins the calling thread to a given set of CPUs.
+ *
+ * @param cpus the set of CPUs to run on, bit N denotes CPU N, > 0.
+ * @return 0 if successful, or a negative errno value in case of failure.
+ */
+int ud_set_cpu_affinity(uint64_t cpus);
+
+/**
+ * Switches the calling thread to a real-time scheduling policy.
+ *
+ * @param policy the real-time scheduling policy to use, `SCHED_FIFO` or
+ *        `SCHED_RR`;
+ * @param priority the real-time priority to use, 1..99.
+ * @return 0 if successful, or a negative errno value in case of failure.
+ */
+int ud_set_rt_priority(int policy, uint8_t priority);
+
+/**
+ * Binds all future memory allocations of the calling thread to a given set
+ * of NUMA nodes, and migrates the pages of a given memory region to them.
+ *
+ * NOTE: the memory policy is per thread: threads created afterwards inherit
+ * it, but threads that already exist keep their own. The mainloop applies
+ * `ud_config_t.numa_nodes` on its own thread, when it starts.
+ *
+ * @param nodes the set of NUMA nodes to allocate from, bit N denotes node N, > 0;
+ * @param addr the (optional) start of the memory region to migrate, can be NULL;
+ * @param len the length of the memory region to migrate, in bytes.
+ * @return 0 if successful, or a negative errno value in case of failure
+ *         (-ENOSYS if NUMA is not supported).
+ */
+int ud_set_numa_nodes(uint64_t nodes, void *addr, size_t len);
+
+/**
+ * Locks all current and future memory of the calling process into RAM, and
+ * prefaults a given amount of stack and heap memory, so no page faults occur
+ * when this memory is used later on.
+ *
+ * NOTE: the prefaulted heap memory is retained by `malloc`, which means that
+ * heap memory is never returned to the OS after calling this function. To do
+ * so, heap prefaulting sets `M_TRIM_THRESHOLD` to -1 and `M_MMAP_MAX` to 0
+ * using `mallopt`, which applies to the *whole* process: from then on, even
+ * large allocations are served from the heap instead of being mapped (and
+ * unmapped) separately.
+ *
+ * @param stack the amount of stack (in bytes) to prefault, should be well
+ *        below the stack size limit;
+ * @param heap the amount of heap (in bytes) to prefault.
+ * @return 0 if successful, or a negative errno value in case of failure.
+ */
+int ud_lock_memory(size_t stack, size_t heap);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* UD_UTILS_H_ */
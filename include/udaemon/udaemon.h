@@ -8,6 +8,7 @@
 #define UDAEMON_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <poll.h>
 
@@ -15,6 +16,10 @@
 
 #include "ud_logging.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * Represents a simplification of the OS signals that might occur.
  */
@@ -31,8 +36,41 @@ typedef enum ud_signal {
 typedef enum ud_result {
     RES_OK = 0,
     RES_ERROR = 1,
+    RES_MORE = 2,
 } ud_result_t;
 
+/**
+ * Represents the backend used to wait for events.
+ */
+typedef enum ud_backend {
+    /** use epoll when available, and poll otherwise. */
+    UD_BACKEND_AUTO = 0,
+    /** always use poll. */
+    UD_BACKEND_POLL = 1,
+    /** use epoll, falls back to poll when not available. */
+    UD_BACKEND_EPOLL = 2,
+} ud_backend_t;
+
+/**
+ * Represents the real-time scheduling policy of the mainloop.
+ */
+typedef enum ud_rt_policy {
+    /** first-in, first-out (SCHED_FIFO). */
+    UD_RT_FIFO = 0,
+    /** round-robin (SCHED_RR). */
+    UD_RT_RR = 1,
+} ud_rt_policy_t;
+
+/**
+ * The default maximum number of event handlers, see `ud_config_t.max_handlers`.
+ */
+#define UD_DEFAULT_HANDLERS 64
+
+/**
+ * The default maximum number of scheduled tasks, see `ud_config_t.max_tasks`.
+ */
+#define UD_DEFAULT_TASKS 32
+
 /**
  * Represents the (private) state of udaemon.
  */
@@ -52,6 +90,36 @@ typedef struct ud_config {
     char *pid_file;
     /** the absolute path to the configuration file. */
     char *conf_file;
+    /** the backend to use for waiting on events. */
+    ud_backend_t backend;
+    /** the time (in microseconds) the mainloop keeps spinning after activity before blocking, 0 to always block. */
+    uint32_t busy_poll;
+    /** the set of CPUs (bit N denotes CPU N) to pin the mainloop to, 0 to not pin the mainloop. */
+    uint64_t cpu_affinity;
+    /** the real-time priority (1..99) to run the mainloop with, 0 to keep the default scheduling. */
+    uint8_t rt_priority;
+    /** the real-time scheduling policy to use when `rt_priority` is set. */
+    ud_rt_policy_t rt_policy;
+    /** the set of NUMA nodes (bit N denotes node N) the mainloop thread allocates memory from, 0 for the default policy. */
+    uint64_t numa_nodes;
+    /** true to lock all memory into RAM, avoiding page faults. */
+    bool lock_memory;
+    /** the amount of stack (in bytes) to prefault when `lock_memory` is set. */
+    size_t prefault_stack;
+    /**
+     * the amount of heap (in bytes) to prefault when `lock_memory` is set. Note
+     * that this disables trimming the heap and serving large allocations with
+     * `mmap` (using `mallopt(M_MMAP_MAX, 0)`) for the whole process.
+     */
+    size_t prefault_heap;
+    /** the (optional) file to record all events to, see #ud_record_start. */
+    char *record_file;
+    /** true to account the time used by event handlers and tasks, see #ud_dump_top. */
+    bool accounting;
+    /** the maximum number of event handlers (including the one of udaemon itself), 0 for #UD_DEFAULT_HANDLERS. */
+    uint32_t max_handlers;
+    /** the maximum number of scheduled tasks, 0 for #UD_DEFAULT_TASKS. */
+    uint32_t max_tasks;
 
     // Hooks and callbacks...
 
@@ -122,12 +190,23 @@ typedef struct ud_config {
  * ignored from reading. A solution for this is to return RES_ERROR from the
  * event handler after scheduling a task for reconnecting.
  *
+ * An event handler that processes its input in chunks (for example, one
+ * message per call) can return RES_MORE to indicate it has more work to do.
+ * It is then called again right away, until its event or byte budget (see
+ * #ud_set_event_handler_opts) is exhausted. In the latter case, it is called
+ * again in the next iteration of the main loop, even if no new events are
+ * available for it.
+ *
  * @param ud_state the udaemon state to use, cannot be NULL;
- * @param pollfd the polling information, such as file descriptor, cannot be NULL;
+ * @param pollfd the polling information, such as file descriptor, cannot be
+ *        NULL. It is a copy that is only valid during the call, changing it
+ *        has no effect: use #ud_modify_event_handler to change the events
+ *        polled for;
  * @param context the context registered with the event handler, can be NULL.
- * @return RES_OK upon ok, or RES_ERROR upon errors. In case of RES_ERROR,
- *         udaemon will close the file-descriptor effectively removing this
- *         event handler from being polled/called.
+ * @return RES_OK upon ok, RES_MORE if more work is pending, or RES_ERROR upon
+ *         errors. In case of RES_ERROR, udaemon removes the event handler and
+ *         closes its file-descriptor (see #ud_close_event_handler), so the
+ *         application should not close it as well.
  */
 typedef ud_result_t (*ud_event_handler_t)(const ud_state_t *ud_state, struct pollfd *pollfd, void *context);
 
@@ -146,12 +225,65 @@ typedef int (*ud_task_t)(const ud_state_t *ud_state, const uint16_t interval, vo
 /**
  * Denotes an identifier of event handlers.
  */
-typedef uint8_t eh_id_t;
+typedef uint32_t eh_id_t;
 
 /**
  * Denotes an invalid event handler ID.
  */
-#define UD_INVALID_ID (uint8_t)(-1)
+#define UD_INVALID_ID ((eh_id_t) -1)
+
+/**
+ * The size (in bytes) of the inline storage of event handlers and tasks.
+ */
+#define UD_INLINE_SIZE 48
+
+/**
+ * Callback used to release the inline storage of an event handler or task
+ * once it is removed.
+ *
+ * @param storage the inline storage to release, cannot be NULL.
+ */
+typedef void (*ud_release_t)(void *storage);
+
+/**
+ * Callback called right before udaemon closes the file descriptor of an event
+ * handler, either because it returned RES_ERROR or due to a call to
+ * #ud_close_event_handler. This allows the application to forget about the
+ * file descriptor and its event handler, without closing it twice.
+ *
+ * @param ud_state the current state of udaemon, cannot be NULL;
+ * @param fd the file descriptor that is about to be closed;
+ * @param context the context registered with the event handler, can be NULL.
+ */
+typedef void (*ud_close_hook_t)(const ud_state_t *ud_state, int fd, void *context);
+
+/**
+ * Flag to indicate an event handler is disarmed after it has been called once,
+ * until it is re-armed by #ud_resume_handler or #ud_modify_event_handler.
+ */
+#define UD_HANDLER_ONESHOT 0x01
+
+/**
+ * Flag to indicate an event handler is edge-triggered: it is only called when
+ * new events arrive, so it must process all available data (for example, by
+ * using #ud_drain_fd) or return RES_MORE. Only honoured by the epoll backend,
+ * the poll backend is always level-triggered.
+ */
+#define UD_HANDLER_EDGE 0x02
+
+/**
+ * Represents the dispatch options of an event handler.
+ */
+typedef struct ud_handler_opts {
+    /** the flags of the event handler, such as UD_HANDLER_ONESHOT. */
+    uint8_t flags;
+    /** the priority of the event handler; handlers with a higher priority are called first. */
+    uint8_t priority;
+    /** the maximum number of calls per loop iteration while RES_MORE is returned, 0 for 1. */
+    uint16_t max_events;
+    /** the maximum number of bytes to process per loop iteration, 0 for no limit. */
+    size_t max_bytes;
+} ud_handler_opts_t;
 
 /**
  * Returns the current version of udaemon, as string.
@@ -163,6 +295,9 @@ const char *ud_version(void);
 /**
  * Initializes a new udaemon state value.
  *
+ * The tables of event handlers and tasks are allocated once, with the sizes
+ * given in the configuration, so they never grow while the mainloop runs.
+ *
  * @param config the udaemon configuration to use.
  * @return a new udaemon state value, or NULL in case of out of memory.
  */
@@ -172,7 +307,8 @@ ud_state_t *ud_init(const ud_config_t *config);
  * Destroys a given udaemon state value.
  *
  * NOTE: after calling this method, the given `ud_state` value must not be
- * used anymore!
+ * used anymore! This includes other threads that post to it (see #ud_post),
+ * which can do so safely up until the state is destroyed.
  *
  * @param ud_state the udaemon state to use, may be NULL.
  */
@@ -252,15 +388,232 @@ int ud_add_event_handler(const ud_state_t *ud_state, const int fd, const short e
                          void *context,
                          eh_id_t *event_handler_id);
 
+/**
+ * Adds a new event handler whose context is stored inline in the event handler
+ * itself, avoiding a separate allocation for it.
+ *
+ * The context passed to the event handler callback is the inline storage of
+ * #UD_INLINE_SIZE bytes (suitably aligned for any type) that is returned in
+ * `storage`. The caller is expected to initialize it right after this call.
+ * Once the event handler is removed, or udaemon is destroyed, the given release
+ * callback is called to release the contents of the inline storage.
+ *
+ * An event handler is allowed to remove itself while it is running: the inline
+ * storage is only released once all ready event handlers are dispatched.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param fd the file descriptor to poll;
+ * @param emask the event mask to poll for;
+ * @param callback the event callback (see #ud_event_handler_t) to call once an
+ *                 event is available;
+ * @param release the (optional) callback to release the inline storage with;
+ * @param storage the pointer to the inline storage, cannot be NULL;
+ * @param event_handler_id (optional) the event handler identifier that is set
+ *                         when the registration succeeded.
+ * @return a non-zero value in case of errors, or zero in case of success.
+ */
+int ud_add_event_handler_inline(const ud_state_t *ud_state, const int fd, const short emask,
+                                const ud_event_handler_t callback,
+                                const ud_release_t release,
+                                void **storage,
+                                eh_id_t *event_handler_id);
+
 /**
  * Removes a previously registered event handler.
  *
+ * Event handlers can be removed from within other event handlers. The removed
+ * event handler is no longer called, but its identifier is only released after
+ * all ready event handlers are dispatched, so it is not reused by handlers
+ * that are added in the meantime.
+ *
  * @param ud_state the udaemon state to use, cannot be NULL;
  * @param event_handler_id the event handler identifier to remove.
  * @return zero in case of a successful removal, a non-zero value in case of errors.
  */
 int ud_remove_event_handler(const ud_state_t *ud_state, const eh_id_t event_handler_id);
 
+/**
+ * Removes a previously registered event handler and closes its file
+ * descriptor, calling its close hook (see #ud_set_close_hook) first.
+ *
+ * When called from within an event handler, both are deferred until all ready
+ * event handlers are dispatched, which makes it cheap to drop many connections
+ * at once.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param event_handler_id the event handler identifier to close.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_close_event_handler(const ud_state_t *ud_state, const eh_id_t event_handler_id);
+
+/**
+ * Sets the hook that is called right before udaemon closes the file
+ * descriptor of an event handler.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param event_handler_id the event handler identifier to set the hook for;
+ * @param on_close the hook to call, or NULL to remove it.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_set_close_hook(const ud_state_t *ud_state, const eh_id_t event_handler_id, ud_close_hook_t on_close);
+
+/**
+ * Changes the event mask of a registered event handler, without changing its
+ * identifier. A paused or disarmed (one-shot) event handler is resumed.
+ *
+ * Changes to the interest of event handlers are collected and applied once,
+ * right before udaemon waits for new events, so toggling the event mask many
+ * times in a single iteration of the main loop is cheap.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param event_handler_id the event handler identifier to modify;
+ * @param emask the new event mask to poll for.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_modify_event_handler(const ud_state_t *ud_state, const eh_id_t event_handler_id, const short emask);
+
+/**
+ * Pauses a registered event handler: it is not called until it is resumed,
+ * not even for error or hang-up conditions.
+ *
+ * A paused event handler stays registered with the backend, so pausing and
+ * resuming it is as cheap as modifying its event mask.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param event_handler_id the event handler identifier to pause.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_pause_handler(const ud_state_t *ud_state, const eh_id_t event_handler_id);
+
+/**
+ * Resumes a paused, or re-arms a one-shot, event handler.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param event_handler_id the event handler identifier to resume.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_resume_handler(const ud_state_t *ud_state, const eh_id_t event_handler_id);
+
+/**
+ * Sets the dispatch options of a registered event handler.
+ *
+ * Event handlers that are ready at the same time are called in order of their
+ * priority. Handlers with equal priorities are called round-robin, so no
+ * handler is always called first.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param event_handler_id the event handler identifier to set the options for;
+ * @param opts the options to set, cannot be NULL.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_set_event_handler_opts(const ud_state_t *ud_state, const eh_id_t event_handler_id,
+                              const ud_handler_opts_t *opts);
+
+/**
+ * Returns the time at which an event handler was last dispatched, or added if
+ * it has not been dispatched yet. This can be used to detect idle connections,
+ * see also `ud_keepalive.h`.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param event_handler_id the event handler identifier to get the last activity of.
+ * @return the monotonic time (see #ud_now) of the last activity, in
+ *         milliseconds, or zero if the event handler does not exist.
+ */
+uint64_t ud_last_activity(const ud_state_t *ud_state, const eh_id_t event_handler_id);
+
+/**
+ * Represents the resources used by an event handler or task, which are only
+ * accounted when `ud_config_t.accounting` is set.
+ *
+ * Accounting reads two clocks after every event handler and task that is
+ * called, which adds well under a microsecond per call.
+ */
+typedef struct ud_usage {
+    /** the number of times the event handler or task is called. */
+    uint64_t calls;
+    /** the cumulative wall-clock time (in microseconds) spent in calls. */
+    uint64_t wall_time;
+    /** the cumulative CPU time (in microseconds) of the mainloop spent in calls. */
+    uint64_t cpu_time;
+    /** the number of bytes read in calls, using #ud_read (or #ud_drain_fd). */
+    uint64_t bytes;
+} ud_usage_t;
+
+/**
+ * Returns the resources used by an event handler since it was added.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param event_handler_id the event handler identifier to get the usage of;
+ * @param usage the usage to fill, cannot be NULL.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_get_handler_usage(const ud_state_t *ud_state, const eh_id_t event_handler_id, ud_usage_t *usage);
+
+/**
+ * Returns the resources used by a task since it was scheduled.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param task the task to get the usage of, cannot be NULL;
+ * @param context the context of the task, as it was scheduled with;
+ * @param usage the usage to fill, cannot be NULL. If the task is scheduled
+ *        multiple times, the usage of all of them is summed.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_get_task_usage(const ud_state_t *ud_state, const ud_task_t task, void *context, ud_usage_t *usage);
+
+/**
+ * Formats a "top" report of the resources used by all event handlers and
+ * tasks, sorted by their CPU time, with one line per event handler or task.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param buf the buffer to format the report into, can only be NULL if size
+ *        is zero;
+ * @param size the size of the buffer.
+ * @return the length of the (complete) report, like snprintf(3), or a
+ *         negative errno value in case of errors.
+ */
+int ud_format_top(const ud_state_t *ud_state, char *buf, size_t size);
+
+/**
+ * Formats the tables of all event handlers and tasks, with their current
+ * state, for example, for diagnostic purposes.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param buf the buffer to format the tables into, can only be NULL if size
+ *        is zero;
+ * @param size the size of the buffer.
+ * @return the length of the (complete) tables, like snprintf(3), or a
+ *         negative errno value in case of errors.
+ */
+int ud_format_tables(const ud_state_t *ud_state, char *buf, size_t size);
+
+/**
+ * Logs the "top" report (see #ud_format_top). When accounting is enabled,
+ * this is also done upon receiving SIGQUIT.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL.
+ */
+void ud_dump_top(const ud_state_t *ud_state);
+
+/**
+ * Returns the remaining byte budget of the event handler that is currently
+ * being called. Event handlers should not process more than this number of
+ * bytes, and return RES_MORE if they have more data available.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL.
+ * @return the remaining byte budget, SIZE_MAX if no budget is set.
+ */
+size_t ud_dispatch_budget(const ud_state_t *ud_state);
+
+/**
+ * Subtracts the given number of processed bytes from the byte budget of the
+ * event handler that is currently being called.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param bytes the number of bytes processed.
+ */
+void ud_dispatch_consume(const ud_state_t *ud_state, size_t bytes);
+
 /**
  * Schedules a given task to be executed after a given interval.
  *
@@ -278,6 +631,246 @@ int ud_remove_event_handler(const ud_state_t *ud_state, const eh_id_t event_hand
 int ud_schedule_task(const ud_state_t *ud_state, const uint16_t interval,
                      const ud_task_t task, void *context);
 
+/**
+ * Schedules a given task to be executed after a given interval in
+ * milliseconds.
+ *
+ * This behaves exactly like #ud_schedule_task, except that both the given
+ * interval and the value returned by the task to reschedule itself are
+ * expressed in milliseconds instead of seconds.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param interval the interval in milliseconds to schedule the task in;
+ * @param task the task (see #ud_task_t) to schedule;
+ * @param context the (optional) context to pass on to the task.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_schedule_timer(const ud_state_t *ud_state, const uint16_t interval,
+                      const ud_task_t task, void *context);
+
+/**
+ * Cancels all scheduled tasks matching the given task and context.
+ *
+ * A task is allowed to cancel itself while it is running: it is cleaned up
+ * (and its inline storage released) once it returns, regardless of the
+ * interval it returns.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param task the task (see #ud_task_t) to cancel;
+ * @param context the context the task was scheduled with.
+ * @return the number of cancelled tasks, or a negative value in case of errors.
+ */
+int ud_cancel_task(const ud_state_t *ud_state, const ud_task_t task, void *context);
+
+/**
+ * Schedules a given task whose context is stored inline in the task itself,
+ * avoiding a separate allocation for it.
+ *
+ * The context passed to the task is the inline storage of #UD_INLINE_SIZE
+ * bytes (suitably aligned for any type) that is returned in `storage`. The
+ * caller is expected to initialize it right after this call. Once the task
+ * terminates, is cancelled, or udaemon is destroyed, the given release
+ * callback is called to release the contents of the inline storage. The task
+ * can be cancelled using #ud_cancel_task with the inline storage as context.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param interval the interval to schedule the task in;
+ * @param millis true if the interval (and the rescheduling interval returned
+ *               by the task) is expressed in milliseconds, false for seconds;
+ * @param task the task (see #ud_task_t) to schedule;
+ * @param release the (optional) callback to release the inline storage with;
+ * @param storage the pointer to the inline storage, cannot be NULL.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+int ud_schedule_inline(const ud_state_t *ud_state, const uint16_t interval, const bool millis,
+                       const ud_task_t task, const ud_release_t release, void **storage);
+
+/**
+ * Returns the current time of the monotonic clock used by udaemon.
+ *
+ * While the main loop is running, this returns the (cached) time at which the
+ * current loop iteration started, making it cheap to call from event handlers
+ * and tasks.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL.
+ * @return the current monotonic time, in milliseconds.
+ */
+uint64_t ud_now(const ud_state_t *ud_state);
+
+/**
+ * Represents the clock used by udaemon, for example, to run the mainloop on a
+ * simulated time (see `ud_sim.h`).
+ */
+typedef struct ud_clock {
+    /**
+     * Returns the current time, in milliseconds. The time should never go
+     * backwards.
+     *
+     * @param context the context of the clock.
+     * @return the current time, in milliseconds.
+     */
+    uint64_t (*now)(void *context);
+    /** the (optional) context to pass on to the clock. */
+    void *context;
+} ud_clock_t;
+
+/**
+ * Represents a backend used to wait for events, for example, to run the
+ * mainloop without any actual I/O (see `ud_sim.h`).
+ */
+typedef struct ud_backend_ops {
+    /**
+     * Waits for events on the given file descriptors, like poll(2).
+     *
+     * Unlike the builtin backends, the timeout is not capped, but is the
+     * actual time until the next task deadline, so a backend can skip ahead.
+     *
+     * @param ud_state the current state of udaemon, cannot be NULL;
+     * @param pollfds the file descriptors to wait for, with a negative file
+     *        descriptor for event handlers that are paused. The `revents` of
+     *        all entries should be set;
+     * @param count the number of file descriptors;
+     * @param timeout the maximum time (in milliseconds) to wait;
+     * @param context the context of the backend.
+     * @return the number of file descriptors with events, zero in case of a
+     *         timeout, or -1 in case of errors, in which case errno is set.
+     */
+    int (*wait)(const ud_state_t *ud_state, struct pollfd *pollfds, int count, int timeout, void *context);
+    /** the (optional) context to pass on to the backend. */
+    void *context;
+} ud_backend_ops_t;
+
+/**
+ * Replaces the clock of udaemon, which can only be done while the mainloop is
+ * not running. All times, such as returned by #ud_now and the deadlines of
+ * tasks, are taken from this clock.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param clock the clock to use, or NULL to use the monotonic clock of the OS.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_set_clock(const ud_state_t *ud_state, const ud_clock_t *clock);
+
+/**
+ * Replaces the backend of udaemon, which can only be done while the mainloop
+ * is not running. This takes precedence over `ud_config_t.backend`.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param ops the backend to use, or NULL to use the configured backend.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_set_backend_ops(const ud_state_t *ud_state, const ud_backend_ops_t *ops);
+
+/**
+ * Raises a signal, as if the corresponding OS signal is received. For
+ * example, raising SIG_HUP reloads the configuration and calls the signal
+ * handler of the application. Like #ud_post, this function can be called from
+ * any thread.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param signal the signal to raise.
+ * @return zero in case of success, a negative errno value in case of errors,
+ *         such as -ESRCH if the mainloop is not running.
+ */
+int ud_raise_signal(const ud_state_t *ud_state, ud_signal_t signal);
+
+/**
+ * Represents a function posted to the mainloop, see #ud_post.
+ *
+ * Posts are intrusive: embed this structure in your own (for example, using
+ * `offsetof` to get back to the containing structure), so posting does not
+ * need any allocations.
+ */
+typedef struct ud_post {
+    /** the function to call on the mainloop, cannot be NULL. */
+    void (*fn)(const ud_state_t *ud_state, struct ud_post *post);
+    /** used internally to queue the post, should not be touched. */
+    struct ud_post *next;
+} ud_post_t;
+
+/**
+ * Posts a function to run on the mainloop.
+ *
+ * Unlike all other functions of udaemon, this function can be called from any
+ * thread. Posted functions are called in the order in which they are posted,
+ * at the start of the next iteration of the mainloop. The post should remain
+ * valid until its function is called. Posts that are still queued when the
+ * mainloop terminates are never called.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param post the post to queue, cannot be NULL and its function cannot be NULL.
+ * @return zero in case of success, a non-zero value in case of errors.
+ */
+#if defined(__cplusplus) && defined(__GNUC__)
+// in C++, the function hides the (implicit) constructor of struct ud_post...
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wshadow"
+#endif
+int ud_post(const ud_state_t *ud_state, ud_post_t *post);
+#if defined(__cplusplus) && defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+/**
+ * Reads from the file descriptor of an event handler, like read(2).
+ *
+ * Event handlers should use this function (or #ud_drain_fd) to read their
+ * input, so it becomes part of an event recording and can be replayed (see
+ * #ud_record_start and #ud_replay). Reads from file descriptors without an
+ * event handler are never recorded.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param fd the file descriptor to read from;
+ * @param buf the buffer to read into, cannot be NULL;
+ * @param count the maximum number of bytes to read.
+ * @return the number of bytes read, zero on EOF, or -1 in case of errors, in
+ *         which case errno is set.
+ */
+ssize_t ud_read(const ud_state_t *ud_state, int fd, void *buf, size_t count);
+
+/**
+ * Starts recording all events of the mainloop to a file.
+ *
+ * The recording contains the events of all event handlers, the data they read
+ * (see #ud_read), the times at which tasks ran and the received signals, in a
+ * compact binary format. Recordings can be replayed using #ud_replay, for
+ * example, to benchmark changes to event handlers against actual traffic.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param path the path of the file to write the recording to, cannot be NULL.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_record_start(const ud_state_t *ud_state, const char *path);
+
+/**
+ * Stops the recording of events, if any. Called automatically when the main
+ * loop terminates.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_record_stop(const ud_state_t *ud_state);
+
+/**
+ * Runs the main loop of udaemon, replaying a recording made with
+ * #ud_record_start instead of waiting for actual events.
+ *
+ * The configured event handlers and tasks are called as they were during the
+ * recording, but as fast as possible: the time (see #ud_now) is taken from the
+ * recording. Event handlers are identified by their identifier, so the
+ * application should add its event handlers in the same order as it did while
+ * recording; their file descriptors are never polled, and #ud_read returns
+ * the recorded data instead. Posted functions are not recorded, nor replayed.
+ *
+ * A replay always runs in the foreground, without applying any of the runtime
+ * options, and returns once the end of the recording is reached.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param path the path of the recording to replay, cannot be NULL.
+ * @return zero in case of success, a negative errno value in case of errors.
+ */
+int ud_replay(ud_state_t *ud_state, const char *path);
+
 /**
  * Runs the main loop of udaemon.
  *
@@ -289,6 +882,9 @@ int ud_schedule_task(const ud_state_t *ud_state, const uint16_t interval,
  * This method will return if the main loop is terminated by either a SIGINT or
  * SIGTERM, or by programmatically calling `ud_terminate`.
  *
+ * Each state has a mainloop of its own, and these can run on different
+ * threads. OS signals are delivered to the mainloop that was started last.
+ *
  * @param ud_state the udaemon state to use, cannot be NULL;
  * @return non-zero in case of errors, zero if successful.
  */
@@ -305,4 +901,8 @@ int ud_main_loop(ud_state_t *ud_state);
  */
 int ud_terminate(const ud_state_t *ud_state);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* UDAEMON_H_ */
@@ -0,0 +1,241 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UDAEMON_HPP_
+#define UDAEMON_HPP_
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "udaemon.h"
+
+/**
+ * Provides a thin, header-only, C++17 layer on top of udaemon.
+ *
+ * Callables (such as lambdas) registered as event handler or task are stored
+ * inline in the event handler or task itself (see #UD_INLINE_SIZE), so no
+ * allocations are needed. As the type of the callable is known at compile
+ * time, calling it is a direct (and usually inlined) call from a trampoline
+ * function, instead of the additional indirection of `std::function`.
+ *
+ * NOTE: exceptions must not escape from callables, as they cannot propagate
+ * through the mainloop of udaemon. Doing so terminates the application.
+ */
+namespace udaemon {
+
+namespace detail {
+
+template <typename Fn>
+constexpr void check_inline() noexcept {
+    static_assert(sizeof(Fn) <= UD_INLINE_SIZE,
+                  "callable is too large for the inline storage, capture less state or capture it by reference");
+    static_assert(alignof(Fn) <= alignof(std::max_align_t),
+                  "callable is over-aligned for the inline storage");
+    static_assert(std::is_nothrow_move_constructible_v<Fn>,
+                  "callable should be nothrow move constructible");
+}
+
+template <typename Fn>
+void release(void *storage) noexcept {
+    static_cast<Fn *>(storage)->~Fn();
+}
+
+template <typename Fn>
+ud_result_t handler_trampoline(const ud_state_t *, struct pollfd *pollfd, void *context) noexcept {
+    Fn &fn = *static_cast<Fn *>(context);
+    if constexpr (std::is_void_v<std::invoke_result_t<Fn &, struct pollfd &>>) {
+        fn(*pollfd);
+        return RES_OK;
+    } else {
+        return fn(*pollfd);
+    }
+}
+
+template <typename Fn>
+int task_trampoline(const ud_state_t *, uint16_t, void *context) noexcept {
+    Fn &fn = *static_cast<Fn *>(context);
+    if constexpr (std::is_void_v<std::invoke_result_t<Fn &>>) {
+        fn();
+        return 0;
+    } else {
+        return static_cast<int>(fn());
+    }
+}
+
+} // namespace detail
+
+/**
+ * Owns the state of udaemon, and provides typed access to it.
+ */
+class Daemon {
+public:
+    /**
+     * Creates a new daemon for a given configuration.
+     *
+     * @param config the configuration to use, should outlive this daemon.
+     * @throws std::bad_alloc in case the state could not be allocated.
+     */
+    explicit Daemon(const ud_config_t &config) : state_(ud_init(&config)) {
+        if (!state_) {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~Daemon() {
+        ud_destroy(state_);
+    }
+
+    Daemon(const Daemon &) = delete;
+    Daemon &operator=(const Daemon &) = delete;
+
+    Daemon(Daemon &&other) noexcept : state_(std::exchange(other.state_, nullptr)) {
+    }
+
+    Daemon &operator=(Daemon &&other) noexcept {
+        if (this != &other) {
+            ud_destroy(state_);
+            state_ = std::exchange(other.state_, nullptr);
+        }
+        return *this;
+    }
+
+    /**
+     * @return the underlying state of udaemon, for use with the C API.
+     */
+    ud_state_t *get() const noexcept {
+        return state_;
+    }
+
+    /**
+     * Runs the mainloop of udaemon, see #ud_main_loop.
+     */
+    int run() noexcept {
+        return ud_main_loop(state_);
+    }
+
+    /**
+     * Terminates the mainloop of udaemon, see #ud_terminate.
+     */
+    void terminate() noexcept {
+        ud_terminate(state_);
+    }
+
+    /**
+     * Adds an event handler for a given file descriptor.
+     *
+     * The callable is called with a `struct pollfd &` and returns either a
+     * `ud_result_t` or nothing (which is the same as returning `RES_OK`).
+     *
+     * The event handler is allowed to remove itself while it is running, the
+     * callable is only destroyed once all ready event handlers are dispatched.
+     *
+     * @param fd the file descriptor to poll;
+     * @param emask the event mask to poll for;
+     * @param fn the callable to call once an event is available;
+     * @param id (optional) the event handler identifier that is set when the
+     *           registration succeeded.
+     * @return zero in case of success, a non-zero value in case of errors.
+     */
+    template <typename F>
+    int add_handler(int fd, short emask, F &&fn, eh_id_t *id = nullptr) {
+        using Fn = std::decay_t<F>;
+        detail::check_inline<Fn>();
+
+        // construct it up front, so a throwing copy does not leave a half-registered handler...
+        Fn tmp(std::forward<F>(fn));
+
+        void *storage;
+        int retval = ud_add_event_handler_inline(state_, fd, emask, &detail::handler_trampoline<Fn>,
+                                                 &detail::release<Fn>, &storage, id);
+        if (retval == 0) {
+            ::new (storage) Fn(std::move(tmp));
+        }
+        return retval;
+    }
+
+    /**
+     * Removes an event handler, destroying its callable.
+     *
+     * @param id the identifier of the event handler to remove.
+     * @return zero in case of success, a non-zero value in case of errors.
+     */
+    int remove_handler(eh_id_t id) noexcept {
+        return ud_remove_event_handler(state_, id);
+    }
+
+    /**
+     * Schedules a callable to run after a given number of milliseconds.
+     *
+     * The callable takes no arguments and returns either nothing, which makes
+     * it run once, or an integer denoting the number of milliseconds after
+     * which it should run again, or zero to stop running.
+     *
+     * @param interval the interval to run the callable after, at most 65535 ms;
+     * @param fn the callable to run.
+     * @return zero in case of success, -EINVAL if the interval is out of range,
+     *         or another non-zero value in case of errors.
+     */
+    template <typename F>
+    int schedule(std::chrono::milliseconds interval, F &&fn) {
+        if (!in_range(interval.count())) {
+            return -EINVAL;
+        }
+        return schedule_inline(static_cast<uint16_t>(interval.count()), true, std::forward<F>(fn));
+    }
+
+    /**
+     * Schedules a callable to run after a given number of seconds.
+     *
+     * This behaves like the millisecond variant, except that the interval
+     * returned by the callable is expressed in seconds as well.
+     *
+     * @param interval the interval to run the callable after, at most 65535 s;
+     * @param fn the callable to run.
+     * @return zero in case of success, -EINVAL if the interval is out of range,
+     *         or another non-zero value in case of errors.
+     */
+    template <typename F>
+    int schedule(std::chrono::seconds interval, F &&fn) {
+        if (!in_range(interval.count())) {
+            return -EINVAL;
+        }
+        return schedule_inline(static_cast<uint16_t>(interval.count()), false, std::forward<F>(fn));
+    }
+
+private:
+    template <typename Rep>
+    static constexpr bool in_range(Rep count) noexcept {
+        // the intervals of tasks are 16-bit, so do not let larger ones wrap around...
+        return count >= 0 && count <= UINT16_MAX;
+    }
+
+    template <typename F>
+    int schedule_inline(uint16_t interval, bool millis, F &&fn) {
+        using Fn = std::decay_t<F>;
+        detail::check_inline<Fn>();
+
+        Fn tmp(std::forward<F>(fn));
+
+        void *storage;
+        int retval = ud_schedule_inline(state_, interval, millis, &detail::task_trampoline<Fn>,
+                                        &detail::release<Fn>, &storage);
+        if (retval == 0) {
+            ::new (storage) Fn(std::move(tmp));
+        }
+        return retval;
+    }
+
+    ud_state_t *state_;
+};
+
+} // namespace udaemon
+
+#endif /* UDAEMON_HPP_ */
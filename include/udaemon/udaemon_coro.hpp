@@ -0,0 +1,815 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UDAEMON_CORO_HPP_
+#define UDAEMON_CORO_HPP_
+
+#if __cplusplus < 202002L
+#error "udaemon_coro.hpp requires C++20"
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <new>
+#include <queue>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+
+#include "udaemon.h"
+
+/**
+ * Provides header-only C++20 coroutine support on top of the mainloop of
+ * udaemon.
+ *
+ * A coroutine returning #udaemon::Task starts running right away, and runs
+ * until it awaits one of the awaitables of a #udaemon::Loop, such as
+ * `co_await loop.readable(fd)` or `co_await loop.sleep(100ms)`. It is resumed
+ * from the mainloop once the awaited event occurs. For example:
+ *
+ * ```cpp
+ * udaemon::Task relay(udaemon::Loop &loop, int fd) {
+ *     for (;;) {
+ *         short revents = co_await loop.readable(fd);
+ *         // read from fd...
+ *     }
+ * }
+ * ```
+ *
+ * Coroutine frames are allocated from a pool owned by the loop that is passed
+ * as argument to the coroutine (as in the example above). Coroutines without a
+ * loop argument use the global allocator. Sleeping coroutines cost nothing more
+ * than their frame and a heap entry, as they share a single task of udaemon.
+ * Each file descriptor that is awaited is registered once as event handler,
+ * which is paused while no coroutine waits for it, so the number of distinct
+ * file descriptors that can be awaited is bounded by
+ * `ud_config_t.max_handlers`. Call #udaemon::Loop::forget before closing such
+ * a file descriptor.
+ *
+ * NOTE: GCC 12.2 miscompiles a `co_await` in the condition of an `if` or
+ * `while` statement, crashing the coroutine once it is resumed. Store the
+ * result of the `co_await` in a variable first.
+ *
+ * NOTE: all of this is single-threaded, and should only be used from the thread
+ * running the mainloop, except for #udaemon::Completion::complete. Destroying a
+ * loop destroys all coroutines that are still waiting on it.
+ */
+namespace udaemon {
+
+class Loop;
+
+namespace detail {
+
+/**
+ * Pools coroutine frames in size classes of 64 bytes, up to 1 KiB. Larger
+ * frames are allocated directly.
+ */
+class FramePool {
+public:
+    FramePool() = default;
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    ~FramePool() {
+        for (Header *&head : free_) {
+            while (head) {
+                Header *next = head->next;
+                std::free(head);
+                head = next;
+            }
+        }
+    }
+
+    static void *allocate(std::size_t size, FramePool *pool) {
+        std::size_t cls = size_class(size);
+        Header *hdr = nullptr;
+
+        if (pool && cls < classes && pool->free_[cls]) {
+            hdr = pool->free_[cls];
+            pool->free_[cls] = hdr->next;
+        } else {
+            hdr = static_cast<Header *>(std::malloc((pool && cls < classes) ? (cls + 1) * granularity : sizeof(Header) + size));
+            if (!hdr) {
+                throw std::bad_alloc();
+            }
+        }
+
+        hdr->pool = (cls < classes) ? pool : nullptr;
+        return hdr + 1;
+    }
+
+    static void deallocate(void *ptr, std::size_t size) noexcept {
+        Header *hdr = static_cast<Header *>(ptr) - 1;
+        FramePool *pool = hdr->pool;
+
+        if (pool) {
+            std::size_t cls = size_class(size);
+            hdr->next = pool->free_[cls];
+            pool->free_[cls] = hdr;
+        } else {
+            std::free(hdr);
+        }
+    }
+
+private:
+    static constexpr std::size_t granularity = 64;
+    static constexpr std::size_t classes = 16;
+
+    union alignas(std::max_align_t) Header {
+        /** the pool that owns this frame while it is in use. */
+        FramePool *pool;
+        /** the next free frame while it is pooled. */
+        Header *next;
+    };
+
+    static constexpr std::size_t size_class(std::size_t size) noexcept {
+        return (size + sizeof(Header) + granularity - 1) / granularity - 1;
+    }
+
+    Header *free_[classes] = {};
+};
+
+/**
+ * Represents a coroutine waiting for an event of a loop.
+ */
+struct Waiter {
+    Waiter *prev = nullptr;
+    Waiter *next = nullptr;
+    std::coroutine_handle<> handle;
+
+    bool linked() const noexcept {
+        return prev != nullptr;
+    }
+};
+
+/**
+ * Represents the registration of a file descriptor that is awaited by one or
+ * more coroutines. It is kept while no coroutine is waiting, so awaiting the
+ * same file descriptor again only changes the interest of its event handler.
+ */
+struct FdWatch {
+    Loop *loop = nullptr;
+    eh_id_t id = UD_INVALID_ID;
+    /** the events the event handler polls for, 0 if it is paused. */
+    short events = 0;
+    /** the coroutines waiting for this file descriptor. */
+    Waiter waiters;
+};
+
+template <typename... Args>
+FramePool *find_pool(Args &...args) noexcept;
+
+} // namespace detail
+
+/**
+ * Awaitable that waits until a file descriptor is ready, and yields the
+ * returned events (`revents`). When no event handler could be registered, for
+ * example because the table of event handlers is full, `POLLERR` is returned
+ * right away.
+ */
+class FdAwaiter : protected detail::Waiter {
+public:
+    FdAwaiter(Loop &loop, int fd, short events) noexcept : loop_(loop), fd_(fd), events_(events) {
+    }
+
+    FdAwaiter(const FdAwaiter &) = delete;
+    FdAwaiter &operator=(const FdAwaiter &) = delete;
+
+    ~FdAwaiter();
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+
+    short await_resume() const noexcept {
+        return revents_;
+    }
+
+protected:
+    friend class Loop;
+
+    static ud_result_t on_event(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) noexcept;
+
+    /** brings the interest of the event handler of a watch in line with its waiters. */
+    static void rearm(detail::FdWatch &watch) noexcept;
+
+    Loop &loop_;
+    int fd_;
+    short events_;
+    short revents_ = 0;
+    /** -ENOSPC if no event handler could be registered, zero otherwise. */
+    int error_ = 0;
+    detail::FdWatch *watch_ = nullptr;
+};
+
+/**
+ * Awaitable that connects a non-blocking socket, and yields zero upon success,
+ * -ENOSPC if no event handler could be registered to wait for the connection,
+ * or another negative errno value in case the connection failed.
+ */
+class ConnectAwaiter : public FdAwaiter {
+public:
+    ConnectAwaiter(Loop &loop, int fd, const struct sockaddr *addr, socklen_t addrlen) noexcept
+        : FdAwaiter(loop, fd, POLLOUT), addr_(addr), addrlen_(addrlen) {
+    }
+
+    bool await_ready() noexcept {
+        if (::connect(fd_, addr_, addrlen_) == 0) {
+            result_ = 0;
+            return true;
+        }
+        if (errno != EINPROGRESS) {
+            result_ = -errno;
+            return true;
+        }
+        return false;
+    }
+
+    int await_resume() const noexcept {
+        if (result_ <= 0) {
+            return result_;
+        }
+        if (error_) {
+            return error_;
+        }
+        if (revents_ & POLLNVAL) {
+            return -EBADF;
+        }
+
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+            return -errno;
+        }
+        if ((revents_ & POLLERR) || !(revents_ & POLLOUT)) {
+            // the connection failed, even if the error is already consumed...
+            return err ? -err : -ECONNREFUSED;
+        }
+        return -err;
+    }
+
+private:
+    const struct sockaddr *addr_;
+    socklen_t addrlen_;
+    /** the result of the connect, or 1 while it is in progress. */
+    int result_ = 1;
+};
+
+/**
+ * Awaitable that waits until a given deadline on the monotonic clock of
+ * udaemon (see #ud_now) has passed, and yields zero, or a negative errno value
+ * if no timer could be scheduled, in which case it returns right away.
+ */
+class SleepAwaiter {
+public:
+    SleepAwaiter(Loop &loop, uint64_t deadline) noexcept : loop_(loop), deadline_(deadline) {
+    }
+
+    bool await_ready() const noexcept;
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept;
+
+    int await_resume() const noexcept {
+        return error_;
+    }
+
+private:
+    Loop &loop_;
+    uint64_t deadline_;
+    int error_ = 0;
+};
+
+/**
+ * Represents the completion of an operation that is performed outside of the
+ * mainloop, for example, by a worker thread.
+ *
+ * A coroutine awaits the completion, which yields the result that is passed to
+ * #complete. The completion should be created on, and awaited from, the thread
+ * running the mainloop, but can be completed from any thread, which posts it
+ * to the mainloop (see #ud_post). It must not be destroyed before its
+ * completion is delivered, unless the mainloop does not run anymore.
+ */
+class Completion : protected detail::Waiter {
+public:
+    explicit Completion(Loop &loop) noexcept : loop_(loop) {
+        post_.fn = &Completion::on_posted;
+        post_.self = this;
+    }
+
+    Completion(const Completion &) = delete;
+    Completion &operator=(const Completion &) = delete;
+
+    ~Completion();
+
+    /**
+     * Completes this completion, resuming the awaiting coroutine on the
+     * mainloop. Can be called from any thread, but only once.
+     *
+     * @param result the result to yield to the awaiting coroutine.
+     */
+    void complete(int result) noexcept;
+
+    /**
+     * Awaits a completion through a reference to it. Awaiting the completion
+     * directly makes some compilers (GCC 12) copy it, which is not possible.
+     */
+    struct Awaiter {
+        Completion &self;
+
+        bool await_ready() const noexcept {
+            return self.done_;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) noexcept {
+            self.suspend(h);
+        }
+
+        int await_resume() const noexcept {
+            return self.result_;
+        }
+    };
+
+    Awaiter operator co_await() noexcept {
+        return Awaiter { *this };
+    }
+
+private:
+    struct Post : ud_post_t {
+        Completion *self;
+    };
+
+    static void on_posted(const ud_state_t *ud_state, ud_post_t *post) noexcept;
+
+    void suspend(std::coroutine_handle<> h) noexcept;
+
+    Loop &loop_;
+    int result_ = 0;
+    bool done_ = false;
+    Post post_ {};
+};
+
+/**
+ * Provides the coroutine awaitables for the mainloop of udaemon.
+ */
+class Loop {
+public:
+    explicit Loop(const ud_state_t *ud_state) noexcept : ud_state_(ud_state) {
+        waiters_.prev = waiters_.next = &waiters_;
+    }
+
+    Loop(const Loop &) = delete;
+    Loop &operator=(const Loop &) = delete;
+
+    ~Loop() {
+        if (timer_armed_) {
+            ud_cancel_task(ud_state_, &Loop::on_timer, this);
+        }
+        while (!timers_.empty()) {
+            std::coroutine_handle<> h = timers_.top().handle;
+            timers_.pop();
+            h.destroy();
+        }
+        while (waiters_.next != &waiters_) {
+            detail::Waiter *waiter = waiters_.next;
+            unlink(waiter);
+            waiter->handle.destroy();
+        }
+        for (auto &[fd, watch] : watches_) {
+            while (watch.waiters.next != &watch.waiters) {
+                detail::Waiter *waiter = watch.waiters.next;
+                unlink(waiter);
+                waiter->handle.destroy();
+            }
+            ud_remove_event_handler(ud_state_, watch.id);
+        }
+    }
+
+    const ud_state_t *state() const noexcept {
+        return ud_state_;
+    }
+
+    /**
+     * @return an awaitable that waits until the given file descriptor is readable.
+     */
+    FdAwaiter readable(int fd) noexcept {
+        return FdAwaiter(*this, fd, POLLIN);
+    }
+
+    /**
+     * @return an awaitable that waits until the given file descriptor is writable.
+     */
+    FdAwaiter writable(int fd) noexcept {
+        return FdAwaiter(*this, fd, POLLOUT);
+    }
+
+    /**
+     * @return an awaitable that connects the given non-blocking socket.
+     */
+    ConnectAwaiter connect(int fd, const struct sockaddr *addr, socklen_t addrlen) noexcept {
+        return ConnectAwaiter(*this, fd, addr, addrlen);
+    }
+
+    /**
+     * @return an awaitable that waits for the given duration.
+     */
+    SleepAwaiter sleep(std::chrono::milliseconds duration) noexcept {
+        int64_t ms = duration.count() > 0 ? duration.count() : 0;
+        return SleepAwaiter(*this, ud_now(ud_state_) + static_cast<uint64_t>(ms));
+    }
+
+    /**
+     * Releases the event handler of a file descriptor that was awaited, which
+     * should be done before it is closed. Coroutines that are still waiting
+     * for it are resumed with `POLLNVAL`.
+     *
+     * @param fd the file descriptor to forget.
+     */
+    void forget(int fd) noexcept;
+
+private:
+    friend class FdAwaiter;
+    friend class SleepAwaiter;
+    friend class Completion;
+    template <typename... Args>
+    friend detail::FramePool *detail::find_pool(Args &...args) noexcept;
+
+    struct Timer {
+        uint64_t deadline;
+        uint64_t seq;
+        std::coroutine_handle<> handle;
+
+        bool operator>(const Timer &other) const noexcept {
+            return deadline != other.deadline ? deadline > other.deadline : seq > other.seq;
+        }
+    };
+
+    void link(detail::Waiter *waiter) noexcept {
+        link(&waiters_, waiter);
+    }
+
+    static void link(detail::Waiter *list, detail::Waiter *waiter) noexcept {
+        waiter->prev = list->prev;
+        waiter->next = list;
+        list->prev->next = waiter;
+        list->prev = waiter;
+    }
+
+    static void unlink(detail::Waiter *waiter) noexcept {
+        waiter->prev->next = waiter->next;
+        waiter->next->prev = waiter->prev;
+        waiter->prev = waiter->next = nullptr;
+    }
+
+    static uint16_t clamp_interval(uint64_t deadline, uint64_t now) noexcept {
+        if (deadline <= now) {
+            return 0;
+        }
+        return static_cast<uint16_t>(std::min<uint64_t>(deadline - now, UINT16_MAX));
+    }
+
+    /**
+     * Looks up the watch of a file descriptor, registering it if needed.
+     *
+     * @return the watch, or nullptr if no event handler could be registered.
+     */
+    detail::FdWatch *watch(int fd) noexcept {
+        auto it = watches_.find(fd);
+        if (it != watches_.end()) {
+            return &it->second;
+        }
+
+        detail::FdWatch *watch;
+        try {
+            // the elements of an unordered_map never move, so it is safe to pass them as context...
+            watch = &watches_[fd];
+        } catch (const std::bad_alloc &) {
+            return nullptr;
+        }
+        watch->loop = this;
+        watch->waiters.prev = watch->waiters.next = &watch->waiters;
+
+        // registered paused, the awaiter sets its interest right away...
+        if (ud_add_event_handler(ud_state_, fd, POLLIN, &FdAwaiter::on_event, watch, &watch->id)) {
+            watches_.erase(fd);
+            return nullptr;
+        }
+        ud_pause_handler(ud_state_, watch->id);
+        return watch;
+    }
+
+    /**
+     * Adds a sleeping coroutine, (re)arming the timer if it is the first to
+     * wake up.
+     *
+     * @return zero in case of success, or a negative errno value if the
+     *         coroutine cannot be woken up and should not be suspended.
+     */
+    int add_timer(uint64_t deadline, std::coroutine_handle<> h) noexcept {
+        try {
+            timers_.push(Timer { deadline, timer_seq_++, h });
+        } catch (const std::bad_alloc &) {
+            return -ENOMEM;
+        }
+
+        if (in_timer_ || (timer_armed_ && deadline >= armed_deadline_)) {
+            // the current timer fires early enough...
+            return 0;
+        }
+        if (timer_armed_) {
+            ud_cancel_task(ud_state_, &Loop::on_timer, this);
+        }
+
+        uint64_t now = ud_now(ud_state_);
+        uint16_t interval = clamp_interval(deadline, now);
+        if (ud_schedule_timer(ud_state_, interval, &Loop::on_timer, this) == 0) {
+            timer_armed_ = true;
+            armed_deadline_ = now + interval;
+            return 0;
+        }
+
+        // this deadline is the first one, so it is the top of the heap...
+        timers_.pop();
+        timer_armed_ = false;
+        if (!timers_.empty()) {
+            // try to keep the others running, we just freed the task slot of the cancelled timer...
+            interval = clamp_interval(timers_.top().deadline, now);
+            if (ud_schedule_timer(ud_state_, interval, &Loop::on_timer, this) == 0) {
+                timer_armed_ = true;
+                armed_deadline_ = now + interval;
+            }
+        }
+        return -ENOSPC;
+    }
+
+    static int on_timer(const ud_state_t *ud_state, uint16_t, void *context) noexcept {
+        Loop *self = static_cast<Loop *>(context);
+        uint64_t now = ud_now(ud_state);
+
+        self->in_timer_ = true;
+        while (!self->timers_.empty() && self->timers_.top().deadline <= now) {
+            std::coroutine_handle<> h = self->timers_.top().handle;
+            self->timers_.pop();
+            h.resume();
+        }
+        self->in_timer_ = false;
+
+        if (self->timers_.empty()) {
+            self->timer_armed_ = false;
+            return 0;
+        }
+
+        // reschedule ourselves for the next deadline...
+        uint16_t interval = std::max<uint16_t>(clamp_interval(self->timers_.top().deadline, now), 1);
+        self->armed_deadline_ = now + interval;
+        return interval;
+    }
+
+    // NOTE: the pool should be destroyed last, as the frames are returned to it...
+    detail::FramePool pool_;
+
+    const ud_state_t *ud_state_;
+    /** the coroutines waiting for completions. */
+    detail::Waiter waiters_;
+
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    uint64_t timer_seq_ = 0;
+    uint64_t armed_deadline_ = 0;
+    bool timer_armed_ = false;
+    bool in_timer_ = false;
+
+    /** the registrations of all awaited file descriptors. */
+    std::unordered_map<int, detail::FdWatch> watches_;
+};
+
+inline void Loop::forget(int fd) noexcept {
+    auto it = watches_.find(fd);
+    if (it == watches_.end()) {
+        return;
+    }
+    detail::FdWatch &watch = it->second;
+
+    detail::Waiter ready;
+    ready.prev = ready.next = &ready;
+    while (watch.waiters.next != &watch.waiters) {
+        FdAwaiter *awaiter = static_cast<FdAwaiter *>(watch.waiters.next);
+        unlink(awaiter);
+        awaiter->revents_ = POLLNVAL;
+        awaiter->watch_ = nullptr;
+        link(&ready, awaiter);
+    }
+
+    ud_remove_event_handler(ud_state_, watch.id);
+    watches_.erase(it);
+
+    while (ready.next != &ready) {
+        detail::Waiter *waiter = ready.next;
+        unlink(waiter);
+        waiter->handle.resume();
+    }
+}
+
+inline FdAwaiter::~FdAwaiter() {
+    if (linked()) {
+        Loop::unlink(this);
+        if (watch_) {
+            rearm(*watch_);
+        }
+    }
+}
+
+inline bool FdAwaiter::await_suspend(std::coroutine_handle<> h) noexcept {
+    detail::FdWatch *watch = loop_.watch(fd_);
+    if (!watch) {
+        revents_ = POLLERR;
+        error_ = -ENOSPC;
+        return false;
+    }
+    handle = h;
+    watch_ = watch;
+    Loop::link(&watch->waiters, this);
+    rearm(*watch);
+    return true;
+}
+
+inline void FdAwaiter::rearm(detail::FdWatch &watch) noexcept {
+    short events = 0;
+    for (detail::Waiter *w = watch.waiters.next; w != &watch.waiters; w = w->next) {
+        events |= static_cast<FdAwaiter *>(w)->events_;
+    }
+    if (events == watch.events) {
+        return;
+    }
+
+    watch.events = events;
+    // changes are applied once per iteration of the mainloop, so this is cheap...
+    if (events) {
+        ud_modify_event_handler(watch.loop->state(), watch.id, events);
+    } else {
+        ud_pause_handler(watch.loop->state(), watch.id);
+    }
+}
+
+inline ud_result_t FdAwaiter::on_event(const ud_state_t *, struct pollfd *pollfd, void *context) noexcept {
+    detail::FdWatch *watch = static_cast<detail::FdWatch *>(context);
+    short revents = pollfd->revents;
+
+    // take out the waiters that are ready first, as a resumed coroutine that
+    // awaits this file descriptor again should wait for the next event...
+    detail::Waiter ready;
+    ready.prev = ready.next = &ready;
+    for (detail::Waiter *w = watch->waiters.next; w != &watch->waiters;) {
+        detail::Waiter *next = w->next;
+        FdAwaiter *awaiter = static_cast<FdAwaiter *>(w);
+        if (revents & (awaiter->events_ | POLLERR | POLLHUP | POLLNVAL)) {
+            awaiter->revents_ = revents;
+            awaiter->watch_ = nullptr;
+            Loop::unlink(awaiter);
+            Loop::link(&ready, awaiter);
+        }
+        w = next;
+    }
+    rearm(*watch);
+
+    while (ready.next != &ready) {
+        detail::Waiter *waiter = ready.next;
+        Loop::unlink(waiter);
+        // NOTE: the coroutine might complete, destroying its awaiter...
+        waiter->handle.resume();
+    }
+
+    // the file descriptor is owned by the application, never let udaemon close it...
+    return RES_OK;
+}
+
+inline bool SleepAwaiter::await_ready() const noexcept {
+    return deadline_ <= ud_now(loop_.state());
+}
+
+inline bool SleepAwaiter::await_suspend(std::coroutine_handle<> h) noexcept {
+    error_ = loop_.add_timer(deadline_, h);
+    return error_ == 0;
+}
+
+inline Completion::~Completion() {
+    if (linked()) {
+        Loop::unlink(this);
+    }
+}
+
+inline void Completion::complete(int result) noexcept {
+    result_ = result;
+    // can only fail for invalid arguments, which is not the case here...
+    ud_post(loop_.state(), &post_);
+}
+
+inline void Completion::on_posted(const ud_state_t *, ud_post_t *post) noexcept {
+    Completion *self = static_cast<Post *>(post)->self;
+
+    self->done_ = true;
+    if (self->linked()) {
+        std::coroutine_handle<> h = self->handle;
+        Loop::unlink(self);
+        h.resume();
+    }
+}
+
+inline void Completion::suspend(std::coroutine_handle<> h) noexcept {
+    handle = h;
+    loop_.link(this);
+}
+
+namespace detail {
+
+template <typename... Args>
+FramePool *find_pool(Args &...args) noexcept {
+    FramePool *pool = nullptr;
+    // use the pool of the first loop argument, if any...
+    ([&](auto &arg) {
+        if constexpr (std::is_same_v<std::remove_cv_t<std::remove_reference_t<decltype(arg)>>, Loop>) {
+            if (!pool) {
+                pool = &const_cast<Loop &>(arg).pool_;
+            }
+        }
+    }(args), ...);
+    return pool;
+}
+
+} // namespace detail
+
+/**
+ * Represents a detached coroutine that starts running right away, and whose
+ * frame is released once it completes.
+ *
+ * NOTE: exceptions must not escape from the coroutine, doing so terminates the
+ * application.
+ */
+class Task {
+};
+
+namespace detail {
+
+/**
+ * The promise of a #udaemon::Task, for a coroutine with the given parameter
+ * types. Its operator new is not a template itself, as GCC 12 reports any
+ * coroutine using a templated operator new with -Wmismatched-new-delete (and
+ * the warning is reported in the coroutine, so it cannot be suppressed here).
+ */
+template <typename... Args>
+class TaskPromise {
+public:
+    Task get_return_object() noexcept {
+        return {};
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+        return {};
+    }
+
+    std::suspend_never final_suspend() noexcept {
+        return {};
+    }
+
+    void return_void() noexcept {
+    }
+
+    void unhandled_exception() noexcept {
+        std::terminate();
+    }
+
+    static void *operator new(std::size_t size, Args &...args) {
+        return FramePool::allocate(size, find_pool(args...));
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept {
+        FramePool::deallocate(ptr, size);
+    }
+};
+
+} // namespace detail
+
+} // namespace udaemon
+
+namespace std {
+
+template <typename... Args>
+struct coroutine_traits<udaemon::Task, Args...> {
+    using promise_type = udaemon::detail::TaskPromise<Args...>;
+};
+
+} // namespace std
+
+#endif /* UDAEMON_CORO_HPP_ */
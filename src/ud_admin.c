@@ -0,0 +1,433 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "udaemon/ud_admin.h"
+#include "udaemon/ud_keepalive.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+// The maximum length of a single command...
+#define CMD_MAX 256
+// The maximum length of a single reply...
+#define REPLY_MAX 4096
+// The maximum number of words in a command...
+#define ARGS_MAX 4
+// The default time (in ms) after which an idle connection is closed...
+#define DEFAULT_IDLE_TIMEOUT 30000
+
+struct ud_admin {
+    const ud_state_t *ud_state;
+    ud_admin_config_t config;
+    char *path;
+
+    int listen_fd;
+    eh_id_t listen_id;
+
+    /** the connection being served, or -1 if there is none. */
+    int client_fd;
+    eh_id_t client_id;
+    /** the (partial) command read from the connection. */
+    char line[CMD_MAX];
+    size_t len;
+
+    /** closes the connection once it is idle, so it does not block all others. */
+    ud_keepalive_t *keepalive;
+    ud_keepalive_entry_t idle;
+};
+
+static const char *HELP =
+    "loglevel [module] <debug|info|warning|error>\n"
+    "stats\n"
+    "tables\n"
+    "reload\n"
+    "record start <path>\n"
+    "record stop\n"
+    "drain\n"
+    "help\n"
+    "quit\n";
+
+static void reply(const ud_admin_t *admin, const char *text, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(admin->client_fd, text, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // replies are small, so only a misbehaving peer causes this...
+            log_debug("Failed to reply on admin socket: %m");
+            return;
+        }
+        text += n;
+        len -= (size_t) n;
+    }
+}
+
+__attribute__((__format__ (__printf__, 2, 3)))
+static void replyf(const ud_admin_t *admin, const char *fmt, ...) {
+    char buf[CMD_MAX];
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    if (n > 0) {
+        reply(admin, buf, ((size_t) n < sizeof(buf)) ? (size_t) n : sizeof(buf) - 1);
+    }
+}
+
+static void reply_status(const ud_admin_t *admin, int retval) {
+    if (retval < 0) {
+        replyf(admin, "ERR %s\n", strerror(-retval));
+    } else {
+        reply(admin, "OK\n", 3);
+    }
+}
+
+static void reply_report(const ud_admin_t *admin, int (*format)(const ud_state_t *, char *, size_t)) {
+    char buf[REPLY_MAX];
+
+    int n = format(admin->ud_state, buf, sizeof(buf));
+    if (n > 0) {
+        // a truncated report is still better than none...
+        reply(admin, buf, ((size_t) n < sizeof(buf)) ? (size_t) n : sizeof(buf) - 1);
+    }
+    reply_status(admin, n);
+}
+
+static int parse_loglevel(const char *name, loglevel_t *level) {
+    static const char *NAMES[] = { "debug", "info", "warning", "error" };
+
+    for (int i = 0; i <= ERROR; i++) {
+        if (strcmp(name, NAMES[i]) == 0) {
+            *level = (loglevel_t) i;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+static int cmd_loglevel(int argc, char **argv) {
+    loglevel_t level;
+    if (argc < 2 || argc > 3 || parse_loglevel(argv[argc - 1], &level)) {
+        return -EINVAL;
+    }
+
+    if (argc == 3) {
+        return set_module_loglevel(argv[1], level);
+    }
+    set_loglevel(level);
+    return 0;
+}
+
+static int cmd_record(const ud_admin_t *admin, int argc, char **argv) {
+    if (argc == 3 && strcmp(argv[1], "start") == 0) {
+        return ud_record_start(admin->ud_state, argv[2]);
+    }
+    if (argc == 2 && strcmp(argv[1], "stop") == 0) {
+        return ud_record_stop(admin->ud_state);
+    }
+    return -EINVAL;
+}
+
+/**
+ * Runs a single command.
+ *
+ * @return RES_OK to continue serving the connection, RES_ERROR to close it.
+ */
+static ud_result_t run_command(ud_admin_t *admin, char *line) {
+    char *argv[ARGS_MAX + 1];
+    int argc = 0;
+
+    char *saveptr = NULL;
+    for (char *word = strtok_r(line, " \t\r", &saveptr); word; word = strtok_r(NULL, " \t\r", &saveptr)) {
+        if (argc > ARGS_MAX) {
+            break;
+        }
+        argv[argc++] = word;
+    }
+    if (argc == 0) {
+        return RES_OK;
+    }
+
+    const char *cmd = argv[0];
+    log_debug("Running admin command: %s", cmd);
+
+    if (strcmp(cmd, "loglevel") == 0) {
+        reply_status(admin, cmd_loglevel(argc, argv));
+    } else if (strcmp(cmd, "stats") == 0) {
+        reply_report(admin, ud_format_top);
+    } else if (strcmp(cmd, "tables") == 0) {
+        reply_report(admin, ud_format_tables);
+    } else if (strcmp(cmd, "reload") == 0) {
+        reply_status(admin, ud_raise_signal(admin->ud_state, SIG_HUP));
+    } else if (strcmp(cmd, "record") == 0) {
+        reply_status(admin, cmd_record(admin, argc, argv));
+    } else if (strcmp(cmd, "drain") == 0) {
+        reply_status(admin, 0);
+
+        if (admin->config.drain) {
+            admin->config.drain(admin->ud_state, admin->config.context);
+        } else {
+            ud_raise_signal(admin->ud_state, SIG_TERM);
+        }
+    } else if (strcmp(cmd, "help") == 0) {
+        reply(admin, HELP, strlen(HELP));
+        reply_status(admin, 0);
+    } else if (strcmp(cmd, "quit") == 0) {
+        reply_status(admin, 0);
+        return RES_ERROR;
+    } else {
+        replyf(admin, "ERR unknown command: %s\n", cmd);
+    }
+
+    return RES_OK;
+}
+
+static ud_result_t on_client(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    ud_admin_t *admin = context;
+    (void) ud_state;
+
+    if (!(pollfd->revents & POLLIN)) {
+        // hang-up or error...
+        return RES_ERROR;
+    }
+
+    ssize_t n = read(pollfd->fd, admin->line + admin->len, sizeof(admin->line) - admin->len);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? RES_OK : RES_ERROR;
+    }
+    if (n == 0) {
+        // the connection is closed by the peer...
+        return RES_ERROR;
+    }
+    admin->len += (size_t) n;
+    ud_keepalive_touch(admin->keepalive, &admin->idle);
+
+    char *start = admin->line;
+    char *end = admin->line + admin->len;
+    char *eol;
+    while ((eol = memchr(start, '\n', (size_t) (end - start))) != NULL) {
+        *eol = '\0';
+
+        ud_result_t res = run_command(admin, start);
+        if (res != RES_OK) {
+            return res;
+        }
+        start = eol + 1;
+    }
+
+    // keep the partial command for the next read...
+    admin->len = (size_t) (end - start);
+    memmove(admin->line, start, admin->len);
+
+    if (admin->len == sizeof(admin->line)) {
+        replyf(admin, "ERR command too long\n");
+        return RES_ERROR;
+    }
+    return RES_OK;
+}
+
+static void on_client_close(const ud_state_t *ud_state, int fd, void *context) {
+    ud_admin_t *admin = context;
+    (void) fd;
+
+    admin->client_fd = -1;
+    admin->client_id = UD_INVALID_ID;
+    admin->len = 0;
+    ud_keepalive_remove(admin->keepalive, &admin->idle);
+
+    // ready for the next connection...
+    ud_resume_handler(ud_state, admin->listen_id);
+}
+
+static void on_client_idle(const ud_state_t *ud_state, ud_keepalive_entry_t *entry, void *context) {
+    ud_admin_t *admin = context;
+    (void) entry;
+
+    log_debug("Closing idle admin connection...");
+
+    replyf(admin, "ERR idle timeout\n");
+    ud_close_event_handler(ud_state, admin->client_id);
+}
+
+static ud_result_t on_accept(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    ud_admin_t *admin = context;
+
+    int fd = accept4(pollfd->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        // never close the listening socket...
+        log_debug("Failed to accept admin connection: %m");
+        return RES_OK;
+    }
+
+    if (ud_add_event_handler(ud_state, fd, POLLIN, on_client, admin, &admin->client_id)) {
+        log_warning("Unable to serve admin connection, no event handlers left!");
+        close(fd);
+        return RES_OK;
+    }
+    ud_set_close_hook(ud_state, admin->client_id, on_client_close);
+
+    admin->client_fd = fd;
+    admin->len = 0;
+
+    if (ud_keepalive_add(admin->keepalive, &admin->idle, admin->config.idle_timeout)) {
+        log_warning("Unable to track idle admin connection!");
+    }
+
+    // serve a single connection at a time, others wait in the backlog...
+    ud_pause_handler(ud_state, admin->listen_id);
+
+    return RES_OK;
+}
+
+/**
+ * Determines whether a socket is left behind by a previous run: only if
+ * nobody accepts connections on it anymore.
+ */
+static bool stale_socket(const struct sockaddr_un *addr) {
+    // never block on the backlog of a busy, but live, instance...
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    bool stale = connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) < 0 && errno == ECONNREFUSED;
+    close(fd);
+    return stale;
+}
+
+ud_admin_t *ud_admin_create(const ud_state_t *ud_state, const ud_admin_config_t *config) {
+    if (!ud_state || !config || !config->path) {
+        return NULL;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(config->path) >= sizeof(addr.sun_path)) {
+        log_warning("Admin socket path is too long: %s", config->path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, config->path);
+
+    ud_admin_t *admin = calloc(1, sizeof(ud_admin_t));
+    if (!admin || !(admin->path = strdup(config->path))) {
+        free(admin);
+        return NULL;
+    }
+    admin->ud_state = ud_state;
+    admin->config = *config;
+    admin->config.path = admin->path;
+    admin->listen_fd = -1;
+    admin->client_fd = -1;
+    admin->client_id = UD_INVALID_ID;
+    if (!admin->config.idle_timeout) {
+        admin->config.idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    }
+    admin->idle = (ud_keepalive_entry_t) {
+        .cb = on_client_idle,
+        .context = admin,
+        // reads touch the entry themselves...
+        .eh_id = UD_INVALID_ID,
+    };
+    bool bound = false;
+    int err;
+
+    // a tenth of the timeout is precise enough, without waking up too often...
+    uint32_t tick = admin->config.idle_timeout / 10;
+    admin->keepalive = ud_keepalive_create(ud_state, (uint16_t) (tick < 10 ? 10 : (tick > 1000 ? 1000 : tick)));
+    if (!admin->keepalive) {
+        log_warning("Unable to create keepalive manager for admin socket!");
+        goto error;
+    }
+
+    admin->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (admin->listen_fd < 0) {
+        log_warning("Unable to create admin socket: %m");
+        goto error;
+    }
+
+    // remove the socket of a previous run, if any, but never anything else...
+    struct stat st;
+    if (lstat(admin->path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            log_warning("Admin socket path %s exists and is not a socket!", admin->path);
+            goto error;
+        }
+        if (!stale_socket(&addr)) {
+            log_warning("Admin socket %s is in use by another process!", admin->path);
+            errno = EADDRINUSE;
+            goto error;
+        }
+        unlink(admin->path);
+    }
+
+    // do not allow anyone else to connect before the permissions are set...
+    mode_t old_umask = umask(0177);
+    int rc = bind(admin->listen_fd, (struct sockaddr *) &addr, sizeof(addr));
+    umask(old_umask);
+    bound = rc == 0;
+
+    if (rc < 0 || chmod(admin->path, config->mode ? config->mode : 0600) < 0 || listen(admin->listen_fd, 4) < 0) {
+        log_warning("Unable to listen on admin socket %s: %m", admin->path);
+        goto error;
+    }
+
+    if (ud_add_event_handler(ud_state, admin->listen_fd, POLLIN, on_accept, admin, &admin->listen_id)) {
+        log_warning("Unable to register admin socket!");
+        goto error;
+    }
+
+    return admin;
+
+error:
+    err = errno;
+    ud_keepalive_destroy(admin->keepalive);
+    if (admin->listen_fd >= 0) {
+        close(admin->listen_fd);
+    }
+    if (bound) {
+        // only remove what we created ourselves...
+        unlink(admin->path);
+    }
+    free(admin->path);
+    free(admin);
+    errno = err;
+    return NULL;
+}
+
+void ud_admin_destroy(ud_admin_t *admin) {
+    if (!admin) {
+        return;
+    }
+
+    if (admin->client_fd >= 0) {
+        // the admin socket is gone by the time the connection is closed...
+        ud_set_close_hook(admin->ud_state, admin->client_id, NULL);
+        ud_close_event_handler(admin->ud_state, admin->client_id);
+    }
+
+    ud_remove_event_handler(admin->ud_state, admin->listen_id);
+    close(admin->listen_fd);
+    unlink(admin->path);
+
+    ud_keepalive_destroy(admin->keepalive);
+    free(admin->path);
+    free(admin);
+}
@@ -0,0 +1,159 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "udaemon/ud_buffer.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+// The maximum number of idle buffers we keep around...
+#define POOL_MAX 64
+
+/**
+ * Each thread has a pool of its own, so mainloops running on different
+ * threads never share their idle buffers.
+ */
+static _Thread_local struct _buf_pool {
+    ud_buf_t *free;
+    uint16_t count;
+} buf_pool = {
+    .free = NULL,
+    .count = 0,
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
+static bool pool_key_valid;
+
+/**
+ * Frees the idle buffers of a thread that exits.
+ */
+static void pool_destroy(void *arg) {
+    struct _buf_pool *pool = arg;
+
+    while (pool->free) {
+        ud_buf_t *buf = pool->free;
+        pool->free = buf->next;
+        free(buf);
+    }
+    pool->count = 0;
+}
+
+static void pool_init(void) {
+    if (pthread_key_create(&pool_key, pool_destroy)) {
+        log_warning("Unable to free buffer pools at thread exit!");
+        return;
+    }
+    pool_key_valid = true;
+}
+
+ud_buf_t *ud_buf_alloc(void) {
+    ud_buf_t *buf = buf_pool.free;
+    if (buf) {
+        buf_pool.free = buf->next;
+        buf_pool.count--;
+    } else {
+        buf = malloc(sizeof(ud_buf_t) + UD_BUF_SIZE);
+        if (!buf) {
+            return NULL;
+        }
+        buf->cap = UD_BUF_SIZE;
+    }
+
+    buf->len = 0;
+    buf->refs = 1;
+    buf->next = NULL;
+
+    return buf;
+}
+
+ud_buf_t *ud_buf_ref(ud_buf_t *buf) {
+    buf->refs++;
+    return buf;
+}
+
+void ud_buf_release(ud_buf_t *buf) {
+    if (!buf || --buf->refs > 0) {
+        return;
+    }
+
+    if (buf_pool.count < POOL_MAX) {
+        if (!buf_pool.free) {
+            // the key only needs a non-NULL value for its destructor to run...
+            pthread_once(&pool_once, pool_init);
+            if (pool_key_valid) {
+                pthread_setspecific(pool_key, &buf_pool);
+            }
+        }
+        buf->next = buf_pool.free;
+        buf_pool.free = buf;
+        buf_pool.count++;
+    } else {
+        free(buf);
+    }
+}
+
+ud_result_t ud_drain_fd(const ud_state_t *ud_state, int fd, ud_drain_handler_t handler, void *context) {
+    if (!ud_state || !handler) {
+        return RES_ERROR;
+    }
+
+    for (;;) {
+        size_t budget = ud_dispatch_budget(ud_state);
+        if (budget == 0) {
+            // we're not done yet, but others should have their turn as well...
+            return RES_MORE;
+        }
+
+        ud_buf_t *buf = ud_buf_alloc();
+        if (!buf) {
+            log_warning("Unable to allocate buffer!");
+            return RES_MORE;
+        }
+
+        ssize_t n = ud_read(ud_state, fd, buf->data, (budget < buf->cap) ? budget : buf->cap);
+        if (n < 0) {
+            int err = errno;
+            ud_buf_release(buf);
+
+            if (err == EINTR) {
+                continue;
+            }
+            if (err == EAGAIN || err == EWOULDBLOCK) {
+                // completely drained...
+                return RES_OK;
+            }
+
+            errno = err;
+            log_debug("Failed to read from fd#%d: %m", fd);
+            return RES_ERROR;
+        }
+
+        if (n == 0) {
+            ud_buf_release(buf);
+            // signal EOF...
+            return handler(ud_state, NULL, context);
+        }
+
+        buf->len = (size_t) n;
+        ud_dispatch_consume(ud_state, buf->len);
+
+        ud_result_t res = handler(ud_state, buf, context);
+        ud_buf_release(buf);
+
+        if (res != RES_OK) {
+            return res;
+        }
+    }
+}
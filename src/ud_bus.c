@@ -0,0 +1,304 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "udaemon/ud_bus.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+#include "ud_module.h"
+
+// The maximum number of subscriptions per bus...
+#define SUB_MAX 16
+// The maximum number of messages delivered in a single batch...
+#define BATCH_MAX 64
+
+typedef struct ud_bus_sub {
+    ud_topic_t topic;
+    ud_bus_handler_t handler;
+    void *context;
+} ud_bus_sub_t;
+
+struct ud_bus {
+    const ud_state_t *ud_state;
+
+    ud_bus_sub_t subs[SUB_MAX];
+
+    /** the messages published on the mainloop, in order of publication. */
+    ud_msg_t *head;
+    ud_msg_t *tail;
+    bool timer_armed;
+
+    /** the number of messages posted by other threads that are not yet on the mainloop. */
+    uint32_t posted;
+    /** true if the bus is destroyed while messages were still posted. */
+    bool destroyed;
+};
+
+ud_topic_t ud_topic_id(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+ud_msg_t *ud_msg_alloc(ud_topic_t topic, const void *data, size_t len) {
+    ud_msg_t *msg = malloc(sizeof(ud_msg_t) + len);
+    if (!msg) {
+        return NULL;
+    }
+
+    msg->topic = topic;
+    msg->refs = 1;
+    msg->next = NULL;
+    msg->bus = NULL;
+    msg->len = len;
+    if (data && len) {
+        memcpy(msg->data, data, len);
+    }
+
+    return msg;
+}
+
+ud_msg_t *ud_msg_ref(ud_msg_t *msg) {
+    __atomic_add_fetch(&msg->refs, 1, __ATOMIC_RELAXED);
+    return msg;
+}
+
+void ud_msg_release(ud_msg_t *msg) {
+    if (msg && __atomic_sub_fetch(&msg->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(msg);
+    }
+}
+
+static void release_all(ud_msg_t *msg) {
+    while (msg) {
+        ud_msg_t *next = msg->next;
+        ud_msg_release(msg);
+        msg = next;
+    }
+}
+
+static void bus_enqueue(ud_bus_t *bus, ud_msg_t *msg) {
+    msg->next = NULL;
+    if (bus->tail) {
+        bus->tail->next = msg;
+    } else {
+        bus->head = msg;
+    }
+    bus->tail = msg;
+}
+
+static void bus_deliver(ud_bus_t *bus) {
+    // take the current messages, anything published from here on is delivered in the next round...
+    ud_msg_t *list = bus->head;
+    bus->head = bus->tail = NULL;
+
+    ud_msg_t *batch[BATCH_MAX];
+    ud_msg_t *selected[BATCH_MAX];
+
+    while (list) {
+        size_t count = 0;
+        while (list && count < BATCH_MAX) {
+            batch[count++] = list;
+            list = list->next;
+        }
+
+        for (int i = 0; i < SUB_MAX; i++) {
+            const ud_bus_sub_t *sub = &bus->subs[i];
+            if (!sub->handler) {
+                continue;
+            }
+
+            size_t n = 0;
+            for (size_t j = 0; j < count; j++) {
+                if (batch[j]->topic == sub->topic) {
+                    selected[n++] = batch[j];
+                }
+            }
+            if (n) {
+                sub->handler(bus->ud_state, selected, n, sub->context);
+            }
+        }
+
+        for (size_t j = 0; j < count; j++) {
+            ud_msg_release(batch[j]);
+        }
+    }
+}
+
+static int bus_timer(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+
+    ud_bus_t *bus = context;
+    bus->timer_armed = false;
+    bus_deliver(bus);
+
+    return 0;
+}
+
+/**
+ * Drops a posted message that is not going to be delivered.
+ */
+static void bus_drop_posted(ud_bus_t *bus, ud_msg_t *msg, uint32_t posted) {
+    ud_msg_release(msg);
+    if (bus->destroyed && !posted) {
+        // the last posted message, nothing refers to the bus anymore...
+        free(bus);
+    }
+}
+
+static void bus_posted(const ud_state_t *ud_state, ud_post_t *post) {
+    (void) ud_state;
+
+    ud_msg_t *msg = (ud_msg_t *) ((char *) post - offsetof(ud_msg_t, post));
+    ud_bus_t *bus = msg->bus;
+
+    uint32_t posted = __atomic_sub_fetch(&bus->posted, 1, __ATOMIC_ACQ_REL);
+    if (bus->destroyed) {
+        bus_drop_posted(bus, msg, posted);
+        return;
+    }
+
+    if (ud_bus_publish(bus, msg)) {
+        // deliver it right away, rather than dropping it...
+        bus_enqueue(bus, msg);
+        bus_deliver(bus);
+    }
+}
+
+/**
+ * Drops the messages that are posted to the buses of a state that is being
+ * destroyed, which never reach its mainloop.
+ */
+static void bus_module_drop(const ud_state_t *ud_state, void *data) {
+    (void) data;
+
+    ud_post_t *post = ud_module_take_posts(ud_state, bus_posted);
+    while (post) {
+        ud_post_t *next = post->next;
+
+        ud_msg_t *msg = (ud_msg_t *) ((char *) post - offsetof(ud_msg_t, post));
+        ud_bus_t *bus = msg->bus;
+        bus_drop_posted(bus, msg, --bus->posted);
+
+        post = next;
+    }
+}
+
+ud_bus_t *ud_bus_create(const ud_state_t *ud_state) {
+    if (!ud_state) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    ud_bus_t *bus = calloc(1, sizeof(ud_bus_t));
+    if (!bus) {
+        return NULL;
+    }
+
+    bus->ud_state = ud_state;
+
+    if (!ud_module_get(ud_state, UD_MODULE_BUS)) {
+        // the buses keep no data in the state, but need to know when it is destroyed...
+        static int bus_module;
+        ud_module_set(ud_state, UD_MODULE_BUS, &bus_module, bus_module_drop);
+    }
+
+    return bus;
+}
+
+void ud_bus_destroy(ud_bus_t *bus) {
+    if (!bus) {
+        return;
+    }
+
+    if (bus->timer_armed) {
+        ud_cancel_task(bus->ud_state, bus_timer, bus);
+        bus->timer_armed = false;
+    }
+
+    release_all(bus->head);
+    bus->head = bus->tail = NULL;
+
+    if (__atomic_load_n(&bus->posted, __ATOMIC_ACQUIRE)) {
+        // posted messages still refer to the bus, the last of them frees it...
+        bus->destroyed = true;
+        return;
+    }
+    free(bus);
+}
+
+int ud_bus_subscribe(ud_bus_t *bus, ud_topic_t topic, ud_bus_handler_t handler, void *context) {
+    if (!bus || !handler) {
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < SUB_MAX; i++) {
+        ud_bus_sub_t *sub = &bus->subs[i];
+        if (!sub->handler) {
+            sub->topic = topic;
+            sub->handler = handler;
+            sub->context = context;
+            return i;
+        }
+    }
+    return -ENOMEM;
+}
+
+int ud_bus_unsubscribe(ud_bus_t *bus, int subscription) {
+    if (!bus || subscription < 0 || subscription >= SUB_MAX) {
+        return -EINVAL;
+    }
+
+    bus->subs[subscription] = (ud_bus_sub_t) { .handler = NULL };
+    return 0;
+}
+
+int ud_bus_publish(ud_bus_t *bus, ud_msg_t *msg) {
+    if (!bus || !msg) {
+        return -EINVAL;
+    }
+
+    if (!bus->timer_armed) {
+        // deliver in the next iteration of the mainloop...
+        if (ud_schedule_timer(bus->ud_state, 0, bus_timer, bus)) {
+            log_warning("Failed to schedule delivery for bus!");
+            return -ENOMEM;
+        }
+        bus->timer_armed = true;
+    }
+
+    bus_enqueue(bus, msg);
+    return 0;
+}
+
+int ud_bus_post(ud_bus_t *bus, ud_msg_t *msg) {
+    if (!bus || !msg) {
+        return -EINVAL;
+    }
+
+    msg->bus = bus;
+    msg->post.fn = bus_posted;
+
+    __atomic_add_fetch(&bus->posted, 1, __ATOMIC_RELAXED);
+    int retval = ud_post(bus->ud_state, &msg->post);
+    if (retval) {
+        __atomic_sub_fetch(&bus->posted, 1, __ATOMIC_RELAXED);
+    }
+    return retval;
+}
@@ -0,0 +1,608 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "udaemon/ud_fiber.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+#include "ud_module.h"
+
+#if !defined(__x86_64__) && !defined(__aarch64__)
+#include <ucontext.h>
+#define UD_FIBER_UCONTEXT 1
+#endif
+
+// The smallest stack we hand out, excluding the guard page...
+#define STACK_MIN (16 * 1024)
+// The maximum number of unused stacks kept around for reuse...
+#define STACK_POOL_MAX 16
+// The longest interval a single timer can be scheduled for...
+#define TIMER_MAX UINT16_MAX
+
+typedef struct fiber_stack {
+    /** the start of the mapping, including the guard page. */
+    void *base;
+    size_t size;
+} fiber_stack_t;
+
+struct fiber_sched;
+
+typedef struct ud_fiber {
+#ifdef UD_FIBER_UCONTEXT
+    ucontext_t ctx;
+#else
+    /** the saved stack pointer while this fiber is suspended. */
+    void *sp;
+#endif
+    fiber_stack_t stack;
+
+    const ud_state_t *ud_state;
+    struct fiber_sched *sched;
+    ud_fiber_fn_t fn;
+    void *context;
+    bool done;
+
+    /** the event handler and returned events while waiting for a file descriptor. */
+    eh_id_t eh_id;
+    short revents;
+    /** the deadline while sleeping, in ms. */
+    uint64_t deadline;
+
+    /** the next fiber in the run queue or the list of sleepers. */
+    struct ud_fiber *next;
+    /** the other unfinished fibers of the same scheduler. */
+    struct ud_fiber *all_next;
+    struct ud_fiber **all_prev;
+} ud_fiber_t;
+
+/**
+ * Each state has a scheduler of its own, which is only used on the thread
+ * running its mainloop, and dropped once the state is destroyed.
+ */
+typedef struct fiber_sched {
+    const ud_state_t *ud_state;
+#ifdef UD_FIBER_UCONTEXT
+    ucontext_t main_ctx;
+#else
+    void *main_sp;
+#endif
+
+    /** the fibers that are ready to run, in FIFO order. */
+    ud_fiber_t *run_head;
+    ud_fiber_t *run_tail;
+    bool run_armed;
+
+    /** the sleeping fibers, ordered by their deadline. */
+    ud_fiber_t *sleepers;
+    uint64_t sleep_deadline;
+    bool sleep_armed;
+    bool in_sleep_timer;
+
+    /** all unfinished fibers, whose stacks are released with the state. */
+    ud_fiber_t *fibers;
+
+    fiber_stack_t pool[STACK_POOL_MAX];
+    int pool_count;
+} fiber_sched_t;
+
+/** the fiber running on this thread, if any. */
+static _Thread_local ud_fiber_t *current;
+
+#ifndef UD_FIBER_UCONTEXT
+/**
+ * Saves the callee-saved registers on the current stack, stores the stack
+ * pointer in `*from` and restores the registers from the stack at `to`. This
+ * avoids the signal mask syscalls done by swapcontext.
+ */
+void ud_fiber_switch(void **from, void *to);
+
+#if defined(__x86_64__)
+__asm__(
+    ".text\n"
+    ".globl ud_fiber_switch\n"
+    ".hidden ud_fiber_switch\n"
+    ".type ud_fiber_switch, @function\n"
+    "ud_fiber_switch:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size ud_fiber_switch, .-ud_fiber_switch\n"
+);
+#elif defined(__aarch64__)
+__asm__(
+    ".text\n"
+    ".globl ud_fiber_switch\n"
+    ".hidden ud_fiber_switch\n"
+    ".type ud_fiber_switch, %function\n"
+    "ud_fiber_switch:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size ud_fiber_switch, .-ud_fiber_switch\n"
+);
+#endif
+#endif /* !UD_FIBER_UCONTEXT */
+
+static size_t page_size(void) {
+    static size_t size;
+    if (!size) {
+        long sz = sysconf(_SC_PAGESIZE);
+        size = sz > 0 ? (size_t) sz : 4096;
+    }
+    return size;
+}
+
+static void sched_drop(const ud_state_t *ud_state, void *data);
+
+static fiber_sched_t *sched_get(const ud_state_t *ud_state) {
+    fiber_sched_t *sched = ud_module_get(ud_state, UD_MODULE_FIBER);
+    if (!sched && (sched = calloc(1, sizeof(fiber_sched_t))) != NULL) {
+        sched->ud_state = ud_state;
+        ud_module_set(ud_state, UD_MODULE_FIBER, sched, sched_drop);
+    }
+    return sched;
+}
+
+/**
+ * Returns the fiber running on this thread, provided it belongs to the given
+ * state, or NULL otherwise.
+ */
+static ud_fiber_t *current_fiber(const ud_state_t *ud_state) {
+    ud_fiber_t *fiber = current;
+    return ud_state && fiber && fiber->ud_state == ud_state ? fiber : NULL;
+}
+
+static int stack_acquire(fiber_sched_t *sched, fiber_stack_t *stack, size_t size) {
+    for (int i = 0; i < sched->pool_count; i++) {
+        if (sched->pool[i].size == size) {
+            *stack = sched->pool[i];
+            sched->pool[i] = sched->pool[--sched->pool_count];
+            return 0;
+        }
+    }
+
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (base == MAP_FAILED) {
+        return -errno;
+    }
+    // stacks grow downwards, so the guard page is at the start of the mapping...
+    if (mprotect(base, page_size(), PROT_NONE) < 0) {
+        int err = errno;
+        munmap(base, size);
+        return -err;
+    }
+
+    stack->base = base;
+    stack->size = size;
+    return 0;
+}
+
+static void stack_release(fiber_sched_t *sched, const fiber_stack_t *stack) {
+    if (sched->pool_count < STACK_POOL_MAX) {
+        sched->pool[sched->pool_count++] = *stack;
+    } else {
+        munmap(stack->base, stack->size);
+    }
+}
+
+static void fiber_link(fiber_sched_t *sched, ud_fiber_t *fiber) {
+    fiber->all_next = sched->fibers;
+    fiber->all_prev = &sched->fibers;
+    if (sched->fibers) {
+        sched->fibers->all_prev = &fiber->all_next;
+    }
+    sched->fibers = fiber;
+}
+
+static void fiber_unlink(ud_fiber_t *fiber) {
+    *fiber->all_prev = fiber->all_next;
+    if (fiber->all_next) {
+        fiber->all_next->all_prev = fiber->all_prev;
+    }
+}
+
+static void fiber_suspend(ud_fiber_t *fiber) {
+#ifdef UD_FIBER_UCONTEXT
+    swapcontext(&fiber->ctx, &fiber->sched->main_ctx);
+#else
+    ud_fiber_switch(&fiber->sp, fiber->sched->main_sp);
+#endif
+}
+
+static void fiber_entry(void) {
+    ud_fiber_t *fiber = current;
+
+    fiber->fn(fiber->ud_state, fiber->context);
+
+    fiber->done = true;
+    fiber_suspend(fiber);
+    // never reached, as finished fibers are never resumed...
+    abort();
+}
+
+static int fiber_init(ud_fiber_t *fiber) {
+    uint8_t *top = (uint8_t *) fiber->stack.base + fiber->stack.size;
+
+#ifdef UD_FIBER_UCONTEXT
+    if (getcontext(&fiber->ctx) < 0) {
+        return -errno;
+    }
+    fiber->ctx.uc_stack.ss_sp = (uint8_t *) fiber->stack.base + page_size();
+    fiber->ctx.uc_stack.ss_size = fiber->stack.size - page_size();
+    fiber->ctx.uc_link = NULL;
+    makecontext(&fiber->ctx, fiber_entry, 0);
+#elif defined(__x86_64__)
+    // lay out the frame as ud_fiber_switch expects it, "returning" into
+    // fiber_entry with the stack aligned as if it were called...
+    uint64_t *sp = (uint64_t *) top;
+    *--sp = 0;
+    *--sp = (uint64_t) (uintptr_t) fiber_entry;
+    for (int i = 0; i < 6; i++) {
+        *--sp = 0;
+    }
+    // default MXCSR and x87 control word...
+    *--sp = 0x1f80 | ((uint64_t) 0x037f << 32);
+    fiber->sp = sp;
+#elif defined(__aarch64__)
+    uint64_t *sp = (uint64_t *) (top - 160);
+    for (int i = 0; i < 20; i++) {
+        sp[i] = 0;
+    }
+    // x30 (the link register) is restored from offset 88...
+    sp[11] = (uint64_t) (uintptr_t) fiber_entry;
+    fiber->sp = sp;
+#endif
+    (void) top;
+    return 0;
+}
+
+static void fiber_resume(ud_fiber_t *fiber) {
+    fiber_sched_t *sched = fiber->sched;
+
+    current = fiber;
+#ifdef UD_FIBER_UCONTEXT
+    swapcontext(&sched->main_ctx, &fiber->ctx);
+#else
+    ud_fiber_switch(&sched->main_sp, fiber->sp);
+#endif
+    current = NULL;
+
+    if (fiber->done) {
+        fiber_unlink(fiber);
+        stack_release(sched, &fiber->stack);
+        free(fiber);
+    }
+}
+
+static int run_timer(const ud_state_t *ud_state, const uint16_t interval, void *context);
+
+/**
+ * Appends a fiber to the run queue, making sure the run timer is scheduled.
+ *
+ * @return zero in case of success, or -ENOSPC if the run timer could not be
+ *         scheduled, in which case the fiber is not enqueued.
+ */
+static int run_enqueue(ud_fiber_t *fiber) {
+    fiber_sched_t *sched = fiber->sched;
+
+    if (!sched->run_armed) {
+        if (ud_schedule_timer(fiber->ud_state, 0, run_timer, sched)) {
+            return -ENOSPC;
+        }
+        sched->run_armed = true;
+    }
+
+    fiber->next = NULL;
+    if (sched->run_tail) {
+        sched->run_tail->next = fiber;
+    } else {
+        sched->run_head = fiber;
+    }
+    sched->run_tail = fiber;
+    return 0;
+}
+
+static int run_timer(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) interval;
+    fiber_sched_t *sched = context;
+
+    sched->run_armed = false;
+
+    // only run the fibers that are ready now, fibers that yield run again in
+    // the next iteration of the mainloop...
+    ud_fiber_t *tail = sched->run_tail;
+    while (sched->run_head) {
+        ud_fiber_t *fiber = sched->run_head;
+        sched->run_head = fiber->next;
+        if (!sched->run_head) {
+            sched->run_tail = NULL;
+        }
+
+        fiber_resume(fiber);
+
+        if (fiber == tail) {
+            break;
+        }
+    }
+
+    if (sched->run_head && !sched->run_armed && ud_schedule_timer(ud_state, 0, run_timer, sched) == 0) {
+        sched->run_armed = true;
+    }
+    return 0;
+}
+
+static int sleep_timer(const ud_state_t *ud_state, const uint16_t interval, void *context);
+
+static uint16_t sleep_interval(const ud_state_t *ud_state, const fiber_sched_t *sched) {
+    uint64_t now = ud_now(ud_state);
+    uint64_t deadline = sched->sleepers->deadline;
+    if (deadline <= now) {
+        return 0;
+    }
+    return deadline - now > TIMER_MAX ? TIMER_MAX : (uint16_t) (deadline - now);
+}
+
+/**
+ * Makes sure the sleep timer fires for the first sleeper.
+ *
+ * @return zero in case of success, or -ENOSPC if the sleep timer could not be
+ *         scheduled.
+ */
+static int sleep_arm(const ud_state_t *ud_state, fiber_sched_t *sched) {
+    if (sched->in_sleep_timer) {
+        // the timer re-arms itself when it is done...
+        return 0;
+    }
+    if (sched->sleep_armed) {
+        if (sched->sleep_deadline <= sched->sleepers->deadline) {
+            return 0;
+        }
+        ud_cancel_task(ud_state, sleep_timer, sched);
+        sched->sleep_armed = false;
+    }
+    if (ud_schedule_timer(ud_state, sleep_interval(ud_state, sched), sleep_timer, sched)) {
+        return -ENOSPC;
+    }
+    sched->sleep_armed = true;
+    sched->sleep_deadline = sched->sleepers->deadline;
+    return 0;
+}
+
+static int sleep_timer(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) interval;
+    fiber_sched_t *sched = context;
+
+    sched->sleep_armed = false;
+    sched->in_sleep_timer = true;
+
+    // take the expired sleepers off the list first, so fibers that sleep
+    // again (even for 0 ms) are woken up by the next run of the timer...
+    uint64_t now = ud_now(ud_state);
+    ud_fiber_t *expired = NULL;
+    ud_fiber_t **tail = &expired;
+    while (sched->sleepers && sched->sleepers->deadline <= now) {
+        *tail = sched->sleepers;
+        tail = &sched->sleepers->next;
+        sched->sleepers = sched->sleepers->next;
+    }
+    *tail = NULL;
+
+    while (expired) {
+        ud_fiber_t *fiber = expired;
+        expired = fiber->next;
+        fiber_resume(fiber);
+    }
+
+    sched->in_sleep_timer = false;
+
+    if (!sched->sleepers) {
+        return 0;
+    }
+    // reschedule ourselves for the next sleeper...
+    uint16_t next = sleep_interval(ud_state, sched);
+    sched->sleep_armed = true;
+    sched->sleep_deadline = sched->sleepers->deadline;
+    return next ? next : 1;
+}
+
+static ud_result_t fd_ready(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    ud_fiber_t *fiber = context;
+
+    fiber->revents = pollfd->revents;
+    // the handler is only needed for a single wakeup...
+    ud_remove_event_handler(ud_state, fiber->eh_id);
+
+    fiber_resume(fiber);
+
+    return RES_OK;
+}
+
+int ud_spawn_fiber(const ud_state_t *ud_state, ud_fiber_fn_t fn, void *context, size_t stack_size) {
+    if (!ud_state || !fn) {
+        return -EINVAL;
+    }
+
+    if (!stack_size) {
+        stack_size = UD_FIBER_STACK_SIZE;
+    } else if (stack_size < STACK_MIN) {
+        stack_size = STACK_MIN;
+    }
+    size_t page = page_size();
+    // round up to whole pages and add the guard page...
+    stack_size = ((stack_size + page - 1) & ~(page - 1)) + page;
+
+    fiber_sched_t *sched = sched_get(ud_state);
+    ud_fiber_t *fiber = sched ? calloc(1, sizeof(ud_fiber_t)) : NULL;
+    if (!fiber) {
+        return -ENOMEM;
+    }
+
+    int retval = stack_acquire(sched, &fiber->stack, stack_size);
+    if (retval) {
+        log_warning("Failed to allocate fiber stack: %d", retval);
+        free(fiber);
+        return retval;
+    }
+
+    fiber->ud_state = ud_state;
+    fiber->sched = sched;
+    fiber->fn = fn;
+    fiber->context = context;
+
+    retval = fiber_init(fiber);
+    if (retval) {
+        stack_release(sched, &fiber->stack);
+        free(fiber);
+        return retval;
+    }
+
+    retval = run_enqueue(fiber);
+    if (retval) {
+        log_warning("Failed to schedule fiber: %d", retval);
+        stack_release(sched, &fiber->stack);
+        free(fiber);
+        return retval;
+    }
+
+    fiber_link(sched, fiber);
+    return 0;
+}
+
+int ud_fiber_wait_fd(const ud_state_t *ud_state, int fd, short events) {
+    ud_fiber_t *fiber = current_fiber(ud_state);
+    if (!fiber) {
+        return -EINVAL;
+    }
+
+    if (ud_add_event_handler(ud_state, fd, events, fd_ready, fiber, &fiber->eh_id)) {
+        return -ENOSPC;
+    }
+    fiber->revents = 0;
+
+    fiber_suspend(fiber);
+
+    return fiber->revents;
+}
+
+int ud_fiber_sleep(const ud_state_t *ud_state, uint32_t millis) {
+    ud_fiber_t *fiber = current_fiber(ud_state);
+    if (!fiber) {
+        return -EINVAL;
+    }
+
+    fiber->deadline = ud_now(ud_state) + millis;
+
+    // keep the sleepers ordered by deadline, fibers sleeping equally long wake
+    // up in the order they went to sleep...
+    fiber_sched_t *sched = fiber->sched;
+    ud_fiber_t **pos = &sched->sleepers;
+    while (*pos && (*pos)->deadline <= fiber->deadline) {
+        pos = &(*pos)->next;
+    }
+    fiber->next = *pos;
+    *pos = fiber;
+
+    int retval = sleep_arm(ud_state, sched);
+    if (retval) {
+        *pos = fiber->next;
+        if (sched->sleepers) {
+            // keep the others sleeping, the cancelled timer freed its task...
+            sleep_arm(ud_state, sched);
+        }
+        return retval;
+    }
+
+    fiber_suspend(fiber);
+
+    return 0;
+}
+
+int ud_fiber_yield(const ud_state_t *ud_state) {
+    ud_fiber_t *fiber = current_fiber(ud_state);
+    if (!fiber) {
+        return -EINVAL;
+    }
+
+    int retval = run_enqueue(fiber);
+    if (retval) {
+        return retval;
+    }
+
+    fiber_suspend(fiber);
+
+    return 0;
+}
+
+/**
+ * Drops the scheduler of a state that is being destroyed, releasing the
+ * stacks of all fibers that are still waiting, which are never resumed.
+ */
+static void sched_drop(const ud_state_t *ud_state, void *data) {
+    (void) ud_state;
+    fiber_sched_t *sched = data;
+
+    // fibers that are still waiting are never resumed, so only their stacks are left...
+    while (sched->fibers) {
+        ud_fiber_t *fiber = sched->fibers;
+        sched->fibers = fiber->all_next;
+        munmap(fiber->stack.base, fiber->stack.size);
+        free(fiber);
+    }
+    for (int i = 0; i < sched->pool_count; i++) {
+        munmap(sched->pool[i].base, sched->pool[i].size);
+    }
+    free(sched);
+}
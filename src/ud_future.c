@@ -0,0 +1,509 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "udaemon/ud_future.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+#include "ud_module.h"
+
+// The maximum number of unused futures kept around for reuse...
+#define POOL_MAX 256
+// The longest interval a single timer can be scheduled for...
+#define TIMER_MAX UINT16_MAX
+
+struct future_sched;
+
+struct ud_future {
+    const ud_state_t *ud_state;
+    struct future_sched *sched;
+    uint32_t refs;
+
+    bool settled;
+    int error;
+    void *value;
+
+    /** the continuation to call, if this future is chained to another one. */
+    ud_future_fn_t fn;
+    void *context;
+    /** the combined future this future contributes to, if any. */
+    ud_future_t *target;
+    /** the number of futures that still need to resolve, for when_all. */
+    size_t remaining;
+
+    /** the futures chained to this future, each holding a reference. */
+    ud_future_t *chain_head;
+    ud_future_t *chain_tail;
+    /** the next future in the chain, or in the pool. */
+    ud_future_t *next;
+
+    /** the deadline (in ms) while this future has a timeout. */
+    bool timed;
+    uint64_t deadline;
+    ud_future_t *timeout_next;
+
+    /** used to settle the future from other threads. */
+    ud_post_t post;
+    bool posted;
+    int post_error;
+    void *post_value;
+};
+
+/**
+ * Each state has a pool and timeouts of its own, which are only used on the
+ * thread running its mainloop, so they need no locking. Once the state is
+ * destroyed, this is kept until its last future is released.
+ */
+typedef struct future_sched {
+    const ud_state_t *ud_state;
+
+    ud_future_t *pool;
+    int pool_count;
+    /** the number of futures in use. */
+    uint32_t live;
+    bool destroyed;
+
+    /** the futures with a timeout, ordered by their deadline, each holding a reference. */
+    ud_future_t *timeouts;
+    uint64_t timer_deadline;
+    bool timer_armed;
+    bool in_timer;
+} future_sched_t;
+
+static void sched_drop(const ud_state_t *ud_state, void *data);
+
+static future_sched_t *sched_get(const ud_state_t *ud_state) {
+    future_sched_t *sched = ud_module_get(ud_state, UD_MODULE_FUTURE);
+    if (!sched && (sched = calloc(1, sizeof(future_sched_t))) != NULL) {
+        sched->ud_state = ud_state;
+        ud_module_set(ud_state, UD_MODULE_FUTURE, sched, sched_drop);
+    }
+    return sched;
+}
+
+static ud_future_t *future_alloc(future_sched_t *sched) {
+    ud_future_t *future = sched->pool;
+    if (future) {
+        sched->pool = future->next;
+        sched->pool_count--;
+    } else {
+        future = malloc(sizeof(ud_future_t));
+        if (!future) {
+            return NULL;
+        }
+    }
+    sched->live++;
+
+    *future = (ud_future_t) {
+        .ud_state = sched->ud_state,
+        .sched = sched,
+        .refs = 1,
+    };
+    return future;
+}
+
+static void future_free(ud_future_t *future) {
+    // chained futures are never called once their source is gone...
+    ud_future_t *chained = future->chain_head;
+    while (chained) {
+        ud_future_t *next = chained->next;
+        ud_future_release(chained);
+        chained = next;
+    }
+    ud_future_release(future->target);
+
+    future_sched_t *sched = future->sched;
+    sched->live--;
+    if (sched->destroyed) {
+        free(future);
+        if (!sched->live) {
+            free(sched);
+        }
+    } else if (sched->pool_count < POOL_MAX) {
+        future->next = sched->pool;
+        sched->pool = future;
+        sched->pool_count++;
+    } else {
+        free(future);
+    }
+}
+
+static void timeout_unlink(ud_future_t *future) {
+    ud_future_t **pos = &future->sched->timeouts;
+    while (*pos && *pos != future) {
+        pos = &(*pos)->timeout_next;
+    }
+    if (*pos) {
+        *pos = future->timeout_next;
+    }
+    future->timed = false;
+}
+
+static int settle(ud_future_t *future, int error, void *value) {
+    if (future->settled) {
+        return -EALREADY;
+    }
+
+    future->settled = true;
+    future->error = error;
+    future->value = error ? NULL : value;
+
+    // keep the future alive while its continuations run...
+    ud_future_ref(future);
+
+    if (future->timed) {
+        timeout_unlink(future);
+        ud_future_release(future);
+    }
+
+    while (future->chain_head) {
+        ud_future_t *chained = future->chain_head;
+        future->chain_head = chained->next;
+        if (!future->chain_head) {
+            future->chain_tail = NULL;
+        }
+        chained->next = NULL;
+
+        chained->fn(future->ud_state, future, chained, chained->context);
+        ud_future_release(chained);
+    }
+
+    ud_future_release(future);
+    return 0;
+}
+
+/**
+ * Chains a future to another one, the chain takes over the reference to the
+ * chained future.
+ */
+static void chain(ud_future_t *future, ud_future_t *chained) {
+    if (future->settled) {
+        chained->fn(future->ud_state, future, chained, chained->context);
+        ud_future_release(chained);
+        return;
+    }
+
+    if (future->chain_tail) {
+        future->chain_tail->next = chained;
+    } else {
+        future->chain_head = chained;
+    }
+    future->chain_tail = chained;
+}
+
+ud_future_t *ud_future_create(const ud_state_t *ud_state) {
+    if (!ud_state) {
+        return NULL;
+    }
+    future_sched_t *sched = sched_get(ud_state);
+    return sched ? future_alloc(sched) : NULL;
+}
+
+ud_future_t *ud_future_ref(ud_future_t *future) {
+    if (future) {
+        future->refs++;
+    }
+    return future;
+}
+
+void ud_future_release(ud_future_t *future) {
+    if (future && --future->refs == 0) {
+        future_free(future);
+    }
+}
+
+int ud_future_resolve(ud_future_t *future, void *value) {
+    if (!future) {
+        return -EINVAL;
+    }
+    return settle(future, 0, value);
+}
+
+int ud_future_reject(ud_future_t *future, int error) {
+    if (!future || error >= 0) {
+        return -EINVAL;
+    }
+    return settle(future, error, NULL);
+}
+
+static void post_settle(const ud_state_t *ud_state, ud_post_t *post) {
+    (void) ud_state;
+
+    ud_future_t *future = (ud_future_t *) ((char *) post - offsetof(ud_future_t, post));
+
+    // the future might already be settled, for example, by a timeout...
+    settle(future, future->post_error, future->post_value);
+    ud_future_release(future);
+}
+
+int ud_future_post(ud_future_t *future, int error, void *value) {
+    if (!future || error > 0) {
+        return -EINVAL;
+    }
+    if (future->posted) {
+        return -EALREADY;
+    }
+
+    future->posted = true;
+    future->post_error = error;
+    future->post_value = value;
+    future->post.fn = post_settle;
+
+    int retval = ud_post(future->ud_state, &future->post);
+    if (retval) {
+        // not queued, so the caller keeps its reference and can try again...
+        future->posted = false;
+    }
+    return retval;
+}
+
+bool ud_future_done(const ud_future_t *future) {
+    return future && future->settled;
+}
+
+int ud_future_error(const ud_future_t *future) {
+    if (!future) {
+        return -EINVAL;
+    }
+    return future->settled ? future->error : -EINPROGRESS;
+}
+
+void *ud_future_value(const ud_future_t *future) {
+    return (future && future->settled) ? future->value : NULL;
+}
+
+ud_future_t *ud_future_then(ud_future_t *future, ud_future_fn_t fn, void *context) {
+    if (!future || !fn) {
+        return NULL;
+    }
+
+    ud_future_t *next = future_alloc(future->sched);
+    if (!next) {
+        return NULL;
+    }
+    next->fn = fn;
+    next->context = context;
+
+    // one reference for the caller, one for the chain...
+    chain(future, ud_future_ref(next));
+
+    return next;
+}
+
+static void all_settled(const ud_state_t *ud_state, ud_future_t *future, ud_future_t *next, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    ud_future_t *target = next->target;
+    if (target->settled) {
+        return;
+    }
+    if (future->error) {
+        settle(target, future->error, NULL);
+    } else if (--target->remaining == 0) {
+        settle(target, 0, NULL);
+    }
+}
+
+static void any_settled(const ud_state_t *ud_state, ud_future_t *future, ud_future_t *next, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    ud_future_t *target = next->target;
+    if (!target->settled) {
+        settle(target, future->error, future->value);
+    }
+}
+
+static ud_future_t *combine(const ud_state_t *ud_state, ud_future_t *const *futures, size_t count,
+                            ud_future_fn_t fn) {
+    future_sched_t *sched = sched_get(ud_state);
+    ud_future_t *combined = sched ? future_alloc(sched) : NULL;
+    if (!combined) {
+        return NULL;
+    }
+    combined->remaining = count;
+
+    for (size_t i = 0; i < count && !combined->settled; i++) {
+        ud_future_t *node = future_alloc(sched);
+        if (!node) {
+            log_warning("Failed to allocate future!");
+            ud_future_release(combined);
+            return NULL;
+        }
+        node->fn = fn;
+        node->target = ud_future_ref(combined);
+
+        chain(futures[i], node);
+    }
+
+    return combined;
+}
+
+ud_future_t *ud_future_when_all(const ud_state_t *ud_state, ud_future_t *const *futures, size_t count) {
+    if (!ud_state || (!futures && count)) {
+        return NULL;
+    }
+
+    ud_future_t *combined = combine(ud_state, futures, count, all_settled);
+    if (combined && !count) {
+        settle(combined, 0, NULL);
+    }
+    return combined;
+}
+
+ud_future_t *ud_future_when_any(const ud_state_t *ud_state, ud_future_t *const *futures, size_t count) {
+    if (!ud_state || !futures || !count) {
+        return NULL;
+    }
+    return combine(ud_state, futures, count, any_settled);
+}
+
+static int timeout_timer(const ud_state_t *ud_state, const uint16_t interval, void *context);
+
+static uint16_t timeout_interval(const ud_state_t *ud_state, const future_sched_t *sched) {
+    uint64_t now = ud_now(ud_state);
+    uint64_t deadline = sched->timeouts->deadline;
+    if (deadline <= now) {
+        return 0;
+    }
+    return deadline - now > TIMER_MAX ? TIMER_MAX : (uint16_t) (deadline - now);
+}
+
+/**
+ * Makes sure the timeout timer fires for the first timeout.
+ *
+ * @return zero in case of success, or -ENOSPC if the timeout timer could not
+ *         be scheduled.
+ */
+static int timeout_arm(const ud_state_t *ud_state, future_sched_t *sched) {
+    if (sched->in_timer) {
+        // the timer re-arms itself when it is done...
+        return 0;
+    }
+    if (sched->timer_armed) {
+        if (sched->timer_deadline <= sched->timeouts->deadline) {
+            return 0;
+        }
+        ud_cancel_task(ud_state, timeout_timer, sched);
+        sched->timer_armed = false;
+    }
+    if (ud_schedule_timer(ud_state, timeout_interval(ud_state, sched), timeout_timer, sched)) {
+        return -ENOSPC;
+    }
+    sched->timer_armed = true;
+    sched->timer_deadline = sched->timeouts->deadline;
+    return 0;
+}
+
+static int timeout_timer(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) interval;
+    future_sched_t *sched = context;
+
+    sched->timer_armed = false;
+    sched->in_timer = true;
+
+    uint64_t now = ud_now(ud_state);
+    while (sched->timeouts && sched->timeouts->deadline <= now) {
+        // settling unlinks the future and drops the reference of the timeout,
+        // so it is not touched afterwards...
+        settle(sched->timeouts, -ETIMEDOUT, NULL);
+    }
+
+    sched->in_timer = false;
+
+    if (!sched->timeouts) {
+        return 0;
+    }
+    // reschedule ourselves for the next timeout...
+    uint16_t next = timeout_interval(ud_state, sched);
+    sched->timer_armed = true;
+    sched->timer_deadline = sched->timeouts->deadline;
+    return next ? next : 1;
+}
+
+int ud_future_timeout(ud_future_t *future, uint32_t millis) {
+    if (!future) {
+        return -EINVAL;
+    }
+    if (future->settled) {
+        return -EALREADY;
+    }
+    future_sched_t *sched = future->sched;
+    if (sched->destroyed) {
+        // there is no mainloop left to time out on...
+        return -ESRCH;
+    }
+
+    if (future->timed) {
+        timeout_unlink(future);
+    } else {
+        // the list of timeouts keeps the future alive...
+        ud_future_ref(future);
+    }
+
+    future->timed = true;
+    future->deadline = ud_now(future->ud_state) + millis;
+
+    ud_future_t **pos = &sched->timeouts;
+    while (*pos && (*pos)->deadline <= future->deadline) {
+        pos = &(*pos)->timeout_next;
+    }
+    future->timeout_next = *pos;
+    *pos = future;
+
+    int retval = timeout_arm(future->ud_state, sched);
+    if (retval) {
+        *pos = future->timeout_next;
+        future->timed = false;
+        if (sched->timeouts) {
+            // keep the others timing out, the cancelled timer freed its task...
+            timeout_arm(future->ud_state, sched);
+        }
+        // no longer kept alive by the list of timeouts...
+        ud_future_release(future);
+        return retval;
+    }
+    return 0;
+}
+
+/**
+ * Drops the pool and the timeouts of a state that is being destroyed. Futures
+ * that are still referenced stay valid until they are released, but never
+ * time out.
+ */
+static void sched_drop(const ud_state_t *ud_state, void *data) {
+    (void) ud_state;
+    future_sched_t *sched = data;
+
+    // keep it around while we release the futures below...
+    sched->live++;
+    sched->destroyed = true;
+
+    // futures that did not time out yet never will, as their mainloop is gone...
+    while (sched->timeouts) {
+        ud_future_t *future = sched->timeouts;
+        sched->timeouts = future->timeout_next;
+        future->timed = false;
+        ud_future_release(future);
+    }
+    while (sched->pool) {
+        ud_future_t *future = sched->pool;
+        sched->pool = future->next;
+        free(future);
+    }
+    sched->pool_count = 0;
+
+    if (--sched->live == 0) {
+        free(sched);
+    }
+}
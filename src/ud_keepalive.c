@@ -0,0 +1,186 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "udaemon/ud_keepalive.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+// The number of slots of the timing wheel, should be a power of two...
+#define WHEEL_SIZE 512
+#define WHEEL_MASK (WHEEL_SIZE - 1)
+
+struct ud_keepalive {
+    const ud_state_t *ud_state;
+    uint16_t tick;
+    /** the last tick that is processed. */
+    uint64_t current;
+    /** the slots of the wheel, each the sentinel of a circular list. */
+    ud_keepalive_entry_t slots[WHEEL_SIZE];
+};
+
+static void list_init(ud_keepalive_entry_t *head) {
+    head->prev = head->next = head;
+}
+
+static void list_append(ud_keepalive_entry_t *head, ud_keepalive_entry_t *entry) {
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+static void list_unlink(ud_keepalive_entry_t *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->prev = entry->next = NULL;
+}
+
+static void wheel_place(ud_keepalive_t *keepalive, ud_keepalive_entry_t *entry) {
+    uint64_t ticks = (entry->deadline + keepalive->tick - 1) / keepalive->tick;
+    if (ticks <= keepalive->current) {
+        ticks = keepalive->current + 1;
+    }
+    // deadlines beyond a single rotation simply wait for another round...
+    list_append(&keepalive->slots[ticks & WHEEL_MASK], entry);
+}
+
+static uint64_t entry_activity(const ud_keepalive_t *keepalive, const ud_keepalive_entry_t *entry) {
+    uint64_t activity = entry->last_activity;
+    if (entry->eh_id != UD_INVALID_ID) {
+        uint64_t dispatched = ud_last_activity(keepalive->ud_state, entry->eh_id);
+        if (dispatched > activity) {
+            activity = dispatched;
+        }
+    }
+    return activity;
+}
+
+static void wheel_expire(ud_keepalive_t *keepalive, ud_keepalive_entry_t *slot, uint64_t now) {
+    // take all entries out of the slot, as entries can end up in the same slot again...
+    ud_keepalive_entry_t expired;
+    if (slot->next == slot) {
+        return;
+    }
+    expired.next = slot->next;
+    expired.prev = slot->prev;
+    expired.next->prev = &expired;
+    expired.prev->next = &expired;
+    list_init(slot);
+
+    // callbacks are allowed to add and remove entries, including these...
+    while (expired.next != &expired) {
+        ud_keepalive_entry_t *entry = expired.next;
+        list_unlink(entry);
+
+        uint64_t deadline = entry_activity(keepalive, entry) + entry->timeout;
+        if (deadline > now) {
+            // there was activity in the meantime...
+            entry->deadline = deadline;
+            wheel_place(keepalive, entry);
+        } else {
+            entry->cb(keepalive->ud_state, entry, entry->context);
+        }
+    }
+}
+
+static int keepalive_tick(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    ud_keepalive_t *keepalive = context;
+
+    uint64_t now = ud_now(ud_state);
+    uint64_t target = now / keepalive->tick;
+
+    // no need to go around more than once...
+    if (target - keepalive->current > WHEEL_SIZE) {
+        keepalive->current = target - WHEEL_SIZE;
+    }
+    while (keepalive->current < target) {
+        keepalive->current++;
+        wheel_expire(keepalive, &keepalive->slots[keepalive->current & WHEEL_MASK], now);
+    }
+
+    return interval;
+}
+
+ud_keepalive_t *ud_keepalive_create(const ud_state_t *ud_state, uint16_t tick) {
+    if (!ud_state) {
+        return NULL;
+    }
+
+    ud_keepalive_t *keepalive = malloc(sizeof(ud_keepalive_t));
+    if (!keepalive) {
+        return NULL;
+    }
+
+    keepalive->ud_state = ud_state;
+    keepalive->tick = tick ? tick : UD_KEEPALIVE_TICK;
+    keepalive->current = ud_now(ud_state) / keepalive->tick;
+    for (int i = 0; i < WHEEL_SIZE; i++) {
+        list_init(&keepalive->slots[i]);
+    }
+
+    if (ud_schedule_timer(ud_state, keepalive->tick, keepalive_tick, keepalive)) {
+        log_warning("Failed to schedule keepalive timer!");
+        free(keepalive);
+        return NULL;
+    }
+
+    return keepalive;
+}
+
+void ud_keepalive_destroy(ud_keepalive_t *keepalive) {
+    if (!keepalive) {
+        return;
+    }
+
+    ud_cancel_task(keepalive->ud_state, keepalive_tick, keepalive);
+
+    // mark all remaining entries as no longer tracked...
+    for (int i = 0; i < WHEEL_SIZE; i++) {
+        ud_keepalive_entry_t *slot = &keepalive->slots[i];
+        while (slot->next != slot) {
+            list_unlink(slot->next);
+        }
+    }
+    free(keepalive);
+}
+
+int ud_keepalive_add(ud_keepalive_t *keepalive, ud_keepalive_entry_t *entry, uint32_t timeout) {
+    if (!keepalive || !entry || !entry->cb || !timeout) {
+        return -EINVAL;
+    }
+
+    if (entry->next) {
+        list_unlink(entry);
+    }
+
+    entry->timeout = timeout;
+    entry->last_activity = ud_now(keepalive->ud_state);
+    entry->deadline = entry->last_activity + timeout;
+
+    wheel_place(keepalive, entry);
+    return 0;
+}
+
+void ud_keepalive_remove(ud_keepalive_t *keepalive, ud_keepalive_entry_t *entry) {
+    (void) keepalive;
+
+    if (entry && entry->next) {
+        list_unlink(entry);
+    }
+}
+
+void ud_keepalive_touch(const ud_keepalive_t *keepalive, ud_keepalive_entry_t *entry) {
+    entry->last_activity = ud_now(keepalive->ud_state);
+}
+
+bool ud_keepalive_tracked(const ud_keepalive_entry_t *entry) {
+    return entry && entry->next;
+}
@@ -9,19 +9,69 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <string.h>
 #include <syslog.h>
 #include <time.h>
 
+#include "ud_trace.h"
 #include "udaemon/ud_logging.h"
 
+// The maximum number of modules with their own loglevel...
+#define MODULE_MAX 16
+#define MODULE_NAME_MAX 32
+
 static struct _log_config {
     bool initialized;
     bool foreground;
+    /** the loglevel of all modules without a loglevel of their own. */
+    loglevel_t level;
+    int module_count;
+    struct {
+        char name[MODULE_NAME_MAX];
+        loglevel_t level;
+    } modules[MODULE_MAX];
 } log_config = {
     .initialized = false,
     .foreground = true,
+    .level = DEBUG,
 };
 
+static int LEVEL[] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR };
+
+/**
+ * Lets syslog pass all messages of the most verbose loglevel in use, the
+ * loglevels of the individual modules are applied by ourselves.
+ */
+static void update_logmask(void) {
+    loglevel_t level = log_config.level;
+    for (int i = 0; i < log_config.module_count; i++) {
+        if (log_config.modules[i].level < level) {
+            level = log_config.modules[i].level;
+        }
+    }
+    setlogmask(LOG_UPTO(LEVEL[level]));
+}
+
+/**
+ * @return the loglevel of the module of the given source file.
+ */
+static loglevel_t module_level(const char *file) {
+    if (!file || !log_config.module_count) {
+        return log_config.level;
+    }
+
+    const char *name = strrchr(file, '/');
+    name = name ? name + 1 : file;
+    size_t len = strcspn(name, ".");
+
+    for (int i = 0; i < log_config.module_count; i++) {
+        if (strncmp(log_config.modules[i].name, name, len) == 0 && log_config.modules[i].name[len] == '\0') {
+            return log_config.modules[i].level;
+        }
+    }
+    return log_config.level;
+}
+
 void init_logging(void) {
     if (log_config.initialized) {
         // Already initialized; do not do this again...
@@ -60,26 +110,60 @@ void setup_logging(bool foreground) {
 }
 
 void set_loglevel(loglevel_t loglevel) {
-    int mask;
-    if (loglevel == DEBUG) {
-        mask = LOG_UPTO(LOG_DEBUG);
-    } else if (loglevel == WARNING) {
-        mask = LOG_UPTO(LOG_WARNING);
-    } else if (loglevel == ERROR) {
-        mask = LOG_UPTO(LOG_ERR);
-    } else {
-        mask = LOG_UPTO(LOG_INFO);
+    if (loglevel > ERROR) {
+        loglevel = INFO;
     }
-    setlogmask(mask);
+    log_config.level = loglevel;
+    update_logmask();
 }
 
-static int LEVEL[] = { LOG_DEBUG, LOG_INFO, LOG_WARNING, LOG_ERR };
+int set_module_loglevel(const char *module, loglevel_t loglevel) {
+    if (!module || strlen(module) >= MODULE_NAME_MAX || loglevel > ERROR) {
+        return -EINVAL;
+    }
+
+    int i = 0;
+    while (i < log_config.module_count && strcmp(log_config.modules[i].name, module) != 0) {
+        i++;
+    }
+    if (i == log_config.module_count) {
+        if (i == MODULE_MAX) {
+            return -ENOMEM;
+        }
+        strcpy(log_config.modules[i].name, module);
+        log_config.module_count++;
+    }
+    log_config.modules[i].level = loglevel;
+
+    update_logmask();
+    return 0;
+}
+
+__attribute__((__format__ (__printf__, 3, 0)))
+static void vlog_msg(const loglevel_t level, const char *file, const char *msg, va_list ap) {
+    if (level < module_level(file)) {
+        return;
+    }
+
+    // only the format is passed, as formatting is too costly when not traced...
+    UD_TRACE2(log, level, msg);
+
+    init_logging();
+    vsyslog(LEVEL[level], msg, ap);
+}
 
 __attribute__((__format__ (__printf__, 2, 0)))
 void log_msg(const loglevel_t level, const char *msg, ...) {
     va_list ap;
     va_start(ap, msg);
-    init_logging();
-    vsyslog(LEVEL[level], msg, ap);
+    vlog_msg(level, NULL, msg, ap);
+    va_end(ap);
+}
+
+__attribute__((__format__ (__printf__, 3, 0)))
+void log_msg_from(const loglevel_t level, const char *file, const char *msg, ...) {
+    va_list ap;
+    va_start(ap, msg);
+    vlog_msg(level, file, msg, ap);
     va_end(ap);
 }
@@ -0,0 +1,63 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_MODULE_H_
+#define UD_MODULE_H_
+
+#include "udaemon/udaemon.h"
+
+/**
+ * The modules that keep data of their own in each state. The data of the
+ * modules is dropped in this order once the state is destroyed.
+ */
+typedef enum ud_module {
+    UD_MODULE_RESOLVE,
+    UD_MODULE_FIBER,
+    UD_MODULE_FUTURE,
+    UD_MODULE_BUS,
+    UD_MODULE_COUNT,
+} ud_module_t;
+
+/**
+ * Called when the state of a module's data is destroyed, to release it.
+ *
+ * @param ud_state the state that is being destroyed;
+ * @param data the data of the module in this state.
+ */
+typedef void (*ud_module_drop_t)(const ud_state_t *ud_state, void *data);
+
+/**
+ * Returns the data of a module in a state. Like the data itself, this should
+ * only be used on the thread running the mainloop of the state.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param module the module to return the data of.
+ * @return the data of the module, or NULL if it has none (yet).
+ */
+void *ud_module_get(const ud_state_t *ud_state, ud_module_t module);
+
+/**
+ * Sets the data of a module in a state.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param module the module to set the data of;
+ * @param data the data of the module;
+ * @param drop the function that releases the data once the state is destroyed.
+ */
+void ud_module_set(const ud_state_t *ud_state, ud_module_t module, void *data, ud_module_drop_t drop);
+
+/**
+ * Takes the posts with a given function out of the queue of a state that is
+ * being destroyed, as their function is never called anymore (see #ud_post).
+ * Should only be called from the drop function of a module.
+ *
+ * @param ud_state the udaemon state to use, cannot be NULL;
+ * @param fn the function of the posts to take.
+ * @return the taken posts in order of posting, linked by their `next` field.
+ */
+ud_post_t *ud_module_take_posts(const ud_state_t *ud_state, void (*fn)(const ud_state_t *, ud_post_t *));
+
+#endif /* UD_MODULE_H_ */
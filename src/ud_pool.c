@@ -0,0 +1,583 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/ud_pool.h"
+#include "udaemon/udaemon.h"
+
+// The defaults for the configuration...
+#define DEFAULT_MAX_CONNS 4
+#define DEFAULT_CONNECT_TIMEOUT 5000
+// The time (in ms) an endpoint is skipped after a failed connect...
+#define DOWN_TIME 1000
+
+typedef enum conn_state {
+    CONN_FREE = 0,
+    CONN_CONNECTING,
+    CONN_IDLE,
+    CONN_BUSY,
+} conn_state_t;
+
+typedef struct pool_endpoint pool_endpoint_t;
+
+typedef struct pool_conn {
+    ud_pool_t *pool;
+    pool_endpoint_t *endpoint;
+    conn_state_t state;
+    int fd;
+    /** the event handler while connecting. */
+    eh_id_t eh_id;
+    /** the time (in ms) the connect started, or the connection became idle. */
+    uint64_t since;
+    /** the time (in µs) the connect started. */
+    uint64_t started;
+    /** the time (in ms) the connection was last probed. */
+    uint64_t probed;
+} pool_conn_t;
+
+struct pool_endpoint {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    /** the time (in ms) until which the endpoint is not connected to. */
+    uint64_t down_until;
+    /** the number of connections in each state. */
+    uint8_t connecting;
+    uint8_t idle;
+    uint8_t busy;
+    /** the connections, max_conns in total. */
+    pool_conn_t *conns;
+};
+
+typedef struct pool_waiter {
+    ud_pool_cb_t cb;
+    void *context;
+    struct pool_waiter *next;
+} pool_waiter_t;
+
+struct ud_pool {
+    const ud_state_t *ud_state;
+    ud_pool_config_t config;
+
+    pool_endpoint_t **endpoints;
+    size_t count;
+    /** the endpoint at which the next round-robin selection starts. */
+    size_t rr_next;
+
+    /** the acquisitions waiting for a connection, in order of request. */
+    pool_waiter_t *waiters;
+    pool_waiter_t *waiters_tail;
+    size_t waiting;
+
+    /** the error of the last failed connect. */
+    int last_error;
+    /** true while waiters are being served, to prevent recursion from callbacks. */
+    bool dispatching;
+    /** true if the pool is destroyed by a callback, and is freed once dispatching ends. */
+    bool destroyed;
+
+    ud_pool_stats_t stats;
+};
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static uint8_t *state_counter(pool_endpoint_t *endpoint, conn_state_t state) {
+    switch (state) {
+    case CONN_CONNECTING:
+        return &endpoint->connecting;
+    case CONN_IDLE:
+        return &endpoint->idle;
+    case CONN_BUSY:
+        return &endpoint->busy;
+    default:
+        return NULL;
+    }
+}
+
+static void conn_set_state(pool_conn_t *conn, conn_state_t state) {
+    uint8_t *counter = state_counter(conn->endpoint, conn->state);
+    if (counter) {
+        (*counter)--;
+    }
+    conn->state = state;
+    counter = state_counter(conn->endpoint, state);
+    if (counter) {
+        (*counter)++;
+    }
+}
+
+static void conn_close(pool_conn_t *conn) {
+    if (conn->state == CONN_CONNECTING) {
+        ud_remove_event_handler(conn->pool->ud_state, conn->eh_id);
+    }
+    close(conn->fd);
+    conn->fd = -1;
+    conn_set_state(conn, CONN_FREE);
+}
+
+static int endpoint_total(const pool_endpoint_t *endpoint) {
+    return endpoint->connecting + endpoint->idle + endpoint->busy;
+}
+
+static bool can_connect(const ud_pool_t *pool, const pool_endpoint_t *endpoint) {
+    return endpoint->down_until <= ud_now(pool->ud_state) &&
+           endpoint_total(endpoint) < pool->config.max_conns;
+}
+
+static bool has_idle(const ud_pool_t *pool, const pool_endpoint_t *endpoint) {
+    (void) pool;
+    return endpoint->idle > 0;
+}
+
+/**
+ * Selects an endpoint that matches a given predicate, according to the
+ * configured selection policy.
+ */
+static pool_endpoint_t *select_endpoint(ud_pool_t *pool,
+                                        bool (*pred)(const ud_pool_t *, const pool_endpoint_t *)) {
+    pool_endpoint_t *selected = NULL;
+    size_t selected_idx = 0;
+
+    for (size_t i = 0; i < pool->count; i++) {
+        size_t idx = (pool->rr_next + i) % pool->count;
+        pool_endpoint_t *endpoint = pool->endpoints[idx];
+        if (!pred(pool, endpoint)) {
+            continue;
+        }
+        if (pool->config.select == UD_POOL_ROUND_ROBIN) {
+            selected = endpoint;
+            selected_idx = idx;
+            break;
+        }
+        if (!selected || endpoint->busy < selected->busy) {
+            selected = endpoint;
+            selected_idx = idx;
+        }
+    }
+
+    if (selected) {
+        pool->rr_next = selected_idx + 1;
+    }
+    return selected;
+}
+
+static pool_conn_t *find_conn(pool_endpoint_t *endpoint, conn_state_t state, int max_conns) {
+    for (int i = 0; i < max_conns; i++) {
+        if (endpoint->conns[i].state == state) {
+            return &endpoint->conns[i];
+        }
+    }
+    return NULL;
+}
+
+static bool pool_dispatch(ud_pool_t *pool);
+
+static void connect_done(pool_conn_t *conn, int error) {
+    ud_pool_t *pool = conn->pool;
+
+    ud_remove_event_handler(pool->ud_state, conn->eh_id);
+
+    if (error) {
+        log_debug("Failed to connect pooled connection: %s", strerror(-error));
+
+        close(conn->fd);
+        conn->fd = -1;
+        conn_set_state(conn, CONN_FREE);
+
+        conn->endpoint->down_until = ud_now(pool->ud_state) + DOWN_TIME;
+        pool->last_error = error;
+        pool->stats.connect_failures++;
+    } else {
+        uint64_t elapsed = monotonic_us() - conn->started;
+
+        conn_set_state(conn, CONN_IDLE);
+        conn->since = conn->probed = ud_now(pool->ud_state);
+
+        pool->stats.connects++;
+        pool->stats.connect_time_total += elapsed;
+        if (elapsed > pool->stats.connect_time_max) {
+            pool->stats.connect_time_max = elapsed;
+        }
+    }
+
+    pool_dispatch(pool);
+}
+
+static ud_result_t connect_ready(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) ud_state;
+
+    int error = 0;
+    socklen_t len = sizeof(error);
+    if (getsockopt(pollfd->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+        error = errno;
+    }
+
+    connect_done(context, -error);
+
+    return RES_OK;
+}
+
+static void conn_start(ud_pool_t *pool, pool_endpoint_t *endpoint) {
+    pool_conn_t *conn = find_conn(endpoint, CONN_FREE, pool->config.max_conns);
+    if (!conn) {
+        return;
+    }
+
+    int error = 0;
+    int fd = socket(endpoint->addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        error = -errno;
+    } else if (connect(fd, (const struct sockaddr *) &endpoint->addr, endpoint->addrlen) < 0 &&
+               errno != EINPROGRESS) {
+        error = -errno;
+    } else if (ud_add_event_handler(pool->ud_state, fd, POLLOUT, connect_ready, conn, &conn->eh_id)) {
+        error = -ENOSPC;
+    }
+
+    conn->fd = fd;
+    conn->started = monotonic_us();
+    conn->since = ud_now(pool->ud_state);
+    conn_set_state(conn, CONN_CONNECTING);
+
+    if (error) {
+        // do not try to remove a handler that was never added...
+        conn->eh_id = UD_INVALID_ID;
+        connect_done(conn, error);
+    }
+}
+
+static void pool_free(ud_pool_t *pool) {
+    for (size_t i = 0; i < pool->count; i++) {
+        free(pool->endpoints[i]->conns);
+        free(pool->endpoints[i]);
+    }
+    free(pool->endpoints);
+    free(pool);
+}
+
+/**
+ * Serves the waiters as far as possible.
+ *
+ * @return false if a callback destroyed the pool, which is freed by now.
+ */
+static bool pool_dispatch(ud_pool_t *pool) {
+    if (pool->dispatching) {
+        return true;
+    }
+    pool->dispatching = true;
+
+    while (pool->waiters) {
+        pool_endpoint_t *endpoint = select_endpoint(pool, has_idle);
+        if (endpoint) {
+            pool_conn_t *conn = find_conn(endpoint, CONN_IDLE, pool->config.max_conns);
+            conn_set_state(conn, CONN_BUSY);
+
+            pool_waiter_t *waiter = pool->waiters;
+            pool->waiters = waiter->next;
+            if (!pool->waiters) {
+                pool->waiters_tail = NULL;
+            }
+            pool->waiting--;
+
+            waiter->cb(pool->ud_state, conn->fd, waiter->context);
+            free(waiter);
+            if (pool->destroyed) {
+                break;
+            }
+            continue;
+        }
+
+        size_t connecting = 0;
+        size_t busy = 0;
+        for (size_t i = 0; i < pool->count; i++) {
+            connecting += pool->endpoints[i]->connecting;
+            busy += pool->endpoints[i]->busy;
+        }
+
+        if (connecting < pool->waiting) {
+            endpoint = select_endpoint(pool, can_connect);
+            if (endpoint) {
+                // either connects, or marks the endpoint as down...
+                conn_start(pool, endpoint);
+                continue;
+            }
+        }
+
+        if (connecting || busy) {
+            // wait for a connect to finish or a connection to be released...
+            break;
+        }
+
+        // nothing is going to free up, so give up on this one...
+        pool_waiter_t *waiter = pool->waiters;
+        pool->waiters = waiter->next;
+        if (!pool->waiters) {
+            pool->waiters_tail = NULL;
+        }
+        pool->waiting--;
+
+        waiter->cb(pool->ud_state, pool->last_error ? pool->last_error : -EHOSTUNREACH, waiter->context);
+        free(waiter);
+        if (pool->destroyed) {
+            break;
+        }
+    }
+
+    pool->dispatching = false;
+    if (pool->destroyed) {
+        pool_free(pool);
+        return false;
+    }
+    return true;
+}
+
+static int default_probe(int fd, void *context) {
+    (void) context;
+
+    uint8_t buf;
+    ssize_t n = recv(fd, &buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    // closed by the peer, failed or unsolicited data...
+    return -1;
+}
+
+static int pool_tick(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    ud_pool_t *pool = context;
+    const ud_pool_config_t *config = &pool->config;
+    uint64_t now = ud_now(ud_state);
+
+    // serve the waiters only once all connections are checked...
+    pool->dispatching = true;
+
+    for (size_t i = 0; i < pool->count; i++) {
+        pool_endpoint_t *endpoint = pool->endpoints[i];
+
+        for (int j = 0; j < config->max_conns; j++) {
+            pool_conn_t *conn = &endpoint->conns[j];
+
+            if (conn->state == CONN_CONNECTING && now - conn->since >= config->connect_timeout) {
+                connect_done(conn, -ETIMEDOUT);
+            } else if (conn->state == CONN_IDLE) {
+                if (config->idle_timeout && now - conn->since >= config->idle_timeout &&
+                        endpoint->idle > config->min_idle) {
+                    conn_close(conn);
+                    pool->stats.evictions++;
+                } else if (config->probe_interval && now - conn->probed >= config->probe_interval) {
+                    conn->probed = now;
+                    if (config->probe(conn->fd, config->context)) {
+                        conn_close(conn);
+                        pool->stats.probe_failures++;
+                    }
+                }
+            }
+        }
+
+        // keep the minimum number of idle connections around...
+        while (endpoint->idle + endpoint->connecting < config->min_idle && can_connect(pool, endpoint)) {
+            conn_start(pool, endpoint);
+        }
+    }
+
+    pool->dispatching = false;
+
+    // endpoints might have come back up...
+    return pool_dispatch(pool) ? interval : 0;
+}
+
+ud_pool_t *ud_pool_create(const ud_state_t *ud_state, const ud_pool_config_t *config) {
+    if (!ud_state || !config) {
+        return NULL;
+    }
+
+    ud_pool_t *pool = calloc(1, sizeof(ud_pool_t));
+    if (!pool) {
+        return NULL;
+    }
+
+    pool->ud_state = ud_state;
+    pool->config = *config;
+    if (!pool->config.max_conns) {
+        pool->config.max_conns = DEFAULT_MAX_CONNS;
+    }
+    if (!pool->config.max_idle || pool->config.max_idle > pool->config.max_conns) {
+        pool->config.max_idle = pool->config.max_conns;
+    }
+    if (pool->config.min_idle > pool->config.max_idle) {
+        pool->config.min_idle = pool->config.max_idle;
+    }
+    if (!pool->config.connect_timeout) {
+        pool->config.connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+    }
+    if (!pool->config.probe) {
+        pool->config.probe = default_probe;
+    }
+
+    if (ud_schedule_timer(ud_state, UD_POOL_TICK, pool_tick, pool)) {
+        log_warning("Failed to schedule connection pool housekeeping!");
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+void ud_pool_destroy(ud_pool_t *pool) {
+    if (!pool || pool->destroyed) {
+        return;
+    }
+    pool->destroyed = true;
+
+    ud_cancel_task(pool->ud_state, pool_tick, pool);
+
+    while (pool->waiters) {
+        pool_waiter_t *waiter = pool->waiters;
+        pool->waiters = waiter->next;
+        pool->waiting--;
+        waiter->cb(pool->ud_state, -ECANCELED, waiter->context);
+        free(waiter);
+    }
+    pool->waiters_tail = NULL;
+
+    for (size_t i = 0; i < pool->count; i++) {
+        pool_endpoint_t *endpoint = pool->endpoints[i];
+        for (int j = 0; j < pool->config.max_conns; j++) {
+            pool_conn_t *conn = &endpoint->conns[j];
+            // acquired connections are owned by the application until released...
+            if (conn->state != CONN_FREE && conn->state != CONN_BUSY) {
+                conn_close(conn);
+            }
+        }
+    }
+
+    if (!pool->dispatching) {
+        pool_free(pool);
+    }
+}
+
+int ud_pool_add_endpoint(ud_pool_t *pool, const struct sockaddr *addr, socklen_t addrlen) {
+    if (!pool || pool->destroyed || !addr || addrlen > sizeof(struct sockaddr_storage)) {
+        return -EINVAL;
+    }
+
+    pool_endpoint_t **endpoints = realloc(pool->endpoints, (pool->count + 1) * sizeof(pool_endpoint_t *));
+    if (!endpoints) {
+        return -ENOMEM;
+    }
+    pool->endpoints = endpoints;
+
+    pool_endpoint_t *endpoint = calloc(1, sizeof(pool_endpoint_t));
+    if (endpoint) {
+        endpoint->conns = calloc(pool->config.max_conns, sizeof(pool_conn_t));
+    }
+    if (!endpoint || !endpoint->conns) {
+        free(endpoint);
+        return -ENOMEM;
+    }
+
+    memcpy(&endpoint->addr, addr, addrlen);
+    endpoint->addrlen = addrlen;
+    for (int i = 0; i < pool->config.max_conns; i++) {
+        endpoint->conns[i] = (pool_conn_t) {
+            .pool = pool,
+            .endpoint = endpoint,
+            .fd = -1,
+            .eh_id = UD_INVALID_ID,
+        };
+    }
+
+    pool->endpoints[pool->count++] = endpoint;
+    return 0;
+}
+
+int ud_pool_acquire(ud_pool_t *pool, ud_pool_cb_t cb, void *context) {
+    if (!pool || pool->destroyed || !cb || !pool->count) {
+        return -EINVAL;
+    }
+
+    if (!pool->waiters) {
+        pool_endpoint_t *endpoint = select_endpoint(pool, has_idle);
+        if (endpoint) {
+            pool_conn_t *conn = find_conn(endpoint, CONN_IDLE, pool->config.max_conns);
+            conn_set_state(conn, CONN_BUSY);
+
+            pool->stats.hits++;
+            cb(pool->ud_state, conn->fd, context);
+            return 0;
+        }
+    }
+
+    pool_waiter_t *waiter = malloc(sizeof(pool_waiter_t));
+    if (!waiter) {
+        return -ENOMEM;
+    }
+    *waiter = (pool_waiter_t) {
+        .cb = cb,
+        .context = context,
+    };
+
+    if (pool->waiters_tail) {
+        pool->waiters_tail->next = waiter;
+    } else {
+        pool->waiters = waiter;
+    }
+    pool->waiters_tail = waiter;
+    pool->waiting++;
+    pool->stats.waits++;
+
+    pool_dispatch(pool);
+    return 0;
+}
+
+int ud_pool_release(ud_pool_t *pool, int fd, bool reuse) {
+    if (!pool || pool->destroyed || fd < 0) {
+        return -EINVAL;
+    }
+
+    for (size_t i = 0; i < pool->count; i++) {
+        pool_endpoint_t *endpoint = pool->endpoints[i];
+        for (int j = 0; j < pool->config.max_conns; j++) {
+            pool_conn_t *conn = &endpoint->conns[j];
+            if (conn->state != CONN_BUSY || conn->fd != fd) {
+                continue;
+            }
+
+            if (!reuse || endpoint->idle >= pool->config.max_idle) {
+                conn_close(conn);
+            } else {
+                conn_set_state(conn, CONN_IDLE);
+                conn->since = conn->probed = ud_now(pool->ud_state);
+            }
+
+            pool_dispatch(pool);
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+void ud_pool_get_stats(const ud_pool_t *pool, ud_pool_stats_t *stats) {
+    if (pool && stats) {
+        *stats = pool->stats;
+    }
+}
@@ -0,0 +1,440 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/ud_resolve.h"
+#include "udaemon/udaemon.h"
+
+#include "ud_module.h"
+
+// The maximum number of helper threads...
+#define WORKER_MAX 4
+// The maximum number of cached results per state, resolutions in progress are never evicted...
+#define CACHE_MAX 64
+
+/** the progress of a resolution on the helper threads, protected by the lock. */
+typedef enum resolve_job {
+    JOB_NONE,
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_POSTED,
+} resolve_job_t;
+
+typedef struct resolve_waiter {
+    ud_resolve_cb_t cb;
+    void *context;
+    struct resolve_waiter *next;
+} resolve_waiter_t;
+
+typedef struct resolve_entry {
+    char *host;
+    uint16_t port;
+
+    /** true while the resolution is in progress on a helper thread. */
+    bool pending;
+    /** the number of callbacks running with its result, which pin it in the cache. */
+    int in_use;
+    /** where the resolution is, and whether its state is gone (both protected by the lock). */
+    resolve_job_t job;
+    bool orphaned;
+    /** the result of the resolution, only valid when not pending. */
+    int error;
+    struct addrinfo *result;
+    /** the time (in ms) at which the result expires. */
+    uint64_t expires;
+
+    /** the callbacks waiting for the resolution, in order of request. */
+    resolve_waiter_t *waiters;
+    resolve_waiter_t *waiters_tail;
+
+    /** used to post the result back to the mainloop. */
+    const ud_state_t *ud_state;
+    struct resolve_cache *cache;
+    ud_post_t post;
+
+    /** the next entry in the cache. */
+    struct resolve_entry *next;
+    /** the next entry in the job queue. */
+    struct resolve_entry *job_next;
+} resolve_entry_t;
+
+/**
+ * The cache of a single state, which is only used on the thread running its
+ * mainloop. Results are never shared between states, as they can run on
+ * different threads.
+ */
+typedef struct resolve_cache {
+    const ud_state_t *ud_state;
+    resolve_entry_t *entries;
+    int count;
+} resolve_cache_t;
+
+/**
+ * The job queue is shared with the helper threads, and protected by the lock.
+ */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    resolve_entry_t *jobs;
+    resolve_entry_t *jobs_tail;
+    int workers;
+    int idle;
+} resolver = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void entry_free(resolve_entry_t *entry) {
+    if (entry->result) {
+        freeaddrinfo(entry->result);
+    }
+    free(entry->host);
+    free(entry);
+}
+
+static void waiters_free(resolve_entry_t *entry) {
+    resolve_waiter_t *waiter = entry->waiters;
+    while (waiter) {
+        resolve_waiter_t *next = waiter->next;
+        free(waiter);
+        waiter = next;
+    }
+    entry->waiters = entry->waiters_tail = NULL;
+}
+
+static void cache_drop(const ud_state_t *ud_state, void *data);
+
+static resolve_cache_t *cache_get(const ud_state_t *ud_state) {
+    resolve_cache_t *cache = ud_module_get(ud_state, UD_MODULE_RESOLVE);
+    if (!cache && (cache = calloc(1, sizeof(resolve_cache_t))) != NULL) {
+        cache->ud_state = ud_state;
+        ud_module_set(ud_state, UD_MODULE_RESOLVE, cache, cache_drop);
+    }
+    return cache;
+}
+
+/** true if the entry can be evicted: it is neither resolving nor in use by a callback. */
+static bool evictable(const resolve_entry_t *entry) {
+    return !entry->pending && !entry->in_use;
+}
+
+/**
+ * Shrinks the cache to (at most) the given number of entries, evicting the
+ * expired results first, and the results that expire first otherwise.
+ */
+static void cache_evict(resolve_cache_t *cache, uint64_t now, int limit) {
+    resolve_entry_t **pos = &cache->entries;
+    while (*pos) {
+        resolve_entry_t *entry = *pos;
+        if (evictable(entry) && entry->expires <= now) {
+            *pos = entry->next;
+            cache->count--;
+            entry_free(entry);
+            continue;
+        }
+        pos = &entry->next;
+    }
+
+    while (cache->count > limit) {
+        resolve_entry_t **oldest = NULL;
+        for (pos = &cache->entries; *pos; pos = &(*pos)->next) {
+            if (evictable(*pos) && (!oldest || (*pos)->expires < (*oldest)->expires)) {
+                oldest = pos;
+            }
+        }
+        if (!oldest) {
+            // everything is pinned, the cache shrinks once the callbacks return...
+            break;
+        }
+        resolve_entry_t *entry = *oldest;
+        *oldest = entry->next;
+        cache->count--;
+        entry_free(entry);
+    }
+}
+
+/**
+ * Calls a callback with the result of an entry, which is pinned in the cache
+ * while the callback runs, so the callback can resolve other hosts.
+ */
+static void entry_deliver(const ud_state_t *ud_state, resolve_entry_t *entry, ud_resolve_cb_t cb, void *context) {
+    entry->in_use++;
+    cb(ud_state, entry->error, entry->result, context);
+    entry->in_use--;
+}
+
+static resolve_entry_t *cache_find(resolve_cache_t *cache, const char *host, uint16_t port, uint64_t now) {
+    resolve_entry_t **pos = &cache->entries;
+    while (*pos) {
+        resolve_entry_t *entry = *pos;
+        if (entry->port == port && strcmp(entry->host, host) == 0) {
+            if (entry->pending || entry->expires > now) {
+                return entry;
+            }
+            if (entry->in_use) {
+                // expired, but a callback still uses it, so leave it to cache_evict...
+                pos = &entry->next;
+                continue;
+            }
+            // expired, resolve it again...
+            *pos = entry->next;
+            cache->count--;
+            entry_free(entry);
+            return NULL;
+        }
+        pos = &entry->next;
+    }
+    return NULL;
+}
+
+static void *resolve_worker(void *arg) {
+    (void) arg;
+
+    const struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV,
+    };
+
+    pthread_mutex_lock(&resolver.lock);
+    for (;;) {
+        while (!resolver.jobs) {
+            resolver.idle++;
+            pthread_cond_wait(&resolver.cond, &resolver.lock);
+            resolver.idle--;
+        }
+
+        resolve_entry_t *entry = resolver.jobs;
+        resolver.jobs = entry->job_next;
+        if (!resolver.jobs) {
+            resolver.jobs_tail = NULL;
+        }
+        entry->job = JOB_RUNNING;
+        pthread_mutex_unlock(&resolver.lock);
+
+        char service[8];
+        snprintf(service, sizeof(service), "%u", entry->port);
+
+        entry->error = getaddrinfo(entry->host, service, &hints, &entry->result);
+        if (entry->error) {
+            entry->result = NULL;
+        }
+
+        pthread_mutex_lock(&resolver.lock);
+        if (entry->orphaned) {
+            // its state is destroyed while we were resolving...
+            entry_free(entry);
+        } else {
+            // posted while holding the lock, so its state cannot be destroyed in the meantime...
+            entry->job = JOB_POSTED;
+            ud_post(entry->ud_state, &entry->post);
+        }
+    }
+    return NULL;
+}
+
+static int submit(resolve_entry_t *entry) {
+    int retval = 0;
+
+    pthread_mutex_lock(&resolver.lock);
+
+    if (!resolver.idle && resolver.workers < WORKER_MAX) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+        pthread_t thread;
+        retval = -pthread_create(&thread, &attr, resolve_worker, NULL);
+        if (retval == 0) {
+            resolver.workers++;
+        } else if (resolver.workers) {
+            // the existing helper threads pick it up eventually...
+            retval = 0;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    if (retval == 0) {
+        entry->job = JOB_QUEUED;
+        entry->job_next = NULL;
+        if (resolver.jobs_tail) {
+            resolver.jobs_tail->job_next = entry;
+        } else {
+            resolver.jobs = entry;
+        }
+        resolver.jobs_tail = entry;
+        pthread_cond_signal(&resolver.cond);
+    }
+
+    pthread_mutex_unlock(&resolver.lock);
+    return retval;
+}
+
+static void resolved(const ud_state_t *ud_state, ud_post_t *post) {
+    resolve_entry_t *entry = (resolve_entry_t *) ((char *) post - offsetof(resolve_entry_t, post));
+
+    pthread_mutex_lock(&resolver.lock);
+    entry->job = JOB_NONE;
+    pthread_mutex_unlock(&resolver.lock);
+
+    entry->pending = false;
+    entry->expires = ud_now(ud_state) + (entry->error ? UD_RESOLVE_NEGATIVE_TTL : UD_RESOLVE_TTL);
+
+    if (entry->error) {
+        log_debug("Failed to resolve '%s': %s", entry->host, gai_strerror(entry->error));
+    }
+
+    // callbacks are allowed to resolve (other) hosts, which can fill up the
+    // cache, so the entry is pinned until all of them are called...
+    resolve_waiter_t *waiter = entry->waiters;
+    entry->waiters = entry->waiters_tail = NULL;
+    entry->in_use++;
+    while (waiter) {
+        resolve_waiter_t *next = waiter->next;
+        waiter->cb(ud_state, entry->error, entry->result, waiter->context);
+        free(waiter);
+        waiter = next;
+    }
+    entry->in_use--;
+
+    // only now the entries added by the callbacks can push others out...
+    cache_evict(entry->cache, ud_now(ud_state), CACHE_MAX);
+}
+
+int ud_resolve_async(const ud_state_t *ud_state, const char *host, uint16_t port,
+                     ud_resolve_cb_t cb, void *context) {
+    if (!ud_state || !host || !cb) {
+        return -EINVAL;
+    }
+
+    resolve_cache_t *cache = cache_get(ud_state);
+    if (!cache) {
+        return -ENOMEM;
+    }
+
+    uint64_t now = ud_now(ud_state);
+
+    resolve_entry_t *entry = cache_find(cache, host, port, now);
+    if (entry && !entry->pending) {
+        entry_deliver(ud_state, entry, cb, context);
+        if (!entry->in_use) {
+            cache_evict(cache, now, CACHE_MAX);
+        }
+        return 0;
+    }
+
+    resolve_waiter_t *waiter = malloc(sizeof(resolve_waiter_t));
+    if (!waiter) {
+        return -ENOMEM;
+    }
+    *waiter = (resolve_waiter_t) {
+        .cb = cb,
+        .context = context,
+    };
+
+    if (!entry) {
+        if (cache->count >= CACHE_MAX) {
+            cache_evict(cache, now, CACHE_MAX - 1);
+        }
+
+        entry = calloc(1, sizeof(resolve_entry_t));
+        if (!entry || !(entry->host = strdup(host))) {
+            free(entry);
+            free(waiter);
+            return -ENOMEM;
+        }
+        entry->port = port;
+        entry->pending = true;
+        entry->ud_state = ud_state;
+        entry->cache = cache;
+        entry->post.fn = resolved;
+
+        int retval = submit(entry);
+        if (retval) {
+            log_warning("Failed to start resolver thread: %s", strerror(-retval));
+            entry_free(entry);
+            free(waiter);
+            return retval;
+        }
+
+        entry->next = cache->entries;
+        cache->entries = entry;
+        cache->count++;
+    }
+
+    // share the resolution that is already in progress...
+    if (entry->waiters_tail) {
+        entry->waiters_tail->next = waiter;
+    } else {
+        entry->waiters = waiter;
+    }
+    entry->waiters_tail = waiter;
+
+    return 0;
+}
+
+/**
+ * Drops the cache and all resolutions of a state that is being destroyed,
+ * without calling their callbacks. Resolutions that are still running on a
+ * helper thread are freed by that thread, instead of being posted.
+ */
+static void cache_drop(const ud_state_t *ud_state, void *data) {
+    resolve_cache_t *cache = data;
+
+    pthread_mutex_lock(&resolver.lock);
+
+    // posted results are taken out of the queue of the state before they are
+    // freed, the helper threads cannot post any others while we hold the lock...
+    ud_post_t *post = ud_module_take_posts(ud_state, resolved);
+    while (post) {
+        resolve_entry_t *entry = (resolve_entry_t *) ((char *) post - offsetof(resolve_entry_t, post));
+        post = post->next;
+        entry->job = JOB_NONE;
+    }
+
+    resolve_entry_t *entry = cache->entries;
+    while (entry) {
+        resolve_entry_t *next = entry->next;
+        waiters_free(entry);
+
+        if (entry->job == JOB_QUEUED) {
+            resolve_entry_t **job = &resolver.jobs;
+            resolve_entry_t *prev = NULL;
+            while (*job != entry) {
+                prev = *job;
+                job = &(*job)->job_next;
+            }
+            *job = entry->job_next;
+            if (resolver.jobs_tail == entry) {
+                resolver.jobs_tail = prev;
+            }
+            entry_free(entry);
+        } else if (entry->job == JOB_RUNNING) {
+            // the helper thread frees it once it is done...
+            entry->orphaned = true;
+        } else if (entry->job == JOB_NONE) {
+            // results taken out of the queue are never delivered, as the state is destroyed...
+            entry_free(entry);
+        }
+        entry = next;
+    }
+
+    pthread_mutex_unlock(&resolver.lock);
+    free(cache);
+}
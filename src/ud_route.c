@@ -0,0 +1,385 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "udaemon/ud_route.h"
+
+// The number of cached matches, should be a power of two...
+#define CACHE_SIZE 256
+// The initial number of edges in the trie, should be a power of two...
+#define EDGE_MIN 64
+
+#define FNV32_OFFSET 2166136261u
+#define FNV32_PRIME 16777619u
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+typedef struct route_targets {
+    void **items;
+    uint32_t count;
+    uint32_t cap;
+} route_targets_t;
+
+typedef struct route_node {
+    /** the index of the `+` and `#` child nodes, or 0 if there are none. */
+    uint32_t plus;
+    uint32_t hash;
+    /** the targets of the routes ending in this node. */
+    route_targets_t targets;
+} route_node_t;
+
+/**
+ * Represents an edge between a node and its child for a particular level. All
+ * edges are kept in a single open addressing hash table, keyed by the parent
+ * node and the level.
+ */
+typedef struct route_edge {
+    /** the level of the edge, or NULL if this slot is unused. */
+    char *token;
+    uint32_t len;
+    uint32_t hash;
+    uint32_t parent;
+    uint32_t child;
+} route_edge_t;
+
+typedef struct route_cache {
+    /** the table generation this entry was filled in, or 0 if this entry is unused. */
+    uint64_t generation;
+    uint64_t hash;
+    /** the cached topic, the buffer is reused when the entry is replaced. */
+    char *topic;
+    size_t len;
+    size_t cap;
+    route_targets_t targets;
+} route_cache_t;
+
+struct ud_route_table {
+    /** the nodes of the trie, the root node is at index 0. */
+    route_node_t *nodes;
+    uint32_t node_count;
+    uint32_t node_cap;
+
+    route_edge_t *edges;
+    uint32_t edge_count;
+    uint32_t edge_cap;
+
+    /** bumped for every added route, which invalidates all cached matches at once. */
+    uint64_t generation;
+    route_cache_t cache[CACHE_SIZE];
+};
+
+static uint32_t edge_hash(uint32_t parent, const char *token, uint32_t len) {
+    uint32_t hash = FNV32_OFFSET;
+    for (int i = 0; i < 4; i++) {
+        hash ^= (parent >> (i * 8)) & 0xff;
+        hash *= FNV32_PRIME;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= (uint8_t) token[i];
+        hash *= FNV32_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t topic_hash(const char *topic) {
+    uint64_t hash = FNV64_OFFSET;
+    while (*topic) {
+        hash ^= (uint8_t) *topic++;
+        hash *= FNV64_PRIME;
+    }
+    return hash;
+}
+
+static int targets_add(route_targets_t *targets, void *target) {
+    for (uint32_t i = 0; i < targets->count; i++) {
+        if (targets->items[i] == target) {
+            return 0;
+        }
+    }
+
+    if (targets->count == targets->cap) {
+        uint32_t cap = targets->cap ? 2 * targets->cap : 4;
+        void **items = realloc(targets->items, cap * sizeof(void *));
+        if (!items) {
+            return -ENOMEM;
+        }
+        targets->items = items;
+        targets->cap = cap;
+    }
+    targets->items[targets->count++] = target;
+    return 0;
+}
+
+static int targets_add_all(route_targets_t *targets, const route_targets_t *other) {
+    for (uint32_t i = 0; i < other->count; i++) {
+        if (targets_add(targets, other->items[i])) {
+            return -ENOMEM;
+        }
+    }
+    return 0;
+}
+
+static uint32_t node_new(ud_route_table_t *table) {
+    if (table->node_count == table->node_cap) {
+        uint32_t cap = 2 * table->node_cap;
+        route_node_t *nodes = realloc(table->nodes, cap * sizeof(route_node_t));
+        if (!nodes) {
+            return 0;
+        }
+        table->nodes = nodes;
+        table->node_cap = cap;
+    }
+
+    uint32_t idx = table->node_count++;
+    table->nodes[idx] = (route_node_t) { .plus = 0 };
+    return idx;
+}
+
+static uint32_t edge_find(const ud_route_table_t *table, uint32_t parent, const char *token, uint32_t len) {
+    uint32_t hash = edge_hash(parent, token, len);
+    uint32_t mask = table->edge_cap - 1;
+
+    for (uint32_t i = hash & mask; table->edges[i].token; i = (i + 1) & mask) {
+        const route_edge_t *edge = &table->edges[i];
+        if (edge->hash == hash && edge->parent == parent && edge->len == len &&
+                memcmp(edge->token, token, len) == 0) {
+            return edge->child;
+        }
+    }
+    return 0;
+}
+
+static void edge_put(route_edge_t *edges, uint32_t cap, const route_edge_t *edge) {
+    uint32_t mask = cap - 1;
+    uint32_t i = edge->hash & mask;
+    while (edges[i].token) {
+        i = (i + 1) & mask;
+    }
+    edges[i] = *edge;
+}
+
+static int edges_grow(ud_route_table_t *table) {
+    uint32_t cap = 2 * table->edge_cap;
+    route_edge_t *edges = calloc(cap, sizeof(route_edge_t));
+    if (!edges) {
+        return -ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < table->edge_cap; i++) {
+        if (table->edges[i].token) {
+            edge_put(edges, cap, &table->edges[i]);
+        }
+    }
+
+    free(table->edges);
+    table->edges = edges;
+    table->edge_cap = cap;
+    return 0;
+}
+
+static uint32_t edge_add(ud_route_table_t *table, uint32_t parent, const char *token, uint32_t len) {
+    // keep the load factor below 50%...
+    if (2 * (table->edge_count + 1) > table->edge_cap && edges_grow(table)) {
+        return 0;
+    }
+
+    route_edge_t edge = {
+        .token = strndup(token, len),
+        .len = len,
+        .hash = edge_hash(parent, token, len),
+        .parent = parent,
+    };
+    if (!edge.token) {
+        return 0;
+    }
+
+    edge.child = node_new(table);
+    if (!edge.child) {
+        free(edge.token);
+        return 0;
+    }
+
+    edge_put(table->edges, table->edge_cap, &edge);
+    table->edge_count++;
+
+    return edge.child;
+}
+
+ud_route_table_t *ud_route_create(void) {
+    ud_route_table_t *table = calloc(1, sizeof(ud_route_table_t));
+    if (!table) {
+        return NULL;
+    }
+
+    table->node_cap = EDGE_MIN;
+    table->nodes = calloc(table->node_cap, sizeof(route_node_t));
+    table->edge_cap = EDGE_MIN;
+    table->edges = calloc(table->edge_cap, sizeof(route_edge_t));
+
+    if (!table->nodes || !table->edges) {
+        ud_route_destroy(table);
+        return NULL;
+    }
+
+    // the root node...
+    table->node_count = 1;
+    table->generation = 1;
+
+    return table;
+}
+
+void ud_route_destroy(ud_route_table_t *table) {
+    if (!table) {
+        return;
+    }
+
+    for (int i = 0; i < CACHE_SIZE; i++) {
+        free(table->cache[i].topic);
+        free(table->cache[i].targets.items);
+    }
+    if (table->edges) {
+        for (uint32_t i = 0; i < table->edge_cap; i++) {
+            free(table->edges[i].token);
+        }
+    }
+    if (table->nodes) {
+        for (uint32_t i = 0; i < table->node_count; i++) {
+            free(table->nodes[i].targets.items);
+        }
+    }
+    free(table->edges);
+    free(table->nodes);
+    free(table);
+}
+
+int ud_route_add(ud_route_table_t *table, const char *filter, void *target) {
+    if (!table || !filter || !target) {
+        return -EINVAL;
+    }
+
+    uint32_t node = 0;
+    const char *level = filter;
+    for (;;) {
+        const char *end = strchrnul(level, '/');
+        uint32_t len = (uint32_t) (end - level);
+
+        uint32_t child;
+        if (len == 1 && *level == '+') {
+            child = table->nodes[node].plus;
+            if (!child) {
+                child = node_new(table);
+                table->nodes[node].plus = child;
+            }
+        } else if (len == 1 && *level == '#') {
+            if (*end) {
+                // only allowed as last level...
+                return -EINVAL;
+            }
+            child = table->nodes[node].hash;
+            if (!child) {
+                child = node_new(table);
+                table->nodes[node].hash = child;
+            }
+        } else {
+            if (memchr(level, '+', len) || memchr(level, '#', len)) {
+                // wildcards should occupy an entire level...
+                return -EINVAL;
+            }
+            child = edge_find(table, node, level, len);
+            if (!child) {
+                child = edge_add(table, node, level, len);
+            }
+        }
+        if (!child) {
+            return -ENOMEM;
+        }
+        node = child;
+
+        if (!*end) {
+            break;
+        }
+        level = end + 1;
+    }
+
+    table->generation++;
+
+    return targets_add(&table->nodes[node].targets, target);
+}
+
+/**
+ * Collects the targets of all routes below a given node that match the
+ * remaining levels of a topic, or NULL if all levels are matched.
+ */
+static int route_collect(const ud_route_table_t *table, uint32_t node, const char *level,
+                         bool first, route_targets_t *result) {
+    const route_node_t *n = &table->nodes[node];
+    // topics starting with a '$' are not matched by wildcards...
+    bool wildcards = !(first && *level == '$');
+
+    if (n->hash && wildcards && targets_add_all(result, &table->nodes[n->hash].targets)) {
+        return -ENOMEM;
+    }
+    if (!level) {
+        return targets_add_all(result, &n->targets);
+    }
+
+    const char *end = strchrnul(level, '/');
+    const char *next = *end ? end + 1 : NULL;
+
+    uint32_t child = edge_find(table, node, level, (uint32_t) (end - level));
+    if (child && route_collect(table, child, next, false, result)) {
+        return -ENOMEM;
+    }
+    if (n->plus && wildcards && route_collect(table, n->plus, next, false, result)) {
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+int ud_route_match(ud_route_table_t *table, const char *topic, void *const **targets) {
+    if (!table || !topic || !targets) {
+        return -EINVAL;
+    }
+
+    uint64_t hash = topic_hash(topic);
+    size_t len = strlen(topic);
+    route_cache_t *entry = &table->cache[hash & (CACHE_SIZE - 1)];
+
+    if (entry->generation != table->generation || entry->hash != hash || entry->len != len ||
+            memcmp(entry->topic, topic, len) != 0) {
+        entry->generation = 0;
+
+        if (len >= entry->cap) {
+            size_t cap = (len + 64) & ~(size_t) 63;
+            char *buf = realloc(entry->topic, cap);
+            if (!buf) {
+                return -ENOMEM;
+            }
+            entry->topic = buf;
+            entry->cap = cap;
+        }
+
+        entry->targets.count = 0;
+        if (route_collect(table, 0, topic, true, &entry->targets)) {
+            return -ENOMEM;
+        }
+
+        memcpy(entry->topic, topic, len + 1);
+        entry->len = len;
+        entry->hash = hash;
+        entry->generation = table->generation;
+    }
+
+    *targets = entry->targets.items;
+    return (int) entry->targets.count;
+}
@@ -0,0 +1,144 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/ud_sim.h"
+#include "udaemon/udaemon.h"
+
+// The maximum number of injected events that are not delivered yet...
+#define INJECT_MAX 16
+
+typedef struct sim_event {
+    int fd;
+    short revents;
+} sim_event_t;
+
+struct ud_sim {
+    const ud_state_t *ud_state;
+    /** the simulated time, in milliseconds. */
+    uint64_t now;
+    /** the injected events that are not delivered yet, in order of injection. */
+    sim_event_t events[INJECT_MAX];
+    int count;
+};
+
+static uint64_t sim_now(void *context) {
+    const ud_sim_t *sim = context;
+    return sim->now;
+}
+
+static int sim_wait(const ud_state_t *ud_state, struct pollfd *pollfds, int count, int timeout, void *context) {
+    ud_sim_t *sim = context;
+    (void) ud_state;
+
+    int ready = 0;
+    for (int i = 0; i < count; i++) {
+        struct pollfd *pollfd = &pollfds[i];
+        pollfd->revents = 0;
+        if (pollfd->fd < 0) {
+            // paused...
+            continue;
+        }
+
+        for (int j = 0; j < sim->count; j++) {
+            if (sim->events[j].fd == pollfd->fd) {
+                // errors and hang-ups are always reported, like poll() does...
+                pollfd->revents |= sim->events[j].revents & (pollfd->events | POLLERR | POLLHUP | POLLNVAL);
+            }
+        }
+        if (pollfd->revents) {
+            ready++;
+        }
+    }
+
+    if (!ready) {
+        // nothing happens until the next deadline, so skip right to it...
+        if (timeout > 0) {
+            sim->now += (uint64_t) timeout;
+        }
+        return 0;
+    }
+
+    // only keep the events for file descriptors that are not polled right now...
+    int kept = 0;
+    for (int j = 0; j < sim->count; j++) {
+        bool delivered = false;
+        for (int i = 0; i < count && !delivered; i++) {
+            delivered = pollfds[i].fd >= 0 && pollfds[i].fd == sim->events[j].fd;
+        }
+        if (!delivered) {
+            sim->events[kept++] = sim->events[j];
+        }
+    }
+    sim->count = kept;
+
+    return ready;
+}
+
+ud_sim_t *ud_sim_create(const ud_state_t *ud_state) {
+    if (!ud_state) {
+        return NULL;
+    }
+
+    ud_sim_t *sim = calloc(1, sizeof(ud_sim_t));
+    if (!sim) {
+        return NULL;
+    }
+    sim->ud_state = ud_state;
+
+    const ud_clock_t clock = {
+        .now = sim_now,
+        .context = sim,
+    };
+    const ud_backend_ops_t ops = {
+        .wait = sim_wait,
+        .context = sim,
+    };
+
+    if (ud_set_clock(ud_state, &clock) || ud_set_backend_ops(ud_state, &ops)) {
+        log_warning("Unable to install simulation, is the mainloop running?");
+        ud_set_clock(ud_state, NULL);
+        free(sim);
+        return NULL;
+    }
+
+    return sim;
+}
+
+void ud_sim_destroy(ud_sim_t *sim) {
+    if (!sim) {
+        return;
+    }
+
+    ud_set_clock(sim->ud_state, NULL);
+    ud_set_backend_ops(sim->ud_state, NULL);
+    free(sim);
+}
+
+void ud_sim_advance(ud_sim_t *sim, uint64_t ms) {
+    sim->now += ms;
+}
+
+int ud_sim_inject(ud_sim_t *sim, int fd, short revents) {
+    if (!sim || fd < 0 || !revents) {
+        return -EINVAL;
+    }
+    if (sim->count >= INJECT_MAX) {
+        return -ENOMEM;
+    }
+
+    sim->events[sim->count++] = (sim_event_t) {
+        .fd = fd,
+        .revents = revents,
+    };
+    return 0;
+}
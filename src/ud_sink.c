@@ -0,0 +1,802 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/ud_sink.h"
+#include "udaemon/ud_spool.h"
+#include "udaemon/udaemon.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+typedef struct ud_sink_queue {
+    /** the buffered message data. */
+    uint8_t *arena;
+    size_t arena_size;
+    size_t arena_used;
+    /** the buffered messages, pointing into the arena. */
+    struct iovec *iov;
+    uint16_t iov_size;
+    uint16_t count;
+    /** the number of buffered messages that are completely written. */
+    uint16_t sent;
+    /** true if the message at `sent` is only partially written. */
+    bool partial;
+} ud_sink_queue_t;
+
+struct ud_sink {
+    const ud_state_t *ud_state;
+    ud_sink_config_t config;
+
+    int fd;
+    /** the socket type of fd, or 0 if fd is not a socket. */
+    int sock_type;
+    /** the event handler of fd, paused unless we wait for fd to become writable. */
+    eh_id_t eh_id;
+    bool waiting;
+    bool timer_armed;
+    bool throttled;
+    /** the error of the last asynchronous write, reported by the next write. */
+    int error;
+
+    ud_sink_queue_t queues[UD_SINK_PRIO_MAX];
+
+    /** the messages gathered for a single write, and the queue they originate from. */
+    struct iovec *out;
+    uint8_t *out_prio;
+    struct mmsghdr *msgs;
+    uint16_t out_size;
+
+    /** the number of control messages sent since the last bulk message. */
+    uint16_t credit;
+    /** the time at which the first message of the current batch was queued. */
+    uint64_t first_queued;
+    /** the number of messages written in the current batch. */
+    uint64_t batch_count;
+
+    /** the available tokens for bulk messages, in 1/1000 bytes. */
+    uint64_t tokens;
+    uint64_t last_refill;
+
+    ud_sink_stats_t stats;
+};
+
+static void sink_histogram(uint64_t *hist, uint64_t value) {
+    int bucket = 0;
+    while (value > 1 && bucket < UD_SINK_HIST_BUCKETS - 1) {
+        value >>= 1;
+        bucket++;
+    }
+    hist[bucket]++;
+}
+
+static void queue_reset(ud_sink_queue_t *queue) {
+    queue->arena_used = 0;
+    queue->count = 0;
+    queue->sent = 0;
+    queue->partial = false;
+}
+
+static bool queue_pending(const ud_sink_queue_t *queue) {
+    return queue->sent < queue->count;
+}
+
+static bool sink_pending(const ud_sink_t *sink) {
+    for (int p = 0; p < UD_SINK_PRIO_MAX; p++) {
+        if (queue_pending(&sink->queues[p])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Tests whether we are currently able to write to the file descriptor.
+ */
+static bool sink_writable_now(const ud_sink_t *sink) {
+    return sink->fd >= 0 && !sink->waiting && !sink->throttled;
+}
+
+static ud_result_t sink_writable(const ud_state_t *ud_state, struct pollfd *pollfd, void *context);
+
+/**
+ * Resumes or pauses the event handler of the sink. The handler is registered
+ * for as long as the sink is attached, so waiting for POLLOUT after every
+ * short write does not add and remove it over and over again.
+ */
+static void sink_wait_writable(ud_sink_t *sink, bool wait) {
+    if (wait == sink->waiting || sink->eh_id == UD_INVALID_ID) {
+        return;
+    }
+    if (wait) {
+        ud_resume_handler(sink->ud_state, sink->eh_id);
+    } else {
+        ud_pause_handler(sink->ud_state, sink->eh_id);
+    }
+    sink->waiting = wait;
+}
+
+static void sink_refill(ud_sink_t *sink) {
+    if (sink->config.rate_limit == 0) {
+        return;
+    }
+
+    uint64_t now = ud_now(sink->ud_state);
+    uint64_t max = (uint64_t) sink->config.rate_burst * 1000;
+
+    // bytes per second times milliseconds yields tokens in 1/1000 bytes...
+    sink->tokens += (now - sink->last_refill) * sink->config.rate_limit;
+    if (sink->tokens > max) {
+        sink->tokens = max;
+    }
+    sink->last_refill = now;
+}
+
+static int sink_throttle_timer(const ud_state_t *ud_state, const uint16_t interval, void *context);
+
+/**
+ * Pauses writing until enough tokens are available to write the given number
+ * of bytes. We deliberately do not wait for POLLOUT in the meantime.
+ */
+static void sink_throttle(ud_sink_t *sink, size_t len) {
+    uint64_t need = (uint64_t) len * 1000 - sink->tokens;
+    uint64_t wait = (need + sink->config.rate_limit - 1) / sink->config.rate_limit;
+    if (wait == 0) {
+        wait = 1;
+    } else if (wait > UINT16_MAX) {
+        wait = UINT16_MAX;
+    }
+
+    sink_wait_writable(sink, false);
+
+    if (sink->throttled) {
+        // already waiting for the tokens to become available...
+        return;
+    }
+    if (ud_schedule_timer(sink->ud_state, (uint16_t) wait, sink_throttle_timer, sink)) {
+        log_warning("Failed to schedule timer for throttled sink!");
+        return;
+    }
+
+    sink->throttled = true;
+    sink->stats.throttled++;
+}
+
+/**
+ * Picks the queue to take the next message from, or -1 if no message can be
+ * sent right now.
+ */
+static int sink_next_prio(const ud_sink_t *sink, const uint16_t *next, uint64_t tokens, uint16_t credit,
+                          bool *limited) {
+    const ud_sink_queue_t *control = &sink->queues[UD_SINK_PRIO_CONTROL];
+    const ud_sink_queue_t *bulk = &sink->queues[UD_SINK_PRIO_BULK];
+
+    bool has_control = next[UD_SINK_PRIO_CONTROL] < control->count;
+    bool has_bulk = next[UD_SINK_PRIO_BULK] < bulk->count;
+
+    if (has_bulk && sink->config.rate_limit) {
+        // bulk messages are only sent when there are enough tokens for them...
+        size_t len = bulk->iov[next[UD_SINK_PRIO_BULK]].iov_len;
+        if ((uint64_t) len * 1000 > tokens) {
+            has_bulk = false;
+            *limited = true;
+        }
+    }
+
+    if (has_control && (!has_bulk || sink->config.control_weight == 0 ||
+                        credit < sink->config.control_weight)) {
+        return UD_SINK_PRIO_CONTROL;
+    }
+    if (has_bulk) {
+        return UD_SINK_PRIO_BULK;
+    }
+    return has_control ? UD_SINK_PRIO_CONTROL : -1;
+}
+
+/**
+ * Gathers the pending messages of all queues for a single write, in the order
+ * determined by their priority and the rate limit. The credit of the weighted
+ * scheduling is only consumed by messages that are actually written.
+ *
+ * @return the number of gathered messages.
+ */
+static uint16_t sink_gather(ud_sink_t *sink, bool *limited, bool *more) {
+    uint16_t next[UD_SINK_PRIO_MAX];
+    uint64_t tokens = sink->tokens;
+    uint16_t n = 0;
+    uint16_t credit = sink->credit;
+
+    for (int p = 0; p < UD_SINK_PRIO_MAX; p++) {
+        next[p] = sink->queues[p].sent;
+
+        if (sink->queues[p].partial) {
+            // a partially written message must be completed before anything else...
+            sink->out[n] = sink->queues[p].iov[next[p]++];
+            sink->out_prio[n++] = (uint8_t) p;
+        }
+    }
+
+    while (n < sink->out_size && n < IOV_MAX) {
+        int p = sink_next_prio(sink, next, tokens, credit, limited);
+        if (p < 0) {
+            break;
+        }
+
+        const struct iovec *iov = &sink->queues[p].iov[next[p]++];
+        if (p == UD_SINK_PRIO_BULK) {
+            tokens -= sink->config.rate_limit ? (uint64_t) iov->iov_len * 1000 : 0;
+            credit = 0;
+        } else {
+            credit++;
+        }
+
+        sink->out[n] = *iov;
+        sink->out_prio[n++] = (uint8_t) p;
+    }
+
+    // messages that did not fit in this write follow right away...
+    bool ignored = false;
+    *more = (n > 0) && sink_next_prio(sink, next, tokens, credit, &ignored) >= 0;
+
+    return n;
+}
+
+/**
+ * Advances the queues by the given number of gathered messages and/or bytes.
+ */
+static void sink_advance(ud_sink_t *sink, uint16_t n_out, uint16_t n_msgs, size_t n_bytes) {
+    for (uint16_t i = 0; i < n_out; i++) {
+        int p = sink->out_prio[i];
+        ud_sink_queue_t *queue = &sink->queues[p];
+        struct iovec *iov = &queue->iov[queue->sent];
+
+        size_t len;
+        if (i < n_msgs || n_bytes >= iov->iov_len) {
+            len = iov->iov_len;
+            queue->sent++;
+            queue->partial = false;
+        } else if (n_bytes > 0) {
+            len = n_bytes;
+            iov->iov_base = (uint8_t *) iov->iov_base + n_bytes;
+            iov->iov_len -= n_bytes;
+            queue->partial = true;
+        } else {
+            break;
+        }
+
+        if (i >= n_msgs) {
+            n_bytes -= len;
+        }
+
+        if (queue->partial) {
+            break;
+        }
+
+        sink->batch_count++;
+        if (p == UD_SINK_PRIO_BULK) {
+            sink->credit = 0;
+        } else {
+            sink->credit++;
+        }
+    }
+}
+
+static ssize_t sink_send_stream(ud_sink_t *sink, uint16_t n_out, bool more) {
+    if (sink->sock_type == SOCK_STREAM) {
+        struct msghdr msg = {
+            .msg_iov = sink->out,
+            .msg_iovlen = n_out,
+        };
+        return sendmsg(sink->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT | (more ? MSG_MORE : 0));
+    }
+    return writev(sink->fd, sink->out, n_out);
+}
+
+/**
+ * Sends each gathered message as a separate datagram or record, which is
+ * required for both SOCK_DGRAM and SOCK_SEQPACKET sockets as a single write
+ * would merge all messages into one datagram or record.
+ */
+static ssize_t sink_send_datagrams(ud_sink_t *sink, uint16_t n_out) {
+    for (uint16_t i = 0; i < n_out; i++) {
+        sink->msgs[i] = (struct mmsghdr) {
+            .msg_hdr = {
+                .msg_iov = &sink->out[i],
+                .msg_iovlen = 1,
+            },
+        };
+    }
+    return sendmmsg(sink->fd, sink->msgs, n_out, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+static uint64_t sink_bulk_bytes(const ud_sink_t *sink, uint16_t n_out, uint16_t n_msgs, size_t n_bytes) {
+    uint64_t total = 0;
+    for (uint16_t i = 0; i < n_out; i++) {
+        size_t len = sink->out[i].iov_len;
+        if (i >= n_msgs) {
+            len = (n_bytes < len) ? n_bytes : len;
+            n_bytes -= len;
+        }
+        if (sink->out_prio[i] == UD_SINK_PRIO_BULK) {
+            total += len;
+        }
+    }
+    return total;
+}
+
+static int sink_flush(ud_sink_t *sink) {
+    sink_refill(sink);
+
+    while (sink_pending(sink)) {
+        bool limited = false;
+
+        bool more = false;
+        uint16_t n_out = sink_gather(sink, &limited, &more);
+        if (n_out == 0) {
+            if (limited) {
+                const ud_sink_queue_t *bulk = &sink->queues[UD_SINK_PRIO_BULK];
+
+                sink_throttle(sink, bulk->iov[bulk->sent].iov_len);
+            }
+            return 0;
+        }
+
+        ssize_t n;
+        uint16_t n_msgs = 0;
+        size_t n_bytes = 0;
+        if (sink->sock_type == SOCK_DGRAM || sink->sock_type == SOCK_SEQPACKET) {
+            n = sink_send_datagrams(sink, n_out);
+            n_msgs = (uint16_t) (n > 0 ? n : 0);
+        } else {
+            // let the kernel hold back a partial frame if more data follows right away...
+            n = sink_send_stream(sink, n_out, more);
+            n_bytes = (size_t) (n > 0 ? n : 0);
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // continue as soon as we can write again...
+                sink_wait_writable(sink, true);
+                return 0;
+            }
+
+            int err = errno;
+            log_warning("Failed to write to sink: %m");
+
+            ud_sink_detach(sink);
+            return -err;
+        }
+
+        if (sink->config.rate_limit) {
+            uint64_t used = sink_bulk_bytes(sink, n_out, n_msgs, n_bytes) * 1000;
+            sink->tokens = (used > sink->tokens) ? 0 : sink->tokens - used;
+        }
+
+        sink_advance(sink, n_out, n_msgs, n_bytes);
+    }
+
+    if (sink->batch_count) {
+        sink->stats.batches++;
+
+        sink_histogram(sink->stats.batch_size, sink->batch_count);
+        sink_histogram(sink->stats.batch_latency, ud_now(sink->ud_state) - sink->first_queued);
+
+        sink->batch_count = 0;
+    }
+
+    for (int p = 0; p < UD_SINK_PRIO_MAX; p++) {
+        queue_reset(&sink->queues[p]);
+    }
+    sink_wait_writable(sink, false);
+
+    return 0;
+}
+
+/**
+ * Reports an error that occurred outside a call of the application, either to
+ * the error callback, or to the next call of #ud_sink_write.
+ */
+static void sink_report(ud_sink_t *sink, int err) {
+    if (err >= 0) {
+        return;
+    }
+    if (sink->config.on_error) {
+        sink->config.on_error(sink->ud_state, sink, err, sink->config.context);
+    } else {
+        sink->error = err;
+    }
+}
+
+static ud_result_t sink_writable(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    ud_sink_t *sink = context;
+
+    (void)ud_state;
+
+    if (pollfd->revents & (POLLHUP | POLLERR | POLLNVAL)) {
+        log_debug("Sink connection closed...");
+
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(sink->fd, SOL_SOCKET, SO_ERROR, &err, &len) || err == 0) {
+            err = EPIPE;
+        }
+
+        ud_sink_detach(sink);
+        sink_report(sink, -err);
+    } else if (pollfd->revents & POLLOUT) {
+        sink_wait_writable(sink, false);
+        sink_report(sink, sink_flush(sink));
+    }
+
+    // the file descriptor is owned by the application, never let udaemon close it...
+    return RES_OK;
+}
+
+static int sink_throttle_timer(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    ud_sink_t *sink = context;
+
+    (void)ud_state;
+    (void)interval;
+
+    sink->throttled = false;
+    if (sink->fd >= 0) {
+        sink_report(sink, sink_flush(sink));
+    }
+    return 0;
+}
+
+static int sink_timer(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    ud_sink_t *sink = context;
+
+    (void)interval;
+
+    if (sink_pending(sink)) {
+        uint64_t age = ud_now(ud_state) - sink->first_queued;
+        if (age < sink->config.max_delay) {
+            // the current batch is younger than this timer, wait a little longer...
+            return (int) (sink->config.max_delay - age);
+        }
+
+        if (sink_writable_now(sink)) {
+            sink_report(sink, sink_flush(sink));
+        }
+    }
+
+    sink->timer_armed = false;
+    return 0;
+}
+
+static int sink_enqueue(ud_sink_t *sink, ud_sink_prio_t prio, const void *data, size_t len) {
+    if (len == 0 || len > sink->config.max_bytes) {
+        return -EMSGSIZE;
+    }
+
+    ud_sink_queue_t *queue = &sink->queues[prio];
+
+    if (queue->arena_used + len > queue->arena_size || queue->count >= queue->iov_size) {
+        // make room if we can...
+        if (sink_writable_now(sink)) {
+            int rc = sink_flush(sink);
+            if (rc) {
+                return rc;
+            }
+        }
+        if (queue->arena_used + len > queue->arena_size || queue->count >= queue->iov_size) {
+            return -ENOBUFS;
+        }
+    }
+
+    if (!sink_pending(sink)) {
+        sink->first_queued = ud_now(sink->ud_state);
+    }
+
+    uint8_t *dst = queue->arena + queue->arena_used;
+    memcpy(dst, data, len);
+
+    queue->iov[queue->count++] = (struct iovec) {
+        .iov_base = dst,
+        .iov_len = len,
+    };
+    queue->arena_used += len;
+
+    sink->stats.messages++;
+    sink->stats.bytes += len;
+
+    if (prio == UD_SINK_PRIO_CONTROL && sink->fd >= 0 && !sink->waiting) {
+        // control messages are not subject to the rate limit...
+        return sink_flush(sink);
+    }
+    if (!sink_writable_now(sink)) {
+        // nothing more to do until we can write again...
+        return 0;
+    }
+
+    if (prio == UD_SINK_PRIO_CONTROL || queue->arena_used >= sink->config.max_bytes ||
+            queue->count >= sink->config.max_count || sink->config.max_delay == 0) {
+        return sink_flush(sink);
+    }
+
+    if (!sink->timer_armed) {
+        if (ud_schedule_timer(sink->ud_state, sink->config.max_delay, sink_timer, sink)) {
+            // no timer available, do not keep the message waiting...
+            return sink_flush(sink);
+        }
+        sink->timer_armed = true;
+    }
+
+    return 0;
+}
+
+static int sink_replay_writer(const ud_state_t *ud_state, const void *data, size_t len, void *context) {
+    ud_sink_t *sink = context;
+
+    (void)ud_state;
+
+    if (sink->fd < 0) {
+        // not attached (anymore), retry later...
+        return 1;
+    }
+
+    int rc = sink_enqueue(sink, UD_SINK_PRIO_BULK, data, len);
+    if (rc == -EMSGSIZE) {
+        // will never fit, do not retry it over and over again...
+        sink->stats.dropped++;
+        return 0;
+    }
+    if (rc < 0 && rc != -ENOBUFS) {
+        // the sink is detached, the replay is retried once it is attached again...
+        sink_report(sink, rc);
+    }
+    return rc;
+}
+
+static int queue_init(ud_sink_queue_t *queue, size_t arena_size, uint16_t iov_size) {
+    queue->arena_size = arena_size;
+    queue->iov_size = iov_size;
+
+    queue->arena = malloc(arena_size);
+    queue->iov = calloc(iov_size, sizeof(struct iovec));
+
+    return (queue->arena && queue->iov) ? 0 : -ENOMEM;
+}
+
+ud_sink_t *ud_sink_create(const ud_state_t *ud_state, const ud_sink_config_t *config) {
+    if (!ud_state || !config || config->max_bytes == 0 || config->max_count == 0) {
+        return NULL;
+    }
+    if (config->spool && config->replay_rate == 0) {
+        return NULL;
+    }
+
+    ud_sink_t *sink = malloc(sizeof(ud_sink_t));
+    if (!sink) {
+        return NULL;
+    }
+    // Clear out the initial state...
+    memset(sink, 0, sizeof(ud_sink_t));
+
+    sink->ud_state = ud_state;
+    sink->config = *config;
+    sink->fd = -1;
+    sink->eh_id = UD_INVALID_ID;
+
+    if (sink->config.rate_limit && sink->config.rate_burst < sink->config.max_bytes) {
+        // ensure that even the largest message can be sent eventually...
+        sink->config.rate_burst = (uint32_t) sink->config.max_bytes;
+    }
+    sink->tokens = (uint64_t) sink->config.rate_burst * 1000;
+    sink->last_refill = ud_now(ud_state);
+
+    // allow new messages to be buffered while a full batch is being written...
+    uint16_t iov_size = (config->max_count > UINT16_MAX / 2) ? UINT16_MAX : (uint16_t) (2 * config->max_count);
+
+    int rc = 0;
+    for (int p = 0; p < UD_SINK_PRIO_MAX; p++) {
+        rc |= queue_init(&sink->queues[p], 2 * config->max_bytes, iov_size);
+    }
+
+    sink->out_size = (iov_size > UINT16_MAX / UD_SINK_PRIO_MAX) ? UINT16_MAX : (uint16_t) (UD_SINK_PRIO_MAX * iov_size);
+    sink->out = calloc(sink->out_size, sizeof(struct iovec));
+    sink->out_prio = calloc(sink->out_size, sizeof(uint8_t));
+    sink->msgs = calloc(sink->out_size, sizeof(struct mmsghdr));
+
+    if (rc || !sink->out || !sink->out_prio || !sink->msgs) {
+        ud_sink_destroy(sink);
+        return NULL;
+    }
+
+    return sink;
+}
+
+void ud_sink_destroy(ud_sink_t *sink) {
+    if (!sink) {
+        return;
+    }
+
+    if (ud_spool_replaying(sink->config.spool, sink_replay_writer, sink)) {
+        // the spool can be shared, so only stop the replay that is ours...
+        ud_spool_stop_replay(sink->config.spool);
+    }
+    if (sink->timer_armed) {
+        ud_cancel_task(sink->ud_state, sink_timer, sink);
+    }
+    if (sink->throttled) {
+        ud_cancel_task(sink->ud_state, sink_throttle_timer, sink);
+    }
+    if (sink->eh_id != UD_INVALID_ID) {
+        ud_remove_event_handler(sink->ud_state, sink->eh_id);
+    }
+
+    for (int p = 0; p < UD_SINK_PRIO_MAX; p++) {
+        free(sink->queues[p].iov);
+        free(sink->queues[p].arena);
+    }
+    free(sink->msgs);
+    free(sink->out_prio);
+    free(sink->out);
+    free(sink);
+}
+
+int ud_sink_attach(ud_sink_t *sink, int fd) {
+    if (!sink || fd < 0) {
+        return -EINVAL;
+    }
+
+    if (sink->fd >= 0) {
+        ud_sink_detach(sink);
+    }
+
+    int type = 0;
+    socklen_t len = sizeof(type);
+    if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len)) {
+        // not a socket, use plain writes...
+        type = 0;
+    }
+
+    int rc = ud_add_event_handler(sink->ud_state, fd, POLLOUT, sink_writable, sink, &sink->eh_id);
+    if (rc) {
+        log_warning("Failed to register event handler for sink!");
+        sink->eh_id = UD_INVALID_ID;
+        return rc;
+    }
+    // only wake up for POLLOUT once a write would block...
+    ud_pause_handler(sink->ud_state, sink->eh_id);
+
+    sink->fd = fd;
+    sink->sock_type = type;
+    // errors of a previous connection are no longer relevant...
+    sink->error = 0;
+
+    if (sink->config.spool && !ud_spool_empty(sink->config.spool)) {
+        log_debug("Replaying spooled messages...");
+
+        rc = ud_spool_replay(sink->ud_state, sink->config.spool, sink->config.replay_rate,
+                             sink_replay_writer, sink);
+        if (rc) {
+            // nothing would ever be sent, as new messages keep going to the spool...
+            log_warning("Failed to replay spooled messages!");
+            ud_sink_detach(sink);
+        }
+        return rc;
+    }
+
+    return sink_writable_now(sink) ? sink_flush(sink) : 0;
+}
+
+void ud_sink_detach(ud_sink_t *sink) {
+    if (!sink) {
+        return;
+    }
+
+    if (sink->eh_id != UD_INVALID_ID) {
+        ud_remove_event_handler(sink->ud_state, sink->eh_id);
+        sink->eh_id = UD_INVALID_ID;
+    }
+    sink->waiting = false;
+    sink->fd = -1;
+
+    for (int p = 0; p < UD_SINK_PRIO_MAX; p++) {
+        ud_sink_queue_t *queue = &sink->queues[p];
+
+        if (queue->partial) {
+            // the remainder of a partially written message is useless for a new connection...
+            sink->stats.dropped++;
+            queue->sent++;
+            queue->partial = false;
+        }
+    }
+
+    // control messages only make sense for the connection they were meant for...
+    ud_sink_queue_t *control = &sink->queues[UD_SINK_PRIO_CONTROL];
+    sink->stats.dropped += (uint64_t) (control->count - control->sent);
+    queue_reset(control);
+
+    if (sink->config.spool) {
+        ud_sink_queue_t *bulk = &sink->queues[UD_SINK_PRIO_BULK];
+
+        for (uint16_t i = bulk->sent; i < bulk->count; i++) {
+            if (ud_spool_append(sink->config.spool, bulk->iov[i].iov_base, bulk->iov[i].iov_len)) {
+                sink->stats.dropped++;
+            } else {
+                sink->stats.spooled++;
+            }
+        }
+        queue_reset(bulk);
+    }
+}
+
+int ud_sink_write(ud_sink_t *sink, const void *data, size_t len) {
+    return ud_sink_write_prio(sink, UD_SINK_PRIO_BULK, data, len);
+}
+
+int ud_sink_write_prio(ud_sink_t *sink, ud_sink_prio_t prio, const void *data, size_t len) {
+    if (!sink || !data || prio < 0 || prio >= UD_SINK_PRIO_MAX) {
+        return -EINVAL;
+    }
+    if (sink->error) {
+        // an earlier asynchronous write failed, report it before accepting anything new...
+        int err = sink->error;
+        sink->error = 0;
+        return err;
+    }
+
+    ud_spool_t *spool = sink->config.spool;
+    if (prio == UD_SINK_PRIO_BULK && spool && (sink->fd < 0 || !ud_spool_empty(spool))) {
+        // keep the order of messages intact while the spool is not empty...
+        int rc = ud_spool_append(spool, data, len);
+        if (rc) {
+            sink->stats.dropped++;
+        } else {
+            sink->stats.spooled++;
+        }
+        return rc;
+    }
+
+    int rc = sink_enqueue(sink, prio, data, len);
+    if (rc == -ENOBUFS) {
+        sink->stats.dropped++;
+    }
+    return rc;
+}
+
+int ud_sink_flush(ud_sink_t *sink) {
+    if (!sink) {
+        return -EINVAL;
+    }
+    if (sink->error) {
+        int err = sink->error;
+        sink->error = 0;
+        return err;
+    }
+    if (!sink_writable_now(sink)) {
+        // not attached, throttled or waiting until we can write again...
+        return 0;
+    }
+    return sink_flush(sink);
+}
+
+const ud_sink_stats_t *ud_sink_get_stats(const ud_sink_t *sink) {
+    return &sink->stats;
+}
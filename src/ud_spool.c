@@ -0,0 +1,607 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/ud_spool.h"
+#include "udaemon/udaemon.h"
+
+// Marks the end of a segment when the next record did not fit...
+#define SPOOL_EOS UINT32_MAX
+#define SPOOL_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+#define SPOOL_PATH_MAX 4096
+
+#define SEGMENT_SUFFIX ".seg"
+#define SPARE_NAME "spare" SEGMENT_SUFFIX
+#define CHECKPOINT_NAME "checkpoint"
+
+typedef struct ud_spool_rec {
+    uint32_t length;
+    uint32_t check;
+} ud_spool_rec_t;
+
+typedef struct ud_spool_ckpt {
+    uint64_t seq;
+    uint64_t offset;
+} ud_spool_ckpt_t;
+
+typedef struct ud_segment {
+    uint64_t seq;
+    int fd;
+    uint8_t *base;
+} ud_segment_t;
+
+struct ud_spool {
+    char *directory;
+    size_t segment_size;
+    uint16_t max_segments;
+    uint16_t sync_batch;
+
+    /** the segment we're currently appending to. */
+    ud_segment_t wseg;
+    size_t woff;
+    uint16_t unsynced_appends;
+
+    /** the segment we're currently reading from, only mapped if it differs from wseg. */
+    ud_segment_t rseg;
+    size_t roff;
+    uint16_t unsynced_consumes;
+
+    int ckpt_fd;
+    bool has_spare;
+
+    /** the state of an active replay, if any. */
+    bool replaying;
+    const ud_state_t *replay_state;
+    uint16_t replay_rate;
+    ud_spool_writer_t replay_writer;
+    void *replay_context;
+};
+
+/**
+ * Calculates the check value of a record (FNV-1a), which is salted with the
+ * segment sequence number so records left behind in recycled segments are
+ * never mistaken for valid ones.
+ */
+static uint32_t spool_check(const uint8_t *data, uint32_t len, uint64_t seq) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash ^ (uint32_t) (seq & UINT32_MAX) ^ len;
+}
+
+static void spool_path(const ud_spool_t *spool, const char *name, char *buf, size_t size) {
+    snprintf(buf, size, "%s/%s", spool->directory, name);
+}
+
+static void segment_path(const ud_spool_t *spool, uint64_t seq, char *buf, size_t size) {
+    snprintf(buf, size, "%s/%016" PRIx64 SEGMENT_SUFFIX, spool->directory, seq);
+}
+
+static int segment_map(ud_spool_t *spool, uint64_t seq, bool create, ud_segment_t *seg) {
+    char path[SPOOL_PATH_MAX];
+    segment_path(spool, seq, path, sizeof(path));
+
+    if (create && spool->has_spare) {
+        // recycle a previously consumed segment instead of allocating a new one...
+        char spare[SPOOL_PATH_MAX];
+        spool_path(spool, SPARE_NAME, spare, sizeof(spare));
+
+        if (rename(spare, path)) {
+            log_debug("Failed to recycle spare segment: %m");
+        }
+        spool->has_spare = false;
+    }
+
+    int fd = open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    // allocate all blocks up front: writing to a hole of a shared mapping on
+    // a full disk raises SIGBUS, while this simply fails with ENOSPC...
+    int err = create ? posix_fallocate(fd, 0, (off_t) spool->segment_size) : 0;
+    if (err) {
+        close(fd);
+        unlink(path);
+        return -err;
+    }
+
+    void *base = mmap(NULL, spool->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        err = errno;
+        close(fd);
+        return -err;
+    }
+
+    seg->seq = seq;
+    seg->fd = fd;
+    seg->base = base;
+
+    return 0;
+}
+
+static void segment_unmap(const ud_spool_t *spool, ud_segment_t *seg) {
+    if (seg->base) {
+        munmap(seg->base, spool->segment_size);
+        seg->base = NULL;
+    }
+    if (seg->fd >= 0) {
+        close(seg->fd);
+        seg->fd = -1;
+    }
+}
+
+/**
+ * Returns the length of the valid record at the given offset, 0 if there is
+ * no valid record, or SPOOL_EOS if the segment was explicitly terminated.
+ */
+static uint32_t segment_record(const ud_spool_t *spool, const uint8_t *base, uint64_t seq, size_t off) {
+    if (off + sizeof(ud_spool_rec_t) > spool->segment_size) {
+        return SPOOL_EOS;
+    }
+
+    ud_spool_rec_t rec;
+    memcpy(&rec, base + off, sizeof(rec));
+
+    if (rec.length == SPOOL_EOS) {
+        return SPOOL_EOS;
+    }
+    if (rec.length == 0 || off + SPOOL_ALIGN(sizeof(rec) + rec.length) > spool->segment_size) {
+        return 0;
+    }
+    if (spool_check(base + off + sizeof(rec), rec.length, seq) != rec.check) {
+        // torn or stale record...
+        return 0;
+    }
+    return rec.length;
+}
+
+static int spool_write_checkpoint(ud_spool_t *spool) {
+    ud_spool_ckpt_t ckpt = {
+        .seq = spool->rseg.seq,
+        .offset = spool->roff,
+    };
+
+    if (pwrite(spool->ckpt_fd, &ckpt, sizeof(ckpt), 0) != sizeof(ckpt)) {
+        log_warning("Failed to write spool checkpoint: %m");
+        return -1;
+    }
+    if (fdatasync(spool->ckpt_fd)) {
+        log_warning("Failed to sync spool checkpoint: %m");
+        return -1;
+    }
+
+    spool->unsynced_consumes = 0;
+    return 0;
+}
+
+static int spool_sync_segment(ud_spool_t *spool) {
+    if (spool->unsynced_appends && fdatasync(spool->wseg.fd)) {
+        log_warning("Failed to sync spool segment: %m");
+        return -1;
+    }
+    spool->unsynced_appends = 0;
+    return 0;
+}
+
+/**
+ * Determines the first and last segment sequence numbers present on disk.
+ *
+ * @return the number of segments found, or -1 in case of errors.
+ */
+static int spool_scan(ud_spool_t *spool, uint64_t *first, uint64_t *last) {
+    DIR *dirp = opendir(spool->directory);
+    if (!dirp) {
+        return -1;
+    }
+
+    int count = 0;
+    struct dirent *entry;
+
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strcmp(entry->d_name, SPARE_NAME) == 0) {
+            spool->has_spare = true;
+            continue;
+        }
+
+        char *ep = NULL;
+        uint64_t seq = strtoull(entry->d_name, &ep, 16);
+        if (ep == entry->d_name || strcmp(ep, SEGMENT_SUFFIX) != 0) {
+            // not one of ours...
+            continue;
+        }
+
+        if (count == 0 || seq < *first) {
+            *first = seq;
+        }
+        if (count == 0 || seq > *last) {
+            *last = seq;
+        }
+        count++;
+    }
+
+    closedir(dirp);
+
+    return count;
+}
+
+static int spool_recover(ud_spool_t *spool) {
+    uint64_t first = 0, last = 0;
+
+    int count = spool_scan(spool, &first, &last);
+    if (count < 0) {
+        return -errno;
+    }
+
+    ud_spool_ckpt_t ckpt = { 0 };
+    if (pread(spool->ckpt_fd, &ckpt, sizeof(ckpt), 0) != sizeof(ckpt)) {
+        // no (valid) checkpoint, start reading at the beginning...
+        ckpt.seq = first;
+        ckpt.offset = 0;
+    }
+    if (ckpt.seq < first || ckpt.seq > last) {
+        ckpt.seq = first;
+        ckpt.offset = 0;
+    }
+
+    // remove any segments that were consumed, but not yet recycled...
+    for (uint64_t seq = first; count > 0 && seq < ckpt.seq; seq++) {
+        char path[SPOOL_PATH_MAX];
+        segment_path(spool, seq, path, sizeof(path));
+        unlink(path);
+    }
+
+    int rc = segment_map(spool, last, count == 0, &spool->wseg);
+    if (rc) {
+        return rc;
+    }
+
+    spool->rseg.seq = ckpt.seq;
+    spool->roff = (size_t) ckpt.offset;
+
+    // find the end of the written data in the last segment...
+    size_t off = (ckpt.seq == last) ? spool->roff : 0;
+    for (;;) {
+        uint32_t len = segment_record(spool, spool->wseg.base, last, off);
+        if (len == 0 || len == SPOOL_EOS) {
+            break;
+        }
+        off += SPOOL_ALIGN(sizeof(ud_spool_rec_t) + len);
+    }
+    spool->woff = off;
+
+    if (count > 0) {
+        log_debug("Recovered spool with %d segment(s), reading from %016" PRIx64 ":%zu",
+                  count, spool->rseg.seq, spool->roff);
+    }
+
+    return 0;
+}
+
+/**
+ * Positions the reader at the next record, retiring any consumed segments.
+ *
+ * @return the base of the mapped read segment, or NULL in case of errors.
+ */
+static uint8_t *spool_read_base(ud_spool_t *spool) {
+    while (spool->rseg.seq < spool->wseg.seq) {
+        if (!spool->rseg.base && segment_map(spool, spool->rseg.seq, false, &spool->rseg)) {
+            log_warning("Failed to map spool segment %016" PRIx64 ": %m", spool->rseg.seq);
+            return NULL;
+        }
+
+        uint32_t len = segment_record(spool, spool->rseg.base, spool->rseg.seq, spool->roff);
+        if (len != 0 && len != SPOOL_EOS) {
+            return spool->rseg.base;
+        }
+
+        // segment is completely consumed; recycle it...
+        uint64_t seq = spool->rseg.seq;
+        segment_unmap(spool, &spool->rseg);
+
+        char path[SPOOL_PATH_MAX];
+        segment_path(spool, seq, path, sizeof(path));
+
+        if (!spool->has_spare) {
+            char spare[SPOOL_PATH_MAX];
+            spool_path(spool, SPARE_NAME, spare, sizeof(spare));
+
+            spool->has_spare = (rename(path, spare) == 0);
+        }
+        if (!spool->has_spare) {
+            unlink(path);
+        }
+
+        spool->rseg.seq = seq + 1;
+        spool->roff = 0;
+
+        spool_write_checkpoint(spool);
+    }
+
+    return spool->wseg.base;
+}
+
+ud_spool_t *ud_spool_open(const ud_spool_config_t *config) {
+    if (!config || !config->directory) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (mkdir(config->directory, S_IRWXU) && errno != EEXIST) {
+        log_warning("Unable to create spool directory %s: %m", config->directory);
+        return NULL;
+    }
+
+    ud_spool_t *spool = malloc(sizeof(ud_spool_t));
+    if (!spool) {
+        return NULL;
+    }
+    // Clear out the initial state...
+    memset(spool, 0, sizeof(ud_spool_t));
+
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+    spool->directory = strdup(config->directory);
+    spool->segment_size = ((config->segment_size + page_size - 1) / page_size) * page_size;
+    if (spool->segment_size == 0) {
+        spool->segment_size = page_size;
+    }
+    spool->max_segments = config->max_segments;
+    spool->sync_batch = config->sync_batch;
+    spool->wseg.fd = spool->rseg.fd = -1;
+
+    char path[SPOOL_PATH_MAX];
+    spool_path(spool, CHECKPOINT_NAME, path, sizeof(path));
+
+    spool->ckpt_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (spool->ckpt_fd < 0) {
+        log_warning("Unable to open spool checkpoint %s: %m", path);
+        goto error;
+    }
+    // like segments, so checkpoints can still be written once the disk is full...
+    int err = posix_fallocate(spool->ckpt_fd, 0, sizeof(ud_spool_ckpt_t));
+    if (err) {
+        log_warning("Unable to allocate spool checkpoint %s: %s", path, strerror(err));
+        goto error;
+    }
+
+    int rc = spool_recover(spool);
+    if (rc) {
+        errno = -rc;
+        log_warning("Unable to recover spool in %s: %m", spool->directory);
+        goto error;
+    }
+
+    return spool;
+
+error:
+    ud_spool_close(spool);
+    return NULL;
+}
+
+void ud_spool_close(ud_spool_t *spool) {
+    if (!spool) {
+        return;
+    }
+
+    ud_spool_stop_replay(spool);
+
+    if (spool->wseg.base) {
+        ud_spool_sync(spool);
+    }
+
+    segment_unmap(spool, &spool->rseg);
+    segment_unmap(spool, &spool->wseg);
+
+    if (spool->ckpt_fd >= 0) {
+        close(spool->ckpt_fd);
+    }
+
+    free(spool->directory);
+    free(spool);
+}
+
+int ud_spool_append(ud_spool_t *spool, const void *data, size_t len) {
+    if (!spool || !data || len == 0) {
+        return -EINVAL;
+    }
+
+    size_t need = SPOOL_ALIGN(sizeof(ud_spool_rec_t) + len);
+    if (need > spool->segment_size || len >= SPOOL_EOS) {
+        return -EMSGSIZE;
+    }
+
+    if (spool->woff + need > spool->segment_size) {
+        // roll over to the next segment...
+        uint64_t count = spool->wseg.seq - spool->rseg.seq + 1;
+        if (spool->max_segments && count >= spool->max_segments) {
+            return -ENOSPC;
+        }
+
+        if (spool->woff + sizeof(ud_spool_rec_t) <= spool->segment_size) {
+            ud_spool_rec_t eos = { .length = SPOOL_EOS };
+            memcpy(spool->wseg.base + spool->woff, &eos, sizeof(eos));
+            spool->unsynced_appends++;
+        }
+        spool_sync_segment(spool);
+
+        ud_segment_t next = { .fd = -1 };
+        int rc = segment_map(spool, spool->wseg.seq + 1, true, &next);
+        if (rc) {
+            return rc;
+        }
+
+        if (spool->rseg.seq == spool->wseg.seq) {
+            // the reader takes over the mapping of the current segment...
+            spool->rseg = spool->wseg;
+        } else {
+            segment_unmap(spool, &spool->wseg);
+        }
+
+        spool->wseg = next;
+        spool->woff = 0;
+    }
+
+    ud_spool_rec_t rec = {
+        .length = (uint32_t) len,
+        .check = spool_check(data, (uint32_t) len, spool->wseg.seq),
+    };
+
+    // write the payload before the header to avoid exposing torn records...
+    uint8_t *dst = spool->wseg.base + spool->woff;
+    memcpy(dst + sizeof(rec), data, len);
+    memcpy(dst, &rec, sizeof(rec));
+
+    spool->woff += need;
+
+    if (++spool->unsynced_appends >= spool->sync_batch) {
+        return spool_sync_segment(spool);
+    }
+    return 0;
+}
+
+ssize_t ud_spool_peek(ud_spool_t *spool, const void **data) {
+    if (!spool || !data) {
+        return -EINVAL;
+    }
+
+    const uint8_t *base = spool_read_base(spool);
+    if (!base) {
+        return -EIO;
+    }
+
+    if (spool->rseg.seq == spool->wseg.seq && spool->roff >= spool->woff) {
+        // nothing (more) to read...
+        return 0;
+    }
+
+    uint32_t len = segment_record(spool, base, spool->rseg.seq, spool->roff);
+    if (len == 0 || len == SPOOL_EOS) {
+        return -EIO;
+    }
+
+    *data = base + spool->roff + sizeof(ud_spool_rec_t);
+    return (ssize_t) len;
+}
+
+int ud_spool_consume(ud_spool_t *spool) {
+    const void *data;
+
+    ssize_t len = ud_spool_peek(spool, &data);
+    if (len <= 0) {
+        return len < 0 ? (int) len : -ENOENT;
+    }
+
+    spool->roff += SPOOL_ALIGN(sizeof(ud_spool_rec_t) + (size_t) len);
+
+    if (++spool->unsynced_consumes >= spool->sync_batch) {
+        return spool_write_checkpoint(spool);
+    }
+    return 0;
+}
+
+int ud_spool_sync(ud_spool_t *spool) {
+    if (!spool) {
+        return -EINVAL;
+    }
+
+    int rc = spool_sync_segment(spool);
+    if (spool_write_checkpoint(spool)) {
+        rc = -1;
+    }
+    return rc;
+}
+
+bool ud_spool_empty(const ud_spool_t *spool) {
+    return !spool || (spool->rseg.seq == spool->wseg.seq && spool->roff >= spool->woff);
+}
+
+static int spool_replay_task(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    ud_spool_t *spool = context;
+
+    (void)interval;
+
+    for (uint16_t i = 0; i < spool->replay_rate; i++) {
+        const void *data;
+
+        ssize_t len = ud_spool_peek(spool, &data);
+        if (len <= 0) {
+            if (len < 0) {
+                log_warning("Failed to read from spool, stopping replay!");
+            } else {
+                log_debug("Spool fully replayed...");
+            }
+
+            spool->replaying = false;
+            ud_spool_sync(spool);
+            return (int) len;
+        }
+
+        if (spool->replay_writer(ud_state, data, (size_t) len, spool->replay_context)) {
+            log_debug("Failed to forward spooled record, retrying later...");
+            return 1;
+        }
+
+        ud_spool_consume(spool);
+    }
+
+    // continue in the next interval...
+    return 1;
+}
+
+int ud_spool_replay(const ud_state_t *ud_state, ud_spool_t *spool, uint16_t rate,
+                    ud_spool_writer_t writer, void *context) {
+    if (!ud_state || !spool || !writer || rate == 0) {
+        return -EINVAL;
+    }
+
+    if (spool->replaying) {
+        return 0;
+    }
+
+    spool->replay_state = ud_state;
+    spool->replay_rate = rate;
+    spool->replay_writer = writer;
+    spool->replay_context = context;
+
+    int rc = ud_schedule_task(ud_state, 0, spool_replay_task, spool);
+    if (rc == 0) {
+        spool->replaying = true;
+    }
+    return rc;
+}
+
+void ud_spool_stop_replay(ud_spool_t *spool) {
+    if (spool && spool->replaying) {
+        ud_cancel_task(spool->replay_state, spool_replay_task, spool);
+
+        spool->replaying = false;
+    }
+}
+
+bool ud_spool_replaying(const ud_spool_t *spool, ud_spool_writer_t writer, const void *context) {
+    return spool && spool->replaying && spool->replay_writer == writer && spool->replay_context == context;
+}
@@ -0,0 +1,32 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef UD_TRACE_H_
+#define UD_TRACE_H_
+
+/*
+ * Static tracepoints (USDT) of udaemon, for use with bpftrace, perf and alike.
+ *
+ * These are only compiled in when udaemon is built with UDAEMON_USDT enabled,
+ * in which case each tracepoint is a single nop until a tracer attaches to it.
+ * Otherwise, they compile to nothing at all; their arguments are never
+ * evaluated.
+ */
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define UD_TRACE1(name, a1) DTRACE_PROBE1(udaemon, name, a1)
+#define UD_TRACE2(name, a1, a2) DTRACE_PROBE2(udaemon, name, a1, a2)
+#define UD_TRACE3(name, a1, a2, a3) DTRACE_PROBE3(udaemon, name, a1, a2, a3)
+#define UD_TRACE4(name, a1, a2, a3, a4) DTRACE_PROBE4(udaemon, name, a1, a2, a3, a4)
+#else
+#define UD_TRACE1(name, a1) do { (void) sizeof(a1); } while (0)
+#define UD_TRACE2(name, a1, a2) do { (void) sizeof(a1); (void) sizeof(a2); } while (0)
+#define UD_TRACE3(name, a1, a2, a3) do { UD_TRACE2(name, a1, a2); (void) sizeof(a3); } while (0)
+#define UD_TRACE4(name, a1, a2, a3, a4) do { UD_TRACE3(name, a1, a2, a3); (void) sizeof(a4); } while (0)
+#endif
+
+#endif /* UD_TRACE_H_ */
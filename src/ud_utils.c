@@ -4,8 +4,7 @@
  * Copyright: (C) 2020 jawi
  *   License: Apache License 2.0
  */
-#define _POSIX_C_SOURCE 200809L
-#define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 
 #include <ctype.h>
 #include <dirent.h>
@@ -19,16 +18,26 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <alloca.h>
+#include <malloc.h>
 #include <pwd.h>
 #include <grp.h>
+#include <sched.h>
 
+#include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include "udaemon/ud_utils.h"
 #include "udaemon/ud_logging.h"
 
+// Taken from <numaif.h>, which is only available when libnuma is installed...
+#define UD_MPOL_BIND 2
+#define UD_MPOL_MF_MOVE (1 << 1)
+
 /**
  * Converts a given string to a numeric value, presuming it represents a
  * positive integer value.
@@ -356,3 +365,134 @@ int daemonize(const char *pid_file, uid_t uid, gid_t gid) {
 
     return err_none;
 }
+
+int ud_set_busy_poll(int fd, uint32_t usec) {
+#ifdef SO_BUSY_POLL
+    int val = (int) usec;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &val, sizeof(val)) < 0) {
+        return -errno;
+    }
+#ifdef SO_PREFER_BUSY_POLL
+    val = (usec > 0);
+    // only supported since Linux 5.11, which is not a problem per se...
+    (void) setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &val, sizeof(val));
+#endif
+    return 0;
+#else
+    (void) fd;
+    (void) usec;
+    return -ENOTSUP;
+#endif
+}
+
+int ud_set_cpu_affinity(uint64_t cpus) {
+    if (cpus == 0) {
+        return -EINVAL;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t cpu = 0; cpu < 64; cpu++) {
+        if (cpus & (UINT64_C(1) << cpu)) {
+            CPU_SET(cpu, &set);
+        }
+    }
+
+    if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int ud_set_rt_priority(int policy, uint8_t priority) {
+    if (policy != SCHED_FIFO && policy != SCHED_RR) {
+        return -EINVAL;
+    }
+    if (priority < sched_get_priority_min(policy) || priority > sched_get_priority_max(policy)) {
+        return -EINVAL;
+    }
+
+    struct sched_param param = { .sched_priority = priority };
+    if (sched_setscheduler(0, policy, &param) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+int ud_set_numa_nodes(uint64_t nodes, void *addr, size_t len) {
+    if (nodes == 0) {
+        return -EINVAL;
+    }
+#if defined(SYS_set_mempolicy) && defined(SYS_mbind)
+    // we do not want to depend on libnuma for just these two calls...
+    unsigned long mask = (unsigned long) nodes;
+    unsigned long maxnode = sizeof(mask) * 8 + 1;
+
+    if (syscall(SYS_set_mempolicy, UD_MPOL_BIND, &mask, maxnode) < 0) {
+        return -errno;
+    }
+
+    if (addr && len) {
+        // mbind only accepts page-aligned memory regions...
+        uintptr_t page_size = (uintptr_t) sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t) addr & ~(page_size - 1);
+        uintptr_t end = ((uintptr_t) addr + len + page_size - 1) & ~(page_size - 1);
+
+        if (syscall(SYS_mbind, start, end - start, UD_MPOL_BIND, &mask, maxnode, UD_MPOL_MF_MOVE) < 0) {
+            return -errno;
+        }
+    }
+    return 0;
+#else
+    (void) addr;
+    (void) len;
+    return -ENOSYS;
+#endif
+}
+
+static void prefault_stack(size_t size) {
+    // touch each page of the stack, the volatile ensures this is not optimized away...
+    volatile uint8_t *stack = alloca(size);
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for (size_t i = 0; i < size; i += (size_t) page_size) {
+        stack[i] = 0;
+    }
+}
+
+static int prefault_heap(size_t size) {
+#ifdef M_TRIM_THRESHOLD
+    // keep freed memory around, rather than returning it to the OS...
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+#endif
+
+    uint8_t *heap = malloc(size);
+    if (!heap) {
+        return -ENOMEM;
+    }
+
+    // the stores are dead as far as the compiler knows, do not let it drop them...
+    volatile uint8_t *touch = heap;
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < size; i += (size_t) page_size) {
+        touch[i] = 0;
+    }
+    free(heap);
+
+    return 0;
+}
+
+int ud_lock_memory(size_t stack, size_t heap) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        return -errno;
+    }
+
+    if (stack) {
+        prefault_stack(stack);
+    }
+    if (heap) {
+        return prefault_heap(heap);
+    }
+    return 0;
+}
@@ -7,52 +7,343 @@
 #define _POSIX_C_SOURCE 200809L
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <poll.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <sys/resource.h>
 #include <sys/types.h>
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#include "ud_module.h"
+#include "ud_trace.h"
 #include "udaemon/ud_logging.h"
 #include "udaemon/ud_utils.h"
 #include "udaemon/ud_version.h"
 #include "udaemon/udaemon.h"
 
-// Let's see how often this is not sufficient...
-#define FD_MAX 5
-#define TASK_MAX 10
-
+// Written to the event pipe to wake up the mainloop for posted functions...
+#define EV_POST 0x80
+// Written to the event pipe to dump the usage of event handlers and tasks...
+#define EV_TOP 0x81
+// Denotes an event handler without an entry in the pollfd array...
+#define NO_SLOT UINT32_MAX
+// The largest table sizes we accept, so indices always fit in an int...
+#define TABLE_MAX (1U << 24)
+
+// The size of a cache line, used to keep hot and cold data apart...
+#define CACHE_LINE 64
+
+// Identifies event recordings, and their format version...
+#define REC_MAGIC "UDREC02\n"
+#define REC_MAGIC_LEN 8
+
+// The types of records in an event recording...
+#define REC_POLL 1
+#define REC_TIMER 2
+#define REC_DATA 3
+#define REC_SIGNAL 4
+
+/**
+ * The part of a task that is checked in every iteration of the mainloop.
+ */
 typedef struct ud_taskdef {
     ud_task_t task;
-    uint16_t interval;
-    time_t next_deadline;
     void *context;
+    /** the deadline in milliseconds on the monotonic clock. */
+    uint64_t next_deadline;
+    uint16_t interval;
+    /** true if the interval is expressed in milliseconds instead of seconds. */
+    bool millis;
+    /** true if the task is cancelled while it is running, and awaits its cleanup. */
+    bool cancelled;
 } ud_taskdef_t;
 
+/**
+ * The part of a task that is only used when it is added or removed.
+ */
+typedef struct ud_taskcold {
+    /** the resources used by the task, if accounting is enabled. */
+    ud_usage_t usage;
+    /** the callback to release the inline storage with, if used. */
+    ud_release_t release;
+    _Alignas(max_align_t) uint8_t storage[UD_INLINE_SIZE];
+} ud_taskcold_t;
+
+/**
+ * The part of an event handler that is used to dispatch it, which fits in a
+ * single cache line. It embeds the pollfd that the callback gets a copy of, so
+ * dispatching an event handler touches this cache line only.
+ */
 typedef struct ud_ehdef {
-    ud_event_handler_t callback;
+    _Alignas(CACHE_LINE) ud_event_handler_t callback;
     void *context;
+    /** the time (in milliseconds) the handler was added or last dispatched. */
+    uint64_t last_activity;
+    /** the dispatch options of this event handler. */
+    ud_handler_opts_t opts;
+    /** the registered file descriptor and event mask, and the events to dispatch. */
+    union {
+        struct pollfd pollfd;
+        struct {
+            int fd;
+            short events;
+            short revents;
+        };
+    };
+    short pending_revents;
+    /** true if the handler is paused (or a one-shot handler that has fired). */
+    bool paused;
+    /** true if the interest of the handler changed since the last poll. */
+    bool dirty;
+    /** true if the handler returned RES_MORE and needs to be called again. */
+    bool pending;
+    /** true if the handler is removed while dispatching, and awaits its cleanup. */
+    bool removed;
+    /** true if the file descriptor of a removed handler is to be closed as well. */
+    bool close_fd;
 } ud_ehdef_t;
 
+_Static_assert(sizeof(ud_ehdef_t) == CACHE_LINE, "ud_ehdef_t should fit in a single cache line");
+
+/**
+ * The part of an event handler that is only used when it is added, removed or
+ * its interest changes.
+ */
+typedef struct ud_ehcold {
+    /** true if the handler is registered with the epoll backend. */
+    bool registered;
+    /** the duplicate of fd used to register with epoll, if fd is already registered by another handler. */
+    int ep_fd;
+    /** the (optional) hook to call before udaemon closes the file descriptor. */
+    ud_close_hook_t on_close;
+    /** the resources used by the handler, if accounting is enabled. */
+    ud_usage_t usage;
+    /** the callback to release the inline storage with, if used. */
+    ud_release_t release;
+    _Alignas(max_align_t) uint8_t storage[UD_INLINE_SIZE];
+} ud_ehcold_t;
+
+/**
+ * Represents the start of a measurement of used resources.
+ */
+typedef struct ud_mark {
+    /** the monotonic time, in microseconds. */
+    uint64_t wall;
+    /** the CPU time of the thread running the mainloop, in microseconds. */
+    uint64_t cpu;
+} ud_mark_t;
+
+/**
+ * Represents the result of a single recorded read.
+ */
+typedef struct ud_chunk {
+    struct ud_chunk *next;
+    /** the number of bytes read, zero for EOF, or a negative errno value. */
+    int32_t result;
+    /** the number of bytes already replayed. */
+    uint32_t offset;
+    uint8_t data[];
+} ud_chunk_t;
+
+/**
+ * Represents an event recording that is being replayed.
+ */
+typedef struct ud_replay {
+    FILE *file;
+    /** the type of the next record, or EOF if there are no more records. */
+    int type;
+    /** the time (in milliseconds) between the previous and next timed record. */
+    uint32_t delta;
+    /** the recorded reads that are not yet replayed, per event handler, and
+     *  one more for the signals read from the event pipe. */
+    uint32_t count;
+    ud_chunk_t **head;
+    ud_chunk_t **tail;
+} ud_replay_t;
+
 struct ud_state {
+    // The hot part, used in every iteration of the mainloop...
+
+    ud_ehdef_t *event_handlers;
+    /** the size of all per event handler tables. */
+    uint32_t max_handlers;
+    /** the lowest index of an event handler that might be unused. */
+    uint32_t free_handler;
+
+    /** the pollfds of all event handlers for the poll and custom backends, kept
+     *  dense so poll() only sees live entries. Their events are copied to the
+     *  event handlers before dispatching. */
+    struct pollfd *pollfds;
+    int pollfd_count;
+    /** maps event handler identifiers to their pollfd, and vice versa. */
+    uint32_t *slot_of;
+    uint32_t *id_of;
+    /** the event handlers that have events, in the order they are dispatched. */
+    int *ready;
+    /** rotates the ready list, so each dispatch round starts elsewhere. */
+    uint32_t rr_next;
+    /** the number of event handlers that returned RES_MORE and are to be called again. */
+    uint32_t pending_count;
+    /** the event handlers whose interest changed since the last poll. */
+    uint32_t *dirty;
+    uint32_t dirty_count;
+    /** true while event handlers are dispatched, which defers their removal. */
+    bool dispatching;
+    /** the event handlers that are removed while dispatching. */
+    uint32_t *buried;
+    uint32_t buried_count;
+
     volatile bool running;
+    /** the monotonic time (in milliseconds) of the current loop iteration. */
+    uint64_t now;
+    /** the remaining byte budget of the event handler being dispatched. */
+    size_t dispatch_budget;
+    /** true if the resources used by event handlers and tasks are accounted. */
+    bool accounting;
+    /** the usage of the event handler or task being called, if accounting. */
+    ud_usage_t *current_usage;
+    /** the monotonic time (in microseconds) until which the mainloop keeps spinning. */
+    uint64_t busy_until;
+    /** the epoll instance, or -1 when the poll backend is used. */
+    int epfd;
+    /** the (optional) clock and backend set by the application. */
+    ud_clock_t clock;
+    ud_backend_ops_t ops;
+#ifdef HAVE_EPOLL
+    struct epoll_event *ep_events;
+#endif
+
+    ud_taskdef_t *task_queue;
+    /** the size of all per task tables. */
+    uint32_t max_tasks;
+    /** one beyond the highest index of a task in use, which bounds all scans. */
+    uint32_t task_limit;
+    /** the lowest index of a task that might be unused. */
+    uint32_t free_task;
+    /** the index of the task that is running, or -1, which defers its cancellation. */
+    int running_task;
+
+    /** the event recording being written, if any. */
+    FILE *record;
+    /** the event recording being replayed, if any. */
+    ud_replay_t *replay;
+
+    // Written by other threads, so on a cache line of its own...
+
+    /** the functions posted to the mainloop, in reverse order of posting. */
+    _Alignas(CACHE_LINE) ud_post_t *inbox;
+
+    // The cold part...
+
+    /** the write end of the event pipe while the mainloop runs, -1 otherwise. */
+    _Alignas(CACHE_LINE) int wakeup_fd;
+    /** the pipe used to wake up the mainloop, kept open until the state is destroyed. */
+    int event_pipe[2];
+    /** the event handler of the event pipe while the mainloop runs. */
+    eh_id_t pipe_id;
     const ud_config_t *ud_config;
     /** the actual application configuration. */
     void *app_config;
     /** the application state. */
     void *app_state;
+    /** the time (in milliseconds) of the last timed record written. */
+    uint64_t record_time;
+
+    ud_ehcold_t *eh_cold;
+    ud_taskcold_t *task_cold;
 
-    struct pollfd pollfds[FD_MAX];
-    ud_ehdef_t event_handlers[FD_MAX];
-    ud_taskdef_t task_queue[TASK_MAX];
+    /** the data the modules keep in this state, such as the scheduler of fibers. */
+    struct {
+        void *data;
+        ud_module_drop_t drop;
+    } modules[UD_MODULE_COUNT];
+
+    /** the single allocation holding all of the tables above. */
+    void *tables;
+    size_t tables_size;
 };
 
-static int event_pipe[2] = { 0, 0 };
+/**
+ * The write end of the event pipe of the mainloop that receives the OS
+ * signals, which is the one started last, or -1 if none.
+ */
+static volatile sig_atomic_t signal_fd = -1;
+
+static inline struct pollfd *handler_pollfd(ud_state_t *ud_state, int idx) {
+    return &ud_state->event_handlers[idx].pollfd;
+}
+
+/**
+ * @return the entry of an event handler in the dense pollfd array, as used by
+ *         the poll and custom backends.
+ */
+static inline struct pollfd *dense_pollfd(ud_state_t *ud_state, int idx) {
+    return &ud_state->pollfds[ud_state->slot_of[idx]];
+}
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+/**
+ * @return the current time (in milliseconds) of the clock used by udaemon.
+ */
+static uint64_t clock_ms(const ud_state_t *ud_state) {
+    if (ud_state->clock.now) {
+        return ud_state->clock.now(ud_state->clock.context);
+    }
+    return monotonic_ms();
+}
+
+static uint64_t thread_cpu_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static void mark_now(ud_mark_t *mark) {
+    mark->wall = monotonic_us();
+    mark->cpu = thread_cpu_us();
+}
+
+/**
+ * Adds the resources used since the given mark to the given usage.
+ */
+static void account(ud_usage_t *usage, uint64_t calls, ud_mark_t *mark) {
+    ud_mark_t now;
+    mark_now(&now);
+
+    usage->calls += calls;
+    usage->wall_time += now.wall - mark->wall;
+    usage->cpu_time += now.cpu - mark->cpu;
+
+    // the end of this measurement is the start of the next one, which halves
+    // the number of clock reads...
+    *mark = now;
+}
 
 static int udaemon_initialize(const ud_state_t *ud_state) {
     const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
@@ -88,272 +379,1930 @@ static int udaemon_replace_config(const ud_state_t *ud_state, void *new_app_cfg)
             // best effort; hope we do not leave stuff behind...
             log_debug("No config_cleanup hook defined! Using default configuration cleanup!");
 
-            free(old_app_cfg);
-        }
+            free(old_app_cfg);
+        }
+    }
+    return 0;
+}
+
+static int udaemon_read_config(const ud_state_t *ud_state) {
+    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
+
+    if (ud_cfg->conf_file && ud_cfg->config_parser) {
+        if (ud_state->app_config) {
+            log_debug("Reloading configuration from %s", ud_cfg->conf_file);
+        } else {
+            log_debug("Loading configuration from %s", ud_cfg->conf_file);
+        }
+
+        UD_TRACE2(config__reload__start, ud_cfg->conf_file, ud_state->app_config != NULL);
+
+        int retval = 1;
+        void *new_cfg = ud_cfg->config_parser(ud_cfg->conf_file, ud_state->app_config);
+        if (new_cfg) {
+            retval = udaemon_replace_config(ud_state, new_cfg);
+        }
+        // in case of errors, the existing configuration is left as-is...
+
+        UD_TRACE1(config__reload__done, retval);
+        return retval;
+    }
+    return 0;
+}
+
+static int udaemon_cleanup(ud_state_t *ud_state) {
+    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
+
+    int retval;
+    if (ud_cfg->cleanup) {
+        retval = ud_cfg->cleanup(ud_state);
+        if (retval) {
+            log_warning("Failed to perform cleanup!");
+        }
+    }
+    // Cleanup the configuration, if any...
+    return udaemon_replace_config(ud_state, NULL);
+}
+
+/**
+ * Finds the event handler that polls the given file descriptor.
+ *
+ * @return the index of the event handler, or -1 if there is none.
+ */
+static int find_handler(const ud_state_t *ud_state, int fd) {
+    for (int i = 0; i < (int) ud_state->max_handlers; i++) {
+        if (ud_state->event_handlers[i].callback && ud_state->event_handlers[i].fd == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void record_id(ud_state_t *ud_state, uint32_t id) {
+    fwrite(&id, sizeof(id), 1, ud_state->record);
+}
+
+static int replay_id(ud_replay_t *replay, uint32_t *id) {
+    return fread(id, sizeof(*id), 1, replay->file) == 1 ? 0 : -1;
+}
+
+static void record_type(ud_state_t *ud_state, uint8_t type, bool timed) {
+    fputc(type, ud_state->record);
+    if (timed) {
+        // timed records only store the time since the previous one...
+        uint32_t delta = (uint32_t) (ud_state->now - ud_state->record_time);
+        ud_state->record_time = ud_state->now;
+        fwrite(&delta, sizeof(delta), 1, ud_state->record);
+    }
+}
+
+/**
+ * Records the event handlers that are about to be dispatched, with their events.
+ */
+static void record_poll(ud_state_t *ud_state, const int *ready, int count) {
+    record_type(ud_state, REC_POLL, true);
+    record_id(ud_state, (uint32_t) count);
+    for (int j = 0; j < count; j++) {
+        uint16_t revents = (uint16_t) ud_state->event_handlers[ready[j]].revents;
+        record_id(ud_state, (uint32_t) ready[j]);
+        fwrite(&revents, sizeof(revents), 1, ud_state->record);
+    }
+}
+
+static void record_timer(ud_state_t *ud_state, int idx) {
+    record_type(ud_state, REC_TIMER, true);
+    record_id(ud_state, (uint32_t) idx);
+}
+
+static void record_read(ud_state_t *ud_state, int idx, int32_t result, const void *buf) {
+    if (idx == (int) ud_state->pipe_id) {
+        if (result != 1) {
+            // nothing (or an error) read from our own event pipe is handled as no signal...
+            return;
+        }
+        // our own event pipe only carries signals (and wake-ups)...
+        record_type(ud_state, REC_SIGNAL, false);
+        fputc(*(const uint8_t *) buf, ud_state->record);
+        return;
+    }
+
+    record_type(ud_state, REC_DATA, false);
+    record_id(ud_state, (uint32_t) idx);
+    fwrite(&result, sizeof(result), 1, ud_state->record);
+    if (result > 0) {
+        fwrite(buf, 1, (size_t) result, ud_state->record);
+    }
+}
+
+static void replay_next(ud_replay_t *replay) {
+    replay->type = fgetc(replay->file);
+    if (replay->type == REC_POLL || replay->type == REC_TIMER) {
+        if (fread(&replay->delta, sizeof(replay->delta), 1, replay->file) != 1) {
+            replay->type = EOF;
+        }
+    }
+}
+
+/**
+ * Queues all recorded reads up to the next timed record, so they can be
+ * replayed by the event handlers that did them.
+ */
+static void replay_reads(ud_replay_t *replay) {
+    while (replay->type == REC_DATA || replay->type == REC_SIGNAL) {
+        // the event pipe can have a different handler in the replay, so its
+        // signals are queued separately...
+        uint32_t idx = replay->count;
+        int32_t result = 1;
+        if (replay->type == REC_DATA) {
+            if (replay_id(replay, &idx) || fread(&result, sizeof(result), 1, replay->file) != 1) {
+                replay->type = EOF;
+                return;
+            }
+        }
+
+        size_t len = (result > 0) ? (size_t) result : 0;
+        ud_chunk_t *chunk = malloc(sizeof(ud_chunk_t) + len);
+        if (!chunk || fread(chunk->data, 1, len, replay->file) != len) {
+            free(chunk);
+            replay->type = EOF;
+            return;
+        }
+        chunk->next = NULL;
+        chunk->result = result;
+        chunk->offset = 0;
+
+        if (idx <= replay->count) {
+            if (replay->tail[idx]) {
+                replay->tail[idx]->next = chunk;
+            } else {
+                replay->head[idx] = chunk;
+            }
+            replay->tail[idx] = chunk;
+        } else {
+            free(chunk);
+        }
+
+        replay_next(replay);
+    }
+}
+
+static ssize_t replay_read(ud_replay_t *replay, int idx, void *buf, size_t count) {
+    ud_chunk_t *chunk = replay->head[idx];
+    if (!chunk) {
+        // nothing more was read in the recording...
+        errno = EAGAIN;
+        return -1;
+    }
+
+    ssize_t n = chunk->result;
+    if (chunk->result > 0) {
+        size_t left = (size_t) chunk->result - chunk->offset;
+        if (count < left) {
+            // the event handler reads in smaller parts than it did before...
+            memcpy(buf, chunk->data + chunk->offset, count);
+            chunk->offset += (uint32_t) count;
+            return (ssize_t) count;
+        }
+        memcpy(buf, chunk->data + chunk->offset, left);
+        n = (ssize_t) left;
+    }
+
+    replay->head[idx] = chunk->next;
+    if (!replay->head[idx]) {
+        replay->tail[idx] = NULL;
+    }
+    free(chunk);
+
+    if (n < 0) {
+        errno = (int) -n;
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * Advances the virtual clock to the time at which the recorded tasks ran.
+ */
+static void replay_timers(ud_state_t *ud_state) {
+    ud_replay_t *replay = ud_state->replay;
+    if (replay->type != REC_TIMER) {
+        return;
+    }
+
+    ud_state->now += replay->delta;
+    // all tasks that ran in the same iteration share the same time...
+    do {
+        // the index of the task is informational only...
+        uint32_t idx;
+        if (replay_id(replay, &idx)) {
+            replay->type = EOF;
+            return;
+        }
+        replay_next(replay);
+        replay_reads(replay);
+    } while (replay->type == REC_TIMER && replay->delta == 0);
+}
+
+/**
+ * Replays the next recorded events as `revents` of the event handlers.
+ *
+ * @return the number of event handlers with events, which are stored in the
+ *         ready list.
+ */
+static int replay_events(ud_state_t *ud_state) {
+    ud_replay_t *replay = ud_state->replay;
+
+    if (replay->type == REC_TIMER) {
+        // only tasks ran in the recorded iteration...
+        return 0;
+    }
+    if (replay->type != REC_POLL) {
+        log_info("End of event recording reached...");
+        ud_state->running = false;
+        return 0;
+    }
+
+    ud_state->now += replay->delta;
+
+    int count = 0;
+    uint32_t n = 0;
+    replay_id(replay, &n);
+    for (uint32_t j = 0; j < n; j++) {
+        uint32_t idx;
+        uint16_t revents;
+        if (replay_id(replay, &idx) || fread(&revents, sizeof(revents), 1, replay->file) != 1) {
+            break;
+        }
+        // event handlers of the recording that do not exist (anymore) are skipped...
+        if (idx < ud_state->max_handlers && ud_state->slot_of[idx] != NO_SLOT &&
+                !ud_state->event_handlers[idx].revents && revents) {
+            ud_state->event_handlers[idx].revents = (short) revents;
+            ud_state->ready[count++] = (int) idx;
+        }
+    }
+
+    replay_next(replay);
+    replay_reads(replay);
+
+    return count;
+}
+
+static uint8_t read_signal_event(const ud_state_t *ud_state, int fd) {
+    uint8_t buf[1] = { EV_POST };
+    if (ud_read(ud_state, fd, &buf, sizeof(buf)) != sizeof(buf)) {
+        log_warning("Did not read all event data?!");
+        // handled as a plain wake-up...
+        return EV_POST;
+    }
+    return buf[0];
+}
+
+static void write_signal_event(int fd, uint8_t event_type) {
+    uint8_t buf[1] = { event_type };
+    // a full pipe (the write end is non-blocking) wakes up the mainloop anyway...
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf) && errno != EAGAIN) {
+        log_warning("Did not write all event data?!");
+    }
+}
+
+static void os_signal_handler(int signo) {
+    int fd = signal_fd;
+    if (fd < 0) {
+        return;
+    }
+
+    if (signo == SIGTERM || signo == SIGINT) {
+        write_signal_event(fd, SIG_TERM);
+    } else if (signo == SIGHUP) {
+        write_signal_event(fd, SIG_HUP);
+    } else if (signo == SIGUSR1) {
+        write_signal_event(fd, SIG_USR1);
+    } else if (signo == SIGUSR2) {
+        write_signal_event(fd, SIG_USR2);
+    } else if (signo == SIGQUIT) {
+        write_signal_event(fd, EV_TOP);
+    } else {
+        log_debug("Unknown/unhandled signal: %d", signo);
+    }
+}
+
+static void raise_limits(const ud_config_t *ud_cfg) {
+    // NOTE: only root is able to raise these limits, in which case the daemon
+    // can apply its runtime options after it dropped its privileges...
+    if (getuid() != 0) {
+        return;
+    }
+
+    struct rlimit rlim;
+    if (ud_cfg->rt_priority) {
+        rlim.rlim_cur = rlim.rlim_max = ud_cfg->rt_priority;
+        if (setrlimit(RLIMIT_RTPRIO, &rlim) < 0) {
+            log_warning("Unable to raise real-time priority limit: %m");
+        }
+    }
+    if (ud_cfg->lock_memory) {
+        rlim.rlim_cur = rlim.rlim_max = RLIM_INFINITY;
+        if (setrlimit(RLIMIT_MEMLOCK, &rlim) < 0) {
+            log_warning("Unable to raise locked memory limit: %m");
+        }
+    }
+}
+
+static void apply_runtime_options(ud_state_t *ud_state) {
+    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
+    int retval;
+
+    if (ud_cfg->cpu_affinity) {
+        retval = ud_set_cpu_affinity(ud_cfg->cpu_affinity);
+        if (retval) {
+            log_warning("Unable to set CPU affinity: %s", strerror(-retval));
+        }
+    }
+    if (ud_cfg->numa_nodes) {
+        // also move our own state, which is allocated before the policy is in place...
+        retval = ud_set_numa_nodes(ud_cfg->numa_nodes, ud_state, sizeof(ud_state_t));
+        if (!retval) {
+            retval = ud_set_numa_nodes(ud_cfg->numa_nodes, ud_state->tables, ud_state->tables_size);
+        }
+        if (retval) {
+            log_warning("Unable to set NUMA memory policy: %s", strerror(-retval));
+        }
+    }
+    if (ud_cfg->rt_priority) {
+        int policy = (ud_cfg->rt_policy == UD_RT_RR) ? SCHED_RR : SCHED_FIFO;
+
+        retval = ud_set_rt_priority(policy, ud_cfg->rt_priority);
+        if (retval) {
+            log_warning("Unable to set real-time priority: %s", strerror(-retval));
+        }
+    }
+    if (ud_cfg->lock_memory) {
+        retval = ud_lock_memory(ud_cfg->prefault_stack, ud_cfg->prefault_heap);
+        if (retval) {
+            log_warning("Unable to lock memory: %s", strerror(-retval));
+        }
+    }
+}
+
+static ud_result_t main_signal_handler(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void)context;
+
+    uint8_t event = read_signal_event(ud_state, pollfd->fd);
+    if (event == EV_POST) {
+        // posted functions are run at the start of the next iteration...
+        return RES_OK;
+    }
+    if (event == EV_TOP) {
+        ud_dump_top(ud_state);
+        return RES_OK;
+    }
+
+    ud_signal_t signal = (ud_signal_t) event;
+
+    UD_TRACE1(signal, event);
+
+    if (signal == SIG_HUP) {
+        udaemon_read_config(ud_state);
+    }
+
+    udaemon_signal_handler(ud_state, signal);
+
+    if (signal == SIG_TERM) {
+        log_debug("Terminating main event loop...");
+        if (ud_terminate(ud_state)) {
+            log_warning("Failed to terminate main event loop!");
+        }
+    }
+
+    return RES_OK;
+}
+
+static void run_posts(ud_state_t *ud_state) {
+    if (!__atomic_load_n(&ud_state->inbox, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // restore the order in which the functions were posted...
+    ud_post_t *posted = __atomic_exchange_n(&ud_state->inbox, NULL, __ATOMIC_ACQUIRE);
+    ud_post_t *list = NULL;
+    while (posted) {
+        ud_post_t *next = posted->next;
+        posted->next = list;
+        list = posted;
+        posted = next;
+    }
+
+    while (list) {
+        ud_post_t *next = list->next;
+        // the function is allowed to reuse the post...
+        list->fn(ud_state, list);
+        list = next;
+    }
+}
+
+static void clear_task(ud_state_t *ud_state, int idx) {
+    ud_taskcold_t *taskcold = &ud_state->task_cold[idx];
+    ud_release_t release = taskcold->release;
+
+    ud_state->task_queue[idx].task = NULL;
+    ud_state->task_queue[idx].cancelled = false;
+    taskcold->release = NULL;
+    if (release) {
+        release(taskcold->storage);
+    }
+
+    if ((uint32_t) idx < ud_state->free_task) {
+        ud_state->free_task = (uint32_t) idx;
+    }
+    // keep the scans of the task queue as short as possible...
+    while (ud_state->task_limit > 0 && !ud_state->task_queue[ud_state->task_limit - 1].task) {
+        ud_state->task_limit--;
+    }
+}
+
+static void run_tasks(ud_state_t *ud_state, uint64_t now) {
+    ud_mark_t mark = { 0 };
+
+    for (int i = 0; i < (int) ud_state->task_limit; i++) {
+        ud_taskdef_t *taskdef = &ud_state->task_queue[i];
+
+        if (taskdef->task && taskdef->next_deadline <= now) {
+            if (ud_state->record) {
+                record_timer(ud_state, i);
+            }
+
+            UD_TRACE3(task__run, i, taskdef->task, now - taskdef->next_deadline);
+
+            if (ud_state->accounting) {
+                // only measure the time when a task actually runs...
+                if (!mark.wall) {
+                    mark_now(&mark);
+                }
+                ud_state->current_usage = &ud_state->task_cold[i].usage;
+            }
+
+            // a task that cancels itself keeps its slot (and inline storage) until it returns...
+            ud_state->running_task = i;
+            int retval = taskdef->task(ud_state, taskdef->interval, taskdef->context);
+            ud_state->running_task = -1;
+
+            if (ud_state->accounting) {
+                account(&ud_state->task_cold[i].usage, 1, &mark);
+                ud_state->current_usage = NULL;
+            }
+
+            UD_TRACE2(task__return, i, retval);
+            if (retval <= 0 || taskdef->cancelled) {
+                log_debug("Removing task at index %d", i);
+
+                clear_task(ud_state, i);
+            } else {
+                log_debug("Rescheduling task at index %d to run in %d %s", i, retval,
+                          taskdef->millis ? "milliseconds" : "seconds");
+
+                taskdef->interval = (uint16_t) retval;
+                taskdef->next_deadline = now + (uint64_t) retval * (taskdef->millis ? 1 : 1000);
+            }
+        }
+    }
+}
+
+/**
+ * Determines how long (in milliseconds) we can wait for events before the
+ * next task deadline is hit, capped to the given maximum.
+ */
+static int next_task_timeout(const ud_state_t *ud_state, uint64_t now, int max_timeout) {
+    uint64_t timeout = (uint64_t) max_timeout;
+
+    for (int i = 0; i < (int) ud_state->task_limit; i++) {
+        const ud_taskdef_t *taskdef = &ud_state->task_queue[i];
+
+        if (taskdef->task) {
+            if (taskdef->next_deadline <= now) {
+                return 0;
+            }
+            if (taskdef->next_deadline - now < timeout) {
+                timeout = taskdef->next_deadline - now;
+            }
+        }
+    }
+    return (int) timeout;
+}
+
+static void reverse_ready(int *ready, int from, int to) {
+    while (from < --to) {
+        int tmp = ready[from];
+        ready[from++] = ready[to];
+        ready[to] = tmp;
+    }
+}
+
+/**
+ * Determines the order in which the ready event handlers are dispatched:
+ * by descending priority, and round-robin within the same priority.
+ */
+static void order_ready(ud_state_t *ud_state, int *ready, int count) {
+    // rotate the ready list, so another event handler goes first each time...
+    int first = (int) (ud_state->rr_next++ % (uint32_t) count);
+    if (first) {
+        reverse_ready(ready, 0, first);
+        reverse_ready(ready, first, count);
+        reverse_ready(ready, 0, count);
+    }
+
+    // insertion sort keeps the round-robin order for equal priorities...
+    for (int j = 1; j < count; j++) {
+        int i = ready[j];
+        uint8_t prio = ud_state->event_handlers[i].opts.priority;
+        int k = j;
+        while (k > 0 && ud_state->event_handlers[ready[k - 1]].opts.priority < prio) {
+            ready[k] = ready[k - 1];
+            k--;
+        }
+        ready[k] = i;
+    }
+}
+
+#ifdef HAVE_EPOLL
+/**
+ * Brings the registration of an event handler with epoll up-to-date.
+ */
+static void epoll_update(ud_state_t *ud_state, int idx) {
+    ud_ehdef_t *ehdef = &ud_state->event_handlers[idx];
+    ud_ehcold_t *ehcold = &ud_state->eh_cold[idx];
+
+    if (!ehdef->callback) {
+        if (ehcold->registered) {
+            // the fd might already be closed by the application; that's fine...
+            epoll_ctl(ud_state->epfd, EPOLL_CTL_DEL, ehcold->ep_fd >= 0 ? ehcold->ep_fd : ehdef->fd, NULL);
+            ehcold->registered = false;
+        }
+        if (ehcold->ep_fd >= 0) {
+            close(ehcold->ep_fd);
+            ehcold->ep_fd = -1;
+        }
+        return;
+    }
+
+    // the poll and epoll event bits are identical on Linux...
+    struct epoll_event ev = {
+        .events = (uint32_t) (unsigned short) ehdef->events,
+        .data.u32 = (uint32_t) idx,
+    };
+    if (ehdef->paused) {
+        // stay registered so resuming is a single MOD; epoll always reports
+        // errors and hangups, so let it report those at most once...
+        ev.events = EPOLLONESHOT;
+    } else if (ehdef->opts.flags & UD_HANDLER_EDGE) {
+        ev.events |= EPOLLET;
+    }
+
+    int op = ehcold->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int fd = ehcold->ep_fd >= 0 ? ehcold->ep_fd : ehdef->fd;
+
+    int rc = epoll_ctl(ud_state->epfd, op, fd, &ev);
+    if (rc && errno == ENOENT && op == EPOLL_CTL_MOD) {
+        // the fd was closed (and reopened) while the handler was paused...
+        op = EPOLL_CTL_ADD;
+        rc = epoll_ctl(ud_state->epfd, op, fd, &ev);
+    }
+    if (rc && errno == EEXIST && ehcold->ep_fd < 0) {
+        // another handler polls the same fd; epoll only allows this for a duplicate...
+        ehcold->ep_fd = fcntl(ehdef->fd, F_DUPFD_CLOEXEC, 0);
+        if (ehcold->ep_fd >= 0) {
+            rc = epoll_ctl(ud_state->epfd, op, ehcold->ep_fd, &ev);
+        }
+    }
+    if (rc) {
+        log_warning("Failed to register fd#%d with epoll: %m", ehdef->fd);
+        return;
+    }
+    ehcold->registered = true;
+}
+#endif
+
+static void clear_handler(ud_state_t *ud_state, int idx) {
+    ud_ehcold_t *ehcold = &ud_state->eh_cold[idx];
+
+    ud_release_t release = ehcold->release;
+    if (release) {
+        ehcold->release = NULL;
+        release(ehcold->storage);
+    }
+
+#ifdef HAVE_EPOLL
+    if (ehcold->registered || ehcold->ep_fd >= 0) {
+        // unregister right away, the application is likely to close the fd...
+        ud_state->event_handlers[idx].callback = NULL;
+        epoll_update(ud_state, idx);
+    }
+#endif
+
+    uint32_t slot = ud_state->slot_of[idx];
+    if (slot != NO_SLOT) {
+        // swap-remove keeps the pollfds dense...
+        uint32_t last = (uint32_t) --ud_state->pollfd_count;
+        if (slot != last) {
+            ud_state->pollfds[slot] = ud_state->pollfds[last];
+            ud_state->id_of[slot] = ud_state->id_of[last];
+            ud_state->slot_of[ud_state->id_of[slot]] = slot;
+        }
+        ud_state->slot_of[idx] = NO_SLOT;
+    }
+
+    ud_ehdef_t *ehdef = &ud_state->event_handlers[idx];
+    if (ehdef->pending) {
+        ud_state->pending_count--;
+    }
+    // a handler stays queued for sync_interest, even if its slot is reused...
+    bool dirty = ehdef->dirty;
+    *ehdef = (ud_ehdef_t) {
+        .callback = NULL,
+        .fd = -1,
+        .dirty = dirty,
+    };
+    ehcold->registered = false;
+    ehcold->ep_fd = -1;
+    ehcold->on_close = NULL;
+
+    if ((uint32_t) idx < ud_state->free_handler) {
+        ud_state->free_handler = (uint32_t) idx;
+    }
+}
+
+/**
+ * Marks an event handler as removed, without releasing its slot, so it cannot
+ * be reused while the ready event handlers are dispatched.
+ */
+static void bury_handler(ud_state_t *ud_state, int idx, bool close_fd) {
+    ud_ehdef_t *ehdef = &ud_state->event_handlers[idx];
+
+    if (!ehdef->removed) {
+        ud_state->buried[ud_state->buried_count++] = (uint32_t) idx;
+    }
+    if (ehdef->pending) {
+        ud_state->pending_count--;
+    }
+
+    ehdef->removed = true;
+    ehdef->close_fd = ehdef->close_fd || close_fd;
+    ehdef->pending = false;
+    // never dispatch the events that are left for it...
+    handler_pollfd(ud_state, idx)->revents = 0;
+}
+
+/**
+ * Cleans up all event handlers that are removed while dispatching, closing
+ * their file descriptors if requested.
+ */
+static void reap_handlers(ud_state_t *ud_state) {
+    // hooks are allowed to remove other event handlers, which are reaped as well...
+    bool dispatching = ud_state->dispatching;
+    ud_state->dispatching = true;
+
+    // only handlers that are removed are on the list, so it never overflows...
+    while (ud_state->buried_count > 0) {
+        int i = (int) ud_state->buried[--ud_state->buried_count];
+        ud_ehdef_t *ehdef = &ud_state->event_handlers[i];
+
+        int fd = ehdef->fd;
+        bool close_fd = ehdef->close_fd;
+        ud_close_hook_t on_close = ud_state->eh_cold[i].on_close;
+        if (close_fd && on_close) {
+            // the context might be inline storage, which is released below...
+            on_close(ud_state, fd, ehdef->context);
+        }
+
+        clear_handler(ud_state, i);
+
+        if (close_fd) {
+            close(fd);
+        }
+    }
+
+    ud_state->dispatching = dispatching;
+}
+
+static void mark_dirty(ud_state_t *ud_state, int idx) {
+    ud_ehdef_t *ehdef = &ud_state->event_handlers[idx];
+
+    // the flag keeps every handler on the list at most once...
+    if (!ehdef->dirty) {
+        ehdef->dirty = true;
+        ud_state->dirty[ud_state->dirty_count++] = (uint32_t) idx;
+    }
+}
+
+/**
+ * Applies all changes in the interest of event handlers, which are collected
+ * during an iteration, so repeated changes result in a single update.
+ */
+static void sync_interest(ud_state_t *ud_state) {
+    for (uint32_t j = 0; j < ud_state->dirty_count; j++) {
+        int i = (int) ud_state->dirty[j];
+        ud_ehdef_t *ehdef = &ud_state->event_handlers[i];
+
+        ehdef->dirty = false;
+        if (!ehdef->callback) {
+            // removed in the meantime, which already unregistered it...
+            continue;
+        }
+
+        struct pollfd *pollfd = dense_pollfd(ud_state, i);
+        // a negative fd causes poll() to ignore it entirely...
+        pollfd->fd = ehdef->paused ? -1 : ehdef->fd;
+        pollfd->events = ehdef->events;
+
+#ifdef HAVE_EPOLL
+        if (ud_state->epfd >= 0) {
+            epoll_update(ud_state, i);
+        }
+#endif
+    }
+
+    ud_state->dirty_count = 0;
+}
+
+/**
+ * Copies the events of the dense pollfd array to the event handlers.
+ *
+ * @return the number of event handlers with events, which are stored in the
+ *         ready list.
+ */
+static int collect_pollfds(ud_state_t *ud_state, int count) {
+    int n = 0;
+    // only the live pollfds are scanned, until all ready ones are found...
+    for (int slot = 0; slot < ud_state->pollfd_count && n < count; slot++) {
+        struct pollfd *pollfd = &ud_state->pollfds[slot];
+        if (pollfd->revents) {
+            int i = (int) ud_state->id_of[slot];
+            ud_state->event_handlers[i].revents = pollfd->revents;
+            ud_state->ready[n++] = i;
+            pollfd->revents = 0;
+        }
+    }
+    return n;
+}
+
+/**
+ * Waits for events using the active backend, and stores them as `revents` of
+ * the event handlers.
+ *
+ * @return the number of event handlers with events, which are stored in the
+ *         ready list, or -1 in case of errors.
+ */
+static int wait_events(ud_state_t *ud_state, int timeout) {
+    if (ud_state->replay) {
+        return replay_events(ud_state);
+    }
+
+    int count;
+    if (ud_state->ops.wait) {
+        count = ud_state->ops.wait(ud_state, ud_state->pollfds, ud_state->pollfd_count, timeout, ud_state->ops.context);
+        return count > 0 ? collect_pollfds(ud_state, count) : count;
+    }
+#ifdef HAVE_EPOLL
+    if (ud_state->epfd >= 0) {
+        count = epoll_wait(ud_state->epfd, ud_state->ep_events, (int) ud_state->max_handlers, timeout);
+
+        // epoll tells which event handlers are ready, so only those are touched...
+        int n = 0;
+        for (int j = 0; j < count; j++) {
+            uint32_t idx = ud_state->ep_events[j].data.u32;
+            if (idx < ud_state->max_handlers && ud_state->event_handlers[idx].callback) {
+                ud_state->event_handlers[idx].revents = (short) (ud_state->ep_events[j].events & 0xffff);
+                ud_state->ready[n++] = (int) idx;
+            }
+        }
+        return count < 0 ? count : n;
+    }
+#endif
+    count = poll(ud_state->pollfds, (nfds_t) ud_state->pollfd_count, timeout);
+    return count > 0 ? collect_pollfds(ud_state, count) : count;
+}
+
+static void setup_backend(ud_state_t *ud_state) {
+    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
+
+    ud_state->epfd = -1;
+
+#ifdef HAVE_EPOLL
+    // a replay or custom backend never waits for actual events...
+    if (ud_cfg->backend != UD_BACKEND_POLL && !ud_state->replay && !ud_state->ops.wait) {
+        ud_state->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (ud_state->epfd < 0) {
+            log_warning("Unable to create epoll instance, falling back to poll: %m");
+        }
+    }
+#else
+    if (ud_cfg->backend == UD_BACKEND_EPOLL) {
+        log_warning("No epoll support available, falling back to poll!");
+    }
+#endif
+
+    log_debug("Using %s backend...", ud_state->ops.wait ? "custom" : ud_state->epfd >= 0 ? "epoll" : "poll");
+
+    // (re-)register all event handlers that were added before...
+    for (int i = 0; i < (int) ud_state->max_handlers; i++) {
+        if (ud_state->event_handlers[i].callback) {
+            mark_dirty(ud_state, i);
+        }
+    }
+}
+
+/**
+ * Dispatches the events of an event handler.
+ *
+ * @return the number of times the event handler is called.
+ */
+static uint16_t dispatch_handler(ud_state_t *ud_state, int i) {
+    ud_ehdef_t *ehdef = &ud_state->event_handlers[i];
+
+    ud_event_handler_t callback = ehdef->callback;
+    void *context = ehdef->context;
+    int fd = ehdef->fd;
+    short revents = ehdef->revents;
+
+    uint16_t max_events = ehdef->opts.max_events ? ehdef->opts.max_events : 1;
+    ehdef->last_activity = ud_state->now;
+    ud_state->dispatch_budget = ehdef->opts.max_bytes ? ehdef->opts.max_bytes : SIZE_MAX;
+    if (ud_state->accounting) {
+        ud_state->current_usage = &ud_state->eh_cold[i].usage;
+    }
+
+    UD_TRACE3(dispatch__entry, i, fd, revents);
+
+    ud_result_t res;
+    uint16_t events = 0;
+    do {
+        // callbacks get a copy, so writing to it cannot change the interest of
+        // the handler behind our back (use ud_modify_event_handler instead)...
+        struct pollfd pollfd = { .fd = fd, .events = ehdef->events, .revents = revents };
+        res = callback(ud_state, &pollfd, context);
+        events++;
+    } while (res == RES_MORE && events < max_events && ud_state->dispatch_budget > 0 &&
+             ud_state->running && !ehdef->removed && !ehdef->paused);
+
+    UD_TRACE4(dispatch__return, i, fd, res, events);
+
+    // removed event handlers keep their slot until the dispatch pass is done,
+    // so the slot cannot be taken over by another handler in the meantime...
+    if (res == RES_ERROR) {
+        log_debug("Callback for fd#%d returned an error! Closing it...", fd);
+
+        bury_handler(ud_state, i, true);
+    } else if (!ehdef->removed) {
+        if (ehdef->opts.flags & UD_HANDLER_ONESHOT) {
+            // disarm until the handler is explicitly resumed...
+            ehdef->paused = true;
+            mark_dirty(ud_state, i);
+        } else if (res == RES_MORE) {
+            // budget exhausted; call it again in the next iteration, even without new events...
+            if (!ehdef->pending) {
+                ud_state->pending_count++;
+            }
+            ehdef->pending = true;
+            ehdef->pending_revents = revents;
+        }
+    }
+
+    ud_state->current_usage = NULL;
+
+    return events;
+}
+
+/**
+ * Restores the events of all event handlers that still have work pending,
+ * adding them to the ready list.
+ *
+ * @return the number of event handlers in the ready list.
+ */
+static int restore_pending(ud_state_t *ud_state, int count) {
+    if (!ud_state->pending_count) {
+        return count;
+    }
+
+    // only live event handlers can be pending...
+    for (int slot = 0; slot < ud_state->pollfd_count; slot++) {
+        int i = (int) ud_state->id_of[slot];
+        ud_ehdef_t *ehdef = &ud_state->event_handlers[i];
+
+        if (ehdef->pending) {
+            ehdef->pending = false;
+            if (ehdef->callback && !ehdef->paused && !ehdef->revents) {
+                ehdef->revents = ehdef->pending_revents;
+                ud_state->ready[count++] = i;
+            }
+        }
+    }
+    ud_state->pending_count = 0;
+
+    return count;
+}
+
+static bool has_pending(const ud_state_t *ud_state) {
+    return ud_state->pending_count > 0;
+}
+
+static uint32_t table_size(uint32_t configured, uint32_t fallback) {
+    if (configured == 0) {
+        return fallback;
+    }
+    return (configured < TABLE_MAX) ? configured : TABLE_MAX;
+}
+
+/**
+ * Reserves room for a table in the allocation of all tables, keeping each
+ * table cache line aligned.
+ *
+ * @return the offset of the table.
+ */
+static size_t reserve_table(size_t *size, uint32_t count, size_t elem_size) {
+    size_t offset = (*size + CACHE_LINE - 1) & ~(size_t) (CACHE_LINE - 1);
+    *size = offset + count * elem_size;
+    return offset;
+}
+
+/**
+ * Allocates all per event handler and per task tables at once, which keeps
+ * them close together, and makes it easy to move them to another NUMA node.
+ */
+static int alloc_tables(ud_state_t *state, uint32_t handlers, uint32_t tasks) {
+    size_t size = 0;
+    size_t eh_off = reserve_table(&size, handlers, sizeof(ud_ehdef_t));
+    size_t pollfd_off = reserve_table(&size, handlers, sizeof(struct pollfd));
+    size_t slot_off = reserve_table(&size, handlers, sizeof(uint32_t));
+    size_t id_off = reserve_table(&size, handlers, sizeof(uint32_t));
+    size_t ready_off = reserve_table(&size, handlers, sizeof(int));
+    size_t dirty_off = reserve_table(&size, handlers, sizeof(uint32_t));
+    size_t buried_off = reserve_table(&size, handlers, sizeof(uint32_t));
+#ifdef HAVE_EPOLL
+    size_t ep_off = reserve_table(&size, handlers, sizeof(struct epoll_event));
+#endif
+    size_t task_off = reserve_table(&size, tasks, sizeof(ud_taskdef_t));
+    size_t ehcold_off = reserve_table(&size, handlers, sizeof(ud_ehcold_t));
+    size_t taskcold_off = reserve_table(&size, tasks, sizeof(ud_taskcold_t));
+
+    uint8_t *tables;
+    int rc = posix_memalign((void **) &tables, CACHE_LINE, size);
+    if (rc) {
+        return -rc;
+    }
+    memset(tables, 0, size);
+
+    state->tables = tables;
+    state->tables_size = size;
+    state->max_handlers = handlers;
+    state->max_tasks = tasks;
+
+    state->event_handlers = (ud_ehdef_t *) (tables + eh_off);
+    state->pollfds = (struct pollfd *) (tables + pollfd_off);
+    state->slot_of = (uint32_t *) (tables + slot_off);
+    state->id_of = (uint32_t *) (tables + id_off);
+    state->ready = (int *) (tables + ready_off);
+    state->dirty = (uint32_t *) (tables + dirty_off);
+    state->buried = (uint32_t *) (tables + buried_off);
+#ifdef HAVE_EPOLL
+    state->ep_events = (struct epoll_event *) (tables + ep_off);
+#endif
+    state->task_queue = (ud_taskdef_t *) (tables + task_off);
+    state->eh_cold = (ud_ehcold_t *) (tables + ehcold_off);
+    state->task_cold = (ud_taskcold_t *) (tables + taskcold_off);
+
+    return 0;
+}
+
+static inline bool valid_handler(const ud_state_t *ud_state, eh_id_t event_handler_id) {
+    return event_handler_id < ud_state->max_handlers;
+}
+
+const char *ud_version() {
+    return UD_VERSION;
+}
+
+ud_state_t *ud_init(const ud_config_t *config) {
+    // the state is cache line aligned, to keep its hot and cold parts apart...
+    ud_state_t *state;
+    int rc = posix_memalign((void **) &state, CACHE_LINE, sizeof(ud_state_t));
+    if (rc) {
+        errno = rc;
+        perror("posix_memalign");
+        return NULL;
+    }
+    // Clear out the initial state...
+    memset(state, 0, sizeof(ud_state_t));
+
+    state->ud_config = config;
+    state->dispatch_budget = SIZE_MAX;
+    state->epfd = -1;
+    state->wakeup_fd = -1;
+    state->event_pipe[0] = state->event_pipe[1] = -1;
+    state->pipe_id = UD_INVALID_ID;
+    state->running_task = -1;
+
+    rc = alloc_tables(state,
+                      table_size(config ? config->max_handlers : 0, UD_DEFAULT_HANDLERS),
+                      table_size(config ? config->max_tasks : 0, UD_DEFAULT_TASKS));
+    if (rc) {
+        errno = -rc;
+        perror("posix_memalign");
+        free(state);
+        return NULL;
+    }
+
+    for (int i = 0; i < (int) state->max_handlers; i++) {
+        // ensure poll() doesn't do anything with these by default...
+        state->slot_of[i] = NO_SLOT;
+        state->eh_cold[i].ep_fd = -1;
+        clear_handler(state, i);
+    }
+
+    return state;
+}
+
+void ud_destroy(ud_state_t *ud_state) {
+    if (ud_state) {
+        // resolutions in progress should not be posted to us anymore...
+        for (int i = 0; i < UD_MODULE_COUNT; i++) {
+            if (ud_state->modules[i].data) {
+                ud_state->modules[i].drop(ud_state, ud_state->modules[i].data);
+            }
+        }
+
+        // release all inline storage that is still in use...
+        for (int i = 0; i < (int) ud_state->max_handlers; i++) {
+            if (ud_state->eh_cold[i].release) {
+                ud_state->eh_cold[i].release(ud_state->eh_cold[i].storage);
+            }
+        }
+        for (int i = (int) ud_state->task_limit - 1; i >= 0; i--) {
+            if (ud_state->task_queue[i].task) {
+                clear_task(ud_state, i);
+            }
+        }
+        if (ud_state->record) {
+            ud_record_stop(ud_state);
+        }
+        // only closed now, other threads might still write to it until their post is done...
+        for (int i = 0; i < 2; i++) {
+            if (ud_state->event_pipe[i] >= 0) {
+                close(ud_state->event_pipe[i]);
+            }
+        }
+        free(ud_state->tables);
+        free(ud_state);
+    }
+}
+
+void *ud_module_get(const ud_state_t *ud_state, ud_module_t module) {
+    return ud_state->modules[module].data;
+}
+
+void ud_module_set(const ud_state_t *ud_state, ud_module_t module, void *data, ud_module_drop_t drop) {
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *) ud_state;
+
+    state->modules[module].data = data;
+    state->modules[module].drop = drop;
+}
+
+ud_post_t *ud_module_take_posts(const ud_state_t *ud_state, void (*fn)(const ud_state_t *, ud_post_t *)) {
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *) ud_state;
+
+    // nobody posts to a state that is being destroyed, so the queue is ours...
+    ud_post_t *posted = state->inbox;
+    ud_post_t *taken = NULL;
+    ud_post_t *kept = NULL;
+    ud_post_t **kept_tail = &kept;
+
+    // the queue is newest first, so prepending the taken ones restores their order...
+    while (posted) {
+        ud_post_t *next = posted->next;
+        if (posted->fn == fn) {
+            posted->next = taken;
+            taken = posted;
+        } else {
+            posted->next = NULL;
+            *kept_tail = posted;
+            kept_tail = &posted->next;
+        }
+        posted = next;
+    }
+    state->inbox = kept;
+
+    return taken;
+}
+
+inline const ud_config_t *ud_get_udaemon_config(const ud_state_t *ud_state) {
+    if (ud_state) {
+        return ud_state->ud_config;
+    }
+    return NULL;
+}
+
+const void *ud_get_app_config(const ud_state_t *ud_state) {
+    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
+    if (ud_state && ud_cfg && ud_cfg->conf_file) {
+        // if we're configured *and* there's a config file set *then*
+        // presume there's a valid application configuration present...
+        return ud_state->app_config;
+    }
+    return NULL;
+}
+
+void *ud_get_app_state(const ud_state_t *ud_state) {
+    if (ud_state) {
+        return ud_state->app_state;
+    }
+    return NULL;
+}
+
+void *ud_set_app_state(const ud_state_t *ud_state, void *app_state) {
+    void *old_state = ud_get_app_state(ud_state);
+    if (ud_state) {
+        // remove the const-ness to update our internal state...
+        ((ud_state_t *) ud_state)->app_state = app_state;
+    }
+    return old_state;
+}
+
+bool ud_valid_event_handler_id(eh_id_t event_handler_id) {
+    return event_handler_id != UD_INVALID_ID;
+}
+
+int ud_add_event_handler(const ud_state_t *ud_state, int fd, short emask,
+                         ud_event_handler_t callback, void *context, eh_id_t *event_handler_id) {
+    if (ud_state == NULL || callback == NULL) {
+        return -EINVAL;
+    }
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+
+    int idx = -1;
+    for (uint32_t i = state->free_handler; i < state->max_handlers; i++) {
+        // Find first unused spot...
+        if (state->event_handlers[i].callback == NULL) {
+            idx = (int) i;
+            break;
+        }
+    }
+    if (idx < 0) {
+        state->free_handler = state->max_handlers;
+        return -ENOMEM;
+    }
+    state->free_handler = (uint32_t) idx + 1;
+
+    log_debug("Adding event handler at idx: %d", idx);
+
+    int slot = state->pollfd_count++;
+    state->pollfds[slot] = (struct pollfd) {
+        .fd = fd,
+        .events = emask,
+    };
+    state->slot_of[idx] = (uint32_t) slot;
+    state->id_of[slot] = (uint32_t) idx;
+
+    state->eh_cold[idx].usage = (ud_usage_t) { .calls = 0 };
+    state->event_handlers[idx] = (ud_ehdef_t) {
+        .callback = callback,
+        .context = context,
+        .fd = fd,
+        .events = emask,
+        .opts = { .priority = 0 },
+        .last_activity = ud_now(ud_state),
+        .dirty = state->event_handlers[idx].dirty,
+    };
+    mark_dirty(state, idx);
+
+    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
+    if (ud_cfg && ud_cfg->busy_poll) {
+        // best effort; only applies to sockets...
+        int rc = ud_set_busy_poll(fd, ud_cfg->busy_poll);
+        if (rc < 0 && rc != -ENOTSOCK) {
+            log_debug("Unable to enable busy polling for fd %d: %s", fd, strerror(-rc));
+        }
+    }
+
+    if (event_handler_id) {
+        *event_handler_id = (eh_id_t) idx;
+    }
+
+    return 0;
+}
+
+int ud_add_event_handler_inline(const ud_state_t *ud_state, int fd, short emask,
+                                ud_event_handler_t callback, ud_release_t release,
+                                void **storage, eh_id_t *event_handler_id) {
+    if (storage == NULL) {
+        return -EINVAL;
+    }
+
+    eh_id_t id;
+    int retval = ud_add_event_handler(ud_state, fd, emask, callback, NULL, &id);
+    if (retval) {
+        return retval;
+    }
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *) ud_state;
+    ud_ehcold_t *ehcold = &state->eh_cold[id];
+    state->event_handlers[id].context = ehcold->storage;
+    ehcold->release = release;
+
+    *storage = ehcold->storage;
+    if (event_handler_id) {
+        *event_handler_id = id;
+    }
+
+    return 0;
+}
+
+int ud_remove_event_handler(const ud_state_t *ud_state, eh_id_t event_handler_id) {
+    if (ud_state == NULL || event_handler_id == ud_state->pipe_id || !valid_handler(ud_state, event_handler_id)) {
+        return -EINVAL;
+    }
+
+    int idx = (int) event_handler_id;
+
+    log_debug("Removing event handler at idx: %d", idx);
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+
+    if (state->dispatching && state->event_handlers[idx].callback) {
+        // cleaned up once all ready event handlers are dispatched...
+        bury_handler(state, idx, false);
+    } else {
+        clear_handler(state, idx);
+    }
+
+    return 0;
+}
+
+int ud_close_event_handler(const ud_state_t *ud_state, eh_id_t event_handler_id) {
+    if (ud_state == NULL || event_handler_id == ud_state->pipe_id || !valid_handler(ud_state, event_handler_id)) {
+        return -EINVAL;
+    }
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+
+    int idx = (int) event_handler_id;
+    if (!state->event_handlers[idx].callback) {
+        return -ENOENT;
+    }
+
+    log_debug("Closing event handler at idx: %d", idx);
+
+    bury_handler(state, idx, true);
+    if (!state->dispatching) {
+        reap_handlers(state);
+    }
+
+    return 0;
+}
+
+int ud_set_close_hook(const ud_state_t *ud_state, eh_id_t event_handler_id, ud_close_hook_t on_close) {
+    if (ud_state == NULL || !valid_handler(ud_state, event_handler_id)) {
+        return -EINVAL;
+    }
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+
+    const ud_ehdef_t *ehdef = &state->event_handlers[event_handler_id];
+    if (!ehdef->callback || ehdef->removed) {
+        return -ENOENT;
+    }
+
+    state->eh_cold[event_handler_id].on_close = on_close;
+
+    return 0;
+}
+
+/**
+ * Updates the interest of a registered event handler.
+ *
+ * @param emask the new event mask, or a negative value to keep the current one.
+ */
+static int update_interest(const ud_state_t *ud_state, const eh_id_t event_handler_id, int emask, bool paused) {
+    if (ud_state == NULL || !valid_handler(ud_state, event_handler_id)) {
+        return -EINVAL;
+    }
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+
+    ud_ehdef_t *ehdef = &state->event_handlers[event_handler_id];
+    if (!ehdef->callback || ehdef->removed) {
+        return -ENOENT;
+    }
+
+    short events = (emask < 0) ? ehdef->events : (short) emask;
+    if (ehdef->events != events || ehdef->paused != paused) {
+        ehdef->events = events;
+        ehdef->paused = paused;
+        if (ehdef->pending && paused) {
+            ehdef->pending = false;
+            state->pending_count--;
+        }
+
+        mark_dirty(state, (int) event_handler_id);
+    }
+
+    return 0;
+}
+
+int ud_modify_event_handler(const ud_state_t *ud_state, const eh_id_t event_handler_id, const short emask) {
+    return update_interest(ud_state, event_handler_id, (unsigned short) emask, false);
+}
+
+int ud_pause_handler(const ud_state_t *ud_state, const eh_id_t event_handler_id) {
+    return update_interest(ud_state, event_handler_id, -1, true);
+}
+
+int ud_resume_handler(const ud_state_t *ud_state, const eh_id_t event_handler_id) {
+    return update_interest(ud_state, event_handler_id, -1, false);
+}
+
+int ud_set_event_handler_opts(const ud_state_t *ud_state, const eh_id_t event_handler_id,
+                              const ud_handler_opts_t *opts) {
+    if (ud_state == NULL || opts == NULL || !valid_handler(ud_state, event_handler_id)) {
+        return -EINVAL;
+    }
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+
+    ud_ehdef_t *ehdef = &state->event_handlers[event_handler_id];
+    if (!ehdef->callback || ehdef->removed) {
+        return -ENOENT;
+    }
+
+    if (ehdef->opts.flags != opts->flags) {
+        mark_dirty(state, (int) event_handler_id);
+    }
+    ehdef->opts = *opts;
+
+    return 0;
+}
+
+uint64_t ud_last_activity(const ud_state_t *ud_state, const eh_id_t event_handler_id) {
+    if (ud_state == NULL || !valid_handler(ud_state, event_handler_id) ||
+            ud_state->event_handlers[event_handler_id].callback == NULL ||
+            ud_state->event_handlers[event_handler_id].removed) {
+        return 0;
+    }
+    return ud_state->event_handlers[event_handler_id].last_activity;
+}
+
+int ud_get_handler_usage(const ud_state_t *ud_state, const eh_id_t event_handler_id, ud_usage_t *usage) {
+    if (ud_state == NULL || usage == NULL || !valid_handler(ud_state, event_handler_id)) {
+        return -EINVAL;
+    }
+    if (ud_state->event_handlers[event_handler_id].callback == NULL ||
+            ud_state->event_handlers[event_handler_id].removed) {
+        return -ENOENT;
+    }
+
+    *usage = ud_state->eh_cold[event_handler_id].usage;
+    return 0;
+}
+
+int ud_get_task_usage(const ud_state_t *ud_state, ud_task_t task, void *context, ud_usage_t *usage) {
+    if (ud_state == NULL || task == NULL || usage == NULL) {
+        return -EINVAL;
+    }
+
+    int count = 0;
+    *usage = (ud_usage_t) { .calls = 0 };
+    for (int i = 0; i < (int) ud_state->task_limit; i++) {
+        if (ud_state->task_queue[i].task == task && ud_state->task_queue[i].context == context) {
+            const ud_usage_t *task_usage = &ud_state->task_cold[i].usage;
+
+            usage->calls += task_usage->calls;
+            usage->wall_time += task_usage->wall_time;
+            usage->cpu_time += task_usage->cpu_time;
+            usage->bytes += task_usage->bytes;
+            count++;
+        }
+    }
+    return count ? 0 : -ENOENT;
+}
+
+/**
+ * Represents a single line of the top report.
+ */
+typedef struct top_entry {
+    ud_usage_t usage;
+    int idx;
+    /** the file descriptor of an event handler, or -1 for tasks. */
+    int fd;
+    ud_task_t task;
+} top_entry_t;
+
+static int compare_top(const void *a, const void *b) {
+    const top_entry_t *ea = a;
+    const top_entry_t *eb = b;
+    // the largest consumer of CPU time goes first...
+    if (ea->usage.cpu_time != eb->usage.cpu_time) {
+        return (ea->usage.cpu_time < eb->usage.cpu_time) ? 1 : -1;
+    }
+    if (ea->usage.wall_time != eb->usage.wall_time) {
+        return (ea->usage.wall_time < eb->usage.wall_time) ? 1 : -1;
+    }
+    return ea->idx - eb->idx;
+}
+
+/**
+ * Appends formatted text to a buffer, like snprintf, but keeps counting the
+ * length once the buffer is full.
+ */
+static size_t append(char *buf, size_t size, size_t len, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf((len < size) ? buf + len : NULL, (len < size) ? size - len : 0, fmt, ap);
+    va_end(ap);
+
+    return (n > 0) ? len + (size_t) n : len;
+}
+
+int ud_format_top(const ud_state_t *ud_state, char *buf, size_t size) {
+    if (ud_state == NULL || (buf == NULL && size > 0)) {
+        return -EINVAL;
+    }
+
+    top_entry_t *entries = malloc((ud_state->max_handlers + ud_state->task_limit) * sizeof(top_entry_t));
+    if (!entries) {
+        return -ENOMEM;
+    }
+    int count = 0;
+    // tasks are sorted after event handlers with the same usage...
+    int task_base = (int) ud_state->max_handlers;
+
+    for (int i = 0; i < (int) ud_state->max_handlers; i++) {
+        const ud_ehdef_t *ehdef = &ud_state->event_handlers[i];
+        if (ehdef->callback && !ehdef->removed) {
+            entries[count++] = (top_entry_t) {
+                .usage = ud_state->eh_cold[i].usage,
+                .idx = i,
+                .fd = ehdef->fd,
+            };
+        }
+    }
+    for (int i = 0; i < (int) ud_state->task_limit; i++) {
+        const ud_taskdef_t *taskdef = &ud_state->task_queue[i];
+        if (taskdef->task) {
+            entries[count++] = (top_entry_t) {
+                .usage = ud_state->task_cold[i].usage,
+                .idx = task_base + i,
+                .fd = -1,
+                .task = taskdef->task,
+            };
+        }
+    }
+
+    qsort(entries, (size_t) count, sizeof(top_entry_t), compare_top);
+
+    size_t len = append(buf, size, 0, "%10s %10s %10s %12s  %s\n", "CPU(ms)", "WALL(ms)", "CALLS", "BYTES", "WHAT");
+    for (int j = 0; j < count; j++) {
+        const top_entry_t *entry = &entries[j];
+
+        len = append(buf, size, len, "%10.3f %10.3f %10llu %12llu  ",
+                     (double) entry->usage.cpu_time / 1000.0, (double) entry->usage.wall_time / 1000.0,
+                     (unsigned long long) entry->usage.calls, (unsigned long long) entry->usage.bytes);
+        if (entry->idx < task_base) {
+            len = append(buf, size, len, "handler #%d (fd#%d)\n", entry->idx, entry->fd);
+        } else {
+            len = append(buf, size, len, "task #%d (%p)\n", entry->idx - task_base, (void *) entry->task);
+        }
+    }
+
+    free(entries);
+
+    return (int) len;
+}
+
+int ud_format_tables(const ud_state_t *ud_state, char *buf, size_t size) {
+    if (ud_state == NULL || (buf == NULL && size > 0)) {
+        return -EINVAL;
+    }
+
+    uint64_t now = ud_now(ud_state);
+
+    size_t len = append(buf, size, 0, "%4s %6s %6s %5s %4s %-8s %10s\n",
+                        "ID", "FD", "EVENTS", "FLAGS", "PRIO", "STATE", "IDLE(ms)");
+    for (int i = 0; i < (int) ud_state->max_handlers; i++) {
+        const ud_ehdef_t *ehdef = &ud_state->event_handlers[i];
+        if (!ehdef->callback) {
+            continue;
+        }
+
+        const char *status = ehdef->removed ? "removed" : ehdef->paused ? "paused" : ehdef->pending ? "pending" : "active";
+        len = append(buf, size, len, "%4d %6d %#6x %#5x %4u %-8s %10llu\n",
+                     i, ehdef->fd, (unsigned) (unsigned short) ehdef->events, (unsigned) ehdef->opts.flags,
+                     (unsigned) ehdef->opts.priority, status,
+                     (unsigned long long) (now > ehdef->last_activity ? now - ehdef->last_activity : 0));
+    }
+
+    len = append(buf, size, len, "%4s %18s %18s %10s %10s\n", "TASK", "FUNCTION", "CONTEXT", "INTERVAL", "NEXT(ms)");
+    for (int i = 0; i < (int) ud_state->task_limit; i++) {
+        const ud_taskdef_t *taskdef = &ud_state->task_queue[i];
+        if (!taskdef->task) {
+            continue;
+        }
+
+        len = append(buf, size, len, "%4d %18p %18p %8u%-2s %10lld\n",
+                     i, (void *) taskdef->task, taskdef->context, (unsigned) taskdef->interval,
+                     taskdef->millis ? "ms" : "s", (long long) (taskdef->next_deadline - now));
+    }
+
+    return (int) len;
+}
+
+void ud_dump_top(const ud_state_t *ud_state) {
+    int len = ud_format_top(ud_state, NULL, 0);
+    if (len < 0) {
+        return;
+    }
+    char *buf = malloc((size_t) len + 1);
+    if (!buf || ud_format_top(ud_state, buf, (size_t) len + 1) < 0) {
+        free(buf);
+        return;
+    }
+
+    if (!ud_state->accounting) {
+        log_info("Accounting is not enabled, all usage is zero!");
+    }
+
+    char *saveptr = NULL;
+    for (char *line = strtok_r(buf, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        log_info("%s", line);
+    }
+    free(buf);
+}
+
+size_t ud_dispatch_budget(const ud_state_t *ud_state) {
+    if (ud_state) {
+        return ud_state->dispatch_budget;
+    }
+    return 0;
+}
+
+void ud_dispatch_consume(const ud_state_t *ud_state, size_t bytes) {
+    if (ud_state) {
+        // cast away the const, the caller doesn't see this change...
+        ud_state_t *state = (ud_state_t *)ud_state;
+
+        state->dispatch_budget = (bytes < state->dispatch_budget) ? state->dispatch_budget - bytes : 0;
     }
-    return 0;
 }
 
-static int udaemon_read_config(const ud_state_t *ud_state) {
-    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
+static int schedule_task(const ud_state_t *ud_state, uint16_t interval, bool millis,
+                         ud_task_t task, void *context, ud_release_t release, void **storage) {
+    if (ud_state == NULL || task == NULL) {
+        return -EINVAL;
+    }
 
-    if (ud_cfg->conf_file && ud_cfg->config_parser) {
-        if (ud_state->app_config) {
-            log_debug("Reloading configuration from %s", ud_cfg->conf_file);
-        } else {
-            log_debug("Loading configuration from %s", ud_cfg->conf_file);
-        }
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
 
-        void *new_cfg = ud_cfg->config_parser(ud_cfg->conf_file, ud_state->app_config);
-        if (!new_cfg) {
-            // leave the existing configuration as-is...
-            return 1;
+    int idx = -1;
+    for (uint32_t i = state->free_task; i < state->max_tasks; i++) {
+        // Find first unused spot...
+        if (state->task_queue[i].task == NULL) {
+            idx = (int) i;
+            break;
         }
-        return udaemon_replace_config(ud_state, new_cfg);
     }
-    return 0;
-}
+    if (idx < 0) {
+        state->free_task = state->max_tasks;
+        return -ENOMEM;
+    }
+    state->free_task = (uint32_t) idx + 1;
+    if ((uint32_t) idx >= state->task_limit) {
+        state->task_limit = (uint32_t) idx + 1;
+    }
 
-static int udaemon_cleanup(ud_state_t *ud_state) {
-    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
+    log_debug("Adding task at index %d", idx);
 
-    int retval;
-    if (ud_cfg->cleanup) {
-        retval = ud_cfg->cleanup(ud_state);
-        if (retval) {
-            log_warning("Failed to perform cleanup!");
-        }
+    // relative to the time of the loop iteration, which keeps a replay deterministic...
+    uint64_t next_deadline = ud_now(ud_state) + (uint64_t) interval * (millis ? 1 : 1000);
+
+    state->task_queue[idx].task = task;
+    state->task_queue[idx].interval = interval;
+    state->task_queue[idx].millis = millis;
+    state->task_queue[idx].next_deadline = next_deadline;
+    state->task_queue[idx].context = context;
+    state->task_queue[idx].cancelled = false;
+    state->task_cold[idx].release = release;
+    state->task_cold[idx].usage = (ud_usage_t) { .calls = 0 };
+
+    if (storage) {
+        state->task_queue[idx].context = state->task_cold[idx].storage;
+        *storage = state->task_cold[idx].storage;
     }
-    // Cleanup the configuration, if any...
-    return udaemon_replace_config(ud_state, NULL);
+
+    return 0;
 }
 
-static uint8_t read_signal_event(int fd) {
-    static uint8_t buf[1] = { 0 };
-    if (read(fd, &buf, sizeof(buf)) != sizeof(buf)) {
-        log_warning("Did not read all event data?!");
-    }
-    return buf[0];
+int ud_schedule_task(const ud_state_t *ud_state, uint16_t interval, ud_task_t task, void *context) {
+    return schedule_task(ud_state, interval, false, task, context, NULL, NULL);
 }
 
-static void write_signal_event(int fd, uint8_t event_type) {
-    uint8_t buf[1] = { event_type };
-    if (write(fd, buf, sizeof(buf)) != sizeof(buf)) {
-        log_warning("Did not write all event data?!");
-    }
+int ud_schedule_timer(const ud_state_t *ud_state, uint16_t interval, ud_task_t task, void *context) {
+    return schedule_task(ud_state, interval, true, task, context, NULL, NULL);
 }
 
-static void os_signal_handler(int signo) {
-    if (signo == SIGTERM || signo == SIGINT) {
-        write_signal_event(event_pipe[1], SIG_TERM);
-    } else if (signo == SIGHUP) {
-        write_signal_event(event_pipe[1], SIG_HUP);
-    } else if (signo == SIGUSR1) {
-        write_signal_event(event_pipe[1], SIG_USR1);
-    } else if (signo == SIGUSR2) {
-        write_signal_event(event_pipe[1], SIG_USR2);
-    } else {
-        log_debug("Unknown/unhandled signal: %d", signo);
+int ud_schedule_inline(const ud_state_t *ud_state, uint16_t interval, bool millis,
+                       ud_task_t task, ud_release_t release, void **storage) {
+    if (storage == NULL) {
+        return -EINVAL;
     }
+    return schedule_task(ud_state, interval, millis, task, NULL, release, storage);
 }
 
-static ud_result_t main_signal_handler(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
-    (void)context;
+int ud_cancel_task(const ud_state_t *ud_state, ud_task_t task, void *context) {
+    if (ud_state == NULL || task == NULL) {
+        return -EINVAL;
+    }
 
-    ud_signal_t signal = read_signal_event(pollfd->fd);
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
 
-    if (signal == SIG_HUP) {
-        udaemon_read_config(ud_state);
-    }
+    int count = 0;
+    for (int i = 0; i < (int) state->task_limit; i++) {
+        ud_taskdef_t *taskdef = &state->task_queue[i];
 
-    udaemon_signal_handler(ud_state, signal);
+        if (taskdef->task == task && taskdef->context == context && !taskdef->cancelled) {
+            log_debug("Cancelling task at index %d", i);
 
-    if (signal == SIG_TERM) {
-        log_debug("Terminating main event loop...");
-        if (ud_terminate(ud_state)) {
-            log_warning("Failed to terminate main event loop!");
+            if (i == state->running_task) {
+                // the task is cleaned up once it returns...
+                taskdef->cancelled = true;
+            } else {
+                clear_task(state, i);
+            }
+            count++;
         }
     }
-
-    return RES_OK;
+    return count;
 }
 
-static void run_tasks(ud_state_t *ud_state, time_t now) {
-    for (int i = 0; i < TASK_MAX; i++) {
-        ud_taskdef_t *taskdef = &ud_state->task_queue[i];
+int ud_post(const ud_state_t *ud_state, ud_post_t *post) {
+    if (ud_state == NULL || post == NULL || post->fn == NULL) {
+        return -EINVAL;
+    }
 
-        if (taskdef->task && taskdef->next_deadline < now) {
-            int retval = taskdef->task(ud_state, taskdef->interval, taskdef->context);
-            if (retval <= 0) {
-                log_debug("Removing task at index %d", i);
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
 
-                taskdef->task = NULL;
-            } else {
-                log_debug("Rescheduling task at index %d to run in %d seconds", i, retval);
+    ud_post_t *head = __atomic_load_n(&state->inbox, __ATOMIC_RELAXED);
+    do {
+        post->next = head;
+    } while (!__atomic_compare_exchange_n(&state->inbox, &head, post, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 
-                taskdef->interval = (uint16_t) retval;
-                taskdef->next_deadline = now + retval;
-            }
+    if (!head) {
+        // only the first post needs to wake up the mainloop...
+        int fd = __atomic_load_n(&state->wakeup_fd, __ATOMIC_ACQUIRE);
+        if (fd >= 0) {
+            write_signal_event(fd, EV_POST);
         }
     }
+    return 0;
 }
 
-const char *ud_version() {
-    return UD_VERSION;
-}
-
-ud_state_t *ud_init(const ud_config_t *config) {
-    ud_state_t *state = malloc(sizeof(ud_state_t));
-    if (!state) {
-        perror("malloc");
-        return NULL;
+int ud_raise_signal(const ud_state_t *ud_state, ud_signal_t signal) {
+    if (ud_state == NULL || signal < SIG_TERM || signal > SIG_USR2) {
+        return -EINVAL;
     }
-    // Clear out the initial state...
-    memset(state, 0, sizeof(ud_state_t));
-
-    state->ud_config = config;
 
-    for (int i = 0; i < FD_MAX; i++) {
-        // ensure poll() doesn't do anything with these by default...
-        state->pollfds[i].fd = -1;
+    int fd = __atomic_load_n(&ud_state->wakeup_fd, __ATOMIC_ACQUIRE);
+    if (fd < 0) {
+        // the mainloop is not running...
+        return -ESRCH;
     }
 
-    return state;
+    // handled like any OS signal...
+    write_signal_event(fd, (uint8_t) signal);
+    return 0;
 }
 
-void ud_destroy(ud_state_t *ud_state) {
-    if (ud_state) {
-        free(ud_state);
+uint64_t ud_now(const ud_state_t *ud_state) {
+    // a replay keeps its virtual time until its very end...
+    if (ud_state && (ud_state->running || ud_state->replay)) {
+        return ud_state->now;
     }
+    return clock_ms(ud_state);
 }
 
-inline const ud_config_t *ud_get_udaemon_config(const ud_state_t *ud_state) {
-    if (ud_state) {
-        return ud_state->ud_config;
+int ud_set_clock(const ud_state_t *ud_state, const ud_clock_t *clock) {
+    if (ud_state == NULL || (clock && clock->now == NULL)) {
+        return -EINVAL;
     }
-    return NULL;
+    if (ud_state->running) {
+        return -EBUSY;
+    }
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+    state->clock = clock ? *clock : (ud_clock_t) { .now = NULL };
+
+    return 0;
 }
 
-const void *ud_get_app_config(const ud_state_t *ud_state) {
-    const ud_config_t *ud_cfg = ud_get_udaemon_config(ud_state);
-    if (ud_state && ud_cfg && ud_cfg->conf_file) {
-        // if we're configured *and* there's a config file set *then*
-        // presume there's a valid application configuration present...
-        return ud_state->app_config;
+int ud_set_backend_ops(const ud_state_t *ud_state, const ud_backend_ops_t *ops) {
+    if (ud_state == NULL || (ops && ops->wait == NULL)) {
+        return -EINVAL;
     }
-    return NULL;
+    if (ud_state->running) {
+        return -EBUSY;
+    }
+
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+    state->ops = ops ? *ops : (ud_backend_ops_t) { .wait = NULL };
+
+    return 0;
 }
 
-void *ud_get_app_state(const ud_state_t *ud_state) {
-    if (ud_state) {
-        return ud_state->app_state;
+static ssize_t record_and_read(ud_state_t *ud_state, int fd, void *buf, size_t count) {
+    int idx = (ud_state->record || ud_state->replay) ? find_handler(ud_state, fd) : -1;
+    if (idx < 0) {
+        // not something we record...
+        return read(fd, buf, count);
     }
-    return NULL;
-}
 
-void *ud_set_app_state(const ud_state_t *ud_state, void *app_state) {
-    void *old_state = ud_get_app_state(ud_state);
-    if (ud_state) {
-        // remove the const-ness to update our internal state...
-        ((ud_state_t *) ud_state)->app_state = app_state;
+    if (ud_state->replay) {
+        ud_replay_t *replay = ud_state->replay;
+        return replay_read(replay, idx == (int) ud_state->pipe_id ? (int) replay->count : idx, buf, count);
     }
-    return old_state;
-}
 
-bool ud_valid_event_handler_id(eh_id_t event_handler_id) {
-    return event_handler_id < FD_MAX;
+    ssize_t n = read(fd, buf, (count < INT32_MAX) ? count : INT32_MAX);
+    if (n >= 0) {
+        record_read(ud_state, idx, (int32_t) n, buf);
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        int err = errno;
+        record_read(ud_state, idx, -err, NULL);
+        errno = err;
+    }
+    return n;
 }
 
-int ud_add_event_handler(const ud_state_t *ud_state, int fd, short emask,
-                         ud_event_handler_t callback, void *context, eh_id_t *event_handler_id) {
-    if (ud_state == NULL || callback == NULL) {
-        return -EINVAL;
+ssize_t ud_read(const ud_state_t *ud_state, int fd, void *buf, size_t count) {
+    if (ud_state == NULL) {
+        return read(fd, buf, count);
     }
 
-    int idx = -1;
-    for (int i = 0; i < FD_MAX; i++) {
-        // Find first unused spot...
-        if (ud_state->pollfds[i].fd < 0) {
-            idx = i;
-            break;
-        }
-    }
-    if (idx < 0) {
-        return -ENOMEM;
+    // cast away the const, the caller doesn't see this change...
+    ud_state_t *state = (ud_state_t *)ud_state;
+
+    ssize_t n = record_and_read(state, fd, buf, count);
+    if (n > 0 && state->current_usage) {
+        state->current_usage->bytes += (uint64_t) n;
     }
+    return n;
+}
 
-    log_debug("Adding event handler at idx: %d", idx);
+int ud_record_start(const ud_state_t *ud_state, const char *path) {
+    if (ud_state == NULL || path == NULL) {
+        return -EINVAL;
+    }
 
     // cast away the const, the caller doesn't see this change...
     ud_state_t *state = (ud_state_t *)ud_state;
+    if (state->record || state->replay) {
+        return -EBUSY;
+    }
 
-    state->pollfds[idx].fd = fd;
-    state->pollfds[idx].events = emask;
-    state->pollfds[idx].revents = 0;
+    FILE *file = fopen(path, "wbe");
+    if (!file) {
+        return -errno;
+    }
+    if (fwrite(REC_MAGIC, REC_MAGIC_LEN, 1, file) != 1) {
+        int err = errno;
+        fclose(file);
+        return -err;
+    }
 
-    state->event_handlers[idx] = (ud_ehdef_t) {
-        .callback = callback,
-        .context = context,
-    };
+    log_debug("Recording events to %s...", path);
 
-    if (event_handler_id) {
-        *event_handler_id = (eh_id_t) idx;
-    }
+    state->record_time = ud_now(ud_state);
+    state->record = file;
 
     return 0;
 }
 
-int ud_remove_event_handler(const ud_state_t *ud_state, eh_id_t event_handler_id) {
-    if (ud_state == NULL || event_handler_id == 0) {
+int ud_record_stop(const ud_state_t *ud_state) {
+    if (ud_state == NULL) {
         return -EINVAL;
     }
 
-    int idx = (int) event_handler_id;
-
-    log_debug("Removing event handler at idx: %d", idx);
-
     // cast away the const, the caller doesn't see this change...
     ud_state_t *state = (ud_state_t *)ud_state;
+    if (!state->record) {
+        return -ENOENT;
+    }
 
-    state->pollfds[idx].fd = -1;
-    state->pollfds[idx].events = 0;
-    state->pollfds[idx].revents = 0;
-
-    state->event_handlers[idx].callback = NULL;
-    state->event_handlers[idx].context = NULL;
+    int retval = ferror(state->record) ? -EIO : 0;
+    if (fclose(state->record) && !retval) {
+        retval = -errno;
+    }
+    state->record = NULL;
 
-    return 0;
+    if (retval) {
+        log_warning("Failed to write event recording: %s", strerror(-retval));
+    }
+    return retval;
 }
 
-int ud_schedule_task(const ud_state_t *ud_state, uint16_t interval, ud_task_t task, void *context) {
-    if (ud_state == NULL) {
+int ud_replay(ud_state_t *ud_state, const char *path) {
+    if (ud_state == NULL || path == NULL) {
         return -EINVAL;
     }
+    if (ud_state->record || ud_state->replay) {
+        return -EBUSY;
+    }
 
-    int idx = -1;
-    for (int i = 0; i < TASK_MAX; i++) {
-        // Find first unused spot...
-        if (ud_state->task_queue[i].task == NULL) {
-            idx = i;
-            break;
-        }
+    ud_replay_t *replay = calloc(1, sizeof(ud_replay_t));
+    if (!replay) {
+        return -ENOMEM;
     }
-    if (idx < 0) {
+    replay->count = ud_state->max_handlers;
+    replay->head = calloc(replay->count + 1, sizeof(ud_chunk_t *));
+    replay->tail = calloc(replay->count + 1, sizeof(ud_chunk_t *));
+    if (!replay->head || !replay->tail) {
+        free(replay->head);
+        free(replay->tail);
+        free(replay);
         return -ENOMEM;
     }
 
-    log_debug("Adding task at index %d", idx);
+    replay->file = fopen(path, "rbe");
+    if (!replay->file) {
+        int err = errno;
+        free(replay->head);
+        free(replay->tail);
+        free(replay);
+        return -err;
+    }
+
+    char magic[REC_MAGIC_LEN];
+    if (fread(magic, sizeof(magic), 1, replay->file) != 1 || memcmp(magic, REC_MAGIC, REC_MAGIC_LEN) != 0) {
+        log_warning("Not an event recording: %s", path);
+        fclose(replay->file);
+        free(replay->head);
+        free(replay->tail);
+        free(replay);
+        return -EINVAL;
+    }
 
-    time_t next_deadline = time(NULL) + interval;
+    // reads done during initialization precede the first timed record...
+    replay_next(replay);
+    replay_reads(replay);
 
-    // cast away the const, the caller doesn't see this change...
-    ud_state_t *state = (ud_state_t *)ud_state;
+    ud_state->replay = replay;
+    int retval = ud_main_loop(ud_state);
+    ud_state->replay = NULL;
 
-    state->task_queue[idx].task = task;
-    state->task_queue[idx].interval = interval;
-    state->task_queue[idx].next_deadline = next_deadline;
-    state->task_queue[idx].context = context;
+    for (uint32_t i = 0; i <= replay->count; i++) {
+        while (replay->head[i]) {
+            ud_chunk_t *chunk = replay->head[i];
+            replay->head[i] = chunk->next;
+            free(chunk);
+        }
+    }
+    fclose(replay->file);
+    free(replay->head);
+    free(replay->tail);
+    free(replay);
+
+    return retval;
+}
 
+/**
+ * Creates the event pipe, whose write end is non-blocking, so neither signal
+ * handlers nor other threads can block on it.
+ */
+static int open_event_pipe(ud_state_t *ud_state) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        int flags = fcntl(fds[i], F_GETFL);
+        if (flags < 0 || fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) < 0 || fcntl(fds[i], F_SETFD, FD_CLOEXEC) < 0) {
+            int err = errno;
+            close(fds[0]);
+            close(fds[1]);
+            errno = err;
+            return -1;
+        }
+    }
+    ud_state->event_pipe[0] = fds[0];
+    ud_state->event_pipe[1] = fds[1];
     return 0;
 }
 
@@ -364,10 +2313,14 @@ int ud_main_loop(ud_state_t *ud_state) {
 
     int retval;
     // Indicate that we're currently running...
+    ud_state->now = clock_ms(ud_state);
     ud_state->running = true;
+    ud_state->accounting = ud_cfg->accounting;
 
-    // close any file descriptors we inherited...
-    ud_closefrom(STDERR_FILENO);
+    // close any file descriptors we inherited, unless we're only replaying...
+    if (!ud_state->replay) {
+        ud_closefrom(STDERR_FILENO);
+    }
 
     /* catch all interesting signals */
     struct sigaction sigact;
@@ -384,21 +2337,34 @@ int ud_main_loop(ud_state_t *ud_state) {
     sigaction(SIGALRM, &sigact, NULL);
     sigaction(SIGCHLD, &sigact, NULL);
     sigaction(SIGINT, &sigact, NULL);
+    if (ud_cfg->accounting) {
+        // dumps the usage of all event handlers and tasks...
+        sigaction(SIGQUIT, &sigact, NULL);
+    }
 
     // Ignore SIGPIPE
     sigact.sa_handler = SIG_IGN;
     sigaction(SIGPIPE, &sigact, NULL);
 
-    // allow events to be sent through a pipe...
-    if (pipe(event_pipe) < 0) {
+    // allow events to be sent through a pipe, which is reused by later runs...
+    if (ud_state->event_pipe[0] < 0 && open_event_pipe(ud_state) < 0) {
         perror("pipe");
         goto cleanup;
     }
 
+    setup_backend(ud_state);
+
     // reserve this for our own events...
-    ud_add_event_handler(ud_state, event_pipe[0], POLLIN, main_signal_handler, NULL, NULL);
+    ud_add_event_handler(ud_state, ud_state->event_pipe[0], POLLIN, main_signal_handler, NULL, &ud_state->pipe_id);
+    __atomic_store_n(&ud_state->wakeup_fd, ud_state->event_pipe[1], __ATOMIC_RELEASE);
+    signal_fd = ud_state->event_pipe[1];
+
+    // allow the (unprivileged) daemon to apply the runtime options...
+    if (!ud_state->replay) {
+        raise_limits(ud_cfg);
+    }
 
-    if (!ud_cfg->foreground) {
+    if (!ud_cfg->foreground && !ud_state->replay) {
         log_debug("Going drop privileges to uid %d, gid %d",
                   ud_cfg->priv_user, ud_cfg->priv_group);
         if (ud_cfg->pid_file) {
@@ -413,12 +2379,26 @@ int ud_main_loop(ud_state_t *ud_state) {
         }
     }
 
+    if (!ud_state->replay) {
+        apply_runtime_options(ud_state);
+    }
+
     // read configuration right after we've dropped privileges...
     retval = udaemon_read_config(ud_state);
     if (retval) {
         log_warning("Failed to read/parse application configuration! Trying to continue with defaults...");
     }
 
+    if (ud_cfg->record_file && !ud_state->replay) {
+        // include everything done during initialization in the recording...
+        ud_state->now = clock_ms(ud_state);
+
+        retval = ud_record_start(ud_state, ud_cfg->record_file);
+        if (retval) {
+            log_warning("Unable to record events to %s: %s", ud_cfg->record_file, strerror(-retval));
+        }
+    }
+
     retval = udaemon_initialize(ud_state);
     if (retval) {
         log_warning("Initialization failed!");
@@ -426,46 +2406,103 @@ int ud_main_loop(ud_state_t *ud_state) {
     }
 
     while (ud_state->running) {
-        // Run all pending tasks first...
-        run_tasks(ud_state, time(NULL));
+        if (ud_state->replay) {
+            replay_timers(ud_state);
+        } else {
+            ud_state->now = clock_ms(ud_state);
+        }
+
+        UD_TRACE1(loop__start, ud_state->now);
+
+        // Run all posted functions and pending tasks first...
+        run_posts(ud_state);
+        run_tasks(ud_state, ud_state->now);
+
+        // a custom backend may skip ahead to the next deadline, however far away...
+        int max_timeout = ud_state->ops.wait ? INT_MAX : 100;
+        int timeout = has_pending(ud_state) ? 0 : next_task_timeout(ud_state, ud_state->now, max_timeout);
+
+        // Keep spinning for a while after activity to avoid the wakeup latency...
+        bool spinning = ud_cfg->busy_poll && !ud_state->replay && !ud_state->ops.wait &&
+                        monotonic_us() < ud_state->busy_until;
+        if (spinning) {
+            timeout = 0;
+        }
+
+        sync_interest(ud_state);
+
+        int count = wait_events(ud_state, timeout);
+
+        UD_TRACE2(poll__return, count, timeout);
+
+        if (!ud_state->replay) {
+            ud_state->now = clock_ms(ud_state);
+        }
+        if (count >= 0) {
+            count = restore_pending(ud_state, count);
+        }
+        if (count > 0 && ud_state->record) {
+            record_poll(ud_state, ud_state->ready, count);
+        }
 
-        int count = poll(ud_state->pollfds, FD_MAX, 100);
         if (count < 0) {
             if (errno != EINTR) {
                 log_warning("failed to poll: %m");
                 break;
             }
         } else if (count == 0) {
-            // Call back to the idle handler, if present...
-            if (ud_cfg->idle_handler) {
+            // Call back to the idle handler, if present, but not while spinning...
+            if (ud_cfg->idle_handler && !spinning) {
                 ud_cfg->idle_handler(ud_state);
             }
         } else {
+            if (ud_cfg->busy_poll) {
+                ud_state->busy_until = monotonic_us() + ud_cfg->busy_poll;
+            }
+
             // There was something of interest; let's look a little closer...
-            for (int i = 0; i < FD_MAX; i++) {
-                if (ud_state->pollfds[i].revents) {
-                    // something of interest happened...
-                    ud_event_handler_t callback = ud_state->event_handlers[i].callback;
+            int *ready = ud_state->ready;
+            order_ready(ud_state, ready, count);
+
+            ud_state->dispatching = true;
 
-                    void *context = ud_state->event_handlers[i].context;
+            ud_mark_t mark = { 0 };
+            if (ud_state->accounting) {
+                mark_now(&mark);
+            }
 
-                    ud_result_t res = callback(ud_state, &ud_state->pollfds[i], context);
-                    if (res == RES_ERROR) {
-                        log_debug("Callback for fd#%d returned an error! Closing it...", ud_state->pollfds[i].fd);
+            for (int j = 0; j < count; j++) {
+                ud_ehdef_t *ehdef = &ud_state->event_handlers[ready[j]];
 
-                        close(ud_state->pollfds[i].fd);
+                // earlier event handlers might have removed this one...
+                if (ehdef->callback && !ehdef->paused && ehdef->revents) {
+                    // something of interest happened...
+                    uint16_t calls = dispatch_handler(ud_state, ready[j]);
 
-                        // setting the fd to -1 is sufficient to ignore it in the next poll cycle...
-                        ud_state->pollfds[i].fd = -1;
+                    // removed event handlers keep their slot (and usage) until they are reaped...
+                    if (ud_state->accounting) {
+                        account(&ud_state->eh_cold[ready[j]].usage, calls, &mark);
                     }
                 }
+                // consumed, the next events are collected by the backend...
+                ehdef->revents = 0;
             }
+
+            // only now the slots of removed event handlers can be reused...
+            reap_handlers(ud_state);
+            ud_state->dispatching = false;
         }
+
+        UD_TRACE1(loop__end, ud_state->now);
     }
 
 cleanup:
     log_debug("Cleaning up...");
 
+    if (ud_state->record) {
+        ud_record_stop(ud_state);
+    }
+
     if (ud_cfg->pid_file) {
         // best effort; will only succeed if the permissions are set correctly...
         unlink(ud_cfg->pid_file);
@@ -477,9 +2514,21 @@ cleanup:
 
     destroy_logging();
 
-    // Close our local resources...
-    close(event_pipe[0]);
-    close(event_pipe[1]);
+    // Close our local resources, but keep the event pipe, as other threads
+    // might still write to it...
+    __atomic_store_n(&ud_state->wakeup_fd, -1, __ATOMIC_RELEASE);
+    if (signal_fd == ud_state->event_pipe[1]) {
+        signal_fd = -1;
+    }
+    if (ud_state->pipe_id != UD_INVALID_ID) {
+        clear_handler(ud_state, (int) ud_state->pipe_id);
+        ud_state->pipe_id = UD_INVALID_ID;
+    }
+
+    if (ud_state->epfd >= 0) {
+        close(ud_state->epfd);
+        ud_state->epfd = -1;
+    }
 
     return 0;
 }
@@ -0,0 +1,198 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "udaemon/ud_admin.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The number of clients the scenarios can connect...
+#define CLIENTS 2
+
+/**
+ * Tests the line protocol of the admin socket, tracing the replies read by
+ * its clients, with each newline replaced by a `|`.
+ */
+static struct {
+    char path[64];
+    ud_admin_t *admin;
+    int clients[CLIENTS];
+} ctx;
+
+static int create_admin(const ud_state_t *ud_state, uint32_t idle_timeout) {
+    const ud_admin_config_t config = {
+        .path = ctx.path,
+        .idle_timeout = idle_timeout,
+    };
+    ctx.admin = ud_admin_create(ud_state, &config);
+    return ctx.admin ? 0 : -1;
+}
+
+/**
+ * Connects a client, which waits in the backlog until it is served.
+ */
+static int connect_client(int client) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strcpy(addr.sun_path, ctx.path);
+
+    ctx.clients[client] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ctx.clients[client] < 0) {
+        return -1;
+    }
+    return connect(ctx.clients[client], (struct sockaddr *) &addr, sizeof(addr));
+}
+
+static void send_text(int client, const char *text) {
+    if (send(ctx.clients[client], text, strlen(text), MSG_NOSIGNAL) != (ssize_t) strlen(text)) {
+        test_stepf("<send failed: %s>", strerror(errno));
+    }
+}
+
+/**
+ * Traces everything a client can read right now, `EOF` (or `RST`) once its
+ * connection is closed, or `-` if there is nothing to read.
+ */
+static void read_replies(int client) {
+    char buf[256];
+    bool any = false;
+
+    ssize_t n;
+    while ((n = recv(ctx.clients[client], buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+        buf[n] = '\0';
+        for (char *c = buf; *c; c++) {
+            *c = (*c == '\n') ? '|' : *c;
+        }
+        test_step(buf);
+        any = true;
+    }
+    if (n == 0) {
+        test_step("EOF");
+    } else if (errno == ECONNRESET) {
+        // closed before all that was sent is read...
+        test_step("RST");
+    } else if (!any) {
+        test_step("-");
+    }
+    test_step(" ");
+}
+
+static int finish_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+
+    for (int i = 0; i < CLIENTS; i++) {
+        if (context == NULL || i == (int) (intptr_t) context - 1) {
+            read_replies(i);
+        }
+    }
+
+    ud_admin_destroy(ctx.admin);
+    ctx.admin = NULL;
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+/* protocol: commands split over multiple reads are run one by one, until the client quits. */
+
+static int send_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    (void) context;
+
+    send_text(0, "el bogus\nfoo\nloglevel ud_admin warning\nquit\nhelp\n");
+    return 0;
+}
+
+static int setup_protocol(const ud_state_t *ud_state) {
+    if (create_admin(ud_state, 0) || connect_client(0)) {
+        return -1;
+    }
+
+    // the first command is completed by the next write...
+    send_text(0, "loglev");
+    int rc = ud_schedule_timer(ud_state, 20, send_task, NULL);
+    return rc ? rc : ud_schedule_timer(ud_state, 50, finish_task, (void *) 1);
+}
+
+/* long: a command that does not fit closes the connection. */
+
+static int setup_long(const ud_state_t *ud_state) {
+    if (create_admin(ud_state, 0) || connect_client(0)) {
+        return -1;
+    }
+
+    char line[300];
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+    send_text(0, line);
+    return ud_schedule_timer(ud_state, 50, finish_task, (void *) 1);
+}
+
+/* idle: an idle client is closed, so the next one is served. */
+
+static int check_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    (void) context;
+
+    // still waiting for the idle one...
+    read_replies(1);
+    return 0;
+}
+
+static int setup_idle(const ud_state_t *ud_state) {
+    if (create_admin(ud_state, 200) || connect_client(0) || connect_client(1)) {
+        return -1;
+    }
+
+    send_text(1, "loglevel ud_admin warning\n");
+    int rc = ud_schedule_timer(ud_state, 100, check_task, NULL);
+    return rc ? rc : ud_schedule_timer(ud_state, 400, finish_task, NULL);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "protocol", setup_protocol, "ERR Invalid argument|ERR unknown command: foo|OK|OK|EOF " },
+    { "long", setup_long, "ERR command too long|RST " },
+    { "idle", setup_idle, "- ERR idle timeout|EOF OK| " },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+    snprintf(ctx.path, sizeof(ctx.path), "/tmp/test_admin.%d.sock", (int) getpid());
+    for (int i = 0; i < CLIENTS; i++) {
+        ctx.clients[i] = -1;
+    }
+}
+
+static void cleanup(void) {
+    for (int i = 0; i < CLIENTS; i++) {
+        if (ctx.clients[i] >= 0) {
+            close(ctx.clients[i]);
+        }
+    }
+    // normally removed by the admin socket itself...
+    unlink(ctx.path);
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}
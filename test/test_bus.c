@@ -0,0 +1,241 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "udaemon/ud_bus.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The topics used by the scenarios...
+#define TOPIC_A 1
+#define TOPIC_B 2
+// The number of messages published to check the batching...
+#define BATCHED 100
+// The number of threads posting to the bus, and the number of messages each of them posts...
+#define THREADS 4
+#define POSTS 250
+// The number of messages posted after the mainloop terminated...
+#define LATE_POSTS 10
+
+/**
+ * Tests the delivery of messages published and posted on a bus, tracing the
+ * batches handed to the subscribers.
+ */
+static struct {
+    ud_bus_t *bus;
+    pthread_t threads[THREADS];
+    int started;
+    uint32_t next_seq[THREADS];
+    int received;
+    bool unordered;
+    bool republished;
+} ctx;
+
+typedef struct post_msg {
+    int thread;
+    uint32_t seq;
+} post_msg_t;
+
+static int publish(ud_topic_t topic, char c) {
+    ud_msg_t *msg = ud_msg_alloc(topic, &c, 1);
+    return msg ? ud_bus_publish(ctx.bus, msg) : -1;
+}
+
+static int finish_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    for (int i = 0; i < ctx.started; i++) {
+        pthread_join(ctx.threads[i], NULL);
+    }
+    ctx.started = 0;
+
+    ud_bus_destroy(ctx.bus);
+    ctx.bus = NULL;
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+/* order: messages are delivered in order of publication, per subscriber, and published ones in the next round. */
+
+static void on_msgs(const ud_state_t *ud_state, ud_msg_t *const *msgs, size_t count, void *context) {
+    test_stepf("%s:", (const char *) context);
+    for (size_t i = 0; i < count; i++) {
+        test_stepf("%c", msgs[i]->data[0]);
+    }
+    test_step(" ");
+
+    if (!ctx.republished) {
+        ctx.republished = true;
+        if (publish(TOPIC_A, '3') || ud_schedule_timer(ud_state, 10, finish_task, NULL)) {
+            test_step("<publish failed>");
+        }
+    }
+}
+
+static int setup_order(const ud_state_t *ud_state) {
+    ctx.bus = ud_bus_create(ud_state);
+    if (!ctx.bus || ud_bus_subscribe(ctx.bus, TOPIC_A, on_msgs, "A") < 0 ||
+            ud_bus_subscribe(ctx.bus, TOPIC_B, on_msgs, "B") < 0) {
+        return -1;
+    }
+
+    int rc = publish(TOPIC_A, '1');
+    if (!rc) {
+        rc = publish(TOPIC_B, '1');
+    }
+    return rc ? rc : publish(TOPIC_A, '2');
+}
+
+/* batch: the messages published in one iteration are delivered in batches of at most 64. */
+
+static void on_batch(const ud_state_t *ud_state, ud_msg_t *const *msgs, size_t count, void *context) {
+    (void) ud_state;
+    (void) msgs;
+    (void) context;
+
+    test_stepf("%zu ", count);
+}
+
+static int setup_batch(const ud_state_t *ud_state) {
+    ctx.bus = ud_bus_create(ud_state);
+    if (!ctx.bus || ud_bus_subscribe(ctx.bus, TOPIC_A, on_batch, NULL) < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < BATCHED; i++) {
+        if (publish(TOPIC_A, 'x')) {
+            return -1;
+        }
+    }
+    return ud_schedule_timer(ud_state, 10, finish_task, NULL);
+}
+
+/* post: messages posted by other threads all arrive, in the order in which each thread posted them. */
+
+static void *poster(void *arg) {
+    int thread = (int) (intptr_t) arg;
+
+    for (uint32_t i = 0; i < POSTS; i++) {
+        post_msg_t data = { .thread = thread, .seq = i };
+        ud_msg_t *msg = ud_msg_alloc(TOPIC_A, &data, sizeof(data));
+        if (!msg || ud_bus_post(ctx.bus, msg)) {
+            ud_msg_release(msg);
+        }
+    }
+    return NULL;
+}
+
+static void on_posted(const ud_state_t *ud_state, ud_msg_t *const *msgs, size_t count, void *context) {
+    (void) context;
+
+    for (size_t i = 0; i < count; i++) {
+        const post_msg_t *data = (const post_msg_t *) msgs[i]->data;
+        if (data->seq != ctx.next_seq[data->thread]) {
+            ctx.unordered = true;
+        }
+        ctx.next_seq[data->thread] = data->seq + 1;
+    }
+
+    ctx.received += (int) count;
+    if (ctx.received == THREADS * POSTS) {
+        test_stepf("%d %s", ctx.received, ctx.unordered ? "<unordered>" : "ordered");
+        if (ud_schedule_timer(ud_state, 10, finish_task, NULL)) {
+            test_step("<schedule failed>");
+        }
+    }
+}
+
+static int setup_post(const ud_state_t *ud_state) {
+    ctx.bus = ud_bus_create(ud_state);
+    if (!ctx.bus || ud_bus_subscribe(ctx.bus, TOPIC_A, on_posted, NULL) < 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < THREADS; i++) {
+        if (pthread_create(&ctx.threads[i], NULL, poster, (void *) (intptr_t) i)) {
+            return -1;
+        }
+        ctx.started++;
+    }
+    return 0;
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "order", setup_order, "A:12 B:1 A:3 " },
+    { "batch", setup_batch, "64 36 " },
+    { "post", setup_post, "1000 ordered" },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+/* late: messages posted after the mainloop terminated are released once the state is destroyed. */
+
+static bool check_late(void) {
+    ud_config_t config = {
+        .foreground = true,
+    };
+
+    ud_state_t *ud_state = ud_init(&config);
+    ud_bus_t *bus = ud_state ? ud_bus_create(ud_state) : NULL;
+    if (!bus) {
+        ud_destroy(ud_state);
+        return false;
+    }
+
+    // hold on to the messages, to see whether the bus released them...
+    ud_msg_t *msgs[LATE_POSTS];
+    int posted = 0;
+    for (int i = 0; i < LATE_POSTS; i++) {
+        msgs[i] = ud_msg_alloc(TOPIC_A, NULL, 0);
+        if (msgs[i] && ud_bus_post(bus, ud_msg_ref(msgs[i])) == 0) {
+            posted++;
+        }
+    }
+
+    ud_bus_destroy(bus);
+    ud_destroy(ud_state);
+
+    int released = 0;
+    for (int i = 0; i < LATE_POSTS; i++) {
+        if (msgs[i] && __atomic_load_n(&msgs[i]->refs, __ATOMIC_ACQUIRE) == 1) {
+            released++;
+        }
+        ud_msg_release(msgs[i]);
+    }
+
+    bool ok = posted == LATE_POSTS && released == LATE_POSTS;
+    printf("%-12s %-6s %s (%d of %d posted messages released)\n", "late", "", ok ? "OK" : "FAILED", released,
+           posted);
+    return ok;
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .reset = reset,
+    };
+    int failed = test_run(&suite);
+
+    set_loglevel(WARNING);
+    if (!check_late()) {
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,294 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <thread>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon_coro.hpp"
+
+/**
+ * Tests the awaitables of udaemon::Loop: waiting for a pipe to become
+ * readable, sleeping, connecting a socket (both successfully and to a port
+ * nobody listens on), completing from another thread, forgetting a file
+ * descriptor that is awaited, and destroying a loop with coroutines still
+ * waiting on it. Each scenario is run with both the poll and the epoll
+ * backend, and appends the steps it takes to a trace, which is compared to the
+ * expected one.
+ */
+namespace {
+
+using namespace std::chrono_literals;
+
+// The time (in milliseconds) after which a scenario is considered to hang...
+constexpr uint16_t TIMEOUT = 2000;
+
+struct Scenario {
+    const char *name;
+    /** sets up the scenario, called from the initialize callback. */
+    int (*setup)(udaemon::Loop &loop);
+    /** the expected trace. */
+    const char *expected;
+};
+
+struct {
+    char trace[128];
+    int fds[2];
+    int listener;
+    std::optional<udaemon::Loop> loop;
+    std::optional<udaemon::Completion> completion;
+    std::thread thread;
+    std::thread::id mainloop;
+    struct sockaddr_in addr;
+} ctx;
+
+void step(const char *what) {
+    strncat(ctx.trace, what, sizeof(ctx.trace) - strlen(ctx.trace) - 1);
+}
+
+int terminate_task(const ud_state_t *ud_state, uint16_t, void *) {
+    ud_terminate(ud_state);
+    return 0;
+}
+
+int write_task(const ud_state_t *, uint16_t, void *context) {
+    const char *data = static_cast<const char *>(context);
+
+    if (write(ctx.fds[1], data, strlen(data)) < 0) {
+        step("!");
+    }
+    return 0;
+}
+
+/** marks the destruction of a coroutine frame in the trace. */
+struct Guard {
+    ~Guard() {
+        step("d");
+    }
+};
+
+udaemon::Task reading(udaemon::Loop &loop) {
+    // read a byte at a time, so the second wait is done from within the event
+    // handler of the first, with data still pending...
+    for (int i = 0; i < 3; i++) {
+        short revents = co_await loop.readable(ctx.fds[0]);
+        char c;
+        if (!(revents & POLLIN) || read(ctx.fds[0], &c, 1) != 1) {
+            step("!");
+            break;
+        }
+        const char buf[] = { c, '\0' };
+        step(buf);
+    }
+    ud_terminate(loop.state());
+}
+
+int setup_readable(udaemon::Loop &loop) {
+    if (pipe2(ctx.fds, O_NONBLOCK | O_CLOEXEC)) {
+        return -1;
+    }
+    reading(loop);
+    if (ud_schedule_timer(loop.state(), 10, write_task, const_cast<char *>("xy")) ||
+            ud_schedule_timer(loop.state(), 30, write_task, const_cast<char *>("z"))) {
+        return -1;
+    }
+    return 0;
+}
+
+udaemon::Task sleeping(udaemon::Loop &loop, const char *name) {
+    int result = co_await loop.sleep(std::chrono::milliseconds((name[0] - '0') * 10));
+    if (result) {
+        step("!");
+    }
+    step(name);
+    if (name[0] == '3') {
+        ud_terminate(loop.state());
+    }
+}
+
+int setup_sleep(udaemon::Loop &loop) {
+    sleeping(loop, "3");
+    sleeping(loop, "1");
+    sleeping(loop, "2");
+    return 0;
+}
+
+udaemon::Task connecting(udaemon::Loop &loop) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int result = co_await loop.connect(fd, reinterpret_cast<struct sockaddr *>(&ctx.addr), sizeof(ctx.addr));
+    step(result == 0 ? "c" : "!");
+    loop.forget(fd);
+    close(fd);
+
+    // nobody listens anymore...
+    close(ctx.listener);
+    ctx.listener = -1;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    result = co_await loop.connect(fd, reinterpret_cast<struct sockaddr *>(&ctx.addr), sizeof(ctx.addr));
+    step(result == -ECONNREFUSED ? "r" : "!");
+    loop.forget(fd);
+    close(fd);
+
+    ud_terminate(loop.state());
+}
+
+int setup_connect(udaemon::Loop &loop) {
+    ctx.listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    ctx.addr.sin_family = AF_INET;
+    ctx.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t len = sizeof(ctx.addr);
+    if (ctx.listener < 0 || bind(ctx.listener, reinterpret_cast<struct sockaddr *>(&ctx.addr), len) ||
+            getsockname(ctx.listener, reinterpret_cast<struct sockaddr *>(&ctx.addr), &len) ||
+            listen(ctx.listener, 1)) {
+        return -1;
+    }
+    connecting(loop);
+    return 0;
+}
+
+udaemon::Task awaiting(udaemon::Loop &loop) {
+    int result = co_await *ctx.completion;
+    step(std::this_thread::get_id() == ctx.mainloop ? "m" : "!");
+    step(result == 7 ? "7" : "!");
+    ud_terminate(loop.state());
+}
+
+int setup_complete(udaemon::Loop &loop) {
+    ctx.mainloop = std::this_thread::get_id();
+    ctx.completion.emplace(loop);
+    awaiting(loop);
+
+    ctx.thread = std::thread([] {
+        std::this_thread::sleep_for(10ms);
+        ctx.completion->complete(7);
+    });
+    return 0;
+}
+
+udaemon::Task forgotten(udaemon::Loop &loop) {
+    short revents = co_await loop.readable(ctx.fds[0]);
+    step(revents == POLLNVAL ? "n" : "!");
+    ud_terminate(loop.state());
+}
+
+int forget_task(const ud_state_t *, uint16_t, void *) {
+    step("f");
+    ctx.loop->forget(ctx.fds[0]);
+    return 0;
+}
+
+int setup_forget(udaemon::Loop &loop) {
+    if (pipe2(ctx.fds, O_NONBLOCK | O_CLOEXEC)) {
+        return -1;
+    }
+    forgotten(loop);
+    return ud_schedule_timer(loop.state(), 10, forget_task, nullptr) ? -1 : 0;
+}
+
+udaemon::Task abandoned(udaemon::Loop &loop, bool sleep) {
+    Guard guard;
+    if (sleep) {
+        co_await loop.sleep(1h);
+    } else {
+        co_await loop.readable(ctx.fds[0]);
+    }
+    step("!");
+}
+
+int setup_destroy(udaemon::Loop &loop) {
+    if (pipe2(ctx.fds, O_NONBLOCK | O_CLOEXEC)) {
+        return -1;
+    }
+    abandoned(loop, true);
+    abandoned(loop, false);
+    // destroying the loop destroys both coroutines...
+    return ud_schedule_timer(loop.state(), 10, terminate_task, nullptr) ? -1 : 0;
+}
+
+const Scenario SCENARIOS[] = {
+    { "readable", setup_readable, "xyz" },
+    { "sleep", setup_sleep, "123" },
+    { "connect", setup_connect, "cr" },
+    { "complete", setup_complete, "m7" },
+    { "forget", setup_forget, "fn" },
+    { "destroy", setup_destroy, "dd" },
+};
+
+const Scenario *current;
+
+int init(const ud_state_t *ud_state) {
+    set_loglevel(WARNING);
+
+    if (ud_schedule_timer(ud_state, TIMEOUT, terminate_task, nullptr)) {
+        return -1;
+    }
+    ctx.loop.emplace(ud_state);
+    return current->setup(*ctx.loop);
+}
+
+bool run(const Scenario &scenario, ud_backend_t backend) {
+    ctx.trace[0] = '\0';
+    ctx.fds[0] = ctx.fds[1] = ctx.listener = -1;
+    ctx.addr = {};
+    current = &scenario;
+
+    ud_config_t config {};
+    config.foreground = true;
+    config.backend = backend;
+    config.initialize = init;
+
+    ud_state_t *ud_state = ud_init(&config);
+    if (!ud_state) {
+        return false;
+    }
+    ud_main_loop(ud_state);
+
+    if (ctx.thread.joinable()) {
+        ctx.thread.join();
+    }
+    // the loop (and the completion it is awaited on) go before the state...
+    ctx.loop.reset();
+    ctx.completion.reset();
+    ud_destroy(ud_state);
+
+    for (int fd : { ctx.fds[0], ctx.fds[1], ctx.listener }) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool ok = strcmp(ctx.trace, scenario.expected) == 0;
+    printf("%-10s %-6s %s (trace \"%s\", expected \"%s\")\n", scenario.name,
+           backend == UD_BACKEND_EPOLL ? "epoll" : "poll", ok ? "OK" : "FAILED", ctx.trace, scenario.expected);
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    static const ud_backend_t backends[] = { UD_BACKEND_POLL, UD_BACKEND_EPOLL };
+
+    int failed = 0;
+    for (const Scenario &scenario : SCENARIOS) {
+        for (ud_backend_t backend : backends) {
+            failed += run(scenario, backend) ? 0 : 1;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,391 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The number of pipes the scenarios can use...
+#define PIPES 4
+// The number of iterations the ordering scenarios trace...
+#define ROUNDS 3
+
+/**
+ * Tests how event handlers are dispatched: in which order they are called,
+ * and what their callbacks can change while they are called. Each scenario is
+ * run with both the poll and the epoll backend, and traces the calls of its
+ * event handlers.
+ */
+static struct {
+    int fds[PIPES][2];
+    eh_id_t ids[PIPES];
+    int calls;
+    int hooks;
+    int counts[PIPES];
+    char order[ROUNDS * PIPES + 1];
+    /** traces the order of the calls, once all rounds are done. */
+    void (*check)(void);
+} ctx;
+
+static void write_byte(int pipe, char c) {
+    if (write(ctx.fds[pipe][1], &c, 1) != 1) {
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * @return the (first) byte read from the given file descriptor, or '-' if nothing could be read.
+ */
+static char read_byte(const ud_state_t *ud_state, int fd) {
+    char buf[16];
+    return ud_read(ud_state, fd, buf, sizeof(buf)) > 0 ? buf[0] : '-';
+}
+
+/* copy: changing the pollfd passed to a callback does not change the handler. */
+
+static int write_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    (void) context;
+
+    write_byte(0, 'b');
+    return 0;
+}
+
+static ud_result_t on_readable_copy(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) context;
+
+    test_stepf("%c", read_byte(ud_state, pollfd->fd));
+    if (++ctx.calls == 2) {
+        ud_terminate(ud_state);
+        return RES_OK;
+    }
+
+    // none of this should have any effect...
+    pollfd->fd = -1;
+    pollfd->events = 0;
+    return ud_schedule_timer(ud_state, 10, write_task, NULL) ? RES_ERROR : RES_OK;
+}
+
+static int setup_copy(const ud_state_t *ud_state) {
+    write_byte(0, 'a');
+    return ud_add_event_handler(ud_state, ctx.fds[0][0], POLLIN, on_readable_copy, NULL, &ctx.ids[0]);
+}
+
+/* remove: a handler removes another ready handler, and adds a new one, in the same pass. */
+
+static ud_result_t on_readable_added(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) context;
+
+    // should never be called, its pipe has no data, nor should it get the events of another handler...
+    test_stepf("+%c", read_byte(ud_state, pollfd->fd));
+    return RES_OK;
+}
+
+static ud_result_t on_readable_remove(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    int pipe = (int) (intptr_t) context;
+
+    test_stepf("%c", read_byte(ud_state, pollfd->fd));
+    if (ctx.calls++) {
+        return RES_OK;
+    }
+
+    // which of both handlers is dispatched first depends on the backend...
+    int other = 1 - pipe;
+    if (ud_remove_event_handler(ud_state, ctx.ids[other])) {
+        test_step("<remove failed>");
+    }
+    if (ud_add_event_handler(ud_state, ctx.fds[2][0], POLLIN, on_readable_added, NULL, &ctx.ids[2])) {
+        return RES_ERROR;
+    }
+    test_step(ctx.ids[2] == ctx.ids[other] ? "<slot reused>" : "");
+    return ud_schedule_timer(ud_state, 20, test_terminate_task, NULL) ? RES_ERROR : RES_OK;
+}
+
+static int setup_remove(const ud_state_t *ud_state) {
+    for (int i = 0; i < 2; i++) {
+        write_byte(i, 'a');
+        int rc = ud_add_event_handler(ud_state, ctx.fds[i][0], POLLIN, on_readable_remove, (void *) (intptr_t) i,
+                                      &ctx.ids[i]);
+        if (rc) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/* error: returning RES_ERROR closes the file descriptor once, calling the close hook first. */
+
+static void on_close(const ud_state_t *ud_state, int fd, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    ctx.hooks++;
+    // the file descriptor is still open while its hook is called...
+    test_step(fcntl(fd, F_GETFD) >= 0 ? "H" : "<closed>");
+}
+
+static void check_closed(int pipe) {
+    bool closed = fcntl(ctx.fds[pipe][0], F_GETFD) < 0 && errno == EBADF;
+    test_stepf(" %s %d", closed ? "closed" : "open", ctx.hooks);
+    if (closed) {
+        // never close it again...
+        ctx.fds[pipe][0] = -1;
+    }
+}
+
+static int check_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    check_closed(0);
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static ud_result_t on_readable_error(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) context;
+
+    test_stepf("%c", read_byte(ud_state, pollfd->fd));
+    // closing the handler itself as well should not close its file descriptor twice...
+    if (ud_close_event_handler(ud_state, ctx.ids[0])) {
+        test_step("<close failed>");
+    }
+    if (ud_schedule_timer(ud_state, 10, check_task, NULL)) {
+        test_step("<schedule failed>");
+    }
+    return RES_ERROR;
+}
+
+static int setup_error(const ud_state_t *ud_state) {
+    write_byte(0, 'a');
+    int rc = ud_add_event_handler(ud_state, ctx.fds[0][0], POLLIN, on_readable_error, NULL, &ctx.ids[0]);
+    if (rc) {
+        return rc;
+    }
+    return ud_set_close_hook(ud_state, ctx.ids[0], on_close);
+}
+
+/* close: closing a handler outside of dispatching closes it right away. */
+
+static ud_result_t on_readable_never(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) context;
+
+    test_stepf("<called %c>", read_byte(ud_state, pollfd->fd));
+    return RES_OK;
+}
+
+static int close_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    if (ud_close_event_handler(ud_state, ctx.ids[0])) {
+        test_step("<close failed>");
+    }
+    check_closed(0);
+    // the handler is gone, so cannot be closed again...
+    test_step(ud_close_event_handler(ud_state, ctx.ids[0]) == -ENOENT ? " gone" : " <not gone>");
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static int setup_close(const ud_state_t *ud_state) {
+    int rc = ud_add_event_handler(ud_state, ctx.fds[0][0], POLLIN, on_readable_never, NULL, &ctx.ids[0]);
+    if (!rc) {
+        rc = ud_set_close_hook(ud_state, ctx.ids[0], on_close);
+    }
+    return rc ? rc : ud_schedule_timer(ud_state, 10, close_task, NULL);
+}
+
+/* swap: removing a handler moves the last pollfd into its slot, which is still dispatched and updated. */
+
+static ud_result_t on_readable_swap(const ud_state_t *ud_state, struct pollfd *pollfd, void *context);
+
+static int swap_write_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    // a new handler takes the slot after the moved handler...
+    if (ud_add_event_handler(ud_state, ctx.fds[3][0], POLLIN, on_readable_swap, (void *) (intptr_t) 3, &ctx.ids[3])) {
+        test_step("<add failed>");
+    }
+    // ...and is left alone when the moved handler is paused, which should not be called anymore...
+    if (ud_pause_handler(ud_state, ctx.ids[2])) {
+        test_step("<pause failed>");
+    }
+    // ...nor should the removed handler...
+    for (int i = 0; i < 4; i++) {
+        write_byte(i, 'b');
+    }
+    return 0;
+}
+
+static int swap_check_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    test_stepf("%d %d %d %d", ctx.counts[0], ctx.counts[1], ctx.counts[2], ctx.counts[3]);
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static ud_result_t on_readable_swap(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    int pipe = (int) (intptr_t) context;
+
+    read_byte(ud_state, pollfd->fd);
+    ctx.counts[pipe]++;
+    if (ctx.calls++) {
+        return RES_OK;
+    }
+
+    // the first handler removes the middle one, whose slot is taken by the last one...
+    if (pipe == 1 || ud_remove_event_handler(ud_state, ctx.ids[1])) {
+        test_step("<remove failed>");
+    }
+    if (ud_schedule_timer(ud_state, 10, swap_write_task, NULL) ||
+            ud_schedule_timer(ud_state, 30, swap_check_task, NULL)) {
+        return RES_ERROR;
+    }
+    return RES_OK;
+}
+
+static int setup_swap(const ud_state_t *ud_state) {
+    for (int i = 0; i < 3; i++) {
+        write_byte(i, 'a');
+        int rc = ud_add_event_handler(ud_state, ctx.fds[i][0], POLLIN, on_readable_swap, (void *) (intptr_t) i,
+                                      &ctx.ids[i]);
+        if (rc) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/* priority: handlers that are always ready are called by descending priority. */
+
+static ud_result_t on_readable_order(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) pollfd;
+
+    // never reads its pipe, so it stays ready...
+    ctx.order[ctx.calls++] = (char) (intptr_t) context;
+    if (ctx.calls == ROUNDS * 3) {
+        ctx.check();
+        ud_terminate(ud_state);
+    }
+    return RES_OK;
+}
+
+static int add_ready(const ud_state_t *ud_state, int pipe, char name, uint8_t priority) {
+    const ud_handler_opts_t opts = {
+        .priority = priority,
+    };
+
+    write_byte(pipe, 'a');
+    int rc = ud_add_event_handler(ud_state, ctx.fds[pipe][0], POLLIN, on_readable_order, (void *) (intptr_t) name,
+                                  &ctx.ids[pipe]);
+    return rc ? rc : ud_set_event_handler_opts(ud_state, ctx.ids[pipe], &opts);
+}
+
+static void trace_rounds(void) {
+    for (int i = 0; i < ctx.calls; i += 3) {
+        test_stepf("%.3s ", ctx.order + i);
+    }
+}
+
+static int setup_priority(const ud_state_t *ud_state) {
+    ctx.check = trace_rounds;
+
+    // added in another order than their priority...
+    int rc = add_ready(ud_state, 0, 'c', 0);
+    if (!rc) {
+        rc = add_ready(ud_state, 1, 'a', 2);
+    }
+    return rc ? rc : add_ready(ud_state, 2, 'b', 1);
+}
+
+/* rotate: handlers with the same priority take turns to go first, keeping their order. */
+
+static void check_rotate(void);
+
+static int setup_rotate(const ud_state_t *ud_state) {
+    ctx.check = check_rotate;
+
+    for (int i = 0; i < 3; i++) {
+        int rc = add_ready(ud_state, i, (char) ('a' + i), 1);
+        if (rc) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+static void check_rotate(void) {
+    // which handler goes first depends on the backend, but each round starts with the next one...
+    bool rotated = ctx.calls == ROUNDS * 3;
+    for (int k = 1; rotated && k < ROUNDS; k++) {
+        for (int j = 0; j < 3; j++) {
+            rotated &= ctx.order[k * 3 + j] == ctx.order[(j + k) % 3];
+        }
+    }
+    if (rotated) {
+        test_step("rotated");
+    } else {
+        trace_rounds();
+    }
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "copy", setup_copy, "ab" },
+    { "remove", setup_remove, "a" },
+    { "error", setup_error, "aH closed 1" },
+    { "close", setup_close, "H closed 1 gone" },
+    { "swap", setup_swap, "2 0 1 1" },
+    { "priority", setup_priority, "abc abc abc " },
+    { "rotate", setup_rotate, "rotated" },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+
+    for (int i = 0; i < PIPES; i++) {
+        ctx.ids[i] = UD_INVALID_ID;
+        if (pipe2(ctx.fds[i], O_NONBLOCK | O_CLOEXEC)) {
+            perror("pipe2");
+            ctx.fds[i][0] = ctx.fds[i][1] = -1;
+        }
+    }
+}
+
+static void cleanup(void) {
+    for (int i = 0; i < PIPES; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (ctx.fds[i][j] >= 0) {
+                close(ctx.fds[i][j]);
+            }
+        }
+    }
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .backends = true,
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}
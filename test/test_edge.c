@@ -0,0 +1,204 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "udaemon/ud_buffer.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+/**
+ * Tests the corner cases of edge-triggered event handlers, as documented in
+ * the README, that would otherwise result in lost wake-ups. Each scenario is
+ * run with both the poll and the epoll backend, and is done once its handler
+ * read the expected number of bytes (and EOF, if expected), which is traced.
+ */
+static struct {
+    int fds[2];
+    eh_id_t eh_id;
+    size_t total;
+    int calls;
+    bool eof;
+} ctx;
+
+static void write_bytes(size_t len) {
+    char buf[4096];
+    memset(buf, 'x', sizeof(buf));
+
+    while (len > 0) {
+        size_t n = len < sizeof(buf) ? len : sizeof(buf);
+        if (write(ctx.fds[1], buf, n) != (ssize_t) n) {
+            fprintf(stderr, "write failed: %s\n", strerror(errno));
+            return;
+        }
+        len -= n;
+    }
+}
+
+static void check_done(const ud_state_t *ud_state) {
+    char outcome[32];
+    snprintf(outcome, sizeof(outcome), "%zu%s", ctx.total, ctx.eof ? " EOF" : "");
+
+    if (strcmp(outcome, test_current()->expected) == 0) {
+        test_step(outcome);
+        ud_terminate(ud_state);
+    }
+}
+
+static ud_result_t on_data(const ud_state_t *ud_state, ud_buf_t *buf, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    if (!buf) {
+        ctx.eof = true;
+        return RES_OK;
+    }
+    ctx.total += buf->len;
+    return RES_OK;
+}
+
+static ud_result_t on_readable(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    ctx.calls++;
+
+    ud_result_t res = ud_drain_fd(ud_state, pollfd->fd, on_data, context);
+
+    check_done(ud_state);
+    // never let udaemon close our pipe, we do that ourselves...
+    return res == RES_ERROR ? RES_OK : res;
+}
+
+static int add_handler(const ud_state_t *ud_state, ud_event_handler_t handler, uint8_t flags, size_t max_bytes) {
+    int rc = ud_add_event_handler(ud_state, ctx.fds[0], POLLIN, handler, NULL, &ctx.eh_id);
+    if (rc) {
+        return rc;
+    }
+
+    ud_handler_opts_t opts = {
+        .flags = UD_HANDLER_EDGE | flags,
+        .max_events = 1,
+        .max_bytes = max_bytes,
+    };
+    return ud_set_event_handler_opts(ud_state, ctx.eh_id, &opts);
+}
+
+static int resume_task(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    ud_resume_handler(ud_state, ctx.eh_id);
+    return 0;
+}
+
+/* budget: the byte budget cuts the draining short, no new edge follows. */
+
+static int setup_budget(const ud_state_t *ud_state) {
+    write_bytes(48 * 1024);
+    return add_handler(ud_state, on_readable, 0, 4096);
+}
+
+/* late data: data arrives after read returned EAGAIN, within the same handler call. */
+
+static ud_result_t on_readable_late(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    ud_result_t res = on_readable(ud_state, pollfd, context);
+    if (ctx.calls == 1) {
+        write_bytes(100);
+    }
+    return res;
+}
+
+static int setup_late(const ud_state_t *ud_state) {
+    write_bytes(100);
+    return add_handler(ud_state, on_readable_late, 0, 0);
+}
+
+/* paused: data arrives while the handler is paused. */
+
+static int setup_paused(const ud_state_t *ud_state) {
+    int rc = add_handler(ud_state, on_readable, 0, 0);
+    if (rc) {
+        return rc;
+    }
+    ud_pause_handler(ud_state, ctx.eh_id);
+    write_bytes(100);
+    return ud_schedule_timer(ud_state, 20, resume_task, NULL);
+}
+
+/* one-shot: data arrives while a one-shot handler is disarmed. */
+
+static ud_result_t on_readable_oneshot(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    ud_result_t res = on_readable(ud_state, pollfd, context);
+    if (ctx.calls == 1) {
+        write_bytes(100);
+        if (ud_schedule_timer(ud_state, 20, resume_task, NULL)) {
+            return RES_ERROR;
+        }
+    }
+    return res;
+}
+
+static int setup_oneshot(const ud_state_t *ud_state) {
+    write_bytes(100);
+    return add_handler(ud_state, on_readable_oneshot, UD_HANDLER_ONESHOT, 0);
+}
+
+/* hangup: the writer goes away while the handler is paused. */
+
+static int setup_hangup(const ud_state_t *ud_state) {
+    int rc = add_handler(ud_state, on_readable, 0, 0);
+    if (rc) {
+        return rc;
+    }
+    ud_pause_handler(ud_state, ctx.eh_id);
+    write_bytes(100);
+    close(ctx.fds[1]);
+    ctx.fds[1] = -1;
+    return ud_schedule_timer(ud_state, 20, resume_task, NULL);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "budget", setup_budget, "49152" },
+    { "late data", setup_late, "200" },
+    { "paused", setup_paused, "100" },
+    { "one-shot", setup_oneshot, "200" },
+    { "hangup", setup_hangup, "100 EOF" },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.eh_id = UD_INVALID_ID;
+
+    if (pipe2(ctx.fds, O_NONBLOCK | O_CLOEXEC)) {
+        perror("pipe2");
+        ctx.fds[0] = ctx.fds[1] = -1;
+    }
+}
+
+static void cleanup(void) {
+    for (int i = 0; i < 2; i++) {
+        if (ctx.fds[i] >= 0) {
+            close(ctx.fds[i]);
+        }
+    }
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .backends = true,
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}
@@ -0,0 +1,249 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <fenv.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "udaemon/ud_fiber.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+/**
+ * Tests the scheduling of fibers: spawning, yielding, sleeping and waiting for
+ * file descriptors (including waiting again for the same file descriptor once
+ * woken up), that sleeping for 0 ms lets the mainloop run, that the floating
+ * point control state is kept per fiber, and that fibers left behind by a
+ * destroyed state do not affect the next one.
+ * Each scenario is run with both the poll and the epoll backend.
+ */
+static struct {
+    int fds[2];
+    bool ticked;
+} ctx;
+
+static void yielding(const ud_state_t *ud_state, void *context) {
+    const char *name = context;
+
+    for (int i = 0; i < 3; i++) {
+        test_step(name);
+        if (ud_fiber_yield(ud_state)) {
+            test_step("!");
+        }
+    }
+}
+
+static void finish(const ud_state_t *ud_state, void *context) {
+    (void) context;
+
+    // yielding fibers take turns, so the others are done once we're back...
+    for (int i = 0; i < 3; i++) {
+        ud_fiber_yield(ud_state);
+    }
+    test_step(".");
+    ud_terminate(ud_state);
+}
+
+static int setup_yield(const ud_state_t *ud_state) {
+    if (ud_spawn_fiber(ud_state, yielding, "a", 0) || ud_spawn_fiber(ud_state, yielding, "b", 0)) {
+        return -1;
+    }
+    return ud_spawn_fiber(ud_state, finish, NULL, 0) ? -1 : 0;
+}
+
+static void sleeping(const ud_state_t *ud_state, void *context) {
+    const char *name = context;
+
+    if (ud_fiber_sleep(ud_state, (uint32_t) (name[0] - '0') * 10)) {
+        test_step("!");
+    }
+    test_step(name);
+    if (name[0] == '3') {
+        ud_terminate(ud_state);
+    }
+}
+
+static int setup_sleep(const ud_state_t *ud_state) {
+    if (ud_spawn_fiber(ud_state, sleeping, "3", 0) || ud_spawn_fiber(ud_state, sleeping, "1", 0) ||
+            ud_spawn_fiber(ud_state, sleeping, "2", 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int tick_task(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    (void) context;
+
+    test_step("t");
+    ctx.ticked = true;
+    return 0;
+}
+
+static void spinning(const ud_state_t *ud_state, void *context) {
+    (void) context;
+
+    // each sleep of 0 ms is a turn of the mainloop, so the task gets to run...
+    for (int i = 0; !ctx.ticked; i++) {
+        if (i == 1000000 || ud_fiber_sleep(ud_state, 0)) {
+            test_step("!");
+            break;
+        }
+    }
+    test_step("f");
+    ud_terminate(ud_state);
+}
+
+static int setup_sleep0(const ud_state_t *ud_state) {
+    if (ud_spawn_fiber(ud_state, spinning, NULL, 0)) {
+        return -1;
+    }
+    return ud_schedule_timer(ud_state, 20, tick_task, NULL);
+}
+
+static int write_task(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    const char *data = context;
+
+    if (write(ctx.fds[1], data, strlen(data)) < 0) {
+        test_step("!");
+    }
+    return 0;
+}
+
+static void reading(const ud_state_t *ud_state, void *context) {
+    (void) context;
+
+    // read a byte at a time, so the second wait is done from within the
+    // event handler of the first, with data still pending...
+    for (int i = 0; i < 3; i++) {
+        int revents = ud_fiber_wait_fd(ud_state, ctx.fds[0], POLLIN);
+        if (revents < 0 || !(revents & POLLIN)) {
+            test_step("!");
+            break;
+        }
+        char c;
+        if (read(ctx.fds[0], &c, 1) != 1) {
+            test_step("!");
+            break;
+        }
+        test_step((char[]) { c, '\0' });
+    }
+    ud_terminate(ud_state);
+}
+
+static int setup_wait(const ud_state_t *ud_state) {
+    if (pipe2(ctx.fds, O_NONBLOCK | O_CLOEXEC)) {
+        return -1;
+    }
+    if (ud_spawn_fiber(ud_state, reading, NULL, 0)) {
+        return -1;
+    }
+    if (ud_schedule_timer(ud_state, 10, write_task, "xy") || ud_schedule_timer(ud_state, 30, write_task, "z")) {
+        return -1;
+    }
+    return 0;
+}
+
+static int check_round_task(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    (void) context;
+
+    // the mainloop keeps its own rounding mode...
+    test_step(fegetround() == FE_TONEAREST ? "m" : "!");
+    return 0;
+}
+
+static void rounding(const ud_state_t *ud_state, void *context) {
+    (void) context;
+
+    fesetround(FE_UPWARD);
+    // the task runs in between, as it is scheduled before the yield...
+    ud_schedule_timer(ud_state, 0, check_round_task, NULL);
+    ud_fiber_yield(ud_state);
+    ud_fiber_yield(ud_state);
+    test_step(fegetround() == FE_UPWARD ? "f" : "!");
+
+    // formatting doubles requires a properly aligned stack...
+    char buf[32];
+    volatile double value = 1.0 / 3.0;
+    snprintf(buf, sizeof(buf), "%.3f", value);
+    test_step(strcmp(buf, "0.334") == 0 ? "d" : "!");
+
+    ud_terminate(ud_state);
+}
+
+static int setup_fpu(const ud_state_t *ud_state) {
+    return ud_spawn_fiber(ud_state, rounding, NULL, 0) ? -1 : 0;
+}
+
+static void stale(const ud_state_t *ud_state, void *context) {
+    (void) context;
+
+    if (ud_fiber_sleep(ud_state, 10)) {
+        test_step("!");
+    }
+    // stops the mainloop with this fiber still yielding...
+    ud_terminate(ud_state);
+    while (ud_fiber_yield(ud_state) == 0) {
+        test_step("y");
+    }
+}
+
+static int setup_stale(const ud_state_t *ud_state) {
+    if (ud_spawn_fiber(ud_state, stale, NULL, 0) || ud_spawn_fiber(ud_state, sleeping, "9", 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int setup_fresh(const ud_state_t *ud_state) {
+    return setup_sleep(ud_state);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "yield", setup_yield, "ababab." },
+    { "sleep", setup_sleep, "123" },
+    { "sleep 0", setup_sleep0, "tf" },
+    { "wait fd", setup_wait, "xyz" },
+    { "fpu", setup_fpu, "mfd" },
+    // leaves a yielding and sleeping fiber behind in a destroyed state...
+    { "stale", setup_stale, "" },
+    { "fresh", setup_fresh, "123" },
+};
+
+static void reset(void) {
+    ctx.fds[0] = ctx.fds[1] = -1;
+    ctx.ticked = false;
+}
+
+static void cleanup(void) {
+    for (int i = 0; i < 2; i++) {
+        if (ctx.fds[i] >= 0) {
+            close(ctx.fds[i]);
+        }
+    }
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .backends = true,
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}
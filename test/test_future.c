@@ -0,0 +1,313 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "udaemon/ud_future.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The maximum number of futures a scenario keeps...
+#define FUTURES_MAX 8
+
+/**
+ * Tests chaining futures, combining them with when_all and when_any, timing
+ * them out (also without a timer left to do so), settling them from another
+ * thread, and that a state destroyed with a timeout pending does not affect
+ * the timeouts of the next one.
+ */
+static struct {
+    /** the futures of the scenario, released once its state is destroyed. */
+    ud_future_t *futures[FUTURES_MAX];
+    int count;
+    pthread_t mainloop;
+    pthread_t thread;
+    bool joinable;
+    int posted[2];
+} ctx;
+
+/** appends "v<value>" for resolved futures and "e<errno>" for rejected ones. */
+static void step_result(const ud_future_t *future) {
+    int error = ud_future_error(future);
+    if (error) {
+        test_stepf("e%d", -error);
+    } else {
+        test_stepf("v%d", (int) (intptr_t) ud_future_value(future));
+    }
+}
+
+/** keeps a future until the end of the scenario. */
+static ud_future_t *keep(ud_future_t *future) {
+    if (future && ctx.count < FUTURES_MAX) {
+        ctx.futures[ctx.count++] = future;
+        return future;
+    }
+    ud_future_release(future);
+    return NULL;
+}
+
+static void add_one(const ud_state_t *ud_state, ud_future_t *future, ud_future_t *next, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    test_step("+");
+    if (ud_future_error(future)) {
+        ud_future_reject(next, ud_future_error(future));
+    } else {
+        ud_future_resolve(next, (void *) ((intptr_t) ud_future_value(future) + 1));
+    }
+}
+
+static void note(const ud_state_t *ud_state, ud_future_t *future, ud_future_t *next, void *context) {
+    (void) ud_state;
+    (void) next;
+    (void) context;
+
+    step_result(future);
+}
+
+static void report(const ud_state_t *ud_state, ud_future_t *future, ud_future_t *next, void *context) {
+    note(ud_state, future, next, context);
+    ud_terminate(ud_state);
+}
+
+static int setup_then(const ud_state_t *ud_state) {
+    ud_future_t *first = keep(ud_future_create(ud_state));
+    ud_future_t *last = first ? keep(ud_future_then(first, add_one, NULL)) : NULL;
+    last = last ? keep(ud_future_then(last, add_one, NULL)) : NULL;
+    if (!last) {
+        return -1;
+    }
+    // nothing runs until the first future is resolved...
+    test_step(ud_future_done(last) ? "!" : "p");
+    ud_future_resolve(first, (void *) 40);
+
+    // chaining to a settled future runs the continuation right away...
+    if (!keep(ud_future_then(last, report, NULL))) {
+        return -1;
+    }
+    test_step(".");
+    return 0;
+}
+
+static int setup_reject(const ud_state_t *ud_state) {
+    ud_future_t *first = keep(ud_future_create(ud_state));
+    ud_future_t *next = first ? keep(ud_future_then(first, add_one, NULL)) : NULL;
+    if (!next || !keep(ud_future_then(next, report, NULL))) {
+        return -1;
+    }
+    ud_future_reject(first, -ECONNREFUSED);
+    // a future is settled only once...
+    test_step(ud_future_resolve(first, NULL) == -EALREADY ? "." : "!");
+    return 0;
+}
+
+static int resolve_task(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+
+    intptr_t idx = (intptr_t) context;
+    test_stepf("r%d", (int) idx);
+    ud_future_resolve(ctx.futures[idx], (void *) idx);
+    return 0;
+}
+
+static int reject_task(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+
+    intptr_t idx = (intptr_t) context;
+    test_step("x");
+    ud_future_reject(ctx.futures[idx], -EIO);
+    return 0;
+}
+
+/**
+ * Combines three futures, the first two of which are settled by the given
+ * tasks after 10 and 20 ms, the third one after 30 ms.
+ */
+static int setup_combined(const ud_state_t *ud_state, bool all, ud_task_t first, ud_task_t second) {
+    for (int i = 0; i < 3; i++) {
+        if (!keep(ud_future_create(ud_state))) {
+            return -1;
+        }
+    }
+    ud_future_t *combined = all ? ud_future_when_all(ud_state, ctx.futures, 3)
+                                : ud_future_when_any(ud_state, ctx.futures, 3);
+    if (!keep(combined) || !keep(ud_future_then(combined, report, NULL))) {
+        return -1;
+    }
+    if (ud_schedule_timer(ud_state, 10, first, (void *) 1) || ud_schedule_timer(ud_state, 20, second, (void *) 0) ||
+            ud_schedule_timer(ud_state, 30, resolve_task, (void *) 2)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int setup_all(const ud_state_t *ud_state) {
+    return setup_combined(ud_state, true, resolve_task, resolve_task);
+}
+
+static int setup_all_rejected(const ud_state_t *ud_state) {
+    return setup_combined(ud_state, true, resolve_task, reject_task);
+}
+
+static int setup_any(const ud_state_t *ud_state) {
+    return setup_combined(ud_state, false, resolve_task, reject_task);
+}
+
+static int setup_all_empty(const ud_state_t *ud_state) {
+    ud_future_t *combined = keep(ud_future_when_all(ud_state, NULL, 0));
+    if (!combined || !keep(ud_future_then(combined, report, NULL))) {
+        return -1;
+    }
+    return 0;
+}
+
+static int setup_timeout(const ud_state_t *ud_state) {
+    ud_future_t *first = keep(ud_future_create(ud_state));
+    ud_future_t *second = keep(ud_future_create(ud_state));
+    if (!second || !keep(ud_future_then(first, note, NULL)) || !keep(ud_future_then(second, report, NULL))) {
+        return -1;
+    }
+    // only the first one times out, the second one is resolved before...
+    if (ud_future_timeout(first, 20) || ud_future_timeout(second, 50) ||
+            ud_schedule_timer(ud_state, 30, resolve_task, (void *) 1)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int filler_task(const ud_state_t *ud_state, const uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    return interval;
+}
+
+static int setup_no_timer(const ud_state_t *ud_state) {
+    ud_future_t *future = keep(ud_future_create(ud_state));
+    if (!future || !keep(ud_future_then(future, report, NULL))) {
+        return -1;
+    }
+    // take all tasks, so no timer is left for the timeout...
+    int filled = 0;
+    while (ud_schedule_timer(ud_state, 1000, filler_task, NULL) == 0) {
+        filled++;
+    }
+    test_step(filled && ud_future_timeout(future, 20) == -ENOSPC ? "n" : "!");
+
+    // the future is resolved later on, as it does not time out...
+    ud_cancel_task(ud_state, filler_task, NULL);
+    return ud_schedule_timer(ud_state, 50, resolve_task, (void *) 0);
+}
+
+static void *post_thread(void *arg) {
+    ud_future_t *future = arg;
+
+    // hands over the reference of this thread...
+    ctx.posted[0] = ud_future_post(future, 0, (void *) 7);
+    // the reference is gone, but the caller's keeps the future alive...
+    ctx.posted[1] = ud_future_post(future, 0, (void *) 8);
+    return NULL;
+}
+
+static void on_posted(const ud_state_t *ud_state, ud_future_t *future, ud_future_t *next, void *context) {
+    (void) next;
+    (void) context;
+
+    test_step(pthread_equal(pthread_self(), ctx.mainloop) ? "m" : "!");
+    step_result(future);
+
+    pthread_join(ctx.thread, NULL);
+    ctx.joinable = false;
+    test_step(ctx.posted[0] == 0 ? "." : "!");
+    test_step(ctx.posted[1] == -EALREADY ? "a" : "!");
+
+    ud_terminate(ud_state);
+}
+
+static int setup_post(const ud_state_t *ud_state) {
+    ud_future_t *future = keep(ud_future_create(ud_state));
+    if (!future || !keep(ud_future_then(future, on_posted, NULL))) {
+        return -1;
+    }
+
+    ctx.mainloop = pthread_self();
+    if (pthread_create(&ctx.thread, NULL, post_thread, ud_future_ref(future))) {
+        ud_future_release(future);
+        return -1;
+    }
+    ctx.joinable = true;
+    return 0;
+}
+
+static int setup_stale(const ud_state_t *ud_state) {
+    ud_future_t *future = keep(ud_future_create(ud_state));
+    if (!future || !keep(ud_future_then(future, note, NULL))) {
+        return -1;
+    }
+    // still pending once the mainloop terminates...
+    if (ud_future_timeout(future, 100) || ud_schedule_timer(ud_state, 10, test_terminate_task, NULL)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int setup_fresh(const ud_state_t *ud_state) {
+    ud_future_t *future = keep(ud_future_create(ud_state));
+    if (!future || !keep(ud_future_then(future, report, NULL))) {
+        return -1;
+    }
+    return ud_future_timeout(future, 200);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "then", setup_then, "p++v42." },
+    { "reject", setup_reject, "+e111." },
+    { "all", setup_all, "r1r0r2v0" },
+    { "all/reject", setup_all_rejected, "r1xe5" },
+    { "all/empty", setup_all_empty, "v0" },
+    { "any", setup_any, "r1v1" },
+    { "timeout", setup_timeout, "e110r1v1" },
+    { "no timer", setup_no_timer, "nr0v0" },
+    { "post", setup_post, "mv7.a" },
+    // leaves a pending timeout behind in a destroyed state...
+    { "stale", setup_stale, "" },
+    { "fresh", setup_fresh, "e110" },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+}
+
+static void cleanup(void) {
+    if (ctx.joinable) {
+        pthread_join(ctx.thread, NULL);
+    }
+    // futures can be released after their state is destroyed...
+    for (int i = 0; i < ctx.count; i++) {
+        ud_future_release(ctx.futures[i]);
+    }
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}
@@ -0,0 +1,142 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "udaemon/ud_logging.h"
+
+#include "test_harness.h"
+
+// The default time (in milliseconds) after which a scenario is considered to hang...
+#define TIMEOUT 2000
+// The longest interval of a single timer...
+#define TIMER_MAX 60000
+
+ud_sim_t *test_sim;
+
+static struct {
+    const test_suite_t *suite;
+    const test_scenario_t *scenario;
+    char trace[256];
+    /** the time (in milliseconds) at which the scenario times out. */
+    uint64_t deadline;
+} harness;
+
+const test_scenario_t *test_current(void) {
+    return harness.scenario;
+}
+
+void test_step(const char *what) {
+    strncat(harness.trace, what, sizeof(harness.trace) - strlen(harness.trace) - 1);
+}
+
+void test_stepf(const char *fmt, ...) {
+    char buf[64];
+
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+
+    test_step(buf);
+}
+
+int test_terminate_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static int timeout_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    uint64_t now = ud_now(ud_state);
+    if (now >= harness.deadline) {
+        test_step("<timeout>");
+        ud_terminate(ud_state);
+        return 0;
+    }
+    // simulated scenarios can take longer than a single timer lasts...
+    uint64_t left = harness.deadline - now;
+    return (int) (left < TIMER_MAX ? left : TIMER_MAX);
+}
+
+static int init(const ud_state_t *ud_state) {
+    set_loglevel(WARNING);
+
+    uint64_t timeout = harness.suite->timeout ? harness.suite->timeout : TIMEOUT;
+    harness.deadline = ud_now(ud_state) + timeout;
+    if (ud_schedule_timer(ud_state, (uint16_t) (timeout < TIMER_MAX ? timeout : TIMER_MAX), timeout_task, NULL)) {
+        return -1;
+    }
+    return harness.scenario->setup(ud_state);
+}
+
+static bool run(const test_scenario_t *scenario, ud_backend_t backend, const char *label) {
+    const test_suite_t *suite = harness.suite;
+
+    harness.scenario = scenario;
+    harness.trace[0] = '\0';
+    if (suite->reset) {
+        suite->reset();
+    }
+
+    ud_config_t config = {
+        .foreground = true,
+        .backend = backend,
+        .accounting = suite->accounting,
+        .initialize = init,
+    };
+
+    ud_state_t *ud_state = ud_init(&config);
+    if (!ud_state) {
+        return false;
+    }
+    if (suite->simulated && (test_sim = ud_sim_create(ud_state)) == NULL) {
+        ud_destroy(ud_state);
+        return false;
+    }
+
+    ud_main_loop(ud_state);
+
+    ud_sim_destroy(test_sim);
+    test_sim = NULL;
+    ud_destroy(ud_state);
+
+    if (suite->cleanup) {
+        suite->cleanup();
+    }
+
+    bool ok = strcmp(harness.trace, scenario->expected) == 0;
+    printf("%-12s %-6s %s (trace \"%s\", expected \"%s\")\n", scenario->name, label,
+           ok ? "OK" : "FAILED", harness.trace, scenario->expected);
+    return ok;
+}
+
+int test_run(const test_suite_t *suite) {
+    harness.suite = suite;
+
+    int failed = 0;
+    for (size_t i = 0; i < suite->count; i++) {
+        const test_scenario_t *scenario = &suite->scenarios[i];
+
+        if (suite->simulated) {
+            failed += run(scenario, UD_BACKEND_AUTO, "sim") ? 0 : 1;
+        } else if (suite->backends) {
+            failed += run(scenario, UD_BACKEND_POLL, "poll") ? 0 : 1;
+            failed += run(scenario, UD_BACKEND_EPOLL, "epoll") ? 0 : 1;
+        } else {
+            failed += run(scenario, UD_BACKEND_AUTO, "") ? 0 : 1;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
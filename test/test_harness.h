@@ -0,0 +1,82 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#ifndef TEST_HARNESS_H_
+#define TEST_HARNESS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "udaemon/ud_sim.h"
+#include "udaemon/udaemon.h"
+
+/**
+ * Represents a single scenario of a test. Each scenario runs a mainloop of its
+ * own, and appends the steps it takes to a trace (see #test_step), which is
+ * compared to the expected one once the mainloop has terminated.
+ */
+typedef struct test_scenario {
+    const char *name;
+    /** sets up the scenario, called from the initialize callback. */
+    int (*setup)(const ud_state_t *ud_state);
+    /** the expected trace. */
+    const char *expected;
+} test_scenario_t;
+
+/**
+ * Represents a test, consisting of one or more scenarios.
+ */
+typedef struct test_suite {
+    const test_scenario_t *scenarios;
+    size_t count;
+    /** true to run each scenario with both the poll and the epoll backend. */
+    bool backends;
+    /** true to run each scenario on a simulated clock and backend. */
+    bool simulated;
+    /** true to account the resources used by event handlers and tasks. */
+    bool accounting;
+    /** the time (in milliseconds) after which a scenario is considered to hang, 0 for the default. */
+    uint64_t timeout;
+    /** (optional) called before each scenario, to reset the context of the test. */
+    void (*reset)(void);
+    /** (optional) called after the state of each scenario is destroyed, to clean up. */
+    void (*cleanup)(void);
+} test_suite_t;
+
+/**
+ * The simulation of the running scenario, if its suite is simulated.
+ */
+extern ud_sim_t *test_sim;
+
+/**
+ * @return the scenario that is running.
+ */
+const test_scenario_t *test_current(void);
+
+/**
+ * Appends a step to the trace of the running scenario.
+ */
+void test_step(const char *what);
+
+/**
+ * Appends a formatted step to the trace of the running scenario.
+ */
+void test_stepf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * Task that terminates the mainloop, for use with #ud_schedule_timer.
+ */
+int test_terminate_task(const ud_state_t *ud_state, uint16_t interval, void *context);
+
+/**
+ * Runs all scenarios of a test, and reports their outcome.
+ *
+ * @return zero if all scenarios passed, one otherwise, for use as exit code.
+ */
+int test_run(const test_suite_t *suite);
+
+#endif /* TEST_HARNESS_H_ */
@@ -0,0 +1,282 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <optional>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.hpp"
+
+/**
+ * Tests the callables stored inline by udaemon::Daemon (and the inline C API
+ * underneath it): they are destroyed once their event handler is removed (also
+ * by itself while it is dispatched), once their task finishes or is
+ * cancelled, and once the state is destroyed; callables returning nothing are
+ * treated as returning RES_OK (for event handlers) or run once (for tasks);
+ * and intervals that do not fit in a task are refused. Each scenario is run
+ * with both the poll and the epoll backend, and appends the steps it takes to
+ * a trace, which is compared to the expected one.
+ */
+namespace {
+
+using namespace std::chrono_literals;
+
+// The time (in milliseconds) after which a scenario is considered to hang...
+constexpr uint16_t TIMEOUT = 2000;
+
+struct Scenario {
+    const char *name;
+    /** sets up the scenario, called from the initialize callback. */
+    int (*setup)(udaemon::Daemon &daemon);
+    /** the expected trace. */
+    const char *expected;
+};
+
+struct {
+    char trace[128];
+    int fds[2];
+    udaemon::Daemon *daemon;
+    eh_id_t id;
+    int runs;
+} ctx;
+
+void step(const char *what) {
+    strncat(ctx.trace, what, sizeof(ctx.trace) - strlen(ctx.trace) - 1);
+}
+
+int terminate_task(const ud_state_t *ud_state, uint16_t, void *) {
+    ud_terminate(ud_state);
+    return 0;
+}
+
+/** marks the destruction of a callable in the trace, moved-from ones excluded. */
+struct Tracker {
+    const char *name;
+
+    explicit Tracker(const char *n) noexcept : name(n) {
+    }
+
+    Tracker(Tracker &&other) noexcept : name(std::exchange(other.name, nullptr)) {
+    }
+
+    Tracker(const Tracker &) = delete;
+    Tracker &operator=(const Tracker &) = delete;
+    Tracker &operator=(Tracker &&) = delete;
+
+    ~Tracker() {
+        if (name) {
+            step(name);
+        }
+    }
+};
+
+void write_byte() {
+    if (write(ctx.fds[1], "x", 1) != 1) {
+        step("!");
+    }
+}
+
+void read_byte() {
+    char c;
+    if (read(ctx.fds[0], &c, 1) != 1) {
+        step("!");
+    }
+}
+
+/* remove: removing an event handler destroys its callable right away. */
+
+int setup_remove(udaemon::Daemon &daemon) {
+    if (daemon.add_handler(ctx.fds[0], POLLIN, [t = Tracker("~")](struct pollfd &) {}, &ctx.id)) {
+        return -1;
+    }
+    return daemon.schedule(10ms, [] {
+        ctx.daemon->remove_handler(ctx.id);
+        step(".");
+        ctx.daemon->terminate();
+    });
+}
+
+/* self: an event handler removing itself is destroyed once it is dispatched. */
+
+int setup_self(udaemon::Daemon &daemon) {
+    int rc = daemon.add_handler(ctx.fds[0], POLLIN, [t = Tracker("~")](struct pollfd &) {
+        read_byte();
+        step("c");
+        ctx.daemon->remove_handler(ctx.id);
+        // still alive until we return...
+        step(t.name ? "r" : "!");
+    }, &ctx.id);
+    if (rc) {
+        return -1;
+    }
+    write_byte();
+    return daemon.schedule(20ms, [] {
+        step(".");
+        ctx.daemon->terminate();
+    });
+}
+
+/* void: an event handler returning nothing stays registered, like one returning RES_OK. */
+
+int setup_void(udaemon::Daemon &daemon) {
+    if (daemon.add_handler(ctx.fds[0], POLLIN, [](struct pollfd &) {
+            read_byte();
+            step("c");
+        })) {
+        return -1;
+    }
+    write_byte();
+    int rc = daemon.schedule(10ms, [] { write_byte(); });
+    return rc ? rc : daemon.schedule(20ms, [] { ctx.daemon->terminate(); });
+}
+
+/* once: a task returning nothing runs once, and is destroyed once it is done. */
+
+int setup_once(udaemon::Daemon &daemon) {
+    int rc = daemon.schedule(10ms, [t = Tracker("~")] { step("t"); });
+    return rc ? rc : daemon.schedule(50ms, [] {
+        step(".");
+        ctx.daemon->terminate();
+    });
+}
+
+/* repeat: a task returning an interval runs again, until it returns zero. */
+
+int setup_repeat(udaemon::Daemon &daemon) {
+    int rc = daemon.schedule(10ms, [t = Tracker("~")] {
+        step("t");
+        return ++ctx.runs < 3 ? 10 : 0;
+    });
+    return rc ? rc : daemon.schedule(100ms, [] {
+        step(".");
+        ctx.daemon->terminate();
+    });
+}
+
+/* cancel: cancelling a task with inline storage releases it. */
+
+int never_task(const ud_state_t *, uint16_t, void *) {
+    step("!");
+    return 0;
+}
+
+void release_storage(void *storage) {
+    step(static_cast<const char *>(storage));
+}
+
+int setup_cancel(udaemon::Daemon &daemon) {
+    void *storage;
+    if (ud_schedule_inline(daemon.get(), 100, true, never_task, release_storage, &storage)) {
+        return -1;
+    }
+    strcpy(static_cast<char *>(storage), "~");
+
+    step(ud_cancel_task(daemon.get(), never_task, storage) == 1 ? "c" : "!");
+    return daemon.schedule(10ms, [] {
+        step(".");
+        ctx.daemon->terminate();
+    });
+}
+
+/* destroy: callables left behind are destroyed along with the state. */
+
+int setup_destroy(udaemon::Daemon &daemon) {
+    if (daemon.add_handler(ctx.fds[0], POLLIN, [t = Tracker("h")](struct pollfd &) {})) {
+        return -1;
+    }
+    int rc = daemon.schedule(1s, [t = Tracker("t")] {});
+    return rc ? rc : daemon.schedule(10ms, [] {
+        step(".");
+        ctx.daemon->terminate();
+    });
+}
+
+/* range: intervals that do not fit in 16 bits are refused. */
+
+int setup_range(udaemon::Daemon &daemon) {
+    step(daemon.schedule(65536ms, [] {}) == -EINVAL ? "m" : "!");
+    step(daemon.schedule(-1ms, [] {}) == -EINVAL ? "n" : "!");
+    step(daemon.schedule(std::chrono::seconds(65536), [] {}) == -EINVAL ? "s" : "!");
+    // the largest interval is still fine...
+    step(daemon.schedule(65535ms, [] {}) == 0 ? "." : "!");
+    return daemon.schedule(10ms, [] { ctx.daemon->terminate(); });
+}
+
+const Scenario SCENARIOS[] = {
+    { "remove", setup_remove, "~." },
+    { "self", setup_self, "cr~." },
+    { "void", setup_void, "cc" },
+    { "once", setup_once, "t~." },
+    { "repeat", setup_repeat, "ttt~." },
+    { "cancel", setup_cancel, "~c." },
+    { "destroy", setup_destroy, ".ht" },
+    { "range", setup_range, "mns." },
+};
+
+const Scenario *current;
+
+int init(const ud_state_t *ud_state) {
+    set_loglevel(WARNING);
+
+    if (ud_schedule_timer(ud_state, TIMEOUT, terminate_task, nullptr)) {
+        return -1;
+    }
+    return current->setup(*ctx.daemon);
+}
+
+bool run(const Scenario &scenario, ud_backend_t backend) {
+    ctx.trace[0] = '\0';
+    ctx.id = UD_INVALID_ID;
+    ctx.runs = 0;
+    current = &scenario;
+
+    if (pipe2(ctx.fds, O_NONBLOCK | O_CLOEXEC)) {
+        return false;
+    }
+
+    ud_config_t config {};
+    config.foreground = true;
+    config.backend = backend;
+    config.initialize = init;
+
+    {
+        udaemon::Daemon daemon(config);
+        ctx.daemon = &daemon;
+        daemon.run();
+    }
+    ctx.daemon = nullptr;
+
+    for (int fd : ctx.fds) {
+        close(fd);
+    }
+
+    bool ok = strcmp(ctx.trace, scenario.expected) == 0;
+    printf("%-10s %-6s %s (trace \"%s\", expected \"%s\")\n", scenario.name,
+           backend == UD_BACKEND_EPOLL ? "epoll" : "poll", ok ? "OK" : "FAILED", ctx.trace, scenario.expected);
+    return ok;
+}
+
+} // namespace
+
+int main() {
+    static const ud_backend_t backends[] = { UD_BACKEND_POLL, UD_BACKEND_EPOLL };
+
+    int failed = 0;
+    for (const Scenario &scenario : SCENARIOS) {
+        for (ud_backend_t backend : backends) {
+            failed += run(scenario, backend) ? 0 : 1;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "udaemon/ud_keepalive.h"
+#include "udaemon/ud_sim.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The number of entries the scenarios can use...
+#define ENTRIES 3
+// The time (in milliseconds) a single rotation of the wheel takes, with the default tick...
+#define ROTATION (512 * UD_KEEPALIVE_TICK)
+
+/**
+ * Tests the keepalive manager on the simulated clock, tracing the name of
+ * each entry and the time its callback is called.
+ */
+static struct {
+    ud_keepalive_t *keepalive;
+    ud_keepalive_entry_t entries[ENTRIES];
+    int calls;
+    int fds[2];
+    ud_sim_t *sim;
+    int dispatches;
+    uint64_t idle_at;
+} ctx;
+
+static void on_idle(const ud_state_t *ud_state, ud_keepalive_entry_t *entry, void *context) {
+    (void) entry;
+
+    test_stepf("%s@%d ", (const char *) context, (int) ud_now(ud_state));
+}
+
+static int add_entry(int idx, const char *name, ud_keepalive_cb_t cb, uint32_t timeout) {
+    ctx.entries[idx].cb = cb;
+    ctx.entries[idx].context = (void *) name;
+    ctx.entries[idx].eh_id = UD_INVALID_ID;
+    return ud_keepalive_add(ctx.keepalive, &ctx.entries[idx], timeout);
+}
+
+static int finish_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    ud_keepalive_destroy(ctx.keepalive);
+    ctx.keepalive = NULL;
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static int setup_keepalive(const ud_state_t *ud_state) {
+    ctx.keepalive = ud_keepalive_create(ud_state, 0);
+    return ctx.keepalive ? 0 : -1;
+}
+
+/* touch: activity moves the deadline, once the original deadline passes. */
+
+static int touch_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    (void) context;
+
+    ud_keepalive_touch(ctx.keepalive, &ctx.entries[0]);
+    return 0;
+}
+
+static int setup_touch(const ud_state_t *ud_state) {
+    int rc = setup_keepalive(ud_state);
+    if (!rc) {
+        rc = add_entry(0, "A", on_idle, 1000);
+    }
+    if (!rc) {
+        rc = ud_schedule_timer(ud_state, 600, touch_task, NULL);
+    }
+    return rc ? rc : ud_schedule_timer(ud_state, 2000, finish_task, NULL);
+}
+
+/* rotation: deadlines beyond a single rotation of the wheel wait for later rounds. */
+
+static int setup_rotation(const ud_state_t *ud_state) {
+    int rc = setup_keepalive(ud_state);
+    if (!rc) {
+        // passes its slot twice before it is due...
+        rc = add_entry(0, "A", on_idle, 2 * ROTATION + 10000);
+    }
+    if (!rc) {
+        rc = add_entry(1, "B", on_idle, 10000);
+    }
+    return rc ? rc : ud_schedule_task(ud_state, 3 * ROTATION / 1000, finish_task, NULL);
+}
+
+/* callbacks: a callback re-adds itself, removes an expired entry and adds another one. */
+
+static void on_idle_readd(const ud_state_t *ud_state, ud_keepalive_entry_t *entry, void *context) {
+    on_idle(ud_state, entry, context);
+    if (ctx.calls++) {
+        return;
+    }
+
+    // B expired in the same tick, but is not called anymore...
+    ud_keepalive_remove(ctx.keepalive, &ctx.entries[1]);
+    if (add_entry(2, "C", on_idle, 200) || ud_keepalive_add(ctx.keepalive, entry, 300)) {
+        test_step("<add failed>");
+    }
+}
+
+static int setup_callbacks(const ud_state_t *ud_state) {
+    int rc = setup_keepalive(ud_state);
+    if (!rc) {
+        rc = add_entry(0, "A", on_idle_readd, 500);
+    }
+    if (!rc) {
+        rc = add_entry(1, "B", on_idle, 500);
+    }
+    return rc ? rc : ud_schedule_timer(ud_state, 1000, finish_task, NULL);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "touch", setup_touch, "A@1600 " },
+    { "rotation", setup_rotation, "B@10000 A@112400 " },
+    { "callbacks", setup_callbacks, "A@500 C@700 A@800 " },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.fds[0] = ctx.fds[1] = -1;
+}
+
+/* handler: dispatches of the event handler of an entry count as activity, also for handler 0. */
+
+static void on_handler_idle(const ud_state_t *ud_state, ud_keepalive_entry_t *entry, void *context) {
+    (void) entry;
+    (void) context;
+
+    ctx.idle_at = ud_now(ud_state);
+}
+
+static ud_result_t on_readable(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) ud_state;
+    (void) pollfd;
+    (void) context;
+
+    return RES_OK;
+}
+
+static int inject_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+
+    ud_sim_inject(context, ctx.fds[0], POLLIN);
+    // busy for a second, then idle...
+    return ++ctx.dispatches < 5 ? interval : 0;
+}
+
+static int init_handler(const ud_state_t *ud_state) {
+    int rc = setup_keepalive(ud_state);
+    if (!rc) {
+        rc = ud_keepalive_add(ctx.keepalive, &ctx.entries[0], 500);
+    }
+    if (!rc) {
+        rc = ud_schedule_timer(ud_state, 200, inject_task, ctx.sim);
+    }
+    return rc ? rc : ud_schedule_timer(ud_state, 2000, finish_task, NULL);
+}
+
+static bool check_handler(void) {
+    ud_config_t config = {
+        .foreground = true,
+        .initialize = init_handler,
+    };
+
+    reset();
+    ud_state_t *ud_state = ud_init(&config);
+    if (!ud_state) {
+        return false;
+    }
+
+    // added before the mainloop runs, so it gets identifier 0...
+    eh_id_t id = UD_INVALID_ID;
+    if (!pipe2(ctx.fds, O_NONBLOCK | O_CLOEXEC) &&
+            !ud_add_event_handler(ud_state, ctx.fds[0], POLLIN, on_readable, NULL, &id) &&
+            (ctx.sim = ud_sim_create(ud_state)) != NULL) {
+        ctx.entries[0] = (ud_keepalive_entry_t) {
+            .cb = on_handler_idle,
+            .eh_id = id,
+        };
+        ud_main_loop(ud_state);
+    }
+    ud_sim_destroy(ctx.sim);
+    ud_destroy(ud_state);
+
+    for (int i = 0; i < 2; i++) {
+        if (ctx.fds[i] >= 0) {
+            close(ctx.fds[i]);
+        }
+    }
+
+    // idle since the last dispatch at 1000 ms...
+    bool ok = id == 0 && ctx.idle_at == 1500;
+    printf("%-12s %-6s %s (handler %d idle at %d)\n", "handler", "sim", ok ? "OK" : "FAILED", (int) id,
+           (int) ctx.idle_at);
+    return ok;
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .simulated = true,
+        .timeout = 4 * ROTATION,
+        .reset = reset,
+    };
+    int failed = test_run(&suite);
+
+    if (!check_handler()) {
+        failed = 1;
+    }
+    return failed;
+}
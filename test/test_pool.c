@@ -0,0 +1,280 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "udaemon/ud_pool.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The number of connections the scenarios can hold on to...
+#define HELD 2
+
+/**
+ * Tests connection pools against listening sockets on the loopback interface,
+ * tracing the result of each acquisition.
+ */
+static struct {
+    int lfd;
+    /** the socket that fills the backlog of the listening socket. */
+    int filler;
+    struct sockaddr_in addr;
+    ud_pool_t *pool;
+    int held[HELD];
+} ctx;
+
+/**
+ * Opens a listening socket on an arbitrary port of the loopback interface.
+ */
+static int open_listener(int backlog) {
+    ctx.addr = (struct sockaddr_in) {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(ctx.addr);
+
+    ctx.lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ctx.lfd < 0 || bind(ctx.lfd, (struct sockaddr *) &ctx.addr, sizeof(ctx.addr)) ||
+            listen(ctx.lfd, backlog) || getsockname(ctx.lfd, (struct sockaddr *) &ctx.addr, &len)) {
+        return -1;
+    }
+    return 0;
+}
+
+static int create_pool(const ud_state_t *ud_state, const ud_pool_config_t *config) {
+    ctx.pool = ud_pool_create(ud_state, config);
+    if (!ctx.pool) {
+        return -1;
+    }
+    return ud_pool_add_endpoint(ctx.pool, (struct sockaddr *) &ctx.addr, sizeof(ctx.addr));
+}
+
+static void hold(int fd) {
+    for (int i = 0; i < HELD; i++) {
+        if (ctx.held[i] < 0) {
+            ctx.held[i] = fd;
+            return;
+        }
+    }
+    close(fd);
+}
+
+static void step_result(int fd) {
+    if (fd >= 0) {
+        test_step("ok ");
+    } else if (fd == -ECONNREFUSED) {
+        test_step("refused ");
+    } else if (fd == -ETIMEDOUT) {
+        test_step("timeout ");
+    } else if (fd == -ECANCELED) {
+        test_step("cancelled ");
+    } else {
+        test_stepf("<%s> ", strerror(-fd));
+    }
+}
+
+static void on_acquired(const ud_state_t *ud_state, int fd, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    step_result(fd);
+    if (fd >= 0) {
+        hold(fd);
+    }
+}
+
+static int acquire(void) {
+    return ud_pool_acquire(ctx.pool, on_acquired, NULL);
+}
+
+/**
+ * Traces the number of connects and failed connects, and terminates.
+ */
+static int finish_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    if (ctx.pool) {
+        ud_pool_stats_t stats;
+        ud_pool_get_stats(ctx.pool, &stats);
+        test_stepf("%d/%d", (int) stats.connects, (int) stats.connect_failures);
+
+        ud_pool_destroy(ctx.pool);
+        ctx.pool = NULL;
+    }
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+/* connect: a released connection is reused by the next acquisition. */
+
+static void on_reacquired(const ud_state_t *ud_state, int fd, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    test_step(fd == ctx.held[0] ? "same " : "<other> ");
+    ctx.held[0] = -1;
+    hold(fd);
+}
+
+static int reacquire_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    int rc = ud_pool_release(ctx.pool, ctx.held[0], true);
+    if (!rc) {
+        rc = ud_pool_acquire(ctx.pool, on_reacquired, NULL);
+    }
+    return rc ? rc : ud_schedule_timer(ud_state, 10, finish_task, NULL);
+}
+
+static int setup_connect(const ud_state_t *ud_state) {
+    const ud_pool_config_t config = {
+        .max_conns = 1,
+    };
+    if (open_listener(8) || create_pool(ud_state, &config)) {
+        return -1;
+    }
+
+    int rc = acquire();
+    return rc ? rc : ud_schedule_timer(ud_state, 100, reacquire_task, NULL);
+}
+
+/* refused: an endpoint that refuses a connect is not connected to for a while. */
+
+static int retry_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    int rc = acquire();
+    return rc ? rc : ud_schedule_timer(ud_state, 100, finish_task, NULL);
+}
+
+static int setup_refused(const ud_state_t *ud_state) {
+    const ud_pool_config_t config = {
+        .max_conns = 1,
+    };
+    // nothing listens on this port anymore...
+    if (open_listener(8) || create_pool(ud_state, &config)) {
+        return -1;
+    }
+    close(ctx.lfd);
+    ctx.lfd = -1;
+
+    // the second one fails right away, without connecting...
+    int rc = acquire();
+    if (!rc) {
+        rc = acquire();
+    }
+    // ...as does the third one, once the endpoint is no longer considered down...
+    return rc ? rc : ud_schedule_timer(ud_state, 1300, retry_task, NULL);
+}
+
+/* timeout: a connect that does not finish in time fails. */
+
+static int setup_timeout(const ud_state_t *ud_state) {
+    const ud_pool_config_t config = {
+        .max_conns = 1,
+        .connect_timeout = 300,
+    };
+    if (open_listener(0) || create_pool(ud_state, &config)) {
+        return -1;
+    }
+
+    // a full backlog lets the listening socket drop any further connects...
+    ctx.filler = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (ctx.filler < 0 || connect(ctx.filler, (struct sockaddr *) &ctx.addr, sizeof(ctx.addr))) {
+        return -1;
+    }
+
+    int rc = acquire();
+    // the timeout is checked by the housekeeping of the pool...
+    return rc ? rc : ud_schedule_timer(ud_state, 300 + 2 * UD_POOL_TICK, finish_task, NULL);
+}
+
+/* destroy: a callback destroys its pool, which leaves the acquired connection open. */
+
+static void on_acquired_destroy(const ud_state_t *ud_state, int fd, void *context) {
+    (void) context;
+
+    step_result(fd);
+    if (fd < 0) {
+        return;
+    }
+    hold(fd);
+
+    // cancels the other acquisition...
+    ud_pool_destroy(ctx.pool);
+    ctx.pool = NULL;
+
+    test_step(fcntl(fd, F_GETFD) >= 0 ? "open" : "<closed>");
+    if (ud_schedule_timer(ud_state, 10, finish_task, NULL)) {
+        test_step("<schedule failed>");
+    }
+}
+
+static int setup_destroy(const ud_state_t *ud_state) {
+    const ud_pool_config_t config = {
+        .max_conns = 1,
+    };
+    if (open_listener(8) || create_pool(ud_state, &config)) {
+        return -1;
+    }
+
+    int rc = ud_pool_acquire(ctx.pool, on_acquired_destroy, NULL);
+    return rc ? rc : acquire();
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "connect", setup_connect, "ok same 1/0" },
+    { "refused", setup_refused, "refused refused refused 0/2" },
+    { "timeout", setup_timeout, "timeout 0/1" },
+    { "destroy", setup_destroy, "ok cancelled open" },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.lfd = ctx.filler = -1;
+    for (int i = 0; i < HELD; i++) {
+        ctx.held[i] = -1;
+    }
+}
+
+static void cleanup(void) {
+    if (ctx.lfd >= 0) {
+        close(ctx.lfd);
+    }
+    if (ctx.filler >= 0) {
+        close(ctx.filler);
+    }
+    for (int i = 0; i < HELD; i++) {
+        if (ctx.held[i] >= 0) {
+            close(ctx.held[i]);
+        }
+    }
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}
@@ -0,0 +1,149 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+// The number of posts each worker thread does...
+#define POSTS 1000
+// The number of posts each worker thread does after its mainloop terminated...
+#define LATE_POSTS 100
+// The number of mainloops running at the same time...
+#define LOOPS 2
+// The time (in milliseconds) after which a mainloop is considered to hang...
+#define TIMEOUT 5000
+
+/**
+ * Tests that mainloops running on different threads each have their own
+ * event pipe: every mainloop gets the posts and signals of its own worker
+ * thread, and a worker can keep posting after its mainloop has terminated.
+ */
+typedef struct loop {
+    ud_config_t config;
+    ud_state_t *ud_state;
+    pthread_t thread;
+    pthread_t worker;
+    ud_post_t posts[POSTS];
+    ud_post_t late_posts[LATE_POSTS];
+    int called;
+    int signals;
+    /** the number of posts done after the mainloop terminated. */
+    int late;
+    volatile bool stopped;
+} loop_t;
+
+static loop_t loops[LOOPS];
+
+static void on_post(const ud_state_t *ud_state, ud_post_t *post) {
+    (void) post;
+    loop_t *loop = ud_get_app_state(ud_state);
+
+    if (++loop->called == POSTS) {
+        ud_raise_signal(ud_state, SIG_USR1);
+    }
+}
+
+static void on_signal(const ud_state_t *ud_state, ud_signal_t signal) {
+    loop_t *loop = ud_get_app_state(ud_state);
+
+    if (signal == SIG_USR1) {
+        loop->signals++;
+        ud_terminate(ud_state);
+    }
+}
+
+static int timeout_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static void *worker(void *arg) {
+    loop_t *loop = arg;
+
+    for (int i = 0; i < POSTS; i++) {
+        loop->posts[i].fn = on_post;
+        ud_post(loop->ud_state, &loop->posts[i]);
+    }
+    while (!loop->stopped) {
+        usleep(100);
+    }
+    // posting after the mainloop is gone should not touch any other file descriptor...
+    for (int i = 0; i < LATE_POSTS; i++) {
+        loop->late_posts[i].fn = on_post;
+        if (ud_post(loop->ud_state, &loop->late_posts[i]) == 0) {
+            loop->late++;
+        }
+    }
+    return NULL;
+}
+
+static int init(const ud_state_t *ud_state) {
+    loop_t *loop = ud_get_app_state(ud_state);
+
+    if (ud_schedule_timer(ud_state, TIMEOUT, timeout_task, NULL)) {
+        return -1;
+    }
+    return pthread_create(&loop->worker, NULL, worker, loop) ? -1 : 0;
+}
+
+static void *run(void *arg) {
+    loop_t *loop = arg;
+
+    ud_main_loop(loop->ud_state);
+    loop->stopped = true;
+    pthread_join(loop->worker, NULL);
+    return NULL;
+}
+
+int main(void) {
+    set_loglevel(WARNING);
+
+    for (int i = 0; i < LOOPS; i++) {
+        loop_t *loop = &loops[i];
+        loop->config = (ud_config_t) {
+            .foreground = true,
+            .initialize = init,
+            .signal_handler = on_signal,
+        };
+        loop->ud_state = ud_init(&loop->config);
+        if (!loop->ud_state) {
+            return 1;
+        }
+        ud_set_app_state(loop->ud_state, loop);
+    }
+
+    for (int i = 0; i < LOOPS; i++) {
+        if (pthread_create(&loops[i].thread, NULL, run, &loops[i])) {
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for (int i = 0; i < LOOPS; i++) {
+        loop_t *loop = &loops[i];
+        pthread_join(loop->thread, NULL);
+        ud_destroy(loop->ud_state);
+
+        // posts done after the mainloop terminated are never called...
+        bool ok = loop->called == POSTS && loop->signals == 1 && loop->late == LATE_POSTS;
+        printf("loop %d %s (%d of %d posts, %d signals, %d late posts)\n", i, ok ? "OK" : "FAILED",
+               loop->called, POSTS, loop->signals, loop->late);
+        failed += ok ? 0 : 1;
+    }
+
+    return failed ? 1 : 0;
+}
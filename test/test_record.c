@@ -0,0 +1,144 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/udaemon.h"
+
+// The number of messages written to the event handler...
+#define MESSAGES 3
+// The interval (in milliseconds) at which messages are written...
+#define INTERVAL 10
+
+/**
+ * Tests that replaying a recording calls the same event handlers, with the
+ * same data, and runs the same tasks at the same (virtual) times as during
+ * the recording. The event handler is added before the mainloop starts, so
+ * it precedes the event handler of udaemon itself, and it reads one byte at a
+ * time, just like the signals read from the event pipe of udaemon.
+ */
+static struct {
+    int fds[2];
+    uint64_t start;
+    int writes;
+    char trace[256];
+} ctx;
+
+static void step(const ud_state_t *ud_state, const char *what, char data) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%s%c@%d ", what, data, (int) (ud_now(ud_state) - ctx.start));
+    strncat(ctx.trace, buf, sizeof(ctx.trace) - strlen(ctx.trace) - 1);
+}
+
+static ud_result_t on_readable(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) context;
+
+    char c;
+    while (ud_read(ud_state, pollfd->fd, &c, 1) == 1) {
+        step(ud_state, "D", c);
+    }
+    return RES_OK;
+}
+
+static int write_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) context;
+
+    char c = (char) ('a' + ctx.writes);
+    step(ud_state, "T", c);
+    if (write(ctx.fds[1], &c, 1) != 1) {
+        perror("write");
+    }
+    if (++ctx.writes < MESSAGES) {
+        return interval;
+    }
+    ud_raise_signal(ud_state, SIG_USR1);
+    return 0;
+}
+
+static void on_signal(const ud_state_t *ud_state, ud_signal_t signal) {
+    if (signal == SIG_USR1) {
+        step(ud_state, "S", '1');
+        ud_terminate(ud_state);
+    }
+}
+
+static int init(const ud_state_t *ud_state) {
+    ctx.start = ud_now(ud_state);
+    return ud_schedule_timer(ud_state, INTERVAL, write_task, NULL);
+}
+
+/**
+ * Runs the mainloop once, either recording to or replaying from the given
+ * file, and returns the trace of the run.
+ */
+static const char *run(const char *path, bool replay) {
+    memset(&ctx, 0, sizeof(ctx));
+    if (pipe2(ctx.fds, O_NONBLOCK | O_CLOEXEC)) {
+        perror("pipe2");
+        return NULL;
+    }
+
+    ud_config_t config = {
+        .foreground = true,
+        .initialize = init,
+        .signal_handler = on_signal,
+        .record_file = replay ? NULL : (char *) path,
+    };
+
+    ud_state_t *ud_state = ud_init(&config);
+    if (!ud_state) {
+        return NULL;
+    }
+
+    int rc = ud_add_event_handler(ud_state, ctx.fds[0], POLLIN, on_readable, NULL, NULL);
+    if (!rc) {
+        rc = replay ? ud_replay(ud_state, path) : ud_main_loop(ud_state);
+    }
+    ud_destroy(ud_state);
+
+    close(ctx.fds[0]);
+    close(ctx.fds[1]);
+
+    return rc ? NULL : ctx.trace;
+}
+
+int main(void) {
+    set_loglevel(WARNING);
+
+    char path[] = "/tmp/test_record.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    char recorded[sizeof(ctx.trace)] = "";
+    const char *trace = run(path, false);
+    if (trace) {
+        strcpy(recorded, trace);
+    }
+    const char *replayed = run(path, true);
+    unlink(path);
+
+    // all messages should have been read, followed by the signal...
+    int reads = 0;
+    for (const char *p = recorded; (p = strchr(p, 'D')) != NULL; p++) {
+        reads++;
+    }
+    bool ok = reads == MESSAGES && strchr(recorded, 'S') && replayed && strcmp(recorded, replayed) == 0;
+    printf("round-trip %s (recorded \"%s\", replayed \"%s\")\n", ok ? "OK" : "FAILED", recorded,
+           replayed ? replayed : "<error>");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,270 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "udaemon/ud_bus.h"
+#include "udaemon/ud_logging.h"
+#include "udaemon/ud_resolve.h"
+#include "udaemon/udaemon.h"
+
+// The time (in milliseconds) after which the test is considered to hang...
+#define TIMEOUT 5000
+// The port to fill in...
+#define PORT 8080
+// The number of results a state caches...
+#define CACHE_MAX 64
+
+/**
+ * Tests the asynchronous resolution of names from /etc/hosts: concurrent
+ * requests share a single resolution and get the same result, a cached result
+ * is delivered right away, a result stays valid while its callbacks resolve
+ * other hosts in a full cache, and destroying a state with a resolution in
+ * progress (or posted to it) does not call its callback.
+ */
+static struct {
+    int calls;
+    int errors;
+    bool loopback;
+    const struct addrinfo *first;
+    bool shared;
+    bool synchronous;
+    bool in_call;
+    int filled;
+    bool pinned;
+    int waiters;
+    bool waited;
+} ctx;
+
+static bool is_loopback(const struct addrinfo *result) {
+    for (const struct addrinfo *ai = result; ai; ai = ai->ai_next) {
+        if (ai->ai_family == AF_INET) {
+            const struct sockaddr_in *sin = (const struct sockaddr_in *) ai->ai_addr;
+            if (sin->sin_addr.s_addr == htonl(INADDR_LOOPBACK) && ntohs(sin->sin_port) == PORT) {
+                return true;
+            }
+        } else if (ai->ai_family == AF_INET6) {
+            const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) ai->ai_addr;
+            if (IN6_IS_ADDR_LOOPBACK(&sin6->sin6_addr) && ntohs(sin6->sin6_port) == PORT) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static void on_cached(const ud_state_t *ud_state, int error, const struct addrinfo *result, void *context) {
+    (void) context;
+
+    ctx.synchronous = ctx.in_call && !error && result == ctx.first;
+    ud_terminate(ud_state);
+}
+
+static void on_resolved(const ud_state_t *ud_state, int error, const struct addrinfo *result, void *context) {
+    (void) context;
+
+    ctx.calls++;
+    if (error) {
+        fprintf(stderr, "failed to resolve localhost: %s\n", gai_strerror(error));
+        ctx.errors++;
+        ud_terminate(ud_state);
+        return;
+    }
+    ctx.loopback = is_loopback(result);
+
+    if (ctx.calls == 1) {
+        ctx.first = result;
+        return;
+    }
+    ctx.shared = (result == ctx.first);
+
+    // the result is cached by now...
+    ctx.in_call = true;
+    ud_resolve_async(ud_state, "localhost", PORT, on_cached, NULL);
+    ctx.in_call = false;
+}
+
+static bool has_address(const struct addrinfo *result, const char *addr) {
+    struct in_addr expected;
+    inet_pton(AF_INET, addr, &expected);
+
+    return result && result->ai_family == AF_INET &&
+           ((const struct sockaddr_in *) result->ai_addr)->sin_addr.s_addr == expected.s_addr;
+}
+
+static void on_ignored(const ud_state_t *ud_state, int error, const struct addrinfo *result, void *context) {
+    (void) ud_state;
+    (void) error;
+    (void) result;
+    (void) context;
+}
+
+static void on_extra(const ud_state_t *ud_state, int error, const struct addrinfo *result, void *context) {
+    (void) context;
+
+    ctx.waiters++;
+    if (ctx.waiters == 1) {
+        // evicts the oldest result, which must not be this one...
+        ud_resolve_async(ud_state, "127.0.1.2", PORT, on_ignored, NULL);
+    }
+    if (ctx.waiters == 2) {
+        ctx.waited = !error && has_address(result, "127.0.1.1");
+        ud_terminate(ud_state);
+    }
+}
+
+static void on_pinned(const ud_state_t *ud_state, int error, const struct addrinfo *result, void *context) {
+    (void) context;
+
+    // the cache is full and this result expires first, so it is the one to evict...
+    if (ud_resolve_async(ud_state, "127.0.1.1", PORT, on_extra, NULL) ||
+            ud_resolve_async(ud_state, "127.0.1.1", PORT, on_extra, NULL)) {
+        ud_terminate(ud_state);
+        return;
+    }
+    ctx.pinned = !error && has_address(result, "127.0.0.1");
+}
+
+static void on_filled(const ud_state_t *ud_state, int error, const struct addrinfo *result, void *context) {
+    (void) error;
+    (void) result;
+    (void) context;
+
+    if (++ctx.filled == CACHE_MAX - 1) {
+        ud_resolve_async(ud_state, "127.0.0.1", PORT, on_pinned, NULL);
+    }
+}
+
+static int fill_cache(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    for (int i = 2; i <= CACHE_MAX; i++) {
+        char host[16];
+        snprintf(host, sizeof(host), "127.0.0.%d", i);
+        if (ud_resolve_async(ud_state, host, PORT, on_filled, NULL)) {
+            ud_terminate(ud_state);
+        }
+    }
+    return 0;
+}
+
+static void on_first(const ud_state_t *ud_state, int error, const struct addrinfo *result, void *context) {
+    (void) error;
+    (void) result;
+    (void) context;
+
+    // let the first result expire before all others...
+    ud_schedule_timer(ud_state, 5, fill_cache, NULL);
+}
+
+static void on_never(const ud_state_t *ud_state, int error, const struct addrinfo *result, void *context) {
+    (void) ud_state;
+    (void) error;
+    (void) result;
+
+    *(bool *) context = true;
+}
+
+static int on_timeout(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    fprintf(stderr, "timed out\n");
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static int init(const ud_state_t *ud_state) {
+    if (ud_resolve_async(ud_state, "localhost", PORT, on_resolved, NULL) ||
+            ud_resolve_async(ud_state, "localhost", PORT, on_resolved, NULL)) {
+        return -1;
+    }
+    return ud_schedule_timer(ud_state, TIMEOUT, on_timeout, NULL);
+}
+
+static int init_full(const ud_state_t *ud_state) {
+    if (ud_resolve_async(ud_state, "127.0.0.1", PORT, on_first, NULL)) {
+        return -1;
+    }
+    return ud_schedule_timer(ud_state, TIMEOUT, on_timeout, NULL);
+}
+
+static bool check(const char *name, bool ok) {
+    printf("%-12s %s\n", name, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(void) {
+    // only report warnings and errors of udaemon itself...
+    set_loglevel(WARNING);
+
+    ud_config_t config = {
+        .foreground = true,
+        .initialize = init,
+    };
+
+    ud_state_t *ud_state = ud_init(&config);
+    if (!ud_state) {
+        return 1;
+    }
+    ud_main_loop(ud_state);
+    ud_destroy(ud_state);
+
+    bool ok = true;
+    ok &= check("resolve", ctx.calls == 2 && !ctx.errors && ctx.loopback);
+    ok &= check("shared", ctx.shared);
+    ok &= check("cached", ctx.synchronous);
+
+    // fill the cache and resolve other hosts from the callbacks of cached results...
+    config.initialize = init_full;
+    ud_state = ud_init(&config);
+    if (!ud_state) {
+        return 1;
+    }
+    ud_main_loop(ud_state);
+    ud_destroy(ud_state);
+
+    ok &= check("pinned", ctx.pinned);
+    ok &= check("waiters", ctx.waited);
+
+    // destroy a state while its resolution is (most likely) in progress...
+    bool called = false;
+    ud_config_t other = { .foreground = true };
+    ud_state = ud_init(&other);
+    if (!ud_state || ud_resolve_async(ud_state, "localhost", PORT + 1, on_never, &called)) {
+        return 1;
+    }
+    ud_destroy(ud_state);
+    // give the helper thread the time to finish, it should not post to the destroyed state...
+    usleep(100000);
+    ok &= check("destroyed", !called);
+
+    // destroy a state with a posted result, which the bus looks for in the same queue...
+    ud_state = ud_init(&other);
+    if (!ud_state || ud_resolve_async(ud_state, "localhost", PORT + 2, on_never, &called)) {
+        return 1;
+    }
+    usleep(100000);
+    ud_bus_t *bus = ud_bus_create(ud_state);
+    if (!bus) {
+        return 1;
+    }
+    ud_bus_destroy(bus);
+    ud_destroy(ud_state);
+    ok &= check("teardown", !called);
+
+    return ok ? 0 : 1;
+}
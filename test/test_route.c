@@ -0,0 +1,216 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "udaemon/ud_route.h"
+
+/**
+ * Tests the matching of topics against the routes of a routing table. The
+ * targets are the letters of the alphabet, so each match is described by the
+ * (sorted) letters of its targets.
+ */
+static char TARGETS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+typedef struct route {
+    const char *filter;
+    char target;
+} route_t;
+
+typedef struct match {
+    const char *topic;
+    const char *expected;
+} match_t;
+
+static int compare_chars(const void *a, const void *b) {
+    return *(const char *) a - *(const char *) b;
+}
+
+static void *target_of(char c) {
+    return &TARGETS[c - 'A'];
+}
+
+/**
+ * @return the sorted letters of the targets that match the given topic.
+ */
+static const char *match(ud_route_table_t *table, const char *topic) {
+    static char result[sizeof(TARGETS)];
+
+    void *const *targets;
+    int n = ud_route_match(table, topic, &targets);
+    if (n < 0 || n >= (int) sizeof(result)) {
+        return "<error>";
+    }
+    for (int i = 0; i < n; i++) {
+        result[i] = *(const char *) targets[i];
+    }
+    result[n] = '\0';
+    qsort(result, (size_t) n, 1, compare_chars);
+    return result;
+}
+
+static bool check(const char *name, ud_route_table_t *table, const match_t *matches, size_t count) {
+    bool ok = true;
+    for (size_t i = 0; i < count; i++) {
+        const char *actual = match(table, matches[i].topic);
+        bool matched = strcmp(actual, matches[i].expected) == 0;
+        printf("%-12s %-16s %s (targets \"%s\", expected \"%s\")\n", name, matches[i].topic,
+               matched ? "OK" : "FAILED", actual, matches[i].expected);
+        ok = ok && matched;
+    }
+    return ok;
+}
+
+static ud_route_table_t *create(const route_t *routes, size_t count) {
+    ud_route_table_t *table = ud_route_create();
+    for (size_t i = 0; table && i < count; i++) {
+        if (ud_route_add(table, routes[i].filter, target_of(routes[i].target))) {
+            ud_route_destroy(table);
+            return NULL;
+        }
+    }
+    return table;
+}
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+/* wildcards: `+` matches exactly one level, `#` any number, including its parent level. */
+
+static const route_t WILDCARD_ROUTES[] = {
+    { "a/+/c", 'A' },
+    { "a/#", 'B' },
+    { "+", 'C' },
+    { "a/b/c", 'D' },
+};
+
+static const match_t WILDCARD_MATCHES[] = {
+    { "a/b/c", "ABD" },
+    { "a/b/d/c", "B" },
+    { "a/b", "B" },
+    { "a", "BC" },
+    { "a/x/c", "AB" },
+    { "b", "C" },
+    { "b/c", "" },
+};
+
+/* system: topics starting with `$` are not matched by leading wildcards. */
+
+static const route_t SYSTEM_ROUTES[] = {
+    { "#", 'A' },
+    { "+/stats", 'B' },
+    { "$SYS/#", 'C' },
+    { "$SYS/+", 'D' },
+};
+
+static const match_t SYSTEM_MATCHES[] = {
+    { "$SYS/stats", "CD" },
+    { "$SYS", "C" },
+    { "app/stats", "AB" },
+};
+
+/* dedup: targets matched by multiple routes are returned once. */
+
+static const route_t DEDUP_ROUTES[] = {
+    { "a/b", 'A' },
+    { "a/+", 'A' },
+    { "a/#", 'A' },
+    { "#", 'B' },
+    { "a/b", 'B' },
+};
+
+static const match_t DEDUP_MATCHES[] = {
+    { "a/b", "AB" },
+    { "a", "AB" },
+    { "c", "B" },
+};
+
+/* invalid: misplaced wildcards are refused. */
+
+static bool check_invalid(void) {
+    static const char *const FILTERS[] = { "a/#/b", "a+", "a/b#", "#/a", "+a/b" };
+
+    ud_route_table_t *table = ud_route_create();
+    if (!table) {
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < COUNT(FILTERS); i++) {
+        int rc = ud_route_add(table, FILTERS[i], target_of('A'));
+        printf("%-12s %-16s %s (result %d, expected %d)\n", "invalid", FILTERS[i], rc == -EINVAL ? "OK" : "FAILED",
+               rc, -EINVAL);
+        ok = ok && rc == -EINVAL;
+    }
+    // none of them is added...
+    ok = check("invalid", table, &(match_t) { "a/b", "" }, 1) && ok;
+
+    ud_route_destroy(table);
+    return ok;
+}
+
+/* cache: adding a route invalidates the cached matches. */
+
+static bool check_cache(void) {
+    static const route_t ROUTES[] = {
+        { "a/b", 'A' },
+    };
+    static const match_t BEFORE[] = {
+        { "a/b", "A" },
+        { "a/c", "" },
+    };
+    static const match_t AFTER[] = {
+        { "a/b", "AB" },
+        { "a/c", "B" },
+    };
+
+    ud_route_table_t *table = create(ROUTES, COUNT(ROUTES));
+    if (!table) {
+        return false;
+    }
+
+    // matching twice serves the second match from the cache...
+    bool ok = check("cache", table, BEFORE, COUNT(BEFORE));
+    ok = check("cache", table, BEFORE, COUNT(BEFORE)) && ok;
+    if (ud_route_add(table, "a/+", target_of('B'))) {
+        ok = false;
+    }
+    ok = check("cache", table, AFTER, COUNT(AFTER)) && ok;
+
+    ud_route_destroy(table);
+    return ok;
+}
+
+static bool check_table(const char *name, const route_t *routes, size_t route_count, const match_t *matches,
+                        size_t match_count) {
+    ud_route_table_t *table = create(routes, route_count);
+    if (!table) {
+        printf("%-12s FAILED (unable to create routing table)\n", name);
+        return false;
+    }
+
+    bool ok = check(name, table, matches, match_count);
+
+    ud_route_destroy(table);
+    return ok;
+}
+
+int main(void) {
+    int failed = 0;
+
+    failed += check_table("wildcards", WILDCARD_ROUTES, COUNT(WILDCARD_ROUTES), WILDCARD_MATCHES,
+                          COUNT(WILDCARD_MATCHES)) ? 0 : 1;
+    failed += check_table("system", SYSTEM_ROUTES, COUNT(SYSTEM_ROUTES), SYSTEM_MATCHES, COUNT(SYSTEM_MATCHES))
+              ? 0 : 1;
+    failed += check_table("dedup", DEDUP_ROUTES, COUNT(DEDUP_ROUTES), DEDUP_MATCHES, COUNT(DEDUP_MATCHES)) ? 0 : 1;
+    failed += check_invalid() ? 0 : 1;
+    failed += check_cache() ? 0 : 1;
+
+    return failed ? 1 : 0;
+}
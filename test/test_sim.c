@@ -0,0 +1,208 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/ud_sim.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The (arbitrary) file descriptor the scenarios inject their events for...
+#define SIM_FD 1000
+// The number of milliseconds in a day...
+#define DAY (24 * 3600 * 1000ULL)
+// The longest interval (in seconds) between two attempts of the back-off...
+#define BACKOFF_MAX 43200
+
+/**
+ * Tests the simulated clock and backend (see ud_sim.h): tasks run on the
+ * simulated clock only, and event handlers only get the events that are
+ * injected, as far as they are interested in them and are not paused.
+ */
+static struct {
+    eh_id_t eh_id;
+    int attempts;
+    /** the wall clock time (in milliseconds) the scenario started. */
+    uint64_t started;
+} ctx;
+
+static uint64_t wall_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static ud_result_t on_event(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) context;
+
+    test_stepf("%s%s%s%s@%d ", (pollfd->revents & POLLIN) ? "I" : "", (pollfd->revents & POLLOUT) ? "O" : "",
+               (pollfd->revents & POLLHUP) ? "H" : "", (pollfd->revents & POLLERR) ? "E" : "",
+               (int) (ud_now(ud_state) / 1000));
+    return RES_OK;
+}
+
+static int add_handler(const ud_state_t *ud_state, short emask) {
+    return ud_add_event_handler(ud_state, SIM_FD, emask, on_event, NULL, &ctx.eh_id);
+}
+
+static int inject_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+
+    return ud_sim_inject(test_sim, SIM_FD, (short) (intptr_t) context);
+}
+
+static int terminate_later(const ud_state_t *ud_state, uint16_t seconds) {
+    return ud_schedule_task(ud_state, seconds, test_terminate_task, NULL);
+}
+
+/* backoff: a task that backs off over several days is done almost instantly. */
+
+static int backoff_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) context;
+
+    ctx.attempts++;
+    if (ud_now(ud_state) < 3 * DAY) {
+        return interval < BACKOFF_MAX / 2 ? interval * 2 : BACKOFF_MAX;
+    }
+
+    test_stepf("%d attempts in %d days%s", ctx.attempts, (int) (ud_now(ud_state) / DAY),
+               wall_ms() - ctx.started < 1000 ? "" : " <slow>");
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static int setup_backoff(const ud_state_t *ud_state) {
+    ctx.started = wall_ms();
+    return ud_schedule_task(ud_state, 1, backoff_task, NULL);
+}
+
+/* inject: events are only delivered as far as the handler is interested in them. */
+
+static int setup_inject(const ud_state_t *ud_state) {
+    int rc = add_handler(ud_state, POLLIN);
+    if (!rc) {
+        rc = ud_sim_inject(test_sim, SIM_FD, POLLIN | POLLOUT);
+    }
+    if (!rc) {
+        // never delivered...
+        rc = ud_schedule_task(ud_state, 1, inject_task, (void *) (intptr_t) POLLOUT);
+    }
+    if (!rc) {
+        rc = ud_schedule_task(ud_state, 2, inject_task, (void *) (intptr_t) POLLIN);
+    }
+    return rc ? rc : terminate_later(ud_state, 3);
+}
+
+/* hangup: hang-ups and errors are always delivered. */
+
+static int setup_hangup(const ud_state_t *ud_state) {
+    int rc = add_handler(ud_state, POLLIN);
+    if (!rc) {
+        rc = ud_sim_inject(test_sim, SIM_FD, POLLHUP);
+    }
+    if (!rc) {
+        rc = ud_schedule_task(ud_state, 1, inject_task, (void *) (intptr_t) (POLLERR | POLLOUT));
+    }
+    return rc ? rc : terminate_later(ud_state, 2);
+}
+
+/* paused: events for a paused handler are kept until it is resumed. */
+
+static int resume_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    return ud_resume_handler(ud_state, ctx.eh_id);
+}
+
+static int setup_paused(const ud_state_t *ud_state) {
+    int rc = add_handler(ud_state, POLLIN);
+    if (!rc) {
+        rc = ud_pause_handler(ud_state, ctx.eh_id);
+    }
+    if (!rc) {
+        rc = ud_sim_inject(test_sim, SIM_FD, POLLIN);
+    }
+    if (!rc) {
+        rc = ud_schedule_task(ud_state, 3600, resume_task, NULL);
+    }
+    return rc ? rc : terminate_later(ud_state, 7200);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "backoff", setup_backoff, "21 attempts in 3 days" },
+    { "inject", setup_inject, "I@0 I@2 " },
+    { "hangup", setup_hangup, "H@0 E@1 " },
+    { "paused", setup_paused, "I@3600 " },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.eh_id = UD_INVALID_ID;
+}
+
+/* destroy: destroying a simulation restores the real clock and backend. */
+
+static int init_destroy(const ud_state_t *ud_state) {
+    return ud_schedule_timer(ud_state, 20, test_terminate_task, NULL);
+}
+
+static bool check_destroy(void) {
+    ud_config_t config = {
+        .foreground = true,
+        .initialize = init_destroy,
+    };
+
+    ud_state_t *ud_state = ud_init(&config);
+    if (!ud_state) {
+        return false;
+    }
+
+    ud_sim_t *sim = ud_sim_create(ud_state);
+    bool ok = sim != NULL;
+    if (sim) {
+        ud_sim_advance(sim, DAY);
+        ok = ud_now(ud_state) == DAY;
+        ud_sim_destroy(sim);
+    }
+
+    // back on the real clock, which never runs a mainloop for nothing...
+    uint64_t wall = wall_ms();
+    ok = ok && ud_now(ud_state) - wall < 1000;
+    ud_main_loop(ud_state);
+    ok = ok && wall_ms() - wall >= 20;
+
+    ud_destroy(ud_state);
+
+    printf("%-12s %-6s %s\n", "destroy", "", ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .simulated = true,
+        .timeout = 7 * DAY,
+        .reset = reset,
+    };
+    int failed = test_run(&suite);
+
+    set_loglevel(WARNING);
+    if (!check_destroy()) {
+        failed = 1;
+    }
+    return failed;
+}
@@ -0,0 +1,391 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "udaemon/ud_sink.h"
+#include "udaemon/ud_spool.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The number of messages written to check the use of MSG_MORE, more than IOV_MAX...
+#define MORE_MESSAGES 1500
+// The length of each of these messages...
+#define MORE_LEN 10
+
+/**
+ * Tests the batching of sinks, writing to one end of a socket pair and
+ * tracing what arrives at the other end: the records (or bytes) read at
+ * each check are separated by a `|`, and a check that reads nothing is
+ * traced as `-`.
+ */
+static struct {
+    /** the socket the sink writes to, and the one its output is read from. */
+    int fds[2];
+    ud_sink_t *sinks[2];
+    ud_spool_t *spool;
+    char dir[32];
+} ctx;
+
+static int open_pair(int type) {
+    return socketpair(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, ctx.fds);
+}
+
+/**
+ * Opens a connected pair of TCP sockets on the loopback interface, as Unix
+ * domain sockets ignore MSG_MORE.
+ */
+static int open_tcp_pair(void) {
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+
+    int lfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (lfd < 0) {
+        return -1;
+    }
+    int rc = -1;
+    if (!bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) && !listen(lfd, 1) &&
+            !getsockname(lfd, (struct sockaddr *) &addr, &len)) {
+        ctx.fds[0] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (ctx.fds[0] >= 0 && !connect(ctx.fds[0], (struct sockaddr *) &addr, sizeof(addr))) {
+            ctx.fds[1] = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            rc = (ctx.fds[1] >= 0 && !fcntl(ctx.fds[0], F_SETFL, O_NONBLOCK)) ? 0 : -1;
+        }
+    }
+    close(lfd);
+    return rc;
+}
+
+static int open_spool(void) {
+    strcpy(ctx.dir, "/tmp/test_sink.XXXXXX");
+    if (!mkdtemp(ctx.dir)) {
+        ctx.dir[0] = '\0';
+        return -1;
+    }
+
+    const ud_spool_config_t config = {
+        .directory = ctx.dir,
+        .segment_size = 4096,
+        .max_segments = 4,
+    };
+    ctx.spool = ud_spool_open(&config);
+    return ctx.spool ? 0 : -1;
+}
+
+static ud_sink_t *create_sink(const ud_state_t *ud_state, const ud_sink_config_t *config) {
+    for (int i = 0; i < 2; i++) {
+        if (!ctx.sinks[i]) {
+            ctx.sinks[i] = ud_sink_create(ud_state, config);
+            return ctx.sinks[i];
+        }
+    }
+    return NULL;
+}
+
+static void write_msg(ud_sink_t *sink, ud_sink_prio_t prio, const char *msg) {
+    int rc = ud_sink_write_prio(sink, prio, msg, strlen(msg));
+    if (rc) {
+        test_stepf("<write %s: %d>", msg, rc);
+    }
+}
+
+/**
+ * Traces all records (or bytes) that can be read right now.
+ */
+static void check_records(void) {
+    char buf[256];
+    bool any = false;
+
+    ssize_t n;
+    while ((n = recv(ctx.fds[1], buf, sizeof(buf) - 1, MSG_DONTWAIT)) > 0) {
+        buf[n] = '\0';
+        test_stepf("%s|", buf);
+        any = true;
+    }
+    test_step(any ? " " : "- ");
+}
+
+/**
+ * Destroys all sinks and the spool, which need the state, and terminates.
+ */
+static int finish_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    check_records();
+    for (int i = 0; i < 2; i++) {
+        ud_sink_destroy(ctx.sinks[i]);
+        ctx.sinks[i] = NULL;
+    }
+    ud_spool_close(ctx.spool);
+    ctx.spool = NULL;
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+/* count: a batch is flushed once it has its maximum number of messages, or is old enough. */
+
+static int setup_count(const ud_state_t *ud_state) {
+    const ud_sink_config_t config = {
+        .max_bytes = 64,
+        .max_count = 3,
+        .max_delay = 20,
+    };
+    ud_sink_t *sink = create_sink(ud_state, &config);
+    if (!sink || open_pair(SOCK_SEQPACKET) || ud_sink_attach(sink, ctx.fds[0])) {
+        return -1;
+    }
+
+    write_msg(sink, UD_SINK_PRIO_BULK, "a");
+    write_msg(sink, UD_SINK_PRIO_BULK, "bb");
+    check_records();
+    // each message is a record of its own...
+    write_msg(sink, UD_SINK_PRIO_BULK, "ccc");
+    check_records();
+    write_msg(sink, UD_SINK_PRIO_BULK, "d");
+    check_records();
+    return ud_schedule_timer(ud_state, 50, finish_task, NULL);
+}
+
+/* bytes: a batch is flushed once it has its maximum number of bytes. */
+
+static int setup_bytes(const ud_state_t *ud_state) {
+    const ud_sink_config_t config = {
+        .max_bytes = 8,
+        .max_count = 100,
+        .max_delay = 1000,
+    };
+    ud_sink_t *sink = create_sink(ud_state, &config);
+    if (!sink || open_pair(SOCK_STREAM) || ud_sink_attach(sink, ctx.fds[0])) {
+        return -1;
+    }
+
+    write_msg(sink, UD_SINK_PRIO_BULK, "abcd");
+    check_records();
+    write_msg(sink, UD_SINK_PRIO_BULK, "efgh");
+    return ud_schedule_timer(ud_state, 10, finish_task, NULL);
+}
+
+/* more: a batch written in multiple parts only uses MSG_MORE for all but the last part. */
+
+static int more_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    char buf[MORE_MESSAGES * MORE_LEN + 1];
+    size_t total = 0;
+
+    ssize_t n;
+    while (total < sizeof(buf) - 1 && (n = recv(ctx.fds[1], buf + total, sizeof(buf) - 1 - total, 0)) > 0) {
+        total += (size_t) n;
+    }
+
+    // the kernel holds back the tail of a batch written with MSG_MORE for up to 200 ms...
+    bool ordered = total == MORE_MESSAGES * MORE_LEN;
+    for (int i = 0; ordered && i < MORE_MESSAGES; i++) {
+        char expected[MORE_LEN + 1];
+        snprintf(expected, sizeof(expected), "%09d\n", i);
+        ordered = memcmp(buf + i * MORE_LEN, expected, MORE_LEN) == 0;
+    }
+    test_stepf("%zu %s %llu", total, ordered ? "ordered" : "<unordered>",
+               (unsigned long long) ud_sink_get_stats(ctx.sinks[0])->batches);
+
+    return finish_task(ud_state, 0, NULL);
+}
+
+static int setup_more(const ud_state_t *ud_state) {
+    const ud_sink_config_t config = {
+        .max_bytes = MORE_MESSAGES * MORE_LEN,
+        .max_count = 2 * MORE_MESSAGES,
+        .max_delay = 1000,
+    };
+    ud_sink_t *sink = create_sink(ud_state, &config);
+    if (!sink || open_tcp_pair() || ud_sink_attach(sink, ctx.fds[0])) {
+        return -1;
+    }
+
+    for (int i = 0; i < MORE_MESSAGES; i++) {
+        char msg[MORE_LEN + 1];
+        snprintf(msg, sizeof(msg), "%09d\n", i);
+        write_msg(sink, UD_SINK_PRIO_BULK, msg);
+    }
+    if (ud_sink_flush(sink)) {
+        return -1;
+    }
+    return ud_schedule_timer(ud_state, 50, more_task, NULL);
+}
+
+/* spool: messages written while detached are replayed first, and later ones follow in order. */
+
+static int spool_write_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    (void) context;
+
+    write_msg(ctx.sinks[0], UD_SINK_PRIO_BULK, "4");
+    return 0;
+}
+
+static int setup_spool(const ud_state_t *ud_state) {
+    if (open_spool() || open_pair(SOCK_SEQPACKET)) {
+        return -1;
+    }
+    const ud_sink_config_t config = {
+        .max_bytes = 64,
+        .max_count = 10,
+        .max_delay = 10,
+        .spool = ctx.spool,
+        .replay_rate = 100,
+    };
+    ud_sink_t *sink = create_sink(ud_state, &config);
+    if (!sink) {
+        return -1;
+    }
+
+    write_msg(sink, UD_SINK_PRIO_BULK, "1");
+    write_msg(sink, UD_SINK_PRIO_BULK, "2");
+    if (ud_sink_attach(sink, ctx.fds[0])) {
+        return -1;
+    }
+    // the spool is not replayed yet, so this one should go after the spooled ones...
+    write_msg(sink, UD_SINK_PRIO_BULK, "3");
+
+    int rc = ud_schedule_timer(ud_state, 50, spool_write_task, NULL);
+    return rc ? rc : ud_schedule_timer(ud_state, 100, finish_task, NULL);
+}
+
+/* shared: destroying a sink does not stop the replay of another sink that shares its spool. */
+
+static int setup_shared(const ud_state_t *ud_state) {
+    if (open_spool() || open_pair(SOCK_SEQPACKET)) {
+        return -1;
+    }
+    const ud_sink_config_t config = {
+        .max_bytes = 64,
+        .max_count = 10,
+        .max_delay = 10,
+        .spool = ctx.spool,
+        .replay_rate = 1,
+    };
+    ud_sink_t *sink = create_sink(ud_state, &config);
+    ud_sink_t *other = create_sink(ud_state, &config);
+    if (!sink || !other) {
+        return -1;
+    }
+
+    write_msg(sink, UD_SINK_PRIO_BULK, "1");
+    write_msg(sink, UD_SINK_PRIO_BULK, "2");
+    if (ud_sink_attach(sink, ctx.fds[0])) {
+        return -1;
+    }
+
+    ud_sink_destroy(other);
+    ctx.sinks[1] = NULL;
+
+    // one message is replayed right away, the next one a second later...
+    return ud_schedule_timer(ud_state, 1200, finish_task, NULL);
+}
+
+/* replay: a sink that fails to replay its spool is left detached, until it is attached again. */
+
+static int idle_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    return interval;
+}
+
+static int setup_replay(const ud_state_t *ud_state) {
+    if (open_spool() || open_pair(SOCK_SEQPACKET)) {
+        return -1;
+    }
+    const ud_sink_config_t config = {
+        .max_bytes = 64,
+        .max_count = 10,
+        .max_delay = 10,
+        .spool = ctx.spool,
+        .replay_rate = 100,
+    };
+    ud_sink_t *sink = create_sink(ud_state, &config);
+    if (!sink || ud_schedule_timer(ud_state, 100, finish_task, NULL)) {
+        return -1;
+    }
+    write_msg(sink, UD_SINK_PRIO_BULK, "1");
+
+    // leave no room for the replay...
+    while (ud_schedule_timer(ud_state, 60000, idle_task, NULL) == 0) {
+        // keep filling...
+    }
+    test_step(ud_sink_attach(sink, ctx.fds[0]) ? "E " : "<attached> ");
+    // a detached sink keeps control messages until it is attached again...
+    ud_sink_write_prio(sink, UD_SINK_PRIO_CONTROL, "c", 1);
+    check_records();
+
+    ud_cancel_task(ud_state, idle_task, NULL);
+    return ud_sink_attach(sink, ctx.fds[0]);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "count", setup_count, "- a|bb|ccc| - d| " },
+    { "bytes", setup_bytes, "- abcdefgh| " },
+    { "more", setup_more, "15000 ordered 1- " },
+    { "spool", setup_spool, "1|2|3|4| " },
+    { "shared", setup_shared, "1|2| " },
+    { "replay", setup_replay, "E - c|1| " },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.fds[0] = ctx.fds[1] = -1;
+}
+
+static void cleanup(void) {
+    for (int i = 0; i < 2; i++) {
+        if (ctx.fds[i] >= 0) {
+            close(ctx.fds[i]);
+        }
+    }
+
+    if (ctx.dir[0]) {
+        DIR *dir = opendir(ctx.dir);
+        for (struct dirent *entry = dir ? readdir(dir) : NULL; entry; entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') {
+                unlinkat(dirfd(dir), entry->d_name, 0);
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        rmdir(ctx.dir);
+    }
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}
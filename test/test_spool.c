@@ -0,0 +1,267 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "udaemon/ud_logging.h"
+#include "udaemon/ud_spool.h"
+
+// The length of a record, which takes twice as much in a segment with its header...
+#define RECORD_LEN 8
+
+/**
+ * Tests the recovery of spools from disk: records and the read position
+ * survive a reopen, torn or stale records at the tail of a segment are not
+ * replayed, consumed segments are recycled as the spare segment, and appends
+ * are refused once `max_segments` is reached. Records are numbered, so each
+ * check can tell which ones are read back, and in which order.
+ */
+static struct {
+    char dir[32];
+    size_t segment_size;
+    int per_segment;
+} ctx;
+
+static ud_spool_t *open_spool(uint16_t max_segments) {
+    const ud_spool_config_t config = {
+        .directory = ctx.dir,
+        .segment_size = ctx.segment_size,
+        .max_segments = max_segments,
+    };
+    return ud_spool_open(&config);
+}
+
+static int append_records(ud_spool_t *spool, int first, int count) {
+    for (int i = first; i < first + count; i++) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%0*d", RECORD_LEN, i);
+
+        int rc = ud_spool_append(spool, buf, RECORD_LEN);
+        if (rc) {
+            return rc;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Consumes at most `count` records, which should be numbered from `first`
+ * onwards.
+ *
+ * @return the number of records consumed, or -1 if a record is out of order.
+ */
+static int consume_records(ud_spool_t *spool, int first, int count) {
+    int n = 0;
+    for (; n < count; n++) {
+        const void *data;
+        ssize_t len = ud_spool_peek(spool, &data);
+        if (len <= 0) {
+            break;
+        }
+
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%0*d", RECORD_LEN, first + n);
+        if (len != RECORD_LEN || memcmp(data, buf, RECORD_LEN) || ud_spool_consume(spool)) {
+            return -1;
+        }
+    }
+    return n;
+}
+
+static bool has_file(const char *name) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s", ctx.dir, name);
+    return access(path, F_OK) == 0;
+}
+
+static int count_segments(void) {
+    int count = 0;
+
+    DIR *dir = opendir(ctx.dir);
+    for (struct dirent *entry = dir ? readdir(dir) : NULL; entry; entry = readdir(dir)) {
+        const char *suffix = strrchr(entry->d_name, '.');
+        count += (suffix && strcmp(suffix, ".seg") == 0) ? 1 : 0;
+    }
+    if (dir) {
+        closedir(dir);
+    }
+    return count;
+}
+
+static bool make_dir(void) {
+    strcpy(ctx.dir, "/tmp/test_spool.XXXXXX");
+    if (!mkdtemp(ctx.dir)) {
+        ctx.dir[0] = '\0';
+        return false;
+    }
+    return true;
+}
+
+static void remove_dir(void) {
+    if (ctx.dir[0]) {
+        DIR *dir = opendir(ctx.dir);
+        for (struct dirent *entry = dir ? readdir(dir) : NULL; entry; entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') {
+                unlinkat(dirfd(dir), entry->d_name, 0);
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+        rmdir(ctx.dir);
+        ctx.dir[0] = '\0';
+    }
+}
+
+/* reopen: records appended before closing are read back after reopening. */
+
+static bool check_reopen(void) {
+    ud_spool_t *spool = open_spool(0);
+    if (!spool || append_records(spool, 0, 3)) {
+        ud_spool_close(spool);
+        return false;
+    }
+    ud_spool_close(spool);
+
+    spool = open_spool(0);
+    bool ok = spool && consume_records(spool, 0, 10) == 3 && ud_spool_empty(spool);
+    ud_spool_close(spool);
+    return ok;
+}
+
+/* checkpoint: the read position survives a reopen, also once everything is consumed. */
+
+static bool check_checkpoint(void) {
+    ud_spool_t *spool = open_spool(0);
+    if (!spool || append_records(spool, 0, 3) || consume_records(spool, 0, 1) != 1) {
+        ud_spool_close(spool);
+        return false;
+    }
+    ud_spool_close(spool);
+
+    spool = open_spool(0);
+    bool ok = spool && consume_records(spool, 1, 10) == 2;
+    ud_spool_close(spool);
+
+    spool = open_spool(0);
+    ok = ok && spool && ud_spool_empty(spool);
+    ud_spool_close(spool);
+    return ok;
+}
+
+/* torn: a record whose check does not match ends the segment, and is overwritten by the next append. */
+
+static bool check_torn(void) {
+    ud_spool_t *spool = open_spool(0);
+    if (!spool || append_records(spool, 0, 2)) {
+        ud_spool_close(spool);
+        return false;
+    }
+    ud_spool_close(spool);
+
+    // the header of the next record made it to disk, but its payload did not...
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%016x.seg", ctx.dir, 0);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    const uint32_t header[2] = { RECORD_LEN, 0xdeadbeef };
+    bool ok = pwrite(fd, header, sizeof(header), 2 * 2 * RECORD_LEN) == sizeof(header);
+    close(fd);
+
+    spool = open_spool(0);
+    ok = ok && spool && consume_records(spool, 0, 10) == 2 && ud_spool_empty(spool);
+    ok = ok && append_records(spool, 2, 1) == 0 && consume_records(spool, 2, 10) == 1;
+    ud_spool_close(spool);
+    return ok;
+}
+
+/* recycle: a consumed segment becomes the spare one, and its records are stale once it is reused. */
+
+static bool check_recycle(void) {
+    int per = ctx.per_segment;
+
+    ud_spool_t *spool = open_spool(0);
+    if (!spool || append_records(spool, 0, per + 1)) {
+        ud_spool_close(spool);
+        return false;
+    }
+
+    // reading the first record of the second segment retires the first one...
+    bool ok = consume_records(spool, 0, per + 1) == per + 1;
+    ok = ok && has_file("spare.seg") && !has_file("0000000000000000.seg");
+
+    // rolling over to the third segment takes the spare one, along with its records...
+    ok = ok && append_records(spool, per + 1, per) == 0;
+    ok = ok && !has_file("spare.seg") && has_file("0000000000000002.seg") && count_segments() == 2;
+    ud_spool_close(spool);
+
+    // ...which should not be mistaken for records of the third segment...
+    spool = open_spool(0);
+    ok = ok && spool && consume_records(spool, per + 1, 2 * per) == per && ud_spool_empty(spool);
+    ud_spool_close(spool);
+    return ok;
+}
+
+/* full: appends are refused once max_segments are in use, until a segment is consumed. */
+
+static bool check_full(void) {
+    int per = ctx.per_segment;
+
+    ud_spool_t *spool = open_spool(2);
+    if (!spool || append_records(spool, 0, 2 * per)) {
+        ud_spool_close(spool);
+        return false;
+    }
+
+    bool ok = append_records(spool, 2 * per, 1) == -ENOSPC;
+    ok = ok && consume_records(spool, 0, per + 1) == per + 1;
+    ok = ok && append_records(spool, 2 * per, 1) == 0;
+    ud_spool_close(spool);
+
+    // nothing was lost or written by the refused append...
+    spool = open_spool(2);
+    ok = ok && spool && consume_records(spool, per + 1, 2 * per) == per && ud_spool_empty(spool);
+    ud_spool_close(spool);
+    return ok;
+}
+
+static bool check(const char *name, bool (*fn)(void)) {
+    bool ok = make_dir() && fn();
+    remove_dir();
+
+    printf("%-12s %s\n", name, ok ? "OK" : "FAILED");
+    return ok;
+}
+
+int main(void) {
+    // only report warnings and errors of udaemon itself...
+    set_loglevel(WARNING);
+
+    // segments are rounded up to the page size, so use exactly one...
+    ctx.segment_size = (size_t) sysconf(_SC_PAGESIZE);
+    ctx.per_segment = (int) (ctx.segment_size / (2 * RECORD_LEN));
+
+    bool ok = true;
+    ok &= check("reopen", check_reopen);
+    ok &= check("checkpoint", check_checkpoint);
+    ok &= check("torn", check_torn);
+    ok &= check("recycle", check_recycle);
+    ok &= check("full", check_full);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,222 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "udaemon/ud_sink.h"
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The length of each bulk message written by the rate limited scenarios...
+#define MSG_LEN 10
+// The (simulated) time, in milliseconds, between two reads of the peer...
+#define READ_INTERVAL 50
+
+/**
+ * Tests the rate limit (token bucket) and the weighted scheduling of control
+ * and bulk messages of sinks, on the simulated clock. The sink writes to one
+ * end of a socket pair, the other end is read periodically, tracing each
+ * record by its first character and the (simulated) time it was read.
+ */
+static struct {
+    int fds[2];
+    ud_sink_t *sink;
+} ctx;
+
+static ud_sink_t *create_sink(const ud_state_t *ud_state, const ud_sink_config_t *config) {
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, ctx.fds)) {
+        return NULL;
+    }
+    ctx.sink = ud_sink_create(ud_state, config);
+    return ctx.sink;
+}
+
+static void write_msg(ud_sink_prio_t prio, char c) {
+    char msg[MSG_LEN];
+    memset(msg, c, sizeof(msg));
+
+    // control messages are short, so never count towards the rate limit...
+    int rc = ud_sink_write_prio(ctx.sink, prio, msg, prio == UD_SINK_PRIO_BULK ? sizeof(msg) : 1);
+    if (rc) {
+        test_stepf("<write %c: %d>", c, rc);
+    }
+}
+
+static void write_bulk(const char *msgs) {
+    for (const char *c = msgs; *c; c++) {
+        write_msg(UD_SINK_PRIO_BULK, *c);
+    }
+}
+
+static int read_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    char buf[64];
+    while (recv(ctx.fds[1], buf, sizeof(buf), MSG_DONTWAIT) > 0) {
+        test_stepf("%c@%d ", buf[0], (int) ud_now(ud_state));
+    }
+    return READ_INTERVAL;
+}
+
+static int finish_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    test_stepf("%d", (int) ud_sink_get_stats(ctx.sink)->throttled);
+
+    ud_sink_destroy(ctx.sink);
+    ctx.sink = NULL;
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+/**
+ * Reads the peer every #READ_INTERVAL milliseconds, just after the sink has
+ * written, and finishes the scenario at the given time.
+ */
+static int read_until(const ud_state_t *ud_state, uint16_t finish) {
+    int rc = ud_schedule_timer(ud_state, 5, read_task, NULL);
+    return rc ? rc : ud_schedule_timer(ud_state, finish, finish_task, NULL);
+}
+
+/* throttle: a burst is sent right away, the remainder as tokens are refilled. */
+
+static int setup_throttle(const ud_state_t *ud_state) {
+    const ud_sink_config_t config = {
+        .max_bytes = MSG_LEN,
+        .max_count = 1,
+        .rate_limit = 100,
+        .rate_burst = 2 * MSG_LEN,
+    };
+    if (!create_sink(ud_state, &config) || ud_sink_attach(ctx.sink, ctx.fds[0])) {
+        return -1;
+    }
+
+    // ten bytes take 100 ms at a rate of 100 bytes per second...
+    write_bulk("abcd");
+    return read_until(ud_state, 300);
+}
+
+/* refill: an idle sink does not gather more tokens than its burst. */
+
+static int refill_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) interval;
+    (void) context;
+
+    write_bulk("abcd");
+    return 0;
+}
+
+static int setup_refill(const ud_state_t *ud_state) {
+    const ud_sink_config_t config = {
+        .max_bytes = MSG_LEN,
+        .max_count = 1,
+        .rate_limit = 100,
+        .rate_burst = 2 * MSG_LEN,
+    };
+    if (!create_sink(ud_state, &config) || ud_sink_attach(ctx.sink, ctx.fds[0])) {
+        return -1;
+    }
+
+    // idle for ten seconds, enough to refill a thousand bytes without a burst...
+    int rc = ud_schedule_timer(ud_state, 10000, refill_task, NULL);
+    return rc ? rc : read_until(ud_state, 10300);
+}
+
+/* bypass: control messages are not held back by a throttled sink. */
+
+static int setup_bypass(const ud_state_t *ud_state) {
+    const ud_sink_config_t config = {
+        .max_bytes = MSG_LEN,
+        .max_count = 1,
+        .rate_limit = 100,
+        .rate_burst = MSG_LEN,
+    };
+    if (!create_sink(ud_state, &config) || ud_sink_attach(ctx.sink, ctx.fds[0])) {
+        return -1;
+    }
+
+    write_bulk("ab");
+    write_msg(UD_SINK_PRIO_CONTROL, '1');
+    return read_until(ud_state, 200);
+}
+
+/* weight: with pending messages in both queues, N control messages go for each bulk message. */
+
+static int setup_weighted(const ud_state_t *ud_state, uint16_t weight) {
+    const ud_sink_config_t config = {
+        .max_bytes = 8 * MSG_LEN,
+        .max_count = 8,
+        .max_delay = 10,
+        .control_weight = weight,
+    };
+    if (!create_sink(ud_state, &config)) {
+        return -1;
+    }
+
+    // queued while detached, and all gathered at once when attached...
+    write_bulk("abcd");
+    for (char c = '1'; c <= '6'; c++) {
+        write_msg(UD_SINK_PRIO_CONTROL, c);
+    }
+    if (ud_sink_attach(ctx.sink, ctx.fds[0])) {
+        return -1;
+    }
+    return read_until(ud_state, 20);
+}
+
+static int setup_weight(const ud_state_t *ud_state) {
+    return setup_weighted(ud_state, 2);
+}
+
+/* strict: without a weight, control messages always go first. */
+
+static int setup_strict(const ud_state_t *ud_state) {
+    return setup_weighted(ud_state, 0);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "throttle", setup_throttle, "a@5 b@5 c@105 d@205 2" },
+    { "refill", setup_refill, "a@10005 b@10005 c@10105 d@10205 2" },
+    { "bypass", setup_bypass, "a@5 1@5 b@105 1" },
+    { "weight", setup_weight, "1@5 2@5 a@5 3@5 4@5 b@5 5@5 6@5 c@5 d@5 0" },
+    { "strict", setup_strict, "1@5 2@5 3@5 4@5 5@5 6@5 a@5 b@5 c@5 d@5 0" },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.fds[0] = ctx.fds[1] = -1;
+}
+
+static void cleanup(void) {
+    for (int i = 0; i < 2; i++) {
+        if (ctx.fds[i] >= 0) {
+            close(ctx.fds[i]);
+        }
+    }
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .simulated = true,
+        .timeout = 20000,
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}
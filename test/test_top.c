@@ -0,0 +1,248 @@
+/*
+ * libudaemon - micro daemon library.
+ *
+ * Copyright: (C) 2020 jawi
+ *   License: Apache License 2.0
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "udaemon/udaemon.h"
+
+#include "test_harness.h"
+
+// The size of the buffers the reports are formatted into...
+#define REPORT_MAX 4096
+// The size of the buffer to truncate the reports to...
+#define TRUNCATED 16
+
+/**
+ * Tests the "top" report (see #ud_format_top) and tables (see
+ * #ud_format_tables) of the resources used by event handlers and tasks: how
+ * they are sorted, truncated and reset.
+ */
+static struct {
+    int fds[2][2];
+    eh_id_t ids[2];
+    int calls;
+} ctx;
+
+static void write_byte(int pipe) {
+    if (write(ctx.fds[pipe][1], "x", 1) != 1) {
+        fprintf(stderr, "write failed: %s\n", strerror(errno));
+    }
+}
+
+static void read_all(const ud_state_t *ud_state, int fd) {
+    char buf[16];
+    while (ud_read(ud_state, fd, buf, sizeof(buf)) > 0) {
+        // nothing to do...
+    }
+}
+
+static uint64_t cpu_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static void burn_cpu(uint64_t us) {
+    uint64_t until = cpu_us() + us;
+    while (cpu_us() < until) {
+        // keep spinning...
+    }
+}
+
+static int add_handler(const ud_state_t *ud_state, int pipe, ud_event_handler_t handler) {
+    write_byte(pipe);
+    return ud_add_event_handler(ud_state, ctx.fds[pipe][0], POLLIN, handler, (void *) (intptr_t) pipe,
+                                &ctx.ids[pipe]);
+}
+
+/* sort: the largest consumer of CPU time goes first, tasks go after handlers with the same usage. */
+
+static int sort_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    char report[REPORT_MAX];
+    if (ud_format_top(ud_state, report, sizeof(report)) >= (int) sizeof(report)) {
+        test_step("<truncated>");
+    }
+
+    // skip the header...
+    char *saveptr = NULL;
+    strtok_r(report, "\n", &saveptr);
+    for (char *line = strtok_r(NULL, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+        int fd = -1;
+        const char *what = strstr(line, "handler #");
+        if (!what) {
+            test_step("t");
+        } else if (sscanf(strstr(what, "fd#"), "fd#%d", &fd) == 1 && fd == ctx.fds[0][0]) {
+            test_step("H");
+        } else if (fd == ctx.fds[1][0]) {
+            test_step("L");
+        } else {
+            test_step("h");
+        }
+    }
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static ud_result_t on_readable_burn(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    int pipe = (int) (intptr_t) context;
+
+    read_all(ud_state, pollfd->fd);
+    // the heavy handler uses ten times the CPU time of the light one...
+    burn_cpu(pipe ? 1000 : 10000);
+
+    if (++ctx.calls == 2 && ud_schedule_timer(ud_state, 10, sort_task, NULL)) {
+        return RES_ERROR;
+    }
+    return RES_OK;
+}
+
+static int setup_sort(const ud_state_t *ud_state) {
+    // the light handler is added first, so gets the lowest id...
+    int rc = add_handler(ud_state, 1, on_readable_burn);
+    return rc ? rc : add_handler(ud_state, 0, on_readable_burn);
+}
+
+/* truncate: reports are truncated to the buffer of the caller, but return their complete length. */
+
+static void check_truncated(const ud_state_t *ud_state, int (*format)(const ud_state_t *, char *, size_t)) {
+    char full[REPORT_MAX];
+    char truncated[TRUNCATED];
+
+    int len = format(ud_state, full, sizeof(full));
+    bool ok = len > TRUNCATED && len < REPORT_MAX && (size_t) len == strlen(full);
+    // nothing is formatted, only measured...
+    ok = ok && format(ud_state, NULL, 0) == len;
+    ok = ok && format(ud_state, truncated, sizeof(truncated)) == len;
+    ok = ok && strlen(truncated) == TRUNCATED - 1 && strncmp(truncated, full, TRUNCATED - 1) == 0;
+
+    test_step(ok ? "t" : "<not truncated>");
+}
+
+static int truncate_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    check_truncated(ud_state, ud_format_top);
+    check_truncated(ud_state, ud_format_tables);
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static int setup_truncate(const ud_state_t *ud_state) {
+    return ud_schedule_timer(ud_state, 10, truncate_task, NULL);
+}
+
+/* reuse: the usage of a handler or task starts at zero, also when its slot is reused. */
+
+static ud_result_t on_readable(const ud_state_t *ud_state, struct pollfd *pollfd, void *context) {
+    (void) context;
+
+    read_all(ud_state, pollfd->fd);
+    return RES_OK;
+}
+
+static int idle_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) ud_state;
+    (void) context;
+
+    return interval;
+}
+
+static void step_usage(ud_usage_t *usage) {
+    // the number of times the idle task ran depends on the timing...
+    test_step(usage->calls ? "+" : "0");
+}
+
+static int reuse_task(const ud_state_t *ud_state, uint16_t interval, void *context) {
+    (void) interval;
+    (void) context;
+
+    ud_usage_t usage;
+    if (ud_get_handler_usage(ud_state, ctx.ids[0], &usage) == 0) {
+        step_usage(&usage);
+    }
+    eh_id_t old_id = ctx.ids[0];
+    if (ud_remove_event_handler(ud_state, old_id) || add_handler(ud_state, 1, on_readable)) {
+        test_step("<reuse failed>");
+    }
+    if (ctx.ids[1] == old_id && ud_get_handler_usage(ud_state, ctx.ids[1], &usage) == 0) {
+        step_usage(&usage);
+    }
+
+    if (ud_get_task_usage(ud_state, idle_task, NULL, &usage) == 0) {
+        step_usage(&usage);
+    }
+    if (ud_cancel_task(ud_state, idle_task, NULL) != 1 || ud_schedule_timer(ud_state, 100, idle_task, NULL)) {
+        test_step("<reschedule failed>");
+    }
+    if (ud_get_task_usage(ud_state, idle_task, NULL, &usage) == 0) {
+        step_usage(&usage);
+    }
+
+    ud_terminate(ud_state);
+    return 0;
+}
+
+static int setup_reuse(const ud_state_t *ud_state) {
+    int rc = add_handler(ud_state, 0, on_readable);
+    if (!rc) {
+        rc = ud_schedule_timer(ud_state, 5, idle_task, NULL);
+    }
+    return rc ? rc : ud_schedule_timer(ud_state, 20, reuse_task, NULL);
+}
+
+static const test_scenario_t SCENARIOS[] = {
+    { "sort", setup_sort, "HLhtt" },
+    { "truncate", setup_truncate, "tt" },
+    { "reuse", setup_reuse, "+0+0" },
+};
+
+static void reset(void) {
+    memset(&ctx, 0, sizeof(ctx));
+
+    for (int i = 0; i < 2; i++) {
+        ctx.ids[i] = UD_INVALID_ID;
+        if (pipe2(ctx.fds[i], O_NONBLOCK | O_CLOEXEC)) {
+            perror("pipe2");
+            ctx.fds[i][0] = ctx.fds[i][1] = -1;
+        }
+    }
+}
+
+static void cleanup(void) {
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (ctx.fds[i][j] >= 0) {
+                close(ctx.fds[i][j]);
+            }
+        }
+    }
+}
+
+int main(void) {
+    const test_suite_t suite = {
+        .scenarios = SCENARIOS,
+        .count = sizeof(SCENARIOS) / sizeof(SCENARIOS[0]),
+        .accounting = true,
+        .reset = reset,
+        .cleanup = cleanup,
+    };
+    return test_run(&suite);
+}